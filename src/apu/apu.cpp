@@ -0,0 +1,577 @@
+#include "apu.h"
+
+#include <algorithm>
+
+// https://www.nesdev.org/wiki/APU_Length_Counter
+const static std::array<uint8_t, 32> LENGTH_TABLE = {
+    10, 254, 20, 2,  40, 4,  80, 6,  160, 8,  60, 10, 14, 12, 26, 14,
+    12, 16,  24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30};
+
+// 12.5%, 25%, 50% and 25% negated
+const static std::array<std::array<uint8_t, 8>, 4> DUTY_TABLE = {{
+    {0, 1, 0, 0, 0, 0, 0, 0},
+    {0, 1, 1, 0, 0, 0, 0, 0},
+    {0, 1, 1, 1, 1, 0, 0, 0},
+    {1, 0, 0, 1, 1, 1, 1, 1},
+}};
+
+const static std::array<uint8_t, 32> TRIANGLE_TABLE = {
+    15, 14, 13, 12, 11, 10, 9,  8,  7,  6,  5,  4,  3,  2,  1,  0,
+    0,  1,  2,  3,  4,  5,  6,  7,  8,  9,  10, 11, 12, 13, 14, 15};
+
+// Timer periods in CPU cycles, NTSC
+const static std::array<uint16_t, 16> NOISE_PERIODS = {
+    4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068};
+const static std::array<uint16_t, 16> DMC_PERIODS = {
+    428, 380, 340, 320, 286, 254, 226, 214,
+    190, 160, 142, 128, 106, 84,  72,  54};
+
+// CPU cycles from the start of the frame counter sequence to each step, and
+// to where it starts over, for the 4 and 5 step modes.
+// https://www.nesdev.org/wiki/APU_Frame_Counter
+const static std::array<std::array<uint32_t, 5>, 2> FRAME_STEPS = {{
+    {7457, 14913, 22371, 29829, 29830},
+    {7457, 14913, 22371, 29829, 37281},
+}};
+const static std::array<uint32_t, 2> FRAME_LENGTHS = {29830, 37282};
+
+// Output units per level of each channel. Together they stay just under
+// full scale when everything is at its loudest.
+const static int PULSE_WEIGHT = 260;
+const static int TRIANGLE_WEIGHT = 295;
+const static int NOISE_WEIGHT = 171;
+const static int DMC_WEIGHT = 116;
+
+// Samples moved from the BlipBuffer to the ring at a time
+const static size_t OUTPUT_CHUNK = 512;
+
+APU::APU(MemoryReader memory) : memory(memory), ring(nullptr) { reset(); }
+
+void APU::reset() {
+    clock = 0;
+    five_step = false;
+    irq_inhibit = false;
+    frame_irq = false;
+    frame_start = 0;
+    frame_step = 0;
+
+    pulses = {};
+    pulses[0].ones_complement = true;
+    triangle = {};
+    noise = {};
+    noise.shift = 1;
+    dmc = {};
+    dmc.bits_remaining = 8;
+    dmc.silence = true;
+
+    // times start over from 0
+    if (blip != nullptr) {
+        blip = std::make_unique<BlipBuffer>(CPU_CLOCK_RATE,
+                                            blip->get_sample_rate(), 0);
+    }
+}
+
+void APU::set_output(AudioRing *ring, uint32_t sample_rate) {
+    this->ring = ring;
+    if (ring == nullptr) {
+        blip.reset();
+        return;
+    }
+    blip = std::make_unique<BlipBuffer>(CPU_CLOCK_RATE, sample_rate, clock);
+    // the new buffer starts out silent, so every channel has to step up to
+    // where it is again
+    pulses[0].output = 0;
+    pulses[1].output = 0;
+    triangle.output = 0;
+    noise.output = 0;
+    dmc.output = 0;
+}
+
+void APU::catch_up(uint64_t cpu_cycle) {
+    while (clock < cpu_cycle) {
+        uint64_t step = frame_step_cycle();
+        uint64_t end = std::min(cpu_cycle, step);
+        run_channels(end);
+        clock = end;
+        if (clock == step) {
+            step_frame_counter();
+        }
+    }
+    if (blip != nullptr) {
+        output_samples();
+    }
+}
+
+uint64_t APU::next_event_cycle() {
+    uint64_t next = UINT64_MAX;
+    if (!five_step && !irq_inhibit && !frame_irq) {
+        // past the IRQ step it is the one of the next sequence
+        next = frame_start + FRAME_STEPS[0][3];
+        if (frame_step > 3) {
+            next += FRAME_LENGTHS[0];
+        }
+    }
+    // The buffer is always full while there are bytes left, so the next one
+    // is fetched when the shift register runs out and the last one 8 clocks
+    // per byte after that. Only a guess because the rate can change.
+    if (dmc.irq_enabled && !dmc.irq && !dmc.loop && dmc.bytes_remaining > 0) {
+        uint64_t clocks = dmc.bits_remaining - 1 +
+                          uint64_t{dmc.bytes_remaining - 1u} * 8;
+        uint64_t fetch =
+            clock + dmc.delay + clocks * DMC_PERIODS[dmc.rate] + 1;
+        next = std::min(next, fetch);
+    }
+    return next;
+}
+
+void APU::output_samples() {
+    blip->end_frame(clock);
+    std::array<int16_t, OUTPUT_CHUNK> samples;
+    while (size_t count = blip->read_samples(samples.data(), OUTPUT_CHUNK)) {
+        ring->write(samples.data(), count);
+    }
+}
+
+void APU::run_channels(uint64_t end) {
+    run_pulse(pulses[0], end);
+    run_pulse(pulses[1], end);
+    run_triangle(end);
+    run_noise(end);
+    run_dmc(end);
+}
+
+void APU::update_output(int &output, uint64_t time, int amplitude,
+                        int weight) {
+    if (amplitude != output) {
+        if (blip != nullptr) {
+            blip->add_delta(time, (amplitude - output) * weight);
+        }
+        output = amplitude;
+    }
+}
+
+// With nothing to hear, only where the sequencer ends up matters, and that
+// can be worked out without going through every period
+void APU::run_pulse(Pulse &pulse, uint64_t end) {
+    uint32_t period = (pulse.timer + 1) * 2;
+    uint8_t volume = pulse.length > 0 && !sweep_muted(pulse)
+                         ? envelope_volume(pulse.envelope)
+                         : 0;
+    update_output(pulse.output, clock,
+                  DUTY_TABLE[pulse.duty][pulse.phase] ? volume : 0,
+                  PULSE_WEIGHT);
+
+    uint64_t time = clock + pulse.delay;
+    if (time < end) {
+        if (volume == 0 || blip == nullptr) {
+            uint64_t count = (end - time + period - 1) / period;
+            pulse.phase = (pulse.phase + count) & 7;
+            time += count * period;
+        } else {
+            const std::array<uint8_t, 8> &duty = DUTY_TABLE[pulse.duty];
+            for (; time < end; time += period) {
+                pulse.phase = (pulse.phase + 1) & 7;
+                update_output(pulse.output, time,
+                              duty[pulse.phase] ? volume : 0, PULSE_WEIGHT);
+            }
+        }
+    }
+    pulse.delay = time - end;
+}
+
+// The sequencer only moves while both counters are non zero, and holds its
+// level when they are not instead of going silent. Periods under 2 would be
+// far above hearing and only pop, those hold too.
+void APU::run_triangle(uint64_t end) {
+    uint32_t period = triangle.timer + 1;
+    update_output(triangle.output, clock, TRIANGLE_TABLE[triangle.phase],
+                  TRIANGLE_WEIGHT);
+
+    uint64_t time = clock + triangle.delay;
+    if (time < end) {
+        bool running = triangle.length > 0 && triangle.linear > 0 &&
+                       triangle.timer >= 2;
+        if (!running || blip == nullptr) {
+            uint64_t count = (end - time + period - 1) / period;
+            if (running) {
+                triangle.phase = (triangle.phase + count) & 31;
+            }
+            time += count * period;
+        } else {
+            for (; time < end; time += period) {
+                triangle.phase = (triangle.phase + 1) & 31;
+                update_output(triangle.output, time,
+                              TRIANGLE_TABLE[triangle.phase], TRIANGLE_WEIGHT);
+            }
+        }
+    }
+    triangle.delay = time - end;
+}
+
+// The shift register runs even while the channel is silent, what it holds
+// when it is heard again depends on it
+void APU::run_noise(uint64_t end) {
+    uint32_t period = NOISE_PERIODS[noise.period];
+    uint8_t volume = noise.length > 0 ? envelope_volume(noise.envelope) : 0;
+    int tap = noise.short_mode ? 6 : 1;
+    update_output(noise.output, clock, (noise.shift & 1) ? 0 : volume,
+                  NOISE_WEIGHT);
+
+    uint64_t time = clock + noise.delay;
+    for (; time < end; time += period) {
+        uint16_t feedback = (noise.shift ^ (noise.shift >> tap)) & 1;
+        noise.shift = (noise.shift >> 1) | (feedback << 14);
+        if (volume != 0) {
+            update_output(noise.output, time, (noise.shift & 1) ? 0 : volume,
+                          NOISE_WEIGHT);
+        }
+    }
+    noise.delay = time - end;
+}
+
+// https://www.nesdev.org/wiki/APU_DMC. The output unit takes a byte from the
+// sample buffer every 8 clocks and moves the level up or down by 2 per bit.
+// The CPU is not held up while the buffer is filled, which the real DMC does
+// for a few cycles per byte.
+void APU::run_dmc(uint64_t end) {
+    uint32_t period = DMC_PERIODS[dmc.rate];
+    update_output(dmc.output, clock, dmc.level, DMC_WEIGHT);
+
+    uint64_t time = clock + dmc.delay;
+    // idle, the bit counter is all that moves
+    if (time < end && dmc.silence && !dmc.buffer_full &&
+        dmc.bytes_remaining == 0) {
+        uint64_t count = (end - time + period - 1) / period;
+        dmc.bits_remaining = (dmc.bits_remaining + 7 - count % 8) % 8 + 1;
+        time += count * period;
+    }
+    for (; time < end; time += period) {
+        if (!dmc.silence) {
+            if (dmc.shifter & 1) {
+                if (dmc.level <= 125) {
+                    dmc.level += 2;
+                }
+            } else if (dmc.level >= 2) {
+                dmc.level -= 2;
+            }
+            dmc.shifter >>= 1;
+            update_output(dmc.output, time, dmc.level, DMC_WEIGHT);
+        }
+        if (--dmc.bits_remaining == 0) {
+            dmc.bits_remaining = 8;
+            dmc.silence = !dmc.buffer_full;
+            if (dmc.buffer_full) {
+                dmc.shifter = dmc.buffer;
+                dmc.buffer_full = false;
+            }
+            fill_dmc_buffer();
+        }
+    }
+    dmc.delay = time - end;
+}
+
+void APU::fill_dmc_buffer() {
+    if (dmc.buffer_full || dmc.bytes_remaining == 0) {
+        return;
+    }
+    dmc.buffer = memory.read(memory.context, dmc.address);
+    dmc.buffer_full = true;
+    // wraps around to $8000, not $0000
+    dmc.address = dmc.address == 0xFFFF ? 0x8000 : dmc.address + 1;
+    if (--dmc.bytes_remaining == 0) {
+        if (dmc.loop) {
+            restart_dmc();
+        } else if (dmc.irq_enabled) {
+            dmc.irq = true;
+        }
+    }
+}
+
+void APU::restart_dmc() {
+    dmc.address = dmc.sample_address;
+    dmc.bytes_remaining = dmc.sample_length;
+}
+
+uint64_t APU::frame_step_cycle() {
+    return frame_start + FRAME_STEPS[five_step][frame_step];
+}
+
+// 4 step mode: quarter frames on every step, half frames and the IRQ on the
+// 2nd and 4th. 5 step mode: the same without the IRQ, the 4th step does
+// nothing and the 5th is the 4th.
+void APU::step_frame_counter() {
+    switch (frame_step) {
+        case 0:
+        case 2:
+            quarter_frame();
+            break;
+        case 1:
+            quarter_frame();
+            half_frame();
+            break;
+        case 3:
+            if (!five_step) {
+                quarter_frame();
+                half_frame();
+                if (!irq_inhibit) {
+                    frame_irq = true;
+                }
+            }
+            break;
+        case 4:
+            if (five_step) {
+                quarter_frame();
+                half_frame();
+            }
+            break;
+    }
+
+    frame_step++;
+    if (frame_step == FRAME_STEPS[five_step].size()) {
+        frame_start += FRAME_LENGTHS[five_step];
+        frame_step = 0;
+    }
+}
+
+void APU::quarter_frame() {
+    clock_envelope(pulses[0].envelope);
+    clock_envelope(pulses[1].envelope);
+    clock_envelope(noise.envelope);
+
+    if (triangle.linear_reload) {
+        triangle.linear = triangle.linear_period;
+    } else if (triangle.linear > 0) {
+        triangle.linear--;
+    }
+    if (!triangle.control) {
+        triangle.linear_reload = false;
+    }
+}
+
+void APU::half_frame() {
+    for (Pulse &pulse : pulses) {
+        if (!pulse.halt && pulse.length > 0) {
+            pulse.length--;
+        }
+        clock_sweep(pulse);
+    }
+    // the triangle's length counter halt is its linear counter control flag
+    if (!triangle.control && triangle.length > 0) {
+        triangle.length--;
+    }
+    if (!noise.halt && noise.length > 0) {
+        noise.length--;
+    }
+}
+
+// https://www.nesdev.org/wiki/APU_Envelope
+void APU::clock_envelope(Envelope &envelope) {
+    if (envelope.start) {
+        envelope.start = false;
+        envelope.decay = 15;
+        envelope.divider = envelope.period;
+        return;
+    }
+    if (envelope.divider > 0) {
+        envelope.divider--;
+        return;
+    }
+    envelope.divider = envelope.period;
+    if (envelope.decay > 0) {
+        envelope.decay--;
+    } else if (envelope.loop) {
+        envelope.decay = 15;
+    }
+}
+
+uint8_t APU::envelope_volume(const Envelope &envelope) {
+    return envelope.constant ? envelope.period : envelope.decay;
+}
+
+// https://www.nesdev.org/wiki/APU_Sweep
+uint16_t APU::sweep_target(const Pulse &pulse) {
+    uint16_t change = pulse.timer >> pulse.sweep_shift;
+    if (!pulse.sweep_negate) {
+        return pulse.timer + change;
+    }
+    uint16_t negated = change + (pulse.ones_complement ? 1 : 0);
+    return negated > pulse.timer ? 0 : pulse.timer - negated;
+}
+
+// Muted whether the sweep is enabled or not
+bool APU::sweep_muted(const Pulse &pulse) {
+    return pulse.timer < 8 || sweep_target(pulse) > 0x7FF;
+}
+
+void APU::clock_sweep(Pulse &pulse) {
+    if (pulse.sweep_divider == 0 && pulse.sweep_enabled &&
+        pulse.sweep_shift > 0 && !sweep_muted(pulse)) {
+        pulse.timer = sweep_target(pulse);
+    }
+    if (pulse.sweep_divider == 0 || pulse.sweep_reload) {
+        pulse.sweep_divider = pulse.sweep_period;
+        pulse.sweep_reload = false;
+    } else {
+        pulse.sweep_divider--;
+    }
+}
+
+void APU::write_pulse(Pulse &pulse, uint16_t address, uint8_t data) {
+    switch (address & 3) {
+        case 0:
+            pulse.duty = data >> 6;
+            pulse.halt = data & 0x20;
+            pulse.envelope.loop = data & 0x20;
+            pulse.envelope.constant = data & 0x10;
+            pulse.envelope.period = data & 0x0F;
+            break;
+        case 1:
+            pulse.sweep_enabled = data & 0x80;
+            pulse.sweep_period = (data >> 4) & 0b111;
+            pulse.sweep_negate = data & 0x08;
+            pulse.sweep_shift = data & 0b111;
+            pulse.sweep_reload = true;
+            break;
+        case 2:
+            pulse.timer = (pulse.timer & 0x700) | data;
+            break;
+        case 3:
+            pulse.timer = (pulse.timer & 0xFF) | ((data & 0b111) << 8);
+            if (pulse.enabled) {
+                pulse.length = LENGTH_TABLE[data >> 3];
+            }
+            pulse.phase = 0;
+            pulse.envelope.start = true;
+            break;
+    }
+}
+
+void APU::write_register(uint16_t address, uint8_t data) {
+    switch (address) {
+        case 0x4000:
+        case 0x4001:
+        case 0x4002:
+        case 0x4003:
+            write_pulse(pulses[0], address, data);
+            break;
+        case 0x4004:
+        case 0x4005:
+        case 0x4006:
+        case 0x4007:
+            write_pulse(pulses[1], address, data);
+            break;
+        case 0x4008:
+            triangle.control = data & 0x80;
+            triangle.linear_period = data & 0x7F;
+            break;
+        case 0x400A:
+            triangle.timer = (triangle.timer & 0x700) | data;
+            break;
+        case 0x400B:
+            triangle.timer = (triangle.timer & 0xFF) | ((data & 0b111) << 8);
+            if (triangle.enabled) {
+                triangle.length = LENGTH_TABLE[data >> 3];
+            }
+            triangle.linear_reload = true;
+            break;
+        case 0x400C:
+            noise.halt = data & 0x20;
+            noise.envelope.loop = data & 0x20;
+            noise.envelope.constant = data & 0x10;
+            noise.envelope.period = data & 0x0F;
+            break;
+        case 0x400E:
+            noise.short_mode = data & 0x80;
+            noise.period = data & 0x0F;
+            break;
+        case 0x400F:
+            if (noise.enabled) {
+                noise.length = LENGTH_TABLE[data >> 3];
+            }
+            noise.envelope.start = true;
+            break;
+        case 0x4010:
+            dmc.irq_enabled = data & 0x80;
+            dmc.loop = data & 0x40;
+            dmc.rate = data & 0x0F;
+            if (!dmc.irq_enabled) {
+                dmc.irq = false;
+            }
+            break;
+        case 0x4011:
+            dmc.level = data & 0x7F;
+            break;
+        case 0x4012:
+            dmc.sample_address = 0xC000 + data * 64;
+            break;
+        case 0x4013:
+            dmc.sample_length = data * 16 + 1;
+            break;
+        case 0x4015:
+            pulses[0].enabled = data & APU_STATUS_PULSE_1;
+            pulses[1].enabled = data & APU_STATUS_PULSE_2;
+            triangle.enabled = data & APU_STATUS_TRIANGLE;
+            noise.enabled = data & APU_STATUS_NOISE;
+            for (Pulse &pulse : pulses) {
+                if (!pulse.enabled) {
+                    pulse.length = 0;
+                }
+            }
+            if (!triangle.enabled) {
+                triangle.length = 0;
+            }
+            if (!noise.enabled) {
+                noise.length = 0;
+            }
+            dmc.irq = false;
+            if (!(data & APU_STATUS_DMC)) {
+                dmc.bytes_remaining = 0;
+            } else if (dmc.bytes_remaining == 0) {
+                restart_dmc();
+                fill_dmc_buffer();
+            }
+            break;
+        case 0x4017:
+            // the sequence starts over, and 5 step mode clocks everything
+            // right away. The real one waits 3 or 4 cycles first.
+            five_step = data & 0x80;
+            irq_inhibit = data & 0x40;
+            if (irq_inhibit) {
+                frame_irq = false;
+            }
+            frame_start = clock;
+            frame_step = 0;
+            if (five_step) {
+                quarter_frame();
+                half_frame();
+            }
+            break;
+    }
+}
+
+uint8_t APU::read_status() {
+    uint8_t status = 0;
+    if (pulses[0].length > 0) {
+        status |= APU_STATUS_PULSE_1;
+    }
+    if (pulses[1].length > 0) {
+        status |= APU_STATUS_PULSE_2;
+    }
+    if (triangle.length > 0) {
+        status |= APU_STATUS_TRIANGLE;
+    }
+    if (noise.length > 0) {
+        status |= APU_STATUS_NOISE;
+    }
+    if (dmc.bytes_remaining > 0) {
+        status |= APU_STATUS_DMC;
+    }
+    if (frame_irq) {
+        status |= APU_STATUS_FRAME_IRQ;
+    }
+    if (dmc.irq) {
+        status |= APU_STATUS_DMC_IRQ;
+    }
+    frame_irq = false;
+    return status;
+}
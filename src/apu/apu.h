@@ -0,0 +1,188 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <memory>
+
+#include "audio_ring.h"
+#include "blip_buffer.h"
+
+// NTSC CPU clock, which is also what the APU runs off
+const static double CPU_CLOCK_RATE = 1789773.0;
+
+// $4015
+const static uint8_t APU_STATUS_PULSE_1 = 1 << 0;
+const static uint8_t APU_STATUS_PULSE_2 = 1 << 1;
+const static uint8_t APU_STATUS_TRIANGLE = 1 << 2;
+const static uint8_t APU_STATUS_NOISE = 1 << 3;
+const static uint8_t APU_STATUS_DMC = 1 << 4;
+const static uint8_t APU_STATUS_FRAME_IRQ = 1 << 6;
+const static uint8_t APU_STATUS_DMC_IRQ = 1 << 7;
+
+// How the DMC reads sample bytes from CPU memory
+struct MemoryReader {
+    uint8_t (*read)(void *context, uint16_t address);
+    void *context;
+};
+
+// The 2A03 sound hardware: two pulse channels, a triangle, noise and the
+// DMC, plus the frame counter that clocks their envelopes, sweeps and length
+// counters and raises the frame IRQ. https://www.nesdev.org/wiki/APU
+//
+// Like the PPU it does not run in lockstep with the CPU. It remembers the
+// CPU cycle it got to and catch_up() runs it from there, a frame counter
+// step at a time. Channels are not stepped every cycle either: each one
+// works out when its timer next runs out and jumps straight there, and only
+// says something when its output changes, as a delta into a BlipBuffer that
+// does the band limited resampling. Without an output the channels only
+// keep count of their timers, which is what $4015 and the IRQs need.
+//
+// The five channels are mixed linearly, with weights taken from the slope of
+// the real, non linear mixer around its middle.
+class APU {
+   public:
+    explicit APU(MemoryReader memory);
+
+    APU(const APU &) = delete;
+    APU &operator=(const APU &) = delete;
+
+    void reset();
+
+    // Samples go into ring at sample_rate from here on, or nowhere if ring
+    // is nullptr, which also skips the synthesis
+    void set_output(AudioRing *ring, uint32_t sample_rate);
+
+    // Runs up to the start of cpu_cycle and hands the samples that are done
+    // to the output
+    void catch_up(uint64_t cpu_cycle);
+
+    // The CPU cycle by which an IRQ could come up, UINT64_MAX if none can.
+    // A guess for the DMC, catching up to it and asking again is safe.
+    uint64_t next_event_cycle();
+
+    // $4000-$4013, $4015 and $4017. The APU has to be caught up first.
+    void write_register(uint16_t address, uint8_t data);
+    // $4015, which clears the frame IRQ
+    uint8_t read_status();
+
+    bool is_irq_asserted() { return frame_irq || dmc.irq; }
+
+   private:
+    struct Envelope {
+        bool start;
+        bool loop;
+        bool constant;
+        // the volume when constant, the divider period when not
+        uint8_t period;
+        uint8_t divider;
+        uint8_t decay;
+    };
+
+    struct Pulse {
+        bool enabled;
+        // pulse 1 negates its sweep with ones' complement, pulse 2 with
+        // two's
+        bool ones_complement;
+        uint8_t duty;
+        bool halt;
+        Envelope envelope;
+        bool sweep_enabled;
+        bool sweep_negate;
+        bool sweep_reload;
+        uint8_t sweep_period;
+        uint8_t sweep_shift;
+        uint8_t sweep_divider;
+        uint16_t timer;
+        uint8_t length;
+        uint8_t phase;
+        // CPU cycles from the APU clock until the timer next runs out
+        uint32_t delay;
+        // the amplitude the output last got
+        int output;
+    };
+
+    struct Triangle {
+        bool enabled;
+        bool control;
+        bool linear_reload;
+        uint8_t linear_period;
+        uint8_t linear;
+        uint16_t timer;
+        uint8_t length;
+        uint8_t phase;
+        uint32_t delay;
+        int output;
+    };
+
+    struct Noise {
+        bool enabled;
+        bool halt;
+        bool short_mode;
+        Envelope envelope;
+        uint8_t period;
+        uint8_t length;
+        uint16_t shift;
+        uint32_t delay;
+        int output;
+    };
+
+    struct Dmc {
+        bool irq_enabled;
+        bool loop;
+        bool irq;
+        uint8_t rate;
+        uint8_t level;
+        uint16_t sample_address;
+        uint16_t sample_length;
+        uint16_t address;
+        uint16_t bytes_remaining;
+        uint8_t buffer;
+        bool buffer_full;
+        uint8_t shifter;
+        uint8_t bits_remaining;
+        bool silence;
+        uint32_t delay;
+        int output;
+    };
+
+    void run_channels(uint64_t end);
+    void run_pulse(Pulse &pulse, uint64_t end);
+    void run_triangle(uint64_t end);
+    void run_noise(uint64_t end);
+    void run_dmc(uint64_t end);
+    void fill_dmc_buffer();
+    void restart_dmc();
+    void output_samples();
+    void update_output(int &output, uint64_t time, int amplitude, int weight);
+
+    void step_frame_counter();
+    void quarter_frame();
+    void half_frame();
+    uint64_t frame_step_cycle();
+
+    void write_pulse(Pulse &pulse, uint16_t address, uint8_t data);
+    static void clock_envelope(Envelope &envelope);
+    static uint8_t envelope_volume(const Envelope &envelope);
+    static void clock_sweep(Pulse &pulse);
+    static uint16_t sweep_target(const Pulse &pulse);
+    static bool sweep_muted(const Pulse &pulse);
+
+    MemoryReader memory;
+    AudioRing *ring;
+    std::unique_ptr<BlipBuffer> blip;
+
+    // CPU cycles run since power on
+    uint64_t clock;
+
+    // frame counter
+    bool five_step;
+    bool irq_inhibit;
+    bool frame_irq;
+    // the cycle the step sequence started on, and the step it is on
+    uint64_t frame_start;
+    uint8_t frame_step;
+
+    std::array<Pulse, 2> pulses;
+    Triangle triangle;
+    Noise noise;
+    Dmc dmc;
+};
@@ -0,0 +1,53 @@
+#include "audio_ring.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+AudioRing::AudioRing(size_t capacity)
+    : buffer(std::bit_ceil(std::max<size_t>(capacity, 1)), 0),
+      mask(buffer.size() - 1),
+      head(0),
+      tail(0),
+      dropped(0) {}
+
+// Copies in at most two pieces, the one up to the end of the buffer and the
+// one that wraps around to the start
+size_t AudioRing::write(const int16_t *samples, size_t count) {
+    uint64_t position = head.load(std::memory_order_relaxed);
+    uint64_t used = position - tail.load(std::memory_order_acquire);
+    size_t fits = std::min<size_t>(count, buffer.size() - used);
+    dropped += count - fits;
+
+    size_t start = position & mask;
+    size_t first = std::min(fits, buffer.size() - start);
+    std::memcpy(&buffer[start], samples, first * sizeof(int16_t));
+    std::memcpy(&buffer[0], samples + first, (fits - first) * sizeof(int16_t));
+    head.store(position + fits, std::memory_order_release);
+    return fits;
+}
+
+size_t AudioRing::read(int16_t *out, size_t count) {
+    uint64_t position = tail.load(std::memory_order_relaxed);
+    uint64_t waiting = head.load(std::memory_order_acquire) - position;
+    size_t taken = std::min<size_t>(count, waiting);
+
+    size_t start = position & mask;
+    size_t first = std::min(taken, buffer.size() - start);
+    std::memcpy(out, &buffer[start], first * sizeof(int16_t));
+    std::memcpy(out + first, &buffer[0], (taken - first) * sizeof(int16_t));
+    tail.store(position + taken, std::memory_order_release);
+    return taken;
+}
+
+size_t AudioRing::size() {
+    return head.load(std::memory_order_acquire) -
+           tail.load(std::memory_order_acquire);
+}
+
+void AudioRing::audio_callback(void *ring, uint8_t *stream, int length) {
+    int16_t *out = reinterpret_cast<int16_t *>(stream);
+    size_t count = length / sizeof(int16_t);
+    size_t taken = static_cast<AudioRing *>(ring)->read(out, count);
+    std::fill(out + taken, out + count, 0);
+}
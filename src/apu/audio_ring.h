@@ -0,0 +1,50 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Mono 16 bit samples on their way from the emulator to the sound card.
+//
+// Single producer, single consumer and lock free, so the audio callback,
+// which runs on a thread of the audio driver's and must never wait on a lock,
+// can read while the emulator writes. The producer never waits either: what
+// does not fit is dropped and counted, which is also what happens when
+// nobody reads at all, so the emulator can run as fast as it likes without
+// a sink.
+class AudioRing {
+   public:
+    // capacity is rounded up to a power of 2
+    explicit AudioRing(size_t capacity);
+
+    AudioRing(const AudioRing &) = delete;
+    AudioRing &operator=(const AudioRing &) = delete;
+
+    // Producer side. Returns how many samples fit.
+    size_t write(const int16_t *samples, size_t count);
+
+    // Consumer side. Returns how many samples there were to read.
+    size_t read(int16_t *out, size_t count);
+
+    // Samples waiting to be read
+    size_t size();
+    size_t capacity() { return buffer.size(); }
+
+    // Samples write() had no room for so far, only for the producer
+    uint64_t get_dropped() { return dropped; }
+
+    // Has the shape of an SDL_AudioCallback for AUDIO_S16SYS mono with the
+    // ring as userdata, so SDL_OpenAudioDevice() can take it as it is. Plays
+    // silence for whatever the ring runs short of.
+    static void audio_callback(void *ring, uint8_t *stream, int length);
+
+   private:
+    std::vector<int16_t> buffer;
+    size_t mask;
+
+    // indexes like SpscRing's, but moved by whole blocks of samples
+    alignas(64) std::atomic<uint64_t> head;
+    alignas(64) std::atomic<uint64_t> tail;
+
+    uint64_t dropped;
+};
@@ -0,0 +1,110 @@
+#include "blip_buffer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numbers>
+
+// Kernel taps are fixed point with this many fraction bits, so one phase sums
+// to 1 << KERNEL_BITS and a delta of 1 ends up as 1 in the output
+const static int KERNEL_BITS = 14;
+// How fast the output drifts back to 0, the high pass filter a real console
+// has on its output. 1 / 2^9 per sample is around 14 Hz at 44.1 kHz.
+const static int BASS_SHIFT = 9;
+// Cut off a bit under half the sample rate so the window has room to roll off
+const static double CUTOFF = 0.45;
+
+BlipBuffer::BlipBuffer(double clock_rate, uint32_t sample_rate,
+                       uint64_t start_time)
+    : sample_rate(sample_rate),
+      factor(static_cast<uint64_t>(
+          std::llround(sample_rate / clock_rate *
+                       static_cast<double>(uint64_t{1} << FRACTION_BITS)))),
+      frame_time(start_time),
+      frame_position(0),
+      available(0),
+      integrator(0) {
+    // a tenth of a second to start with, add_delta() makes room if a frame
+    // runs longer
+    impulses.assign(sample_rate / 10 + BLIP_WIDTH, 0);
+
+    // A windowed sinc for every phase, centered between taps BLIP_WIDTH / 2 - 1
+    // and BLIP_WIDTH / 2 and shifted right by the phase
+    for (int phase = 0; phase < BLIP_PHASES; phase++) {
+        double shift = static_cast<double>(phase) / BLIP_PHASES;
+        std::array<double, BLIP_WIDTH> taps;
+        double sum = 0;
+        for (int i = 0; i < BLIP_WIDTH; i++) {
+            double x = i - (BLIP_WIDTH / 2 - 1) - shift;
+            double sinc = x == 0 ? 1
+                                 : std::sin(std::numbers::pi * 2 * CUTOFF * x) /
+                                       (std::numbers::pi * 2 * CUTOFF * x);
+            // Blackman window over the width of the kernel
+            double w = (x + BLIP_WIDTH / 2.0) / BLIP_WIDTH;
+            double window = 0.42 - 0.5 * std::cos(2 * std::numbers::pi * w) +
+                            0.08 * std::cos(4 * std::numbers::pi * w);
+            taps[i] = sinc * std::max(window, 0.0);
+            sum += taps[i];
+        }
+
+        // rounding would leave every phase a little off unity, which shows up
+        // as a DC error that depends on where the steps land. Whatever is
+        // left over goes onto the biggest tap.
+        int total = 0;
+        int biggest = 0;
+        for (int i = 0; i < BLIP_WIDTH; i++) {
+            kernel[phase][i] = static_cast<int16_t>(
+                std::lround(taps[i] / sum * (1 << KERNEL_BITS)));
+            total += kernel[phase][i];
+            if (kernel[phase][i] > kernel[phase][biggest]) {
+                biggest = i;
+            }
+        }
+        kernel[phase][biggest] += (1 << KERNEL_BITS) - total;
+    }
+}
+
+void BlipBuffer::add_delta(uint64_t time, int32_t delta) {
+    uint64_t position = frame_position + (time - frame_time) * factor;
+    size_t index = position >> FRACTION_BITS;
+    uint32_t phase =
+        (position >> (FRACTION_BITS - BLIP_PHASE_BITS)) & (BLIP_PHASES - 1);
+
+    if (index + BLIP_WIDTH > impulses.size()) {
+        impulses.resize((index + BLIP_WIDTH) * 2, 0);
+    }
+    int32_t *out = &impulses[index];
+    const std::array<int16_t, BLIP_WIDTH> &taps = kernel[phase];
+    for (int i = 0; i < BLIP_WIDTH; i++) {
+        out[i] += taps[i] * delta;
+    }
+}
+
+void BlipBuffer::end_frame(uint64_t time) {
+    frame_position += (time - frame_time) * factor;
+    frame_time = time;
+    available = frame_position >> FRACTION_BITS;
+    if (available + BLIP_WIDTH > impulses.size()) {
+        impulses.resize((available + BLIP_WIDTH) * 2, 0);
+    }
+}
+
+size_t BlipBuffer::read_samples(int16_t *out, size_t count) {
+    count = std::min(count, available);
+    for (size_t i = 0; i < count; i++) {
+        integrator += impulses[i];
+        int32_t sample = integrator >> KERNEL_BITS;
+        out[i] = static_cast<int16_t>(std::clamp(sample, -32768, 32767));
+        integrator -= integrator >> BASS_SHIFT;
+    }
+
+    // the rest moves up to the front, including the tails of the impulses
+    // past the end of the frame
+    size_t remaining = impulses.size() - count;
+    std::memmove(impulses.data(), impulses.data() + count,
+                 remaining * sizeof(int32_t));
+    std::fill(impulses.begin() + remaining, impulses.end(), 0);
+    available -= count;
+    frame_position -= static_cast<uint64_t>(count) << FRACTION_BITS;
+    return count;
+}
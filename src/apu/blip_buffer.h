@@ -0,0 +1,61 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Phases a delta's position between two samples is rounded to, and how many
+// samples one band-limited step is spread over
+const static int BLIP_PHASE_BITS = 5;
+const static int BLIP_PHASES = 1 << BLIP_PHASE_BITS;
+const static int BLIP_WIDTH = 16;
+
+// Turns amplitude changes at clock times into samples at a much lower rate
+// without aliasing, the way blargg's Blip_Buffer does.
+//
+// Instead of running a channel at the clock rate and filtering the result,
+// whoever makes the sound only says when its output steps up or down and by
+// how much. Each step is added to the buffer as a band-limited impulse
+// (windowed sinc, picked by where between two samples it lands), and reading
+// integrates them back into a waveform. A square wave at 1 kHz costs 2000
+// add_delta() calls a second however fast the clock is.
+//
+// Times are in clocks since power on and only go up, starting at
+// start_time. Deltas can only be added at or after the time of the last
+// end_frame().
+class BlipBuffer {
+   public:
+    BlipBuffer(double clock_rate, uint32_t sample_rate, uint64_t start_time);
+
+    BlipBuffer(const BlipBuffer &) = delete;
+    BlipBuffer &operator=(const BlipBuffer &) = delete;
+
+    void add_delta(uint64_t time, int32_t delta);
+
+    // Everything before time is final, so the samples up to it can be read
+    void end_frame(uint64_t time);
+
+    size_t samples_available() { return available; }
+
+    // Reads up to count samples, returns how many it read
+    size_t read_samples(int16_t *out, size_t count);
+
+    uint32_t get_sample_rate() { return sample_rate; }
+
+   private:
+    // sample positions are 32.32 fixed point
+    const static int FRACTION_BITS = 32;
+
+    uint32_t sample_rate;
+    // samples per clock
+    uint64_t factor;
+    // the time of the last end_frame(), and the position of it in the buffer
+    uint64_t frame_time;
+    uint64_t frame_position;
+    size_t available;
+
+    // running sum of the impulses read so far, which is the waveform
+    int32_t integrator;
+    std::vector<int32_t> impulses;
+    std::array<std::array<int16_t, BLIP_WIDTH>, BLIP_PHASES> kernel;
+};
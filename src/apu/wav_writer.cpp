@@ -0,0 +1,77 @@
+#include "wav_writer.h"
+
+#include <algorithm>
+#include <bit>
+#include <stdexcept>
+
+const static uint32_t WAV_HEADER_SIZE = 44;
+
+WavWriter::WavWriter(const std::string &path, uint32_t sample_rate)
+    : file(std::fopen(path.c_str(), "wb")),
+      sample_rate(sample_rate),
+      samples_written(0) {
+    if (file == nullptr) {
+        throw std::runtime_error("could not create " + path);
+    }
+    // a placeholder until the sizes are known
+    write_header();
+}
+
+WavWriter::~WavWriter() {
+    std::fseek(file, 0, SEEK_SET);
+    write_header();
+    std::fclose(file);
+}
+
+// WAV is little endian, and so is everything this runs on, but the samples
+// are swapped anyway on the off chance it is not
+void WavWriter::write(const int16_t *samples, size_t count) {
+    if constexpr (std::endian::native == std::endian::little) {
+        std::fwrite(samples, sizeof(int16_t), count, file);
+    } else {
+        for (size_t i = 0; i < count; i++) {
+            uint16_t sample = static_cast<uint16_t>(samples[i]);
+            uint8_t bytes[2] = {static_cast<uint8_t>(sample),
+                                static_cast<uint8_t>(sample >> 8)};
+            std::fwrite(bytes, 1, 2, file);
+        }
+    }
+    samples_written += count;
+}
+
+static void put_16(uint8_t *out, uint16_t value) {
+    out[0] = value;
+    out[1] = value >> 8;
+}
+
+static void put_32(uint8_t *out, uint32_t value) {
+    put_16(out, value);
+    put_16(out + 2, value >> 16);
+}
+
+// http://soundfile.sapp.org/doc/WaveFormat/
+void WavWriter::write_header() {
+    // sizes are 32 bit, anything longer than that (over 13 hours at 44.1 kHz)
+    // is cut short in the header
+    uint32_t data_size = static_cast<uint32_t>(std::min<uint64_t>(
+        samples_written * 2, UINT32_MAX - WAV_HEADER_SIZE));
+
+    uint8_t header[WAV_HEADER_SIZE] = {'R', 'I', 'F', 'F', 0, 0, 0, 0,
+                                       'W', 'A', 'V', 'E', 'f', 'm', 't', ' '};
+    put_32(header + 4, WAV_HEADER_SIZE - 8 + data_size);
+    put_32(header + 16, 16);
+    // PCM, mono
+    put_16(header + 20, 1);
+    put_16(header + 22, 1);
+    put_32(header + 24, sample_rate);
+    // bytes per second, bytes per frame and bits per sample
+    put_32(header + 28, sample_rate * 2);
+    put_16(header + 32, 2);
+    put_16(header + 34, 16);
+    header[36] = 'd';
+    header[37] = 'a';
+    header[38] = 't';
+    header[39] = 'a';
+    put_32(header + 40, data_size);
+    std::fwrite(header, 1, WAV_HEADER_SIZE, file);
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// Writes mono 16 bit PCM to a .wav file, the audio sink for running without
+// a sound card. The sizes in the header are filled in when it is closed.
+class WavWriter {
+   public:
+    // Throws std::runtime_error if the file cannot be created
+    WavWriter(const std::string &path, uint32_t sample_rate);
+    ~WavWriter();
+
+    WavWriter(const WavWriter &) = delete;
+    WavWriter &operator=(const WavWriter &) = delete;
+
+    void write(const int16_t *samples, size_t count);
+
+    uint64_t get_samples_written() { return samples_written; }
+
+   private:
+    void write_header();
+
+    FILE *file;
+    uint32_t sample_rate;
+    uint64_t samples_written;
+};
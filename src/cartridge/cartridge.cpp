@@ -0,0 +1,171 @@
+#include "cartridge.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+Cartridge::Cartridge(const std::string &path) : file(nullptr), file_size(0) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("could not open " + path);
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t)INES_HEADER_SIZE) {
+        close(fd);
+        throw std::runtime_error(path + " is too small to be an iNES file");
+    }
+    file_size = info.st_size;
+
+    // read only and private, so every instance shares the page cache pages
+    void *mapping = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping keeps the file alive on its own
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error("could not mmap " + path);
+    }
+    file = static_cast<const uint8_t *>(mapping);
+
+    try {
+        parse_header(file, file_size);
+    } catch (...) {
+        munmap(const_cast<uint8_t *>(file), file_size);
+        throw;
+    }
+}
+
+Cartridge::~Cartridge() {
+    if (file != nullptr) {
+        munmap(const_cast<uint8_t *>(file), file_size);
+    }
+}
+
+// NES 2.0 sizes are either a plain multiple of the bank size, or when the
+// upper nibble is 0xF an exponent and a multiplier packed into the lower byte
+static size_t rom_size(uint8_t lower, uint8_t upper_nibble, size_t bank_size) {
+    if (upper_nibble == 0xF) {
+        size_t exponent = lower >> 2;
+        size_t multiplier = (lower & 0b11) * 2 + 1;
+        // far more than any file holds, and the multiply could overflow.
+        // parse_header() turns it down like any other size past the end.
+        if (exponent >= 48) {
+            return SIZE_MAX;
+        }
+        return (size_t{1} << exponent) * multiplier;
+    }
+    return ((upper_nibble << 8) | lower) * bank_size;
+}
+
+// RAM sizes in NES 2.0 are shift counts, 64 << shift bytes or none at all
+static size_t ram_size(uint8_t shift) {
+    return shift == 0 ? 0 : 64 << shift;
+}
+
+// Rounds a RAM size up to whole pages, since that is what the bus maps
+static size_t whole_pages(size_t size) {
+    return (size + 0xFF) & ~size_t{0xFF};
+}
+
+void Cartridge::parse_header(const uint8_t *header, size_t size) {
+    if (std::memcmp(header, "NES\x1A", 4) != 0) {
+        throw std::runtime_error("missing the iNES magic number");
+    }
+
+    uint8_t flags_6 = header[6];
+    uint8_t flags_7 = header[7];
+    // https://www.nesdev.org/wiki/NES_2.0#Identification
+    nes2 = (flags_7 & 0x0C) == 0x08;
+
+    if (flags_6 & 0b1000) {
+        mirroring = FOUR_SCREEN;
+    } else if (flags_6 & 0b1) {
+        mirroring = VERTICAL;
+    } else {
+        mirroring = HORIZONTAL;
+    }
+    battery = (flags_6 & 0b10) != 0;
+    bool trainer = (flags_6 & 0b100) != 0;
+
+    mapper = flags_6 >> 4;
+    submapper = 0;
+    size_t prg_ram_size;
+    size_t chr_ram_size;
+    if (nes2) {
+        mapper |= (flags_7 & 0xF0) | ((header[8] & 0x0F) << 8);
+        submapper = header[8] >> 4;
+        prg_rom_size =
+            rom_size(header[4], header[9] & 0x0F, PRG_ROM_BANK_SIZE);
+        chr_rom_size =
+            rom_size(header[5], header[9] >> 4, CHR_ROM_BANK_SIZE);
+        // volatile and battery backed RAM end up in the same place for us
+        prg_ram_size =
+            ram_size(header[10] & 0x0F) + ram_size(header[10] >> 4);
+        chr_ram_size =
+            ram_size(header[11] & 0x0F) + ram_size(header[11] >> 4);
+    } else {
+        // old dumping tools wrote their name over bytes 7-15, in which case
+        // the upper nibble of the mapper is garbage
+        bool archaic = std::any_of(header + 12, header + 16,
+                                   [](uint8_t byte) { return byte != 0; });
+        if (!archaic) {
+            mapper |= flags_7 & 0xF0;
+        }
+        prg_rom_size = header[4] * PRG_ROM_BANK_SIZE;
+        chr_rom_size = header[5] * CHR_ROM_BANK_SIZE;
+        // 0 means 8 KiB for compatibility
+        prg_ram_size = std::max<size_t>(header[8], 1) * 8 * 1024;
+        chr_ram_size = 0;
+    }
+    if (chr_rom_size == 0 && chr_ram_size == 0) {
+        chr_ram_size = CHR_ROM_BANK_SIZE;
+    }
+
+    if (prg_rom_size == 0) {
+        throw std::runtime_error("the iNES file has no PRG ROM");
+    }
+    if (prg_rom_size % PRG_MIN_BANK_SIZE != 0) {
+        throw std::runtime_error(
+            "the iNES file's PRG ROM is not a whole number of 8 KiB banks");
+    }
+    size_t chr_size = chr_rom_size != 0 ? chr_rom_size : chr_ram_size;
+    if (chr_size % CHR_MIN_BANK_SIZE != 0) {
+        throw std::runtime_error(
+            "the iNES file's CHR is not a whole number of 1 KiB banks");
+    }
+    // each on its own first, so the sum below cannot wrap around
+    size_t prg_offset = INES_HEADER_SIZE + (trainer ? INES_TRAINER_SIZE : 0);
+    if (prg_rom_size > size || chr_rom_size > size ||
+        size < prg_offset + prg_rom_size + chr_rom_size) {
+        throw std::runtime_error(
+            "the iNES file is shorter than its header says");
+    }
+    prg_rom = header + prg_offset;
+    chr_rom = chr_rom_size == 0 ? nullptr : prg_rom + prg_rom_size;
+
+    prg_ram.assign(whole_pages(prg_ram_size), 0);
+    chr_ram.assign(chr_rom_size == 0 ? chr_ram_size : 0, 0);
+
+    // the trainer belongs at 0x7000
+    if (trainer && prg_ram.size() >= 0x1000 + INES_TRAINER_SIZE) {
+        std::copy_n(header + INES_HEADER_SIZE, INES_TRAINER_SIZE,
+                    prg_ram.begin() + 0x1000);
+    }
+}
+
+const uint8_t *Cartridge::get_chr() {
+    return has_chr_ram() ? chr_ram.data() : chr_rom;
+}
+
+uint8_t *Cartridge::get_chr_ram() {
+    return has_chr_ram() ? chr_ram.data() : nullptr;
+}
+
+size_t Cartridge::get_chr_size() {
+    return has_chr_ram() ? chr_ram.size() : chr_rom_size;
+}
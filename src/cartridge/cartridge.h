@@ -0,0 +1,84 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// https://www.nesdev.org/wiki/Mirroring#Nametable_Mirroring
+enum Mirroring {
+    HORIZONTAL,
+    VERTICAL,
+    FOUR_SCREEN,
+    // picked by the mapper, MMC1 can show one nametable everywhere
+    SINGLE_SCREEN_LOWER,
+    SINGLE_SCREEN_UPPER,
+};
+
+const static size_t INES_HEADER_SIZE = 16;
+const static size_t INES_TRAINER_SIZE = 512;
+const static size_t PRG_ROM_BANK_SIZE = 16 * 1024;
+const static size_t CHR_ROM_BANK_SIZE = 8 * 1024;
+// Mappers switch PRG and CHR in banks as small as these, so both have to
+// come in whole ones
+const static size_t PRG_MIN_BANK_SIZE = 8 * 1024;
+const static size_t CHR_MIN_BANK_SIZE = 1024;
+
+// A .nes file in the iNES or NES 2.0 format.
+// https://www.nesdev.org/wiki/INES
+// https://www.nesdev.org/wiki/NES_2.0
+//
+// The file is mmapped read only and PRG ROM and CHR ROM point straight into
+// the mapping, nothing gets copied. Loading takes the same time no matter how
+// big the ROM is, and every Cartridge opened from the same file shares the
+// same physical pages. The Cartridge has to outlive the Mapper made for it.
+// The Mapper maps it into the address space.
+//
+// The constructor throws std::runtime_error if the file cannot be read or is
+// not an iNES file.
+class Cartridge {
+   public:
+    explicit Cartridge(const std::string &path);
+    ~Cartridge();
+
+    Cartridge(const Cartridge &) = delete;
+    Cartridge &operator=(const Cartridge &) = delete;
+
+    const uint8_t *get_prg_rom() { return prg_rom; }
+    size_t get_prg_rom_size() { return prg_rom_size; }
+
+    // CHR ROM, or CHR RAM when the cartridge has no CHR ROM. Only CHR RAM
+    // can be written to, get_chr_ram() is nullptr otherwise.
+    const uint8_t *get_chr();
+    uint8_t *get_chr_ram();
+    size_t get_chr_size();
+    bool has_chr_ram() { return chr_rom_size == 0; }
+
+    uint16_t get_mapper_number() { return mapper; }
+    uint8_t get_submapper() { return submapper; }
+    Mirroring get_mirroring() { return mirroring; }
+    bool has_battery() { return battery; }
+    bool is_nes2() { return nes2; }
+    uint8_t *get_prg_ram() { return prg_ram.data(); }
+    size_t get_prg_ram_size() { return prg_ram.size(); }
+
+   private:
+    void parse_header(const uint8_t *header, size_t file_size);
+
+    // the whole file
+    const uint8_t *file;
+    size_t file_size;
+
+    const uint8_t *prg_rom;
+    size_t prg_rom_size;
+    const uint8_t *chr_rom;
+    size_t chr_rom_size;
+
+    uint16_t mapper;
+    uint8_t submapper;
+    Mirroring mirroring;
+    bool battery;
+    bool nes2;
+
+    std::vector<uint8_t> prg_ram;
+    std::vector<uint8_t> chr_ram;
+};
@@ -0,0 +1,324 @@
+#include "mapper.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+Mapper::Mapper(Cartridge &cartridge)
+    : cartridge(cartridge),
+      irq(false),
+      mirroring(cartridge.get_mirroring()),
+      bus(nullptr),
+      chr_listener{} {
+    chr_pages.fill(nullptr);
+    chr_write_pages.fill(nullptr);
+    chr_offsets.fill(0);
+}
+
+void Mapper::attach(Bus &bus) {
+    this->bus = &bus;
+
+    if (cartridge.get_prg_ram_size() != 0) {
+        bus.map_memory(0x60, 0x20, cartridge.get_prg_ram(),
+                       cartridge.get_prg_ram_size(), true);
+    }
+
+    // the registers live under all of PRG ROM, reset_banks() then points the
+    // pages at the right banks
+    size_t prg_size = std::min<size_t>(cartridge.get_prg_rom_size(),
+                                       4 * PRG_PAGE_SIZE);
+    bus.map_rom(0x80, 0x80, cartridge.get_prg_rom(), prg_size,
+                {nullptr, &Mapper::register_write, this});
+    reset_banks();
+}
+
+// Most mappers start with the first bank at 0x8000 and the last at 0xC000,
+// that is where the reset vector has to be
+void Mapper::reset_banks() {
+    switch_prg_16k(0, 0);
+    switch_prg_16k(1, -1);
+    switch_chr_8k(0);
+}
+
+void Mapper::register_write(void *context, uint16_t address, uint8_t data) {
+    static_cast<Mapper *>(context)->write_register(address, data);
+}
+
+// Wraps bank into [0, count) the way a mapper ignores the bank number bits the
+// ROM does not have, with negative banks counting from the end
+static size_t wrap_bank(int bank, size_t count) {
+    int wrapped = bank % static_cast<int>(count);
+    return wrapped < 0 ? wrapped + count : wrapped;
+}
+
+void Mapper::switch_prg_8k(uint8_t slot, int bank) {
+    size_t count = std::max<size_t>(
+        cartridge.get_prg_rom_size() / PRG_PAGE_SIZE, 1);
+    const uint8_t *memory =
+        cartridge.get_prg_rom() + wrap_bank(bank, count) * PRG_PAGE_SIZE;
+    bus->switch_rom(0x80 + slot * (PRG_PAGE_SIZE >> 8), PRG_PAGE_SIZE >> 8,
+                    memory);
+}
+
+void Mapper::switch_prg_16k(uint8_t slot, int bank) {
+    // two 8 KiB halves, with the same wrap around as a 16 KiB bank
+    size_t count = std::max<size_t>(
+        cartridge.get_prg_rom_size() / (2 * PRG_PAGE_SIZE), 1);
+    int first = wrap_bank(bank, count) * 2;
+    switch_prg_8k(slot * 2, first);
+    switch_prg_8k(slot * 2 + 1, first + 1);
+}
+
+void Mapper::switch_prg_32k(int bank) {
+    size_t count = std::max<size_t>(
+        cartridge.get_prg_rom_size() / (4 * PRG_PAGE_SIZE), 1);
+    int first = wrap_bank(bank, count) * 2;
+    switch_prg_16k(0, first);
+    switch_prg_16k(1, first + 1);
+}
+
+void Mapper::switch_chr_1k(uint8_t slot, int bank) {
+    size_t count =
+        std::max<size_t>(cartridge.get_chr_size() / CHR_PAGE_SIZE, 1);
+    size_t offset = wrap_bank(bank, count) * CHR_PAGE_SIZE;
+    if (chr_pages[slot] == cartridge.get_chr() + offset) {
+        return;
+    }
+    chr_changing();
+    chr_pages[slot] = cartridge.get_chr() + offset;
+    chr_offsets[slot] = offset;
+    uint8_t *chr_ram = cartridge.get_chr_ram();
+    chr_write_pages[slot] = chr_ram == nullptr ? nullptr : chr_ram + offset;
+}
+
+void Mapper::switch_chr_4k(uint8_t slot, int bank) {
+    for (int i = 0; i < 4; i++) {
+        switch_chr_1k(slot * 4 + i, bank * 4 + i);
+    }
+}
+
+void Mapper::switch_chr_8k(int bank) {
+    switch_chr_4k(0, bank * 2);
+    switch_chr_4k(1, bank * 2 + 1);
+}
+
+void Mapper::set_mirroring(Mirroring mirroring) {
+    if (mirroring != this->mirroring) {
+        chr_changing();
+        this->mirroring = mirroring;
+    }
+}
+
+void Mapper::chr_changing() {
+    if (chr_listener.changing != nullptr) {
+        chr_listener.changing(chr_listener.context);
+    }
+}
+
+Mmc1::Mmc1(Cartridge &cartridge)
+    : Mapper(cartridge),
+      shift_register(0x10),
+      control(0x0C),
+      chr_bank_0(0),
+      chr_bank_1(0),
+      prg_bank(0) {}
+
+void Mmc1::reset_banks() { update_banks(); }
+
+// The CPU writes the registers one bit at a time, 5 writes each. The last
+// write picks the register with bits 13 and 14 of its address.
+void Mmc1::write_register(uint16_t address, uint8_t data) {
+    if (data & 0x80) {
+        shift_register = 0x10;
+        control |= 0x0C;
+        update_banks();
+        return;
+    }
+
+    bool complete = shift_register & 1;
+    shift_register = (shift_register >> 1) | ((data & 1) << 4);
+    if (!complete) {
+        return;
+    }
+
+    uint8_t value = shift_register;
+    shift_register = 0x10;
+    switch ((address >> 13) & 0b11) {
+        case 0:
+            control = value;
+            break;
+        case 1:
+            chr_bank_0 = value;
+            break;
+        case 2:
+            chr_bank_1 = value;
+            break;
+        case 3:
+            prg_bank = value;
+            break;
+    }
+    update_banks();
+}
+
+void Mmc1::update_banks() {
+    switch (control & 0b11) {
+        case 0:
+            set_mirroring(SINGLE_SCREEN_LOWER);
+            break;
+        case 1:
+            set_mirroring(SINGLE_SCREEN_UPPER);
+            break;
+        case 2:
+            set_mirroring(VERTICAL);
+            break;
+        case 3:
+            set_mirroring(HORIZONTAL);
+            break;
+    }
+
+    // 512 KiB boards (SUROM) pick the 256 KiB half with a CHR bank bit
+    int outer = 0;
+    if (cartridge.get_prg_rom_size() > 16 * PRG_ROM_BANK_SIZE) {
+        outer = chr_bank_0 & 0x10;
+    }
+    int bank = prg_bank & 0x0F;
+    switch ((control >> 2) & 0b11) {
+        case 0:
+        case 1:
+            // 32 KiB at a time, the low bit is ignored
+            switch_prg_16k(0, outer + (bank & 0x0E));
+            switch_prg_16k(1, outer + (bank | 0x01));
+            break;
+        case 2:
+            switch_prg_16k(0, outer);
+            switch_prg_16k(1, outer + bank);
+            break;
+        case 3:
+            switch_prg_16k(0, outer + bank);
+            switch_prg_16k(1, outer + 0x0F);
+            break;
+    }
+
+    if (control & 0x10) {
+        switch_chr_4k(0, chr_bank_0);
+        switch_chr_4k(1, chr_bank_1);
+    } else {
+        switch_chr_8k(chr_bank_0 >> 1);
+    }
+}
+
+void UxRom::write_register(uint16_t, uint8_t data) {
+    switch_prg_16k(0, data);
+}
+
+void CnRom::write_register(uint16_t, uint8_t data) {
+    switch_chr_8k(data);
+}
+
+Mmc3::Mmc3(Cartridge &cartridge)
+    : Mapper(cartridge),
+      bank_select(0),
+      irq_latch(0),
+      irq_counter(0),
+      irq_reload(false),
+      irq_enabled(false) {
+    // what the banks start as is undefined, this is what most emulators do
+    bank_registers = {0, 2, 4, 5, 6, 7, 0, 1};
+}
+
+void Mmc3::reset_banks() { update_banks(); }
+
+// Every register has an even and an odd address, mirrored all the way up to
+// the next one
+void Mmc3::write_register(uint16_t address, uint8_t data) {
+    switch (address & 0xE001) {
+        case 0x8000:
+            bank_select = data;
+            update_banks();
+            break;
+        case 0x8001:
+            bank_registers[bank_select & 0b111] = data;
+            update_banks();
+            break;
+        case 0xA000:
+            if (cartridge.get_mirroring() != FOUR_SCREEN) {
+                set_mirroring((data & 1) ? HORIZONTAL : VERTICAL);
+            }
+            break;
+        case 0xA001:
+            // PRG RAM write protection, which no game needs
+            break;
+        case 0xC000:
+            irq_latch = data;
+            break;
+        case 0xC001:
+            irq_counter = 0;
+            irq_reload = true;
+            break;
+        case 0xE000:
+            irq_enabled = false;
+            irq = false;
+            break;
+        case 0xE001:
+            irq_enabled = true;
+            break;
+    }
+}
+
+void Mmc3::update_banks() {
+    // bit 6 swaps the switchable bank at 0x8000 with the fixed second to
+    // last bank at 0xC000
+    if (bank_select & 0x40) {
+        switch_prg_8k(0, -2);
+        switch_prg_8k(2, bank_registers[6]);
+    } else {
+        switch_prg_8k(0, bank_registers[6]);
+        switch_prg_8k(2, -2);
+    }
+    switch_prg_8k(1, bank_registers[7]);
+    switch_prg_8k(3, -1);
+
+    // two 2 KiB banks and four 1 KiB banks, bit 7 swaps the two halves
+    uint8_t inversion = (bank_select & 0x80) ? 4 : 0;
+    switch_chr_1k(0 ^ inversion, bank_registers[0] & 0xFE);
+    switch_chr_1k(1 ^ inversion, bank_registers[0] | 0x01);
+    switch_chr_1k(2 ^ inversion, bank_registers[1] & 0xFE);
+    switch_chr_1k(3 ^ inversion, bank_registers[1] | 0x01);
+    for (int i = 0; i < 4; i++) {
+        switch_chr_1k((4 + i) ^ inversion, bank_registers[2 + i]);
+    }
+}
+
+// The scanline counter. Reloads when it is 0 or was asked to, otherwise
+// counts down, and raises the IRQ once it gets to 0.
+void Mmc3::ppu_a12_rising() {
+    if (irq_counter == 0 || irq_reload) {
+        irq_counter = irq_latch;
+        irq_reload = false;
+    } else {
+        irq_counter--;
+    }
+
+    if (irq_counter == 0 && irq_enabled) {
+        irq = true;
+    }
+}
+
+std::unique_ptr<Mapper> make_mapper(Cartridge &cartridge) {
+    switch (cartridge.get_mapper_number()) {
+        case 0:
+            return std::make_unique<Nrom>(cartridge);
+        case 1:
+            return std::make_unique<Mmc1>(cartridge);
+        case 2:
+            return std::make_unique<UxRom>(cartridge);
+        case 3:
+            return std::make_unique<CnRom>(cartridge);
+        case 4:
+            return std::make_unique<Mmc3>(cartridge);
+        default:
+            throw std::runtime_error(
+                "unsupported mapper " +
+                std::to_string(cartridge.get_mapper_number()));
+    }
+}
@@ -0,0 +1,182 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <memory>
+
+#include "cartridge.h"
+#include "cpu/bus.h"
+
+// CHR is switched in 1 KiB pages, the smallest bank any mapper here uses
+const static uint16_t CHR_PAGE_SIZE = 0x400;
+const static uint16_t PRG_PAGE_SIZE = 0x2000;
+
+// Told right before the mapper changes what the PPU sees, a CHR bank or the
+// nametable mirroring, so a PPU that runs behind the CPU can catch up first
+struct ChrListener {
+    void (*changing)(void *context);
+    void *context;
+};
+
+// The chip on the cartridge that decides which part of PRG and CHR the CPU and
+// PPU see. https://www.nesdev.org/wiki/Mapper
+//
+// Banks are switched by repointing the pages of the CPU bus and of the CHR
+// page table below, so a switch costs a handful of pointer stores and reading
+// from a switched bank costs nothing extra. The mapper registers sit under
+// PRG ROM as the write handler of its pages.
+class Mapper {
+   public:
+    explicit Mapper(Cartridge &cartridge);
+    virtual ~Mapper() = default;
+
+    Mapper(const Mapper &) = delete;
+    Mapper &operator=(const Mapper &) = delete;
+
+    // Maps PRG RAM at 0x6000-0x7FFF and PRG ROM at 0x8000-0xFFFF with the
+    // banks the mapper starts with. Bank switches change the bus from then
+    // on, so it has to outlive the mapper.
+    void attach(Bus &bus);
+
+    // The PPU side, the pattern tables at 0x0000-0x1FFF
+    uint8_t read_chr(uint16_t address) {
+        return chr_pages[(address >> 10) & 7][address & (CHR_PAGE_SIZE - 1)];
+    }
+
+    void write_chr(uint16_t address, uint8_t data) {
+        // CHR ROM has no write pages
+        uint8_t *page = chr_write_pages[(address >> 10) & 7];
+        if (page != nullptr) {
+            page[address & (CHR_PAGE_SIZE - 1)] = data;
+        }
+    }
+
+    // Where the byte at pattern table address is in the cartridge's CHR
+    uint32_t get_chr_offset(uint16_t address) {
+        return chr_offsets[(address >> 10) & 7] +
+               (address & (CHR_PAGE_SIZE - 1));
+    }
+
+    Mirroring get_mirroring() { return mirroring; }
+    Cartridge &get_cartridge() { return cartridge; }
+
+    void set_chr_listener(ChrListener listener) { chr_listener = listener; }
+
+    // The PPU calls this whenever A12 of its address bus goes from low to
+    // high, which is once per scanline while backgrounds and sprites use
+    // different pattern tables. MMC3 counts scanlines with it.
+    virtual void ppu_a12_rising() {}
+    // Whether ppu_a12_rising() does anything, the PPU has to be caught up
+    // every scanline while rendering if it does
+    virtual bool counts_scanlines() { return false; }
+
+    // Whether the mapper holds the CPU IRQ line
+    bool is_irq_asserted() { return irq; }
+
+   protected:
+    // Sets up the banks the mapper has at power on
+    virtual void reset_banks();
+
+    // Every CPU write to 0x8000-0xFFFF
+    virtual void write_register(uint16_t, uint8_t) {}
+
+    // Bank switching, slots count from 0x8000 for PRG and 0x0000 for CHR in
+    // units of the bank size. Banks past the end wrap around and negative
+    // banks count from the end, so -1 is always the last bank.
+    void switch_prg_8k(uint8_t slot, int bank);
+    void switch_prg_16k(uint8_t slot, int bank);
+    void switch_prg_32k(int bank);
+    void switch_chr_1k(uint8_t slot, int bank);
+    void switch_chr_4k(uint8_t slot, int bank);
+    void switch_chr_8k(int bank);
+    void set_mirroring(Mirroring mirroring);
+
+    Cartridge &cartridge;
+    bool irq;
+
+   private:
+    static void register_write(void *context, uint16_t address, uint8_t data);
+    void chr_changing();
+
+    Mirroring mirroring;
+    Bus *bus;
+    ChrListener chr_listener;
+    std::array<const uint8_t *, 8> chr_pages;
+    std::array<uint8_t *, 8> chr_write_pages;
+    std::array<uint32_t, 8> chr_offsets;
+};
+
+// Mapper 0, no bank switching at all
+class Nrom : public Mapper {
+   public:
+    using Mapper::Mapper;
+};
+
+// Mapper 1
+// https://www.nesdev.org/wiki/MMC1
+class Mmc1 : public Mapper {
+   public:
+    explicit Mmc1(Cartridge &cartridge);
+
+   protected:
+    void reset_banks() override;
+    void write_register(uint16_t address, uint8_t data) override;
+
+   private:
+    void update_banks();
+
+    // bits come in one write at a time, the 1 marks when 5 are in
+    uint8_t shift_register;
+    uint8_t control;
+    uint8_t chr_bank_0;
+    uint8_t chr_bank_1;
+    uint8_t prg_bank;
+};
+
+// Mapper 2
+// https://www.nesdev.org/wiki/UxROM
+class UxRom : public Mapper {
+   public:
+    using Mapper::Mapper;
+
+   protected:
+    void write_register(uint16_t address, uint8_t data) override;
+};
+
+// Mapper 3
+// https://www.nesdev.org/wiki/INES_Mapper_003
+class CnRom : public Mapper {
+   public:
+    using Mapper::Mapper;
+
+   protected:
+    void write_register(uint16_t address, uint8_t data) override;
+};
+
+// Mapper 4
+// https://www.nesdev.org/wiki/MMC3
+class Mmc3 : public Mapper {
+   public:
+    explicit Mmc3(Cartridge &cartridge);
+
+    void ppu_a12_rising() override;
+    bool counts_scanlines() override { return true; }
+
+   protected:
+    void reset_banks() override;
+    void write_register(uint16_t address, uint8_t data) override;
+
+   private:
+    void update_banks();
+
+    uint8_t bank_select;
+    std::array<uint8_t, 8> bank_registers;
+
+    uint8_t irq_latch;
+    uint8_t irq_counter;
+    bool irq_reload;
+    bool irq_enabled;
+};
+
+// The mapper the cartridge header asks for. Throws std::runtime_error for
+// mappers we do not have.
+std::unique_ptr<Mapper> make_mapper(Cartridge &cartridge);
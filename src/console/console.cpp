@@ -0,0 +1,221 @@
+#include "console.h"
+
+#include <algorithm>
+#include <array>
+
+Console::Console(const std::string &path)
+    : cartridge(path),
+      mapper(make_mapper(cartridge)),
+      ppu(*mapper),
+      apu({&Console::read_dmc_sample, this}) {
+    cpu.load(*mapper);
+    mapper->set_chr_listener({&Console::chr_changing, this});
+
+    Bus &bus = cpu.get_bus();
+    // 8 registers mirrored all the way up to $3FFF
+    bus.map_mmio(0x20, 0x20,
+                 {&Console::read_ppu_register, &Console::write_ppu_register,
+                  this});
+    // the APU and I/O registers, the controllers do not answer yet
+    bus.map_mmio(0x40, 0x01,
+                 {&Console::read_io_register, &Console::write_io_register,
+                  this});
+
+    reset();
+}
+
+void Console::reset() {
+    // the worker counts on the cycle only going up, so it starts over too
+    bool threaded = ppu_worker != nullptr;
+    ppu_worker.reset();
+    ppu.reset();
+    apu.reset();
+    cpu.reset();
+    deadline = 0;
+    set_ppu_thread(threaded);
+}
+
+bool Console::set_ppu_thread(bool enabled) {
+    if (enabled == (ppu_worker != nullptr)) {
+        return true;
+    }
+    if (!enabled) {
+        // finishes the log before it stops
+        ppu_worker.reset();
+        return true;
+    }
+    if (mapper->counts_scanlines()) {
+        return false;
+    }
+    ppu.catch_up(cpu.get_cycles());
+    ppu_worker = std::make_unique<PPUWorker>(ppu);
+    return true;
+}
+
+bool Console::run_frame() {
+    sync_ppu();
+    uint64_t frame = ppu.get_frame();
+    while (ppu.get_frame() == frame) {
+        if (!run_slice(next_event_cycle())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Console::run_until_cycle(uint64_t target_cycle) {
+    sync_ppu();
+    while (cpu.get_cycles() < target_cycle) {
+        if (!run_slice(std::min(target_cycle, next_event_cycle()))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Runs the CPU up to target_cycle (or until something cuts it short), then
+// brings the PPU up to the same point and hands the CPU any interrupt that
+// came up. Interrupts raised from outside a slice, like by a register write
+// from the front end, are taken before it starts.
+bool Console::run_slice(uint64_t target_cycle) {
+    take_interrupts();
+    deadline = target_cycle;
+    bool running = run_cpu(target_cycle);
+    take_interrupts();
+    return running;
+}
+
+void Console::take_interrupts() {
+    sync_ppu();
+    apu.catch_up(cpu.get_cycles());
+    if (ppu.take_nmi()) {
+        cpu.nmi();
+    } else if (mapper->is_irq_asserted() || apu.is_irq_asserted()) {
+        cpu.irq();
+    }
+}
+
+uint64_t Console::next_event_cycle() {
+    return std::min(ppu.next_event_cycle(), apu.next_event_cycle());
+}
+
+bool Console::run_cpu(uint64_t target_cycle) {
+#if defined(CPU_DYNAREC)
+    return cpu.run_native_until_cycle(target_cycle);
+#else
+    return cpu.run(instruction_counter, target_cycle);
+#endif
+}
+
+// Brings the PPU up to the CPU. With the PPU on its own thread this waits for
+// the worker, which then leaves the PPU alone until it is given more to do.
+void Console::sync_ppu() {
+    if (ppu_worker != nullptr) {
+        ppu_worker->sync(cpu.get_cycles());
+    } else {
+        ppu.catch_up(cpu.get_cycles());
+    }
+}
+
+// After a register access: stop the slice if the CPU has an interrupt to
+// take, or the PPU now has something to say before the slice would end
+void Console::check_events() {
+    if (ppu.is_nmi_pending() || mapper->is_irq_asserted() ||
+        apu.is_irq_asserted() || next_event_cycle() < deadline) {
+        cpu.stop_run();
+    }
+}
+
+// The same after an APU register access. With the PPU on its own thread it
+// is left to the worker: its events only move when PPUCTRL or PPUMASK are
+// written, and those writes check them after syncing.
+void Console::check_apu_events() {
+    if (ppu_worker == nullptr) {
+        check_events();
+        return;
+    }
+    if (mapper->is_irq_asserted() || apu.is_irq_asserted() ||
+        apu.next_event_cycle() < deadline) {
+        cpu.stop_run();
+    }
+}
+
+uint8_t Console::read_ppu_register(void *context, uint16_t address) {
+    Console &console = *static_cast<Console *>(context);
+    console.sync_ppu();
+    uint8_t value = console.ppu.read_register(address);
+    console.check_events();
+    return value;
+}
+
+void Console::write_ppu_register(void *context, uint16_t address,
+                                 uint8_t data) {
+    Console &console = *static_cast<Console *>(context);
+    // only PPUCTRL and PPUMASK can raise an NMI or move the next event, the
+    // worker can take the others whenever it gets to them
+    if (console.ppu_worker != nullptr && (address & 7) >= 2) {
+        console.ppu_worker->write_register(console.cpu.get_cycles(), address,
+                                           data);
+        return;
+    }
+    console.sync_ppu();
+    console.ppu.write_register(address, data);
+    console.check_events();
+}
+
+// Only $4015 reads back anything, the rest of the page is open bus
+uint8_t Console::read_io_register(void *context, uint16_t address) {
+    Console &console = *static_cast<Console *>(context);
+    if (address != 0x4015) {
+        return 0;
+    }
+    console.apu.catch_up(console.cpu.get_cycles());
+    uint8_t value = console.apu.read_status();
+    console.check_apu_events();
+    return value;
+}
+
+void Console::write_io_register(void *context, uint16_t address,
+                                uint8_t data) {
+    Console &console = *static_cast<Console *>(context);
+    if (address <= 0x4013 || address == 0x4015 || address == 0x4017) {
+        console.apu.catch_up(console.cpu.get_cycles());
+        console.apu.write_register(address, data);
+        console.check_apu_events();
+        return;
+    }
+    if (address != 0x4014) {
+        return;
+    }
+
+    // https://www.nesdev.org/wiki/PPU_registers#OAMDMA
+    CPU &cpu = console.cpu;
+    std::array<uint8_t, 0x100> page;
+    for (int i = 0; i < 0x100; i++) {
+        page[i] = cpu.mem_read((data << 8) | i);
+    }
+    uint64_t cycle = cpu.get_cycles();
+    cpu.set_cycles(cycle + OAM_DMA_CYCLES + (cycle & 1));
+    if (console.ppu_worker != nullptr) {
+        // the console does DMA through OAMDATA too
+        for (uint8_t byte : page) {
+            console.ppu_worker->write_register(cycle, 0x2004, byte);
+        }
+        return;
+    }
+    console.ppu.catch_up(cycle);
+    console.ppu.write_oam_dma(page.data());
+    console.check_events();
+}
+
+// Draws everything up to now with the CHR and mirroring the mapper is about
+// to change
+void Console::chr_changing(void *context) {
+    Console &console = *static_cast<Console *>(context);
+    console.sync_ppu();
+    console.ppu.flush();
+}
+
+uint8_t Console::read_dmc_sample(void *context, uint16_t address) {
+    return static_cast<Console *>(context)->cpu.mem_read(address);
+}
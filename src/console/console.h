@@ -0,0 +1,102 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "apu/apu.h"
+#include "cartridge/cartridge.h"
+#include "cartridge/mapper.h"
+#include "cpu/cpu.h"
+#include "ppu/ppu.h"
+#include "ppu/ppu_worker.h"
+
+// The CPU cycles OAM DMA halts the CPU for, plus one on odd cycles
+const static uint16_t OAM_DMA_CYCLES = 513;
+
+// A whole NES: the cartridge, its mapper, the CPU, the PPU and the APU, wired
+// up the way the console does it.
+//
+// The CPU runs in slices that end where the PPU or the APU said their next
+// event is (see PPU::next_event_cycle()). After each slice both catch up and
+// the CPU takes whatever interrupt is waiting. In between, they only run when
+// the CPU touches their registers, so for most of a frame they never talk to
+// each other. A register access that raises an interrupt or moves the next
+// event earlier cuts the slice short. The APU hands its samples to the output
+// set with APU::set_output() at the end of every slice.
+//
+// Interrupts are only looked at between slices, so an IRQ the CPU could not
+// take because of the interrupt disable flag waits for the next slice.
+//
+// The PPU can also run on a thread of its own (see set_ppu_thread()). Writes
+// to $2002-$2007 and OAM DMA then only go into the worker's log, and the CPU
+// waits for the worker on reads, writes to $2000 and $2001, CHR bank
+// switches and at the end of every slice. The PPU is safe to use from the
+// outside whenever run_frame() or run_until_cycle() return.
+class Console {
+   public:
+    // Throws std::runtime_error if the file cannot be loaded or uses a mapper
+    // we do not have
+    explicit Console(const std::string &path);
+
+    Console(const Console &) = delete;
+    Console &operator=(const Console &) = delete;
+
+    // Like pressing the reset button, except that the PPU starts over too
+    void reset();
+
+    // Runs until the PPU starts the next vblank, when the frame it just drew
+    // is finished. Returns false if the CPU stopped on a BRK or an illegal
+    // opcode.
+    bool run_frame();
+
+    // Runs until the CPU reaches target_cycle, with the PPU caught up to it
+    bool run_until_cycle(uint64_t target_cycle);
+
+    // Moves the PPU onto a thread of its own, or back. Returns false, and
+    // leaves the PPU on this thread, for mappers that count scanlines.
+    bool set_ppu_thread(bool enabled);
+    bool is_ppu_threaded() { return ppu_worker != nullptr; }
+
+    // Instructions the CPU ran since the console was made. Translated code
+    // is not counted, so with CPU_DYNAREC this stays 0.
+    uint64_t get_instructions() { return instruction_counter.count; }
+
+    Cartridge &get_cartridge() { return cartridge; }
+    Mapper &get_mapper() { return *mapper; }
+    CPU &get_cpu() { return cpu; }
+    PPU &get_ppu() { return ppu; }
+    APU &get_apu() { return apu; }
+
+   private:
+    bool run_slice(uint64_t target_cycle);
+    bool run_cpu(uint64_t target_cycle);
+    void take_interrupts();
+    void check_events();
+    void check_apu_events();
+    uint64_t next_event_cycle();
+    void sync_ppu();
+
+    static void chr_changing(void *context);
+    static uint8_t read_ppu_register(void *context, uint16_t address);
+    static void write_ppu_register(void *context, uint16_t address,
+                                   uint8_t data);
+    static uint8_t read_io_register(void *context, uint16_t address);
+    static void write_io_register(void *context, uint16_t address,
+                                  uint8_t data);
+    static uint8_t read_dmc_sample(void *context, uint16_t address);
+
+    Cartridge cartridge;
+    std::unique_ptr<Mapper> mapper;
+    PPU ppu;
+    CPU cpu;
+    APU apu;
+    // only while the PPU runs on a thread of its own, declared last so it
+    // stops before anything it uses goes away
+    std::unique_ptr<PPUWorker> ppu_worker;
+
+    // where the slice the CPU is running now ends
+    uint64_t deadline;
+
+    // the hooks the CPU runs with, an increment per instruction
+    InstructionCounter instruction_counter;
+};
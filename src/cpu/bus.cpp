@@ -0,0 +1,126 @@
+#include "bus.h"
+
+Bus::Bus()
+    : remap_listener{}, observer{}, observing(false), write_map_version(0) {
+    // start from cleared memory so two CPUs running the same program always
+    // see the same bytes
+    ram.fill(0);
+    read_pages.fill(nullptr);
+    write_pages.fill(nullptr);
+    mapped_read.fill(nullptr);
+    mapped_write.fill(nullptr);
+    map_memory(0x00, 256, ram.data(), ram.size(), true);
+}
+
+void Bus::set_page(uint8_t page, const uint8_t *read, uint8_t *write,
+                   MmioHandler handler) {
+    bool changed = mapped_read[page] != read;
+    if (mapped_write[page] != write) {
+        write_map_version++;
+    }
+    mapped_read[page] = read;
+    mapped_write[page] = write;
+    handlers[page] = handler;
+    if (!observing) {
+        read_pages[page] = read;
+        write_pages[page] = write;
+    }
+    // whatever was decoded from the old bytes is stale now
+    if (changed && remap_listener.remapped != nullptr) {
+        remap_listener.remapped(remap_listener.context, page);
+    }
+}
+
+void Bus::map_memory(uint8_t first_page, uint16_t page_count,
+                     uint8_t *memory, uint32_t size, bool writable) {
+    for (uint16_t i = 0; i < page_count && first_page + i < 256; i++) {
+        uint8_t *page = memory + ((i << 8) % size);
+        set_page(first_page + i, page, writable ? page : nullptr,
+                 MmioHandler{});
+    }
+}
+
+void Bus::map_rom(uint8_t first_page, uint16_t page_count,
+                  const uint8_t *memory, uint32_t size,
+                  MmioHandler write_handler) {
+    for (uint16_t i = 0; i < page_count && first_page + i < 256; i++) {
+        set_page(first_page + i, memory + ((i << 8) % size), nullptr,
+                 write_handler);
+    }
+}
+
+void Bus::switch_rom(uint8_t first_page, uint16_t page_count,
+                     const uint8_t *memory) {
+    for (uint16_t i = 0; i < page_count && first_page + i < 256; i++) {
+        uint8_t page = first_page + i;
+        set_page(page, memory + (i << 8), nullptr, handlers[page]);
+    }
+}
+
+void Bus::map_mmio(uint8_t first_page, uint16_t page_count,
+                   MmioHandler handler) {
+    for (uint16_t i = 0; i < page_count && first_page + i < 256; i++) {
+        set_page(first_page + i, nullptr, nullptr, handler);
+    }
+}
+
+void Bus::observe(AccessObserver observer) {
+    this->observer = observer;
+    observing = true;
+    read_pages.fill(nullptr);
+    write_pages.fill(nullptr);
+}
+
+void Bus::stop_observing() {
+    observer = {};
+    observing = false;
+    read_pages = mapped_read;
+    write_pages = mapped_write;
+}
+
+uint8_t Bus::read_mmio(uint16_t address) {
+    if (observing) [[unlikely]] {
+        const uint8_t *page = mapped_read[address >> 8];
+        uint8_t value =
+            page != nullptr ? page[address & 0xFF] : read_handler(address);
+        if (observer.read != nullptr) {
+            observer.read(observer.context, address, value);
+        }
+        return value;
+    }
+    return read_handler(address);
+}
+
+void Bus::write_mmio(uint16_t address, uint8_t data) {
+    if (observing) [[unlikely]] {
+        uint8_t *page = mapped_write[address >> 8];
+        if (page != nullptr) {
+            page[address & 0xFF] = data;
+        } else {
+            write_handler(address, data);
+        }
+        if (observer.write != nullptr) {
+            observer.write(observer.context, address, data);
+        }
+        return;
+    }
+    write_handler(address, data);
+}
+
+uint8_t Bus::read_handler(uint16_t address) {
+    const MmioHandler &handler = handlers[address >> 8];
+    if (handler.read == nullptr) {
+        // nothing drives the data bus
+        return 0;
+    }
+    return handler.read(handler.context, address);
+}
+
+void Bus::write_handler(uint16_t address, uint8_t data) {
+    // writes to ROM end up here too, they are dropped unless the ROM has a
+    // write handler, like the registers of a mapper
+    const MmioHandler &handler = handlers[address >> 8];
+    if (handler.write != nullptr) {
+        handler.write(handler.context, address, data);
+    }
+}
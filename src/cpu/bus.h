@@ -0,0 +1,150 @@
+#pragma once
+#include <array>
+#include <cstdint>
+
+// Callbacks for a page that is not plain memory, like the PPU or APU
+// registers. context is passed back as is.
+struct MmioHandler {
+    uint8_t (*read)(void *context, uint16_t address);
+    void (*write)(void *context, uint16_t address, uint8_t data);
+    void *context;
+};
+
+// Told about every page that now shows different bytes than before, because
+// it was mapped somewhere else or had its bank switched
+struct RemapListener {
+    void (*remapped)(void *context, uint8_t page);
+    void *context;
+};
+
+// Told about every access while a Bus is observed, after it happened. value
+// is what was read or written.
+struct AccessObserver {
+    void (*read)(void *context, uint16_t address, uint8_t value);
+    void (*write)(void *context, uint16_t address, uint8_t value);
+    void *context;
+};
+
+// The CPU address space split into 256 pages of 256 bytes. Each page either
+// points straight at host memory, so an access is a single indirect load, or
+// goes through an MmioHandler. Mirroring and bank switching are done by
+// pointing pages at the right host memory instead of doing any arithmetic per
+// access.
+//
+// Out of the box the whole 64 KiB is mapped flat onto ram, which is what the
+// snake game and the tests expect.
+class Bus {
+   public:
+    Bus();
+
+    Bus(const Bus &) = delete;
+    Bus &operator=(const Bus &) = delete;
+
+    uint8_t read(uint16_t address) {
+        const uint8_t *page = read_pages[address >> 8];
+        if (page != nullptr) [[likely]] {
+            return page[address & 0xFF];
+        }
+        return read_mmio(address);
+    }
+
+    void write(uint16_t address, uint8_t data) {
+        uint8_t *page = write_pages[address >> 8];
+        if (page != nullptr) [[likely]] {
+            page[address & 0xFF] = data;
+            return;
+        }
+        write_mmio(address, data);
+    }
+
+    // Maps page_count pages starting at first_page onto size bytes of host
+    // memory, repeating it for as long as needed, so 2 KiB of RAM mapped over
+    // 8 KiB of pages shows up 4 times. size has to be a multiple of 256.
+    // Writes to pages that are not writable are dropped, like they would be
+    // for ROM.
+    void map_memory(uint8_t first_page, uint16_t page_count, uint8_t *memory,
+                    uint32_t size, bool writable);
+
+    // Same but read only, for ROM that cannot be written to at all like a
+    // mmapped file. Writes go to write_handler if it has a write callback,
+    // which is where mappers have their registers.
+    void map_rom(uint8_t first_page, uint16_t page_count,
+                 const uint8_t *memory, uint32_t size,
+                 MmioHandler write_handler = {});
+
+    // Bank switching: points pages mapped with map_rom() at other memory and
+    // keeps their write handler. Costs one pointer store per page.
+    void switch_rom(uint8_t first_page, uint16_t page_count,
+                    const uint8_t *memory);
+
+    // Sends every access to these pages to handler
+    void map_mmio(uint8_t first_page, uint16_t page_count,
+                  MmioHandler handler);
+
+    void set_remap_listener(RemapListener listener) {
+        remap_listener = listener;
+    }
+
+    // Reports every access to observer, for tracers. Until stop_observing()
+    // every page takes the MMIO path, which is where the observer is
+    // called, so observing is slow but costs read() and write() nothing
+    // while it is off. Mapping and bank switching work as usual meanwhile.
+    void observe(AccessObserver observer);
+    void stop_observing();
+
+    // The byte at address if it is memory, 0 for MMIO. Has no side effects
+    // and is not observed, for looking at code.
+    uint8_t peek(uint16_t address) {
+        const uint8_t *page = mapped_read[address >> 8];
+        return page != nullptr ? page[address & 0xFF] : 0;
+    }
+
+    // Whether reads from this page go straight to host memory
+    bool is_direct(uint8_t page) { return mapped_read[page] != nullptr; }
+    // Whether writes to this page go straight to host memory
+    bool is_writable(uint8_t page) { return mapped_write[page] != nullptr; }
+
+    // The host memory writes to this page go to, nullptr if they do not go
+    // straight to memory
+    uint8_t *get_write_page(uint8_t page) { return mapped_write[page]; }
+    // Goes up whenever a page starts writing to other memory, so whoever
+    // keeps track of the writable pages knows to look again. Bank switching
+    // ROM does not count.
+    uint32_t get_write_map_version() { return write_map_version; }
+
+    // The table translated code reads through. All nullptr while the bus
+    // is observed, so translated code must not run then.
+    const uint8_t *const *get_read_pages() { return read_pages.data(); }
+
+    // The 64 KiB the bus comes with, for whatever wants to map it elsewhere
+    uint8_t *get_ram() { return ram.data(); }
+
+   private:
+    void set_page(uint8_t page, const uint8_t *read, uint8_t *write,
+                  MmioHandler handler);
+
+    // kept out of line and cold so the handlers that inline read() and
+    // write() do not have to set up for a call on every access
+    [[gnu::cold, gnu::noinline]]
+    uint8_t read_mmio(uint16_t address);
+    [[gnu::cold, gnu::noinline]]
+    void write_mmio(uint16_t address, uint8_t data);
+    uint8_t read_handler(uint16_t address);
+    void write_handler(uint16_t address, uint8_t data);
+
+    // What read() and write() go through. The same as the mapped_ tables
+    // unless the bus is observed, then all nullptr.
+    std::array<const uint8_t *, 256> read_pages;
+    std::array<uint8_t *, 256> write_pages;
+    // where every page is mapped, write pages are nullptr for MMIO and read
+    // only pages, handlers tells them apart
+    std::array<const uint8_t *, 256> mapped_read;
+    std::array<uint8_t *, 256> mapped_write;
+    std::array<MmioHandler, 256> handlers;
+    RemapListener remap_listener;
+    AccessObserver observer;
+    bool observing;
+    uint32_t write_map_version;
+
+    std::array<uint8_t, 0x10000> ram;
+};
@@ -1,10 +1,28 @@
 #include "cpu.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstring>
 #include <format>
 #include <stdexcept>
+#include <utility>
 #include <vector>
 
+#include "cartridge/mapper.h"
+#include "dynarec.h"
 #include "opcode.h"
+#include "state/save_state.h"
+
+// see CPU::snapshot()
+const static uint16_t NO_STATE_SLOT = 0xFFFF;
+const static uint32_t CPU_STATE_SIZE = 16;
+// page count, then room for the page list of all 256 pages
+const static uint32_t MEMORY_STATE_HEADER_SIZE = 4 + 256;
+
+// 0 is what a SaveState nobody wrote to says
+static std::atomic<uint64_t> next_state_id{1};
 
 CPU::CPU() {
     register_a = 0;
@@ -12,18 +30,48 @@ CPU::CPU() {
     register_y = 0;
     status = 0;
     program_counter = 0;
+    cycles = 0;
+    stop_cycle = 0;
+    page_crossed = false;
+    watch_start = 0;
+    watch_size = 0;
+    dirty_chunks = 0;
+    blocks_invalidated = false;
+    dirty_pages.fill(0);
+    state_id = next_state_id++;
+    state_serial = 0;
+    update_state_layout();
+    // bank switches change code without anything writing to it
+    bus.set_remap_listener({&CPU::on_remap, this});
 }
 
+// out of line so cpu.h does not need the whole Dynarec for the unique_ptr
+CPU::~CPU() = default;
+
 // Program ROM starts at 0x8000 to 0xffff
 void CPU::load(std::vector<uint8_t> &program) {
     uint16_t starting_index = 0x0600;
     uint16_t index = starting_index;
     for (uint8_t opcode : program) {
-        memory[index] = opcode;
+        bus.write(index, opcode);
         index++;
     }
+    // we wrote straight into memory, so nothing decoded before is valid,
+    // and the next snapshot cannot count on the last one either
+    invalidate_code_caches();
+    dirty_pages.fill(~uint64_t{0});
     mem_write_u16(0xfffc, starting_index);
 }
+
+void CPU::load(Mapper &mapper) {
+    bus.map_memory(0x00, 0x20, bus.get_ram(), RAM_SIZE, true);
+    // $2000-$5FFF answer nothing, reads give 0 and writes are dropped.
+    // Console maps its PPU registers over $2000-$3FFF and its APU and I/O
+    // registers over the $4000 page, the rest stays unanswered.
+    bus.map_mmio(0x20, 0x40, MmioHandler{});
+    mapper.attach(bus);
+    invalidate_code_caches();
+}
 /* NES platform has a special mechanism to mark where the CPU should start the
 execution. Upon inserting a new cartridge, the CPU receives a special signal
 called "Reset interrupt" that instructs CPU to:
@@ -41,6 +89,30 @@ void CPU::reset() {
     status = 0b00100100;
 
     program_counter = mem_read_u16(0xfffc);
+
+    // the reset sequence itself takes 7 cycles before the first instruction
+    cycles = 7;
+}
+
+// https://www.nesdev.org/wiki/CPU_interrupts
+// Same as BRK except that the pushed status has the break flag clear, which is
+// how the handler can tell them apart
+void CPU::interrupt(uint16_t vector) {
+    stack_push_u16(program_counter);
+    stack_push((status & ~BREAK_FLAG) | ALWAYS_ONE_FLAG);
+    set_status_flag(INTERRUPT_DISABLE_FLAG);
+    program_counter = mem_read_u16(vector);
+    cycles += 7;
+}
+
+void CPU::nmi() { interrupt(0xFFFA); }
+
+bool CPU::irq() {
+    if (is_status_flag_set(INTERRUPT_DISABLE_FLAG)) {
+        return false;
+    }
+    interrupt(0xFFFE);
+    return true;
 }
 
 void CPU::load_and_run(std::vector<uint8_t> &program) {
@@ -104,10 +176,19 @@ void CPU::add_to_register_a(uint8_t value) {
 }
 
 void CPU::branch() {
-    uint8_t jump = mem_read(program_counter);
+    // the offset is signed so we can branch backwards as well
+    int8_t jump = mem_read(program_counter);
     // since the location is relative to the branch we have to increment by
     // the program counter and then 1 to start at the next instruction
-    uint8_t jump_addr = program_counter + jump + 1;
+    uint16_t next_instruction = program_counter + 1;
+    uint16_t jump_addr = next_instruction + jump;
+
+    // a taken branch costs one extra cycle, and another one if the jump
+    // lands on a different page than the next instruction
+    cycles++;
+    if ((next_instruction & 0xFF00) != (jump_addr & 0xFF00)) {
+        cycles++;
+    }
 
     program_counter = jump_addr;
 }
@@ -144,9 +225,28 @@ void CPU::update_zero_and_negative_flags(uint8_t register_to_check) {
 // We use a uint16 because memory has a length greater than uint8_t
 // We have to utilize the larger 16 bit unsigned integer to locate the value in
 // memory to read
-uint8_t CPU::mem_read(uint16_t address) { return memory[address]; }
+uint8_t CPU::mem_read(uint16_t address) { return bus.read(address); }
 
-void CPU::mem_write(uint16_t address, uint8_t data) { memory[address] = data; }
+void CPU::mem_write(uint16_t address, uint8_t data) {
+    bus.write(address, data);
+    dirty_pages[address >> 14] |= uint64_t{1} << ((address >> 8) & 63);
+
+    // addresses below the watched range wrap around to large offsets, so
+    // one compare covers both ends
+    uint16_t offset = address - watch_start;
+    if (offset < watch_size) [[unlikely]] {
+        dirty_chunks |= uint64_t{1} << (offset / WATCH_CHUNK_SIZE);
+    }
+
+    // self modifying code, forget whatever was decoded from this byte.
+    // Writes to ROM or MMIO do not change the byte, and a mapper register
+    // write that switches banks is reported by the bus on its own.
+    if (code_pages.test(address >> 8)) [[unlikely]] {
+        if (bus.is_writable(address >> 8)) {
+            invalidate_code(address);
+        }
+    }
+}
 
 // NES is written with little endian
 // LDA $8000      <=>    ad 00 80
@@ -173,6 +273,169 @@ void CPU::mem_write_u16(uint16_t pos, uint16_t data) {
     mem_write(pos + 1, higher);
 }
 
+void CPU::watch_writes(uint16_t start, uint16_t size) {
+    watch_start = start;
+    watch_size = std::min<uint16_t>(size, 64 * WATCH_CHUNK_SIZE);
+    mark_watched_dirty();
+}
+
+void CPU::mark_watched_dirty() {
+    uint16_t chunks = (watch_size + WATCH_CHUNK_SIZE - 1) / WATCH_CHUNK_SIZE;
+    dirty_chunks = chunks == 64 ? ~uint64_t{0} : (uint64_t{1} << chunks) - 1;
+}
+
+// Mirrors share their host memory, so only the first page showing a piece
+// of memory gets a slot and the mirrors use the same one
+void CPU::update_state_layout() {
+    state_layout_version = bus.get_write_map_version();
+    state_page_count = 0;
+    for (int page = 0; page < 256; page++) {
+        uint8_t *memory = bus.get_write_page(page);
+        state_slot[page] = NO_STATE_SLOT;
+        if (memory == nullptr) {
+            continue;
+        }
+        for (uint16_t slot = 0; slot < state_page_count; slot++) {
+            if (bus.get_write_page(state_pages[slot]) == memory) {
+                state_slot[page] = slot;
+                break;
+            }
+        }
+        if (state_slot[page] == NO_STATE_SLOT) {
+            state_slot[page] = state_page_count;
+            state_pages[state_page_count++] = page;
+        }
+    }
+    // slots may have moved, nothing from before can be reused
+    state_serial++;
+}
+
+// The memory section is the page count, the page list and then the pages in
+// slot order. The section lands in the same place every time this CPU
+// writes it, so a page nobody wrote to is still right from last time.
+void CPU::snapshot(SaveState &state) {
+    if (state_layout_version != bus.get_write_map_version()) {
+        update_state_layout();
+    }
+    bool only_dirty = state.owner == state_id && state.serial == state_serial;
+
+    state.begin();
+    uint8_t *registers = state.add_section(STATE_CPU, CPU_STATE_SIZE);
+    put_u16(registers, program_counter);
+    registers[2] = stack_pointer;
+    registers[3] = register_a;
+    registers[4] = register_x;
+    registers[5] = register_y;
+    registers[6] = status;
+    registers[7] = 0;
+    put_u64(registers + 8, cycles);
+
+    uint8_t *memory = state.add_section(
+        STATE_MEMORY, MEMORY_STATE_HEADER_SIZE + state_page_count * 256);
+    uint8_t *pages = memory + MEMORY_STATE_HEADER_SIZE;
+    if (only_dirty) {
+        for (int word = 0; word < 4; word++) {
+            for (uint64_t bits = dirty_pages[word]; bits != 0;
+                 bits &= bits - 1) {
+                int page = word * 64 + std::countr_zero(bits);
+                uint16_t slot = state_slot[page];
+                if (slot != NO_STATE_SLOT) {
+                    std::memcpy(pages + slot * 256, bus.get_write_page(page),
+                                256);
+                }
+            }
+        }
+    } else {
+        put_u16(memory, state_page_count);
+        put_u16(memory + 2, 0);
+        std::memcpy(memory + 4, state_pages.data(), 256);
+        for (uint16_t slot = 0; slot < state_page_count; slot++) {
+            std::memcpy(pages + slot * 256,
+                        bus.get_write_page(state_pages[slot]), 256);
+        }
+    }
+    state.end();
+
+    dirty_pages.fill(0);
+    state.owner = state_id;
+    state.serial = ++state_serial;
+}
+
+void CPU::restore(SaveState &state) {
+    state.check();
+    uint32_t size;
+    const uint8_t *registers = state.find_section(STATE_CPU, size);
+    if (registers == nullptr || size != CPU_STATE_SIZE) {
+        throw std::runtime_error("save state has no CPU");
+    }
+    const uint8_t *memory = state.find_section(STATE_MEMORY, size);
+    if (memory == nullptr || size < MEMORY_STATE_HEADER_SIZE) {
+        throw std::runtime_error("save state has no memory");
+    }
+    uint16_t page_count = get_u16(memory);
+    if (page_count > 256 ||
+        size != MEMORY_STATE_HEADER_SIZE + page_count * 256) {
+        throw std::runtime_error("save state memory is broken");
+    }
+    const uint8_t *page_list = memory + 4;
+    const uint8_t *pages = memory + MEMORY_STATE_HEADER_SIZE;
+
+    if (state_layout_version != bus.get_write_map_version()) {
+        update_state_layout();
+    }
+    // a page whose memory now comes from the state may have had code
+    // decoded from it
+    std::array<uint64_t, 4> restored = {};
+    if (state.owner == state_id && state.serial == state_serial) {
+        for (int word = 0; word < 4; word++) {
+            for (uint64_t bits = dirty_pages[word]; bits != 0;
+                 bits &= bits - 1) {
+                int page = word * 64 + std::countr_zero(bits);
+                uint16_t slot = state_slot[page];
+                if (slot != NO_STATE_SLOT) {
+                    std::memcpy(bus.get_write_page(page), pages + slot * 256,
+                                256);
+                    restored[slot >> 6] |= uint64_t{1} << (slot & 63);
+                }
+            }
+        }
+    } else {
+        for (uint16_t i = 0; i < page_count; i++) {
+            uint16_t slot = state_slot[page_list[i]];
+            if (slot == NO_STATE_SLOT) {
+                throw std::runtime_error(
+                    "save state memory does not fit the memory map");
+            }
+        }
+        for (uint16_t i = 0; i < page_count; i++) {
+            uint16_t slot = state_slot[page_list[i]];
+            std::memcpy(bus.get_write_page(page_list[i]), pages + i * 256,
+                        256);
+            restored[slot >> 6] |= uint64_t{1} << (slot & 63);
+        }
+    }
+    for (int page = 0; page < 256; page++) {
+        uint16_t slot = state_slot[page];
+        if (code_pages.test(page) && slot != NO_STATE_SLOT &&
+            (restored[slot >> 6] & (uint64_t{1} << (slot & 63)))) {
+            invalidate_code_page(page);
+        }
+    }
+
+    program_counter = get_u16(registers);
+    stack_pointer = registers[2];
+    register_a = registers[3];
+    register_x = registers[4];
+    register_y = registers[5];
+    status = registers[6];
+    cycles = get_u64(registers + 8);
+
+    mark_watched_dirty();
+    dirty_pages.fill(0);
+    state.owner = state_id;
+    state.serial = ++state_serial;
+}
+
 #include <iostream>
 void CPU::stack_push(uint8_t data) {
     uint16_t addr = STACK + stack_pointer;
@@ -201,359 +464,919 @@ uint16_t CPU::stack_pop_u16() {
     return (higher << 8) | lower;
 }
 
+// Only instructions that just read their operand pay for crossing a page.
+// Stores and read-modify-write instructions always take the extra cycle, which
+// is already part of their base cycle count in the opcode table.
+static constexpr bool adds_page_cross_cycle(Mnemonic mnemonic) {
+    switch (mnemonic) {
+        case ADC:
+        case AND:
+        case CMP:
+        case EOR:
+        case LDA:
+        case LDX:
+        case LDY:
+        case ORA:
+        case SBC:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static constexpr bool changes_program_counter(Mnemonic mnemonic) {
+    switch (mnemonic) {
+        case BCC:
+        case BCS:
+        case BEQ:
+        case BMI:
+        case BNE:
+        case BPL:
+        case BVC:
+        case BVS:
+        case JMP:
+        case JSR:
+        case RTI:
+        case RTS:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool is_page_crossed(uint16_t base, uint16_t addr) {
+    return (base & 0xFF00) != (addr & 0xFF00);
+}
+
+// The addressing mode is a template parameter so the table core can resolve it
+// at compile time, get_operand_address() below is the runtime version the
+// switch core uses.
+template <AddressingMode A>
+uint16_t CPU::operand_address() {
+    return resolve_address<A>(read_operand<A>());
+}
+
+// The raw operand bytes that follow the opcode, which is everything the decode
+// cache needs to keep to resolve the address again later.
+template <AddressingMode A>
+uint16_t CPU::read_operand() {
+    if constexpr (A == IMMEDIATE || A == RELATIVE) {
+        // these use the address of the operand itself
+        return 0;
+    } else if constexpr (bytes_for_mode(A) == 3) {
+        return mem_read_u16(program_counter);
+    } else if constexpr (bytes_for_mode(A) == 2) {
+        return mem_read(program_counter);
+    } else {
+        return 0;
+    }
+}
+
+template <AddressingMode A>
+uint16_t CPU::resolve_address(uint16_t operand) {
+    page_crossed = false;
+    if constexpr (A == IMMEDIATE) {
+        return program_counter;
+    } else if constexpr (A == ZEROPAGE) {
+        return operand;
+    } else if constexpr (A == ABSOLUTE) {
+        return operand;
+    } else if constexpr (A == ZEROPAGE_X) {
+        uint8_t pos = operand;
+        return pos + register_x;
+    } else if constexpr (A == ZEROPAGE_Y) {
+        uint8_t pos = operand;
+        return pos + register_y;
+    } else if constexpr (A == ABSOLUTE_X) {
+        uint16_t pos = operand;
+        uint16_t addr = pos + register_x;
+        page_crossed = is_page_crossed(pos, addr);
+        return addr;
+    } else if constexpr (A == ABSOLUTE_Y) {
+        uint16_t pos = operand;
+        uint16_t addr = pos + register_y;
+        page_crossed = is_page_crossed(pos, addr);
+        return addr;
+    } else if constexpr (A == INDIRECT) {
+        // JMP is the only instruction with INDIRECT addressing mode
+        // https://www.nesdev.org/obelisk-6502-guide/reference.html#JMP
+        uint16_t addr = operand;
+
+        uint16_t result = 0;
+        // bug in 6502 processors - see link above for more information
+        if ((addr & 0x00FF) == 0x00FF) {
+            uint16_t lower = mem_read(addr);
+            uint16_t higher = mem_read(addr & 0xFF00);
+            result = (higher << 8) | lower;
+        } else {
+            result = mem_read_u16(addr);
+        }
+
+        return result;
+    } else if constexpr (A == INDIRECT_X) {
+        // https://skilldrick.github.io/easy6502/#indexed-indirect-c0x
+        uint8_t pos = operand;
+        uint8_t addr = pos + register_x;
+        uint16_t lower = mem_read(addr);
+        uint16_t higher = mem_read(addr + 1);
+        return (higher << 8) | lower;
+    } else if constexpr (A == INDIRECT_Y) {
+        // https://skilldrick.github.io/easy6502/#indirect-indexed-c0y
+        uint8_t pos = operand;
+        uint16_t lower = mem_read(pos);
+        uint16_t higher = mem_read(pos + 1);
+        uint16_t final_addr = (higher << 8) | lower;
+        uint16_t addr = final_addr + register_y;
+        page_crossed = is_page_crossed(final_addr, addr);
+        return addr;
+    } else if constexpr (A == RELATIVE) {
+        // branch() reads the offset itself
+        return program_counter;
+    } else {
+        // does not need an address if it is implied or accumulator
+        return 0;
+    }
+}
+
 uint16_t CPU::get_operand_address(AddressingMode &mode) {
     switch (mode) {
         case IMMEDIATE:
-            return program_counter;
+            return operand_address<IMMEDIATE>();
         case ZEROPAGE:
-            return mem_read(program_counter);
+            return operand_address<ZEROPAGE>();
         case ABSOLUTE:
-            return mem_read_u16(program_counter);
-        case ZEROPAGE_X: {
-            uint8_t pos = mem_read(program_counter);
-            return pos + register_x;
+            return operand_address<ABSOLUTE>();
+        case ZEROPAGE_X:
+            return operand_address<ZEROPAGE_X>();
+        case ZEROPAGE_Y:
+            return operand_address<ZEROPAGE_Y>();
+        case ABSOLUTE_X:
+            return operand_address<ABSOLUTE_X>();
+        case ABSOLUTE_Y:
+            return operand_address<ABSOLUTE_Y>();
+        case INDIRECT:
+            return operand_address<INDIRECT>();
+        case INDIRECT_X:
+            return operand_address<INDIRECT_X>();
+        case INDIRECT_Y:
+            return operand_address<INDIRECT_Y>();
+        case RELATIVE:
+            return operand_address<RELATIVE>();
+        case ACCUMULATOR:
+        case IMPLIED:
+        default:
+            return operand_address<IMPLIED>();
+    }
+}
+
+void CPU::run() {
+#if defined(CPU_DYNAREC)
+    run_native_until_cycle(UINT64_MAX);
+#else
+    NoHooks hooks;
+    run(hooks);
+#endif
+}
+
+void CPU::run_with_callback(void (*callback_function)(CPU &)) {
+    struct CallbackHooks {
+        void (*callback_function)(CPU &);
+        void instruction(CPU &cpu) { callback_function(cpu); }
+    } hooks{callback_function};
+    run(hooks);
+}
+
+bool CPU::run_until_cycle(uint64_t target_cycle) {
+    stop_cycle = target_cycle;
+    while (cycles < stop_cycle) {
+        if (!step()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CPU::run_for_cycles(uint64_t budget) {
+    return run_until_cycle(cycles + budget);
+}
+
+bool CPU::step() {
+#if defined(CPU_DECODE_CACHE)
+    return step_cached();
+#elif defined(CPU_TABLE_DISPATCH)
+    return step_table();
+#else
+    return step_switch();
+#endif
+}
+
+bool CPU::step_switch() {
+    uint8_t hex_code = mem_read(program_counter);
+    program_counter++;
+    uint16_t old_program_counter = program_counter;
+
+    OpCode opcode = opcodes[hex_code];
+    uint16_t addr = get_operand_address(opcode.mode);
+
+    cycles += opcode.cycles;
+    if (page_crossed && adds_page_cross_cycle(opcode.mnemonic)) {
+        cycles++;
+    }
+
+    if (!execute(opcode.mnemonic, addr)) {
+        return false;
+    }
+
+    // If the program counter has not been updated by the instruction
+    // then we need to update it manually
+    if (old_program_counter == program_counter) {
+        program_counter += opcode.bytes - 1;
+    }
+
+    return true;
+}
+
+// The handlers are plain functions rather than member functions. Calling
+// through a member function pointer adjusts `this` by an offset loaded from the
+// table, which puts that load in front of every register and memory access the
+// handler makes and made this core slower than the switch.
+template <uint8_t Code>
+bool CPU::handle(CPU &cpu) {
+    constexpr OpCode opcode = opcodes[Code];
+    cpu.program_counter++;
+    uint16_t operand = cpu.read_operand<opcode.mode>();
+    return cpu.run_opcode<opcode.mnemonic, opcode.mode, opcode.bytes,
+                          opcode.cycles>(operand);
+}
+
+// Same as handle() but with the operand bytes already read by decode()
+template <uint8_t Code>
+bool CPU::handle_decoded(CPU &cpu, uint16_t operand) {
+    constexpr OpCode opcode = opcodes[Code];
+    cpu.program_counter++;
+    return cpu.run_opcode<opcode.mnemonic, opcode.mode, opcode.bytes,
+                          opcode.cycles>(operand);
+}
+
+// Each handler fuses the operand fetch for its addressing mode with the switch
+// in execute() for its mnemonic. Both are known at compile time, so after
+// inlining there is no mode switch and no mnemonic switch left, only the code
+// for this one opcode.
+template <Mnemonic M, AddressingMode A, uint8_t Bytes, uint8_t Cycles>
+bool CPU::run_opcode(uint16_t operand) {
+    uint16_t old_program_counter = program_counter;
+
+    uint16_t addr = resolve_address<A>(operand);
+
+    cycles += Cycles;
+    if constexpr (adds_page_cross_cycle(M)) {
+        if (page_crossed) {
+            cycles++;
         }
-        case ZEROPAGE_Y: {
-            uint8_t pos = mem_read(program_counter);
-            return pos + register_y;
+    }
+
+    if (!execute(M, addr)) {
+        return false;
+    }
+
+    // Only jumps, branches and returns can move the program counter
+    // themselves, everything else just steps over its operand
+    if (!changes_program_counter(M) ||
+        old_program_counter == program_counter) {
+        program_counter += Bytes - 1;
+    }
+
+    return true;
+}
+
+template <size_t... Code>
+static constexpr std::array<CPU::Handler, 256> make_dispatch_table(
+    std::index_sequence<Code...>) {
+    return {&CPU::handle<Code>...};
+}
+
+// Maps every opcode byte straight to the handler generated for it from the
+// opcode table, ILLEGAL bytes included.
+static constexpr std::array<CPU::Handler, 256> dispatch_table =
+    make_dispatch_table(std::make_index_sequence<256>());
+
+template <size_t... Code>
+static constexpr std::array<CPU::DecodedHandler, 256>
+make_decoded_dispatch_table(std::index_sequence<Code...>) {
+    return {&CPU::handle_decoded<Code>...};
+}
+
+static constexpr std::array<CPU::DecodedHandler, 256> decoded_dispatch_table =
+    make_decoded_dispatch_table(std::make_index_sequence<256>());
+
+bool CPU::step_table() {
+    return dispatch_table[mem_read(program_counter)](*this);
+}
+
+// Runs the instruction at the program counter straight from the decode cache,
+// decoding it first if this is the first time we see it (or it was written
+// to since).
+bool CPU::step_cached() {
+    if (decode_cache.empty()) [[unlikely]] {
+        // 64 KiB worth of entries, so only pay for it when this core is used
+        decode_cache.resize(0x10000);
+    }
+
+    DecodedInstruction &instruction = decode_cache[program_counter];
+    if (instruction.handler == nullptr) [[unlikely]] {
+        decode(program_counter, instruction);
+    }
+    return instruction.handler(*this, instruction.operand);
+}
+
+// Code is decoded ahead of running it, and a block even looks at the
+// instruction after its own, so it is read with peek() to keep MMIO handlers
+// and observers from seeing reads the program never made. Code on an MMIO
+// page has nothing to peek at and is read for real.
+uint8_t CPU::peek_code(uint16_t address) {
+    return bus.is_direct(address >> 8) ? bus.peek(address) : mem_read(address);
+}
+
+// Returns the opcode, which the block builder needs too
+const OpCode &CPU::decode(uint16_t address, DecodedInstruction &instruction) {
+    const OpCode &opcode = opcodes[peek_code(address)];
+
+    uint16_t operand = 0;
+    if (opcode.bytes == 3) {
+        operand = peek_code(address + 1) | (peek_code(address + 2) << 8);
+    } else if (opcode.bytes == 2) {
+        operand = peek_code(address + 1);
+    }
+
+    instruction.handler = decoded_dispatch_table[opcode.opcode];
+    instruction.operand = operand;
+    instruction.bytes = opcode.bytes;
+    instruction.mode = opcode.mode;
+
+    // any write to these pages from now on has to check the cache
+    code_pages.set(address >> 8);
+    code_pages.set(static_cast<uint16_t>(address + opcode.bytes - 1) >> 8);
+    return opcode;
+}
+
+// An instruction is at most 3 bytes, so the only entries that can contain
+// this byte start at it or at one of the two bytes before it.
+void CPU::invalidate_decoded(uint16_t address) {
+    for (uint16_t i = 0; i < 3; i++) {
+        decode_cache[static_cast<uint16_t>(address - i)].handler = nullptr;
+    }
+}
+
+// Something wrote to a page we have run code from
+void CPU::invalidate_code(uint16_t address) {
+    if (!decode_cache.empty()) {
+        invalidate_decoded(address);
+    }
+    invalidate_blocks(address >> 8);
+    if (dynarec) {
+        dynarec->invalidate_page(address >> 8, true);
+    }
+}
+
+// The whole page changed at once, which only happens when the bus maps
+// something else there
+void CPU::invalidate_code_page(uint8_t page) {
+    if (!code_pages.test(page)) {
+        return;
+    }
+    if (!decode_cache.empty()) {
+        // instructions starting up to two bytes before the page run into it
+        for (int i = -2; i < 0x100; i++) {
+            decode_cache[static_cast<uint16_t>((page << 8) + i)].handler =
+                nullptr;
         }
-        case ABSOLUTE_X: {
-            uint16_t pos = mem_read_u16(program_counter);
-            return pos + register_x;
+    }
+    invalidate_blocks(page);
+    if (dynarec) {
+        dynarec->invalidate_page(page, false);
+    }
+}
+
+void CPU::on_remap(void *context, uint8_t page) {
+    static_cast<CPU *>(context)->invalidate_code_page(page);
+}
+
+void CPU::invalidate_code_caches() {
+    for (int page = 0; page < 256; page++) {
+        if (code_pages.test(page) && !decode_cache.empty()) {
+            std::fill_n(decode_cache.begin() + (page << 8), 0x100,
+                        DecodedInstruction{});
         }
-        case ABSOLUTE_Y: {
-            uint16_t pos = mem_read_u16(program_counter);
-            return pos + register_y;
+    }
+    code_pages.reset();
+    clear_blocks();
+    if (dynarec) {
+        dynarec->clear();
+    }
+}
+
+// Pairs of opcodes that show up back to back in hot loops. Each pair gets a
+// superinstruction, a single handler running both, so the block only
+// dispatches once for the two of them.
+static constexpr std::array<std::array<uint8_t, 2>, 15> superinstructions = {{
+    {0xCA, 0xD0},  // DEX; BNE
+    {0x88, 0xD0},  // DEY; BNE
+    {0xE8, 0xD0},  // INX; BNE
+    {0xC8, 0xD0},  // INY; BNE
+    {0xEA, 0xEA},  // NOP; NOP
+    {0xA9, 0x85},  // LDA #; STA zp
+    {0xA5, 0x85},  // LDA zp; STA zp
+    {0xA9, 0x8D},  // LDA #; STA abs
+    {0xB5, 0x95},  // LDA zp,X; STA zp,X
+    {0xC9, 0xF0},  // CMP #; BEQ
+    {0xC9, 0xD0},  // CMP #; BNE
+    {0xC5, 0xF0},  // CMP zp; BEQ
+    {0xC5, 0xD0},  // CMP zp; BNE
+    {0xE4, 0xF0},  // CPX zp; BEQ
+    {0xE0, 0xD0},  // CPX #; BNE
+}};
+
+template <uint8_t Code>
+bool CPU::handle_block_op(CPU &cpu, const BlockOp &op) {
+    return handle_decoded<Code>(cpu, op.operand);
+}
+
+template <uint8_t First, uint8_t Second>
+bool CPU::handle_superinstruction(CPU &cpu, const BlockOp &op) {
+    return handle_decoded<First>(cpu, op.operand) &&
+           handle_decoded<Second>(cpu, op.second_operand);
+}
+
+template <size_t... Code>
+static constexpr std::array<CPU::BlockHandler, 256> make_block_op_table(
+    std::index_sequence<Code...>) {
+    return {&CPU::handle_block_op<Code>...};
+}
+
+static constexpr std::array<CPU::BlockHandler, 256> block_op_table =
+    make_block_op_table(std::make_index_sequence<256>());
+
+template <size_t... I>
+static constexpr std::array<CPU::BlockHandler, sizeof...(I)>
+make_superinstruction_table(std::index_sequence<I...>) {
+    return {&CPU::handle_superinstruction<superinstructions[I][0],
+                                          superinstructions[I][1]>...};
+}
+
+static constexpr auto superinstruction_table = make_superinstruction_table(
+    std::make_index_sequence<superinstructions.size()>());
+
+static CPU::BlockHandler find_superinstruction(uint8_t first, uint8_t second) {
+    for (size_t i = 0; i < superinstructions.size(); i++) {
+        if (superinstructions[i][0] == first &&
+            superinstructions[i][1] == second) {
+            return superinstruction_table[i];
         }
-        case INDIRECT: {
-            // JMP is the only instruction with INDIRECT addressing mode
-            // https://www.nesdev.org/obelisk-6502-guide/reference.html#JMP
-            uint16_t addr = mem_read_u16(program_counter);
-
-            uint16_t result = 0;
-            // bug in 6502 processors - see link above for more information
-            if ((addr & 0x00FF) == 0x00FF) {
-                uint16_t lower = mem_read(addr);
-                uint16_t higher = mem_read(addr & 0xFF00);
-                result = (higher << 8) | lower;
-            } else {
-                result = mem_read_u16(addr);
-            }
+    }
+    return nullptr;
+}
+
+// A block ends at anything that can move the program counter somewhere other
+// than the next instruction, or that stops the CPU.
+static bool ends_block(const OpCode &opcode) {
+    return changes_program_counter(opcode.mnemonic) ||
+           opcode.mnemonic == BRK || opcode.mnemonic == ILLEGAL;
+}
+
+// Decodes the straight line code starting at address, up to and including
+// the first instruction that ends the block.
+uint32_t CPU::build_block(uint16_t address) {
+    if (blocks.size() >= MAX_BLOCKS) {
+        clear_blocks();
+    }
+
+    Block block;
+    block.start = address;
+
+    uint16_t pc = address;
+    while (true) {
+        DecodedInstruction first;
+        const OpCode &opcode = decode(pc, first);
+        uint16_t next = pc + first.bytes;
+
+        BlockOp op{block_op_table[opcode.opcode], first.operand, 0};
+        bool last = ends_block(opcode) ||
+                    block.ops.size() + 1 >= MAX_BLOCK_LENGTH;
 
-            return result;
+        // try to fuse this instruction with the one after it, which is not
+        // even looked at past the end of the block. An MMIO page peeks as 0,
+        // a BRK, which fuses with nothing.
+        BlockHandler fused =
+            last ? nullptr
+                 : find_superinstruction(opcode.opcode, bus.peek(next));
+        if (fused != nullptr) {
+            DecodedInstruction second;
+            const OpCode &next_opcode = decode(next, second);
+            op = {fused, first.operand, second.operand};
+            last = ends_block(next_opcode);
+            next += second.bytes;
         }
-        case INDIRECT_X: {
-            // https://skilldrick.github.io/easy6502/#indexed-indirect-c0x
-            uint8_t pos = mem_read(program_counter);
-            uint8_t addr = pos + register_x;
-            uint16_t lower = mem_read(addr);
-            uint16_t higher = mem_read(addr + 1);
-            return (higher << 8) | lower;
+
+        block.ops.push_back(op);
+        if (last) {
+            block.end = next - 1;
+            break;
         }
-        case INDIRECT_Y: {
-            // https://skilldrick.github.io/easy6502/#indirect-indexed-c0y
-            uint8_t pos = mem_read(program_counter);
-            uint16_t lower = mem_read(pos);
-            uint16_t higher = mem_read(pos + 1);
-            uint16_t final_addr = (higher << 8) | lower;
-            return final_addr + register_y;
+        pc = next;
+    }
+
+    uint32_t index = blocks.size();
+    blocks.push_back(std::move(block));
+    block_at[address] = index;
+
+    // the block may run over into the next page
+    const Block &added = blocks.back();
+    blocks_in_page[added.start >> 8].push_back(index);
+    if ((added.end >> 8) != (added.start >> 8)) {
+        blocks_in_page[added.end >> 8].push_back(index);
+    }
+    return index;
+}
+
+void CPU::invalidate_blocks(uint8_t page) {
+    for (uint32_t index : blocks_in_page[page]) {
+        // only unlink the block, it may be the one running right now so its
+        // ops have to stay alive until the next clear_blocks()
+        if (block_at[blocks[index].start] == static_cast<int32_t>(index)) {
+            block_at[blocks[index].start] = -1;
         }
-        // does not need an address if it is implied or accumulator
-        case ACCUMULATOR:
-        case IMPLIED:
-            return 0;
+    }
+    if (!blocks_in_page[page].empty()) {
+        blocks_in_page[page].clear();
+        blocks_invalidated = true;
     }
 }
 
-void CPU::run() {
-    run_with_callback([](CPU &cpu) {});
+void CPU::clear_blocks() {
+    // cheaper than filling all of block_at when there are only a few blocks
+    for (const Block &block : blocks) {
+        block_at[block.start] = -1;
+    }
+    blocks.clear();
+    for (auto &page : blocks_in_page) {
+        page.clear();
+    }
 }
 
-void CPU::run_with_callback(void (*callback_function)(CPU &)) {
-    while (1) {
-        callback_function(*this);
-
-        uint8_t hex_code = mem_read(program_counter);
-        program_counter++;
-        uint16_t old_program_counter = program_counter;
-
-        OpCode opcode = opcodes[hex_code];
-        uint16_t addr = get_operand_address(opcode.mode);
-
-        switch (opcode.mnemonic) {
-            case ADC: {
-                auto value = mem_read(addr);
-                add_to_register_a(value);
-            } break;
-            case AND: {
-                auto value = mem_read(addr);
-                set_register_a(register_a & value);
-            } break;
-            case ASL_accumulator:
-                set_status_flag_bit(CARRY_FLAG, (register_a >> 7) == 1);
-                set_register_a(register_a << 1);
-                break;
-            case ASL: {
-                auto value = mem_read(addr);
-
-                set_status_flag_bit(CARRY_FLAG, (value >> 7) == 1);
-
-                value <<= 1;
-                mem_write(addr, value);
-                update_zero_and_negative_flags(value);
-            } break;
-            case BCC:
-                if (!is_status_flag_set(CARRY_FLAG)) {
-                    branch();
-                }
-                break;
-            case BCS:
-                if (is_status_flag_set(CARRY_FLAG)) {
-                    branch();
-                }
-                break;
-            case BEQ:
-                if (is_status_flag_set(ZERO_FLAG)) {
-                    branch();
-                }
-                break;
-            case BIT: {
-                auto value = mem_read(addr);
-
-                set_status_flag_bit(ZERO_FLAG, (register_a & value) == 0);
-
-                //  Bits 7 and 6 of the value from memory are copied into the N
-                //  and V flags.
-                set_status_flag_bit(NEGATIVE_FLAG, (value >> 7) & 1);
-                set_status_flag_bit(OVERFLOW_FLAG, (value >> 6) & 1);
-            } break;
-            case BMI:
-                if (is_status_flag_set(NEGATIVE_FLAG)) {
-                    branch();
-                }
-                break;
-            case BNE:
-                if (!is_status_flag_set(ZERO_FLAG)) {
-                    branch();
-                }
-                break;
-            case BPL:
-                if (!is_status_flag_set(NEGATIVE_FLAG)) {
-                    branch();
-                }
-                break;
-            case BVC:
-                if (!is_status_flag_set(OVERFLOW_FLAG)) {
-                    branch();
-                }
-                break;
+bool CPU::run_blocks_until_cycle(uint64_t target_cycle) {
+    if (block_at.empty()) [[unlikely]] {
+        block_at.assign(0x10000, -1);
+    }
 
-            case BVS:
-                if (is_status_flag_set(OVERFLOW_FLAG)) {
-                    branch();
-                }
-                break;
-            case CLC:
-                clear_status_flag(CARRY_FLAG);
-                break;
-            case CLD:
-                clear_status_flag(DECIMAL_MODE_FLAG);
-                break;
+    stop_cycle = target_cycle;
+    while (cycles < stop_cycle) {
+        if (!run_next_block()) {
+            return false;
+        }
+    }
+    return true;
+}
 
-            case CLI:
-                clear_status_flag(INTERRUPT_DISABLE_FLAG);
-                break;
-            case CLV:
-                clear_status_flag(OVERFLOW_FLAG);
-                break;
-            case CMP:
-                compare(addr, register_a);
-                break;
-            case CPX:
-                compare(addr, register_x);
-                break;
-            case CPY:
-                compare(addr, register_y);
-                break;
-            case DEC: {
-                auto value = mem_read(addr);
-                value--;
-                mem_write(addr, value);
-                update_zero_and_negative_flags(value);
-            } break;
-            case DEX:
-                register_x--;
-                update_zero_and_negative_flags(register_x);
-                break;
-            case DEY:
-                register_y--;
-                update_zero_and_negative_flags(register_y);
-                break;
-            case EOR: {
-                // NOTE: different than Jakes but logic is same?
-                auto value = mem_read(addr);
-                register_a ^= value;
-                update_zero_and_negative_flags(register_a);
-            } break;
-            case INC: {
-                auto value = mem_read(addr);
-                value++;
-                mem_write(addr, value);
-                update_zero_and_negative_flags(value);
-            } break;
-            case INX:
-                register_x++;
-                update_zero_and_negative_flags(register_x);
-                break;
-            case INY:
-                register_y++;
-                update_zero_and_negative_flags(register_y);
-                break;
-            case JMP:
-                program_counter = addr;
-                break;
-            case JSR:
-                // The JSR instruction pushes the address (minus one) of the
-                // return point on to the stack and then sets the program
-                // counter to the target memory address.
-                stack_push_u16(program_counter + 2 - 1);
-                program_counter = addr;
-                break;
-            case LDA: {
-                auto value = mem_read(addr);
-                set_register_a(value);
-            } break;
-            case LDX: {
-                auto value = mem_read(addr);
-                set_register_x(value);
-            } break;
-            case LDY: {
-                auto value = mem_read(addr);
-                set_register_y(addr);
-            } break;
-            case LSR_accumulator:
-                set_status_flag_bit(CARRY_FLAG, register_a & 1);
-                set_register_a(register_a >> 1);
-                break;
-            case LSR: {
-                auto value = mem_read(addr);
-                set_status_flag_bit(CARRY_FLAG, value & 1);
-                value >>= 1;
-                mem_write(addr, value);
-                update_zero_and_negative_flags(value);
-            } break;
-            case NOP:
-                // do nothing :)
-                break;
-            case ORA: {
-                auto value = mem_read(addr);
-                set_register_a(register_a | value);
-            } break;
-            case PHA:
-                stack_push(register_a);
-                break;
-            case PHP: {
-                uint8_t status_clone = status;
-                status_clone |= BREAK_FLAG;
-                status_clone |= ALWAYS_ONE_FLAG;
-                stack_push(status_clone);
-            } break;
-            case PLA: {
-                uint8_t accumulator = stack_pop();
-                set_register_a(accumulator);
-            } break;
-            case PLP: {
-                uint8_t processor_status = stack_pop();
-                processor_status &= ~BREAK_FLAG;
-                processor_status |= ALWAYS_ONE_FLAG;
-                status = processor_status;
-            } break;
-            case ROL_accumulator: {
-                uint8_t result = (register_a << 1) | is_status_flag_set(CARRY_FLAG);
-                set_status_flag_bit(CARRY_FLAG, (register_a >> 7) == 1);
-                set_register_a(result);
-            } break;
-            case ROL: {
-                auto data = mem_read(addr);
-                uint8_t result = (data << 1) | is_status_flag_set(CARRY_FLAG);
-                mem_write(addr, result);
-                set_status_flag_bit(CARRY_FLAG, (data >> 7) == 1);
-                update_zero_and_negative_flags(result);
-            } break;
-            case ROR_accumulator: {
-                uint8_t carry = is_status_flag_set(CARRY_FLAG);
-                uint8_t result = (register_a >> 1) | (carry << 7);
-                set_status_flag_bit(CARRY_FLAG, (register_a & 1) == 1);
-                set_register_a(result);
-            } break;
-            case ROR: {
-                auto data = mem_read(addr);
-                uint8_t carry = is_status_flag_set(CARRY_FLAG);
-                uint8_t result = (data << 1) | (carry << 7);
-                mem_write(addr, result);
-                set_status_flag_bit(CARRY_FLAG, (data & 1) == 1);
-                update_zero_and_negative_flags(result);
-            } break;
-            case RTI:
-                status = stack_pop();
-                clear_status_flag(BREAK_FLAG);
-                set_status_flag(ALWAYS_ONE_FLAG);
-
-                program_counter = stack_pop_u16();
-                break;
-            case RTS:
-                program_counter = stack_pop_u16() + 1;
-                break;
-            case SBC: {
-                auto value = mem_read(addr);
-                add_to_register_a((-value) - 1);
-            } break;
-            case SEC:
-                set_status_flag(CARRY_FLAG);
-                break;
-            case SED:
-                set_status_flag(DECIMAL_MODE_FLAG);
-                break;
-            case SEI:
-                set_status_flag(INTERRUPT_DISABLE_FLAG);
-                break;
-            case STA:
-                mem_write(addr, register_a);
-                break;
-            case STX:
-                mem_write(addr, register_x);
-                break;
-            case STY:
-                mem_write(addr, register_y);
-                break;
-            case TAX:
-                set_register_x(register_a);
-                break;
-            case TAY:
-                set_register_y(register_a);
-                break;
-            case TSX:
-                set_register_x(stack_pointer);
-                break;
-            case TXA:
-                set_register_a(register_x);
-                break;
-            case TXS:
-                stack_pointer = register_x;
-                break;
-            case TYA:
-                set_register_a(register_y);
-                break;
-            case BRK:
-                set_status_flag(BREAK_FLAG);
-                return;
-                break;
+// Runs the block at the program counter, building it first if needed.
+// Returns false if it stopped on a BRK.
+bool CPU::run_next_block() {
+    int32_t index = block_at[program_counter];
+    if (index < 0) [[unlikely]] {
+        index = build_block(program_counter);
+    }
+
+    blocks_invalidated = false;
+    for (const BlockOp &op : blocks[index].ops) {
+        if (!op.handler(*this, op)) {
+            return false;
         }
+        // the block just wrote over code, possibly its own, so pick up
+        // again from a fresh lookup
+        if (blocks_invalidated) [[unlikely]] {
+            break;
+        }
+    }
+    return true;
+}
 
-        // If the program counter has not been updated by the instruction
-        // then we need to update it manually
-        if (old_program_counter == program_counter) {
-            program_counter += opcode.bytes - 1;
+Dynarec &CPU::get_dynarec() {
+    if (!dynarec) {
+        dynarec = std::make_unique<Dynarec>();
+    }
+    return *dynarec;
+}
+
+bool CPU::run_native_until_cycle(uint64_t target_cycle) {
+    if (block_at.empty()) [[unlikely]] {
+        block_at.assign(0x10000, -1);
+    }
+    Dynarec &translator = get_dynarec();
+
+    NativeState state;
+    state.read_pages = bus.get_read_pages();
+    state.cpu = this;
+    stop_cycle = target_cycle;
+    while (cycles < stop_cycle) {
+        NativeBlock native = translator.lookup(*this, program_counter);
+        if (native == nullptr) {
+            if (!run_next_block()) {
+                return false;
+            }
+            continue;
         }
+
+        state.cycles = cycles;
+        state.target_cycle = stop_cycle;
+        state.program_counter = program_counter;
+        state.register_a = register_a;
+        state.register_x = register_x;
+        state.register_y = register_y;
+        state.status = status;
+        native(&state);
+        cycles = state.cycles;
+        program_counter = state.program_counter;
+        register_a = state.register_a;
+        register_x = state.register_x;
+        register_y = state.register_y;
+        status = state.status;
+    }
+    return true;
+}
+
+bool CPU::execute(Mnemonic mnemonic, uint16_t addr) {
+    switch (mnemonic) {
+        case ADC: {
+            auto value = mem_read(addr);
+            add_to_register_a(value);
+        } break;
+        case AND: {
+            auto value = mem_read(addr);
+            set_register_a(register_a & value);
+        } break;
+        case ASL_accumulator:
+            set_status_flag_bit(CARRY_FLAG, (register_a >> 7) == 1);
+            set_register_a(register_a << 1);
+            break;
+        case ASL: {
+            auto value = mem_read(addr);
+
+            set_status_flag_bit(CARRY_FLAG, (value >> 7) == 1);
+
+            value <<= 1;
+            mem_write(addr, value);
+            update_zero_and_negative_flags(value);
+        } break;
+        case BCC:
+            if (!is_status_flag_set(CARRY_FLAG)) {
+                branch();
+            }
+            break;
+        case BCS:
+            if (is_status_flag_set(CARRY_FLAG)) {
+                branch();
+            }
+            break;
+        case BEQ:
+            if (is_status_flag_set(ZERO_FLAG)) {
+                branch();
+            }
+            break;
+        case BIT: {
+            auto value = mem_read(addr);
+
+            set_status_flag_bit(ZERO_FLAG, (register_a & value) == 0);
+
+            //  Bits 7 and 6 of the value from memory are copied into the N
+            //  and V flags.
+            set_status_flag_bit(NEGATIVE_FLAG, (value >> 7) & 1);
+            set_status_flag_bit(OVERFLOW_FLAG, (value >> 6) & 1);
+        } break;
+        case BMI:
+            if (is_status_flag_set(NEGATIVE_FLAG)) {
+                branch();
+            }
+            break;
+        case BNE:
+            if (!is_status_flag_set(ZERO_FLAG)) {
+                branch();
+            }
+            break;
+        case BPL:
+            if (!is_status_flag_set(NEGATIVE_FLAG)) {
+                branch();
+            }
+            break;
+        case BVC:
+            if (!is_status_flag_set(OVERFLOW_FLAG)) {
+                branch();
+            }
+            break;
+
+        case BVS:
+            if (is_status_flag_set(OVERFLOW_FLAG)) {
+                branch();
+            }
+            break;
+        case CLC:
+            clear_status_flag(CARRY_FLAG);
+            break;
+        case CLD:
+            clear_status_flag(DECIMAL_MODE_FLAG);
+            break;
+
+        case CLI:
+            clear_status_flag(INTERRUPT_DISABLE_FLAG);
+            break;
+        case CLV:
+            clear_status_flag(OVERFLOW_FLAG);
+            break;
+        case CMP:
+            compare(addr, register_a);
+            break;
+        case CPX:
+            compare(addr, register_x);
+            break;
+        case CPY:
+            compare(addr, register_y);
+            break;
+        case DEC: {
+            auto value = mem_read(addr);
+            value--;
+            mem_write(addr, value);
+            update_zero_and_negative_flags(value);
+        } break;
+        case DEX:
+            register_x--;
+            update_zero_and_negative_flags(register_x);
+            break;
+        case DEY:
+            register_y--;
+            update_zero_and_negative_flags(register_y);
+            break;
+        case EOR: {
+            // NOTE: different than Jakes but logic is same?
+            auto value = mem_read(addr);
+            register_a ^= value;
+            update_zero_and_negative_flags(register_a);
+        } break;
+        case INC: {
+            auto value = mem_read(addr);
+            value++;
+            mem_write(addr, value);
+            update_zero_and_negative_flags(value);
+        } break;
+        case INX:
+            register_x++;
+            update_zero_and_negative_flags(register_x);
+            break;
+        case INY:
+            register_y++;
+            update_zero_and_negative_flags(register_y);
+            break;
+        case JMP:
+            program_counter = addr;
+            break;
+        case JSR:
+            // The JSR instruction pushes the address (minus one) of the
+            // return point on to the stack and then sets the program
+            // counter to the target memory address.
+            stack_push_u16(program_counter + 2 - 1);
+            program_counter = addr;
+            break;
+        case LDA: {
+            auto value = mem_read(addr);
+            set_register_a(value);
+        } break;
+        case LDX: {
+            auto value = mem_read(addr);
+            set_register_x(value);
+        } break;
+        case LDY: {
+            auto value = mem_read(addr);
+            set_register_y(value);
+        } break;
+        case LSR_accumulator:
+            set_status_flag_bit(CARRY_FLAG, register_a & 1);
+            set_register_a(register_a >> 1);
+            break;
+        case LSR: {
+            auto value = mem_read(addr);
+            set_status_flag_bit(CARRY_FLAG, value & 1);
+            value >>= 1;
+            mem_write(addr, value);
+            update_zero_and_negative_flags(value);
+        } break;
+        case NOP:
+            // do nothing :)
+            break;
+        case ORA: {
+            auto value = mem_read(addr);
+            set_register_a(register_a | value);
+        } break;
+        case PHA:
+            stack_push(register_a);
+            break;
+        case PHP: {
+            uint8_t status_clone = status;
+            status_clone |= BREAK_FLAG;
+            status_clone |= ALWAYS_ONE_FLAG;
+            stack_push(status_clone);
+        } break;
+        case PLA: {
+            uint8_t accumulator = stack_pop();
+            set_register_a(accumulator);
+        } break;
+        case PLP: {
+            uint8_t processor_status = stack_pop();
+            processor_status &= ~BREAK_FLAG;
+            processor_status |= ALWAYS_ONE_FLAG;
+            status = processor_status;
+        } break;
+        case ROL_accumulator: {
+            uint8_t result = (register_a << 1) | is_status_flag_set(CARRY_FLAG);
+            set_status_flag_bit(CARRY_FLAG, (register_a >> 7) == 1);
+            set_register_a(result);
+        } break;
+        case ROL: {
+            auto data = mem_read(addr);
+            uint8_t result = (data << 1) | is_status_flag_set(CARRY_FLAG);
+            mem_write(addr, result);
+            set_status_flag_bit(CARRY_FLAG, (data >> 7) == 1);
+            update_zero_and_negative_flags(result);
+        } break;
+        case ROR_accumulator: {
+            uint8_t carry = is_status_flag_set(CARRY_FLAG);
+            uint8_t result = (register_a >> 1) | (carry << 7);
+            set_status_flag_bit(CARRY_FLAG, (register_a & 1) == 1);
+            set_register_a(result);
+        } break;
+        case ROR: {
+            auto data = mem_read(addr);
+            uint8_t carry = is_status_flag_set(CARRY_FLAG);
+            uint8_t result = (data << 1) | (carry << 7);
+            mem_write(addr, result);
+            set_status_flag_bit(CARRY_FLAG, (data & 1) == 1);
+            update_zero_and_negative_flags(result);
+        } break;
+        case RTI:
+            status = stack_pop();
+            clear_status_flag(BREAK_FLAG);
+            set_status_flag(ALWAYS_ONE_FLAG);
+
+            program_counter = stack_pop_u16();
+            break;
+        case RTS:
+            program_counter = stack_pop_u16() + 1;
+            break;
+        case SBC: {
+            auto value = mem_read(addr);
+            add_to_register_a((-value) - 1);
+        } break;
+        case SEC:
+            set_status_flag(CARRY_FLAG);
+            break;
+        case SED:
+            set_status_flag(DECIMAL_MODE_FLAG);
+            break;
+        case SEI:
+            set_status_flag(INTERRUPT_DISABLE_FLAG);
+            break;
+        case STA:
+            mem_write(addr, register_a);
+            break;
+        case STX:
+            mem_write(addr, register_x);
+            break;
+        case STY:
+            mem_write(addr, register_y);
+            break;
+        case TAX:
+            set_register_x(register_a);
+            break;
+        case TAY:
+            set_register_y(register_a);
+            break;
+        case TSX:
+            set_register_x(stack_pointer);
+            break;
+        case TXA:
+            set_register_a(register_x);
+            break;
+        case TXS:
+            stack_pointer = register_x;
+            break;
+        case TYA:
+            set_register_a(register_y);
+            break;
+        case BRK:
+            set_status_flag(BREAK_FLAG);
+            return false;
+            break;
+        case ILLEGAL:
+            // the CPU jams on most of these, so we stop just like BRK but
+            // without touching the status
+            return false;
     }
+
+    return true;
 }
\ No newline at end of file
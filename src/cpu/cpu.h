@@ -1,9 +1,15 @@
 #pragma once
+#include <array>
+#include <bitset>
 #include <cstdint>
+#include <memory>
 #include <vector>
 
+#include "bus.h"
 #include "opcode.h"
 
+class SaveState;
+
 const static uint8_t CARRY_FLAG = 1 << 0;              // 00000001
 const static uint8_t ZERO_FLAG = 1 << 1;               // 00000010
 const static uint8_t INTERRUPT_DISABLE_FLAG = 1 << 2;  // 00000100
@@ -13,19 +19,142 @@ const static uint8_t ALWAYS_ONE_FLAG = 1 << 5;         // 00100000
 const static uint8_t OVERFLOW_FLAG = 1 << 6;           // 01000000
 const static uint8_t NEGATIVE_FLAG = 1 << 7;           // 10000000
 
+// the NES has 2 KiB of RAM, mirrored four times up to 0x1FFF
+const static uint16_t RAM_SIZE = 0x0800;
+
 const static uint16_t STACK = 0x0100;
 const static uint8_t STACK_RESET = 0xFD;
 
+// Granularity of watch_writes(), one row of the snake game's 32x32 screen
+const static uint16_t WATCH_CHUNK_SIZE = 32;
+
+// Limits for the block cache. Once it holds MAX_BLOCKS it starts over.
+const static uint32_t MAX_BLOCKS = 4096;
+const static uint32_t MAX_BLOCK_LENGTH = 64;
+
+class CPU;
+class Mapper;
+class Dynarec;
+
+// An instruction decoded once and cached by the address it starts at, so the
+// next time we get there we can skip reading the opcode and its operand.
+struct DecodedInstruction {
+    bool (*handler)(CPU &cpu, uint16_t operand);
+    uint16_t operand;
+    uint8_t bytes;
+    AddressingMode mode;
+};
+
+// One instruction of a block, or two of them fused into a superinstruction
+struct BlockOp {
+    bool (*handler)(CPU &cpu, const BlockOp &op);
+    uint16_t operand;
+    uint16_t second_operand;
+};
+
+// Straight line code decoded into a list of handlers, from its first
+// instruction up to the branch, jump or return that ends it.
+struct Block {
+    uint16_t start;
+    // address of the last byte of the last instruction
+    uint16_t end;
+    std::vector<BlockOp> ops;
+};
+
 class CPU {
    public:
     CPU();
+    ~CPU();
 
     void reset();
     void load_and_run(std::vector<uint8_t> &program);
     void load(std::vector<uint8_t> &program);
+    // Switches to the NES memory map and maps the cartridge into it through
+    // its mapper, the program counter comes from its reset vector on the
+    // next reset()
+    void load(Mapper &mapper);
     void run();
     void run_with_callback(void (*callback_function)(CPU &));
 
+    // Runs instructions until the cycle counter reaches target_cycle, like
+    // run_until_cycle(), calling whatever hooks the Hooks type has:
+    //
+    //   void instruction(CPU &cpu)    before each instruction
+    //   void read(uint16_t address, uint8_t value)
+    //   void write(uint16_t address, uint8_t value)
+    //                                 after each bus access, instruction
+    //                                 fetches included
+    //   void branch(CPU &cpu, uint16_t from, uint16_t to)
+    //                                 after each instruction that did not
+    //                                 fall through to the next one, like a
+    //                                 taken branch, a jump or a return
+    //
+    // Which hooks there are is worked out at compile time, so a hook that is
+    // not there costs nothing, and with NoHooks this is the plain
+    // interpreter loop. Memory hooks observe the bus for the duration of
+    // the call, which sends every access down its slow path, and always run
+    // step_switch(), the decode cache would only fetch code once.
+    template <typename Hooks>
+    bool run(Hooks &hooks, uint64_t target_cycle = UINT64_MAX);
+
+    // Runs instructions until the cycle counter reaches target_cycle (or for
+    // budget cycles from now). The last instruction may overshoot the target
+    // by a few cycles, which the next call absorbs since the counter is never
+    // reset. Returns false if a BRK stopped execution before the budget ran
+    // out.
+    bool run_until_cycle(uint64_t target_cycle);
+    bool run_for_cycles(uint64_t budget);
+
+    // Same as run_until_cycle() but runs whole basic blocks out of the block
+    // cache, only checking the budget between blocks.
+    bool run_blocks_until_cycle(uint64_t target_cycle);
+
+    // Same as run_blocks_until_cycle() but blocks that ran often enough are
+    // translated to native code by the dynarec and run from there. Blocks
+    // that loop back to themselves check the budget on every iteration.
+    // Falls back to the block cache for everything the dynarec cannot run.
+    bool run_native_until_cycle(uint64_t target_cycle);
+    Dynarec &get_dynarec();
+
+    // Makes the run_*_until_cycle() call in progress return once the current
+    // instruction (or block) is done. For MMIO handlers that raised an
+    // interrupt or otherwise need the caller to look at things early.
+    void stop_run() { stop_cycle = 0; }
+
+    // Interrupts, taken between instructions. Both push the program counter
+    // and the status and jump through their vector. irq() does nothing while
+    // the interrupt disable flag is set and returns whether it was taken.
+    void nmi();
+    bool irq();
+
+    // Executes a single instruction. Returns false when it was BRK or an
+    // illegal opcode.
+    // step() uses whichever core the build selected with CPU_DECODE_CACHE or
+    // CPU_TABLE_DISPATCH, all cores are always available so they can be
+    // checked against each other.
+    bool step();
+    bool step_switch();
+    bool step_table();
+    bool step_cached();
+
+    // One handler per opcode byte, dispatched to straight from the opcode
+    // byte by step_table()
+    using Handler = bool (*)(CPU &cpu);
+    template <uint8_t Code>
+    static bool handle(CPU &cpu);
+
+    // Same for step_cached(), which already has the operand bytes
+    using DecodedHandler = bool (*)(CPU &cpu, uint16_t operand);
+    template <uint8_t Code>
+    static bool handle_decoded(CPU &cpu, uint16_t operand);
+
+    // And for the ops of a block
+    using BlockHandler = bool (*)(CPU &cpu, const BlockOp &op);
+    template <uint8_t Code>
+    static bool handle_block_op(CPU &cpu, const BlockOp &op);
+    template <uint8_t First, uint8_t Second>
+    static bool handle_superinstruction(CPU &cpu, const BlockOp &op);
+
     bool is_status_flag_set(uint8_t status_flag);
     void set_status_flag(uint8_t status_flag);
     void clear_status_flag(uint8_t status_flag);
@@ -47,7 +176,37 @@ class CPU {
     uint8_t get_register_x() { return register_x; }
     uint8_t get_register_y() { return register_y; }
     uint8_t get_status() { return status; }
+    uint8_t get_stack_pointer() { return stack_pointer; }
     uint16_t get_program_counter() { return program_counter; }
+    uint64_t get_cycles() { return cycles; }
+    Bus &get_bus() { return bus; }
+
+    // Save states. snapshot() writes the registers and every page of
+    // memory that takes writes (RAM, cartridge RAM, mirrors only once) into
+    // state, restore() puts them back. Neither allocates.
+    //
+    // Every mem_write() marks its page dirty. A snapshot into the same
+    // SaveState as this CPU's last snapshot or restore only copies the
+    // pages written since, and so does restoring the state last taken or
+    // restored, which makes both cost about as much as the memory the game
+    // touched. Anything else copies every page. restore() throws
+    // std::runtime_error if state is not a save state or its memory does
+    // not fit the pages this CPU can write.
+    void snapshot(SaveState &state);
+    void restore(SaveState &state);
+
+    // Dirty tracking for memory a front end shows, like the snake game's
+    // screen at 0x0200-0x05FF. Every mem_write() to [start, start + size),
+    // from any core, sets the bit of the WATCH_CHUNK_SIZE byte chunk it went
+    // to. size is at most 64 chunks. Everything starts out dirty.
+    void watch_writes(uint16_t start, uint16_t size);
+    // The chunks written since the last call, bit n for the one at start +
+    // n * WATCH_CHUNK_SIZE
+    uint64_t take_dirty_chunks() {
+        uint64_t dirty = dirty_chunks;
+        dirty_chunks = 0;
+        return dirty;
+    }
 
     void set_register_a(uint8_t value) {
         register_a = value;
@@ -76,10 +235,36 @@ class CPU {
         status = value;
     }
 
+    void set_cycles(uint64_t value) {
+        cycles = value;
+    }
+
    private:
-    uint16_t get_operand_address(AddressingMode &mode);
+    template <AddressingMode A>
+    [[gnu::always_inline]]
+    inline uint16_t operand_address();
+
+    template <AddressingMode A>
+    [[gnu::always_inline]]
+    inline uint16_t read_operand();
+
+    template <AddressingMode A>
+    [[gnu::always_inline]]
+    inline uint16_t resolve_address(uint16_t operand);
+
+    [[gnu::always_inline]]
+    inline uint16_t get_operand_address(AddressingMode &mode);
     void add_to_register_a(uint8_t value);
 
+    template <Mnemonic M, AddressingMode A, uint8_t Bytes, uint8_t Cycles>
+    [[gnu::always_inline]]
+    inline bool run_opcode(uint16_t operand);
+
+    // Runs the instruction itself once its operand address is known. Returns
+    // false for BRK.
+    [[gnu::always_inline]]
+    inline bool execute(Mnemonic mnemonic, uint16_t addr);
+
     [[gnu::always_inline]]
     inline void branch();
 
@@ -88,6 +273,23 @@ class CPU {
 
     void update_zero_and_negative_flags(uint8_t register_to_check);
 
+    void interrupt(uint16_t vector);
+
+    const OpCode &decode(uint16_t address, DecodedInstruction &instruction);
+    uint8_t peek_code(uint16_t address);
+    void invalidate_decoded(uint16_t address);
+    void invalidate_code(uint16_t address);
+    void invalidate_code_page(uint8_t page);
+    static void on_remap(void *context, uint8_t page);
+    void invalidate_code_caches();
+    void update_state_layout();
+    void mark_watched_dirty();
+
+    uint32_t build_block(uint16_t address);
+    bool run_next_block();
+    void invalidate_blocks(uint8_t page);
+    void clear_blocks();
+
     uint8_t register_a;
     uint8_t register_x;
     uint8_t register_y;
@@ -96,6 +298,130 @@ class CPU {
     // https://www.nesdev.org/obelisk-6502-guide/registers.html
     // look for Stack Pointer
     uint8_t stack_pointer;
-    // 64 KiB
-    uint8_t memory[0xffff];
-};
\ No newline at end of file
+    // total number of cycles executed, including the page crossed and branch
+    // taken penalties
+    uint64_t cycles;
+    // the run_*_until_cycle() call in progress stops once cycles gets here,
+    // stop_run() lowers it
+    uint64_t stop_cycle;
+    // set by get_operand_address when an indexed address lands on a different
+    // page than its base address
+    bool page_crossed;
+    // everything mem_read() and mem_write() reach goes through here
+    Bus bus;
+
+    // see snapshot(). A bit per page written since the last snapshot or
+    // restore, state_serial counts both and state_id tells CPUs apart.
+    std::array<uint64_t, 4> dirty_pages;
+    uint64_t state_id;
+    uint64_t state_serial;
+    // The writable pages that go into a snapshot, each piece of host memory
+    // once, and for every page its slot among them or NO_STATE_SLOT. Worked
+    // out again when the bus maps writable pages differently.
+    uint32_t state_layout_version;
+    uint16_t state_page_count;
+    std::array<uint8_t, 256> state_pages;
+    std::array<uint16_t, 256> state_slot;
+
+    // see watch_writes(), watch_size is 0 while nothing is watched
+    uint16_t watch_start;
+    uint16_t watch_size;
+    uint64_t dirty_chunks;
+
+    // one entry per address, empty until step_cached() first runs
+    std::vector<DecodedInstruction> decode_cache;
+    // pages we decoded instructions from, a write to any other page never has
+    // to look at the caches
+    std::bitset<256> code_pages;
+
+    // index into blocks of the block starting at each address, -1 if there is
+    // none yet. Empty until run_blocks_until_cycle() first runs.
+    std::vector<int32_t> block_at;
+    std::vector<Block> blocks;
+    // the blocks with code in each page, so a write only drops those
+    std::array<std::vector<uint32_t>, 256> blocks_in_page;
+    // set when a write dropped blocks, so the running block stops
+    bool blocks_invalidated;
+
+    // created by the first run_native_until_cycle()
+    std::unique_ptr<Dynarec> dynarec;
+    // translated blocks need the bus and code_pages
+    friend class Dynarec;
+};
+
+// A hook policy for CPU::run() without any hooks
+struct NoHooks {};
+
+// A hook policy for CPU::run() that counts the instructions it runs
+struct InstructionCounter {
+    uint64_t count = 0;
+    void instruction(CPU &) { count++; }
+};
+
+template <typename Hooks>
+bool CPU::run(Hooks &hooks, uint64_t target_cycle) {
+    constexpr bool has_instruction =
+        requires(Hooks &h, CPU &cpu) { h.instruction(cpu); };
+    constexpr bool has_read =
+        requires(Hooks &h, uint16_t a, uint8_t v) { h.read(a, v); };
+    constexpr bool has_write =
+        requires(Hooks &h, uint16_t a, uint8_t v) { h.write(a, v); };
+    constexpr bool has_branch =
+        requires(Hooks &h, CPU &cpu, uint16_t a) { h.branch(cpu, a, a); };
+
+    // stops observing the bus however the run ends
+    struct Observation {
+        Bus &bus;
+        ~Observation() {
+            if constexpr (has_read || has_write) {
+                bus.stop_observing();
+            }
+        }
+    } observation{bus};
+    if constexpr (has_read || has_write) {
+        AccessObserver observer{nullptr, nullptr, &hooks};
+        if constexpr (has_read) {
+            observer.read = [](void *context, uint16_t address,
+                               uint8_t value) {
+                static_cast<Hooks *>(context)->read(address, value);
+            };
+        }
+        if constexpr (has_write) {
+            observer.write = [](void *context, uint16_t address,
+                                uint8_t value) {
+                static_cast<Hooks *>(context)->write(address, value);
+            };
+        }
+        bus.observe(observer);
+    }
+
+    auto step_hooked = [this]() {
+        if constexpr (has_read || has_write) {
+            return step_switch();
+        } else {
+            return step();
+        }
+    };
+
+    stop_cycle = target_cycle;
+    while (cycles < stop_cycle) {
+        if constexpr (has_instruction) {
+            hooks.instruction(*this);
+        }
+
+        if constexpr (has_branch) {
+            uint16_t from = program_counter;
+            // looked at before the instruction can overwrite itself
+            uint8_t bytes = opcodes[bus.peek(from)].bytes;
+            if (!step_hooked()) {
+                return false;
+            }
+            if (program_counter != static_cast<uint16_t>(from + bytes)) {
+                hooks.branch(*this, from, program_counter);
+            }
+        } else if (!step_hooked()) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,849 @@
+#include "dynarec.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <initializer_list>
+
+#include "cpu.h"
+#include "opcode.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#define DYNAREC_X86_64 1
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Size of the code buffer. When it fills up every translated block is
+// dropped and we start over.
+const static size_t CODE_BUFFER_SIZE = 4 * 1024 * 1024;
+// More than a block of MAX_BLOCK_LENGTH instructions can ever take
+const static size_t MAX_TRANSLATED_BLOCK_SIZE = 16 * 1024;
+
+Dynarec::Dynarec() : code(nullptr), code_used(0) {
+    threshold = CPU_DYNAREC_THRESHOLD;
+    page_invalidations.fill(0);
+#if defined(DYNAREC_X86_64)
+    // never writable and executable at once, translate() flips the pages it
+    // emits to between the two
+    void *buffer = mmap(nullptr, CODE_BUFFER_SIZE, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer != MAP_FAILED) {
+        code = static_cast<uint8_t *>(buffer);
+        native_at.assign(0x10000, nullptr);
+        hits.assign(0x10000, 0);
+    }
+#endif
+}
+
+Dynarec::~Dynarec() {
+#if defined(DYNAREC_X86_64)
+    if (code != nullptr) {
+        munmap(code, CODE_BUFFER_SIZE);
+    }
+#endif
+}
+
+NativeBlock Dynarec::lookup(CPU &cpu, uint16_t address) {
+    if (code == nullptr) {
+        return nullptr;
+    }
+
+    NativeBlock block = native_at[address];
+    if (block != nullptr) [[likely]] {
+        return block;
+    }
+
+    counted_pages.set(address >> 8);
+    // UINT32_MAX marks blocks translate() gave up on
+    if (hits[address] == UINT32_MAX || ++hits[address] <= threshold) {
+        return nullptr;
+    }
+    return translate(cpu, address);
+}
+
+// Called for every write to a page we translated code from. The translated
+// code stays in the buffer since the block doing the write may be running it
+// right now, it is only unlinked.
+void Dynarec::invalidate_page(uint8_t page, bool written) {
+    if (code == nullptr) {
+        return;
+    }
+
+    for (uint16_t address : blocks_in_page[page]) {
+        native_at[address] = nullptr;
+    }
+    if (!blocks_in_page[page].empty()) {
+        blocks_in_page[page].clear();
+        if (written &&
+            page_invalidations[page] < DYNAREC_MAX_PAGE_INVALIDATIONS) {
+            page_invalidations[page]++;
+        }
+    }
+    // what could not be translated before might be now
+    std::fill_n(hits.begin() + (page << 8), 0x100, 0);
+}
+
+// Programs get reloaded a lot (every time the snake dies), so only touch the
+// entries that were actually used instead of all 64K of them
+void Dynarec::clear() {
+    if (code == nullptr) {
+        return;
+    }
+
+    code_used = 0;
+    for (int page = 0; page < 256; page++) {
+        for (uint16_t address : blocks_in_page[page]) {
+            native_at[address] = nullptr;
+        }
+        blocks_in_page[page].clear();
+        if (counted_pages.test(page)) {
+            std::fill_n(hits.begin() + (page << 8), 0x100, 0);
+        }
+    }
+    counted_pages.reset();
+    page_invalidations.fill(0);
+}
+
+// Stores from translated code go through here so they hit the same self
+// modifying code checks as the interpreter. Returns true when the store went
+// to a page with code, in which case the block stops right after it.
+//
+// MMIO handlers see the cycle count as of this store and may add to it, like
+// OAM DMA does, or stop the run. pending_cycles are the ones the block has
+// used since it last updated state->cycles.
+bool Dynarec::write(NativeState *state, uint16_t address, uint8_t value,
+                    uint32_t pending_cycles) {
+    CPU &cpu = *state->cpu;
+    if (cpu.bus.is_writable(address >> 8)) {
+        // plain memory, nothing there can see the cycle count
+        cpu.mem_write(address, value);
+        return cpu.code_pages.test(address >> 8);
+    }
+
+    cpu.cycles = state->cycles + pending_cycles;
+    cpu.mem_write(address, value);
+    state->cycles = cpu.cycles - pending_cycles;
+    state->target_cycle = cpu.stop_cycle;
+    return cpu.code_pages.test(address >> 8) || cpu.cycles >= cpu.stop_cycle;
+}
+
+#if !defined(DYNAREC_X86_64)
+
+// Changes the protection of the whole pages of the code buffer that size
+// bytes from start are on
+static bool protect(uint8_t *start, size_t size, int protection) {
+    static const uintptr_t page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t first = reinterpret_cast<uintptr_t>(start) & ~(page_size - 1);
+    uintptr_t end = reinterpret_cast<uintptr_t>(start) + size;
+    return mprotect(reinterpret_cast<void *>(first), end - first,
+                    protection) == 0;
+}
+
+NativeBlock Dynarec::translate(CPU &cpu, uint16_t address) { return nullptr; }
+
+#else
+
+namespace {
+
+// x86-64 register numbers
+const static int RAX = 0;
+const static int RCX = 1;
+const static int RDX = 2;
+const static int RBX = 3;
+const static int RSP = 4;
+const static int RBP = 5;
+const static int RSI = 6;
+const static int RDI = 7;
+const static int R12 = 12;
+const static int R13 = 13;
+const static int R14 = 14;
+const static int R15 = 15;
+
+// Where the 6502 state lives while a translated block runs. The registers are
+// kept zero extended in the low byte of their host register.
+const static int HOST_STATE = R15;
+const static int HOST_PAGES = RBP;
+const static int HOST_A = R12;
+const static int HOST_X = R13;
+const static int HOST_Y = R14;
+// bl holds the status register
+const static int HOST_STATUS = RBX;
+// the result of the last compare, which only its flags are needed from
+const static int HOST_TEMP = RSI;
+
+// Condition codes for jcc and setcc
+const static uint8_t CONDITION_B = 0x2;
+const static uint8_t CONDITION_AE = 0x3;
+const static uint8_t CONDITION_Z = 0x4;
+const static uint8_t CONDITION_NZ = 0x5;
+
+// A memory operand [base + index * (1 << scale) + disp], index is -1 when
+// there is none
+struct Memory {
+    int base;
+    int index;
+    int32_t disp;
+    uint8_t scale = 0;
+};
+
+Memory state_field(size_t offset) {
+    return {HOST_STATE, -1, static_cast<int32_t>(offset)};
+}
+
+// Just enough of an x86-64 assembler for the instructions below. Every
+// instruction gets a REX prefix, even when it does not need one, so byte
+// registers 4 to 7 are always spl/bpl/sil/dil and never ah/ch/dh/bh.
+class Emitter {
+   public:
+    explicit Emitter(uint8_t *start) : start(start), cursor(start) {}
+
+    size_t size() { return cursor - start; }
+    uint8_t *position() { return cursor; }
+
+    void byte(uint8_t value) { *cursor++ = value; }
+
+    void u16(uint16_t value) {
+        byte(value);
+        byte(value >> 8);
+    }
+
+    void u32(uint32_t value) {
+        u16(value);
+        u16(value >> 16);
+    }
+
+    void u64(uint64_t value) {
+        u32(value);
+        u32(value >> 32);
+    }
+
+    void rex(bool wide, int reg, int index, int base) {
+        byte(0x40 | (wide << 3) | ((reg >> 3) << 2) | ((index >> 3) << 1) |
+             (base >> 3));
+    }
+
+    // opcode reg, rm with a register as rm
+    void op(std::initializer_list<uint8_t> opcode, bool wide, int reg,
+            int rm) {
+        rex(wide, reg, 0, rm);
+        for (uint8_t b : opcode) {
+            byte(b);
+        }
+        byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+    }
+
+    // opcode reg, rm with memory as rm, always using a 32 bit displacement
+    void op(std::initializer_list<uint8_t> opcode, bool wide, int reg,
+            Memory memory) {
+        int index = memory.index < 0 ? 0 : memory.index;
+        rex(wide, reg, index, memory.base);
+        for (uint8_t b : opcode) {
+            byte(b);
+        }
+        if (memory.index < 0 && (memory.base & 7) != RSP) {
+            byte(0x80 | ((reg & 7) << 3) | (memory.base & 7));
+        } else {
+            // SIB byte, index 4 without REX.X means no index
+            byte(0x80 | ((reg & 7) << 3) | RSP);
+            byte(memory.scale << 6 |
+                 ((memory.index < 0 ? RSP : index) & 7) << 3 |
+                 (memory.base & 7));
+        }
+        u32(memory.disp);
+    }
+
+    void push(int reg) {
+        rex(false, 0, 0, reg);
+        byte(0x50 + (reg & 7));
+    }
+
+    void pop(int reg) {
+        rex(false, 0, 0, reg);
+        byte(0x58 + (reg & 7));
+    }
+
+    void mov_imm32(int reg, uint32_t value) {
+        rex(false, 0, 0, reg);
+        byte(0xB8 + (reg & 7));
+        u32(value);
+    }
+
+    void mov_imm64(int reg, uint64_t value) {
+        rex(true, 0, 0, reg);
+        byte(0xB8 + (reg & 7));
+        u64(value);
+    }
+
+    // Jumps with a 32 bit displacement, returns where the displacement goes
+    // so it can be patched once the target is known
+    uint8_t *jcc(uint8_t condition) {
+        byte(0x0F);
+        byte(0x80 + condition);
+        uint8_t *displacement = cursor;
+        u32(0);
+        return displacement;
+    }
+
+    uint8_t *jmp() {
+        byte(0xE9);
+        uint8_t *displacement = cursor;
+        u32(0);
+        return displacement;
+    }
+
+    static void patch(uint8_t *displacement, uint8_t *target) {
+        int32_t offset = target - (displacement + 4);
+        for (int i = 0; i < 4; i++) {
+            displacement[i] = offset >> (i * 8);
+        }
+    }
+
+   private:
+    uint8_t *start;
+    uint8_t *cursor;
+};
+
+// ALU opcodes, "op r8, r/m8" forms and their /digit for the 0x80 immediate form
+struct AluOpcode {
+    uint8_t reg_memory;
+    uint8_t immediate_digit;
+};
+
+const static AluOpcode ALU_OR = {0x0A, 1};
+const static AluOpcode ALU_AND = {0x22, 4};
+const static AluOpcode ALU_SUB = {0x2A, 5};
+const static AluOpcode ALU_XOR = {0x32, 6};
+
+// The zero and negative flags are only worked out when something needs them.
+// Until then we remember which host register holds the value they come from.
+const static int FLAGS_CLEAN = -1;
+
+class Translator {
+   public:
+    Translator(CPU &cpu, uint8_t *buffer, uint16_t start)
+        : cpu(cpu), emit(buffer), start(start), flags_source(FLAGS_CLEAN) {}
+
+    // Returns how many instructions it translated and sets last_byte to the
+    // last byte of the last one
+    uint32_t translate(uint16_t &last_byte);
+
+    size_t size() { return emit.size(); }
+
+   private:
+    bool translate_instruction(const OpCode &opcode, uint16_t pc,
+                               uint16_t operand, uint32_t &pending_cycles,
+                               bool &ended);
+
+    void materialize_flags();
+    void exit_to(uint16_t pc, uint32_t pending_cycles);
+    void loop_back(uint32_t pending_cycles);
+    void load_operand(int reg, AddressingMode mode, uint16_t operand);
+    bool can_read(AddressingMode mode, uint16_t operand);
+    void load_through_pages(int reg, int address_reg);
+    void address_to_temp(AddressingMode mode, uint16_t operand);
+    void call_write(int value_reg, uint16_t next, uint32_t pending_cycles);
+
+    CPU &cpu;
+    Emitter emit;
+    uint16_t start;
+    int flags_source;
+    uint8_t *body;
+    std::vector<uint8_t *> exits;
+};
+
+int register_for(Mnemonic mnemonic) {
+    switch (mnemonic) {
+        case LDX:
+        case STX:
+        case CPX:
+        case INX:
+        case DEX:
+        case TAX:
+        case TXA:
+            return HOST_X;
+        case LDY:
+        case STY:
+        case CPY:
+        case INY:
+        case DEY:
+        case TAY:
+        case TYA:
+            return HOST_Y;
+        default:
+            return HOST_A;
+    }
+}
+
+bool is_writable(AddressingMode mode) {
+    return mode == ZEROPAGE || mode == ZEROPAGE_X || mode == ZEROPAGE_Y ||
+           mode == ABSOLUTE;
+}
+
+// Sets N and Z in bl from the low byte of flags_source
+void Translator::materialize_flags() {
+    if (flags_source == FLAGS_CLEAN) {
+        return;
+    }
+    int source = flags_source;
+    // and bl, ~(N | Z)
+    emit.op({0x80}, false, 4, HOST_STATUS);
+    emit.byte(~(NEGATIVE_FLAG | ZERO_FLAG) & 0xFF);
+    // N is bit 7 of the value itself
+    emit.op({0x8B}, false, RAX, source);
+    emit.op({0x80}, false, 4, RAX);
+    emit.byte(NEGATIVE_FLAG);
+    emit.op({0x08}, false, RAX, HOST_STATUS);
+    // Z is bit 1, so setz and shift it over
+    emit.op({0x84}, false, source, source);
+    emit.op({0x0F, 0x90 + CONDITION_Z}, false, 0, RAX);
+    emit.op({0x00}, false, RAX, RAX);
+    emit.op({0x08}, false, RAX, HOST_STATUS);
+    flags_source = FLAGS_CLEAN;
+}
+
+// Leaves the block with the program counter at pc. Only this path sees the
+// flags get materialized, the code after it still has them lazy.
+void Translator::exit_to(uint16_t pc, uint32_t pending_cycles) {
+    int saved_flags_source = flags_source;
+    materialize_flags();
+    flags_source = saved_flags_source;
+
+    if (pending_cycles != 0) {
+        emit.op({0x81}, true, 0,
+                state_field(offsetof(NativeState, cycles)));
+        emit.u32(pending_cycles);
+    }
+    emit.byte(0x66);
+    emit.op({0xC7}, false, 0,
+            state_field(offsetof(NativeState, program_counter)));
+    emit.u16(pc);
+    exits.push_back(emit.jmp());
+}
+
+// Jumps back to the start of the block while there are cycles left to run
+void Translator::loop_back(uint32_t pending_cycles) {
+    materialize_flags();
+    emit.op({0x81}, true, 0, state_field(offsetof(NativeState, cycles)));
+    emit.u32(pending_cycles);
+    emit.op({0x8B}, true, RAX, state_field(offsetof(NativeState, cycles)));
+    emit.op({0x3B}, true, RAX,
+            state_field(offsetof(NativeState, target_cycle)));
+    Emitter::patch(emit.jcc(CONDITION_B), body);
+    exit_to(start, 0);
+}
+
+// The addressing modes we can turn into a load through the page table, as long
+// as the pages they can reach are direct memory. Anything reading MMIO is left
+// to the interpreter.
+bool Translator::can_read(AddressingMode mode, uint16_t operand) {
+    Bus &bus = cpu.get_bus();
+    switch (mode) {
+        case IMMEDIATE:
+            return true;
+        case ZEROPAGE:
+            return bus.is_direct(0x00);
+        case ZEROPAGE_X:
+        case ZEROPAGE_Y:
+            // no wrap around, just like the interpreter, so this can reach
+            // into page 1
+            return bus.is_direct(0x00) && bus.is_direct(0x01);
+        case ABSOLUTE:
+            return bus.is_direct(operand >> 8);
+        default:
+            return false;
+    }
+}
+
+// movzx reg, byte [read_pages[address >> 8] + (address & 0xFF)] with the
+// address in address_reg. Uses eax and ecx.
+void Translator::load_through_pages(int reg, int address_reg) {
+    emit.op({0x8B}, false, RCX, address_reg);
+    emit.op({0xC1}, false, 5, RCX);
+    emit.byte(8);
+    emit.op({0x8B}, true, RCX, Memory{HOST_PAGES, RCX, 0, 3});
+    emit.op({0x0F, 0xB6}, false, RAX, address_reg);
+    emit.op({0x0F, 0xB6}, false, reg, Memory{RCX, RAX, 0});
+}
+
+// movzx reg, operand. Uses eax, ecx and edx.
+void Translator::load_operand(int reg, AddressingMode mode, uint16_t operand) {
+    if (mode == IMMEDIATE) {
+        emit.mov_imm32(reg, operand);
+    } else if (mode == ZEROPAGE_X || mode == ZEROPAGE_Y) {
+        emit.op({0x8B}, false, RDX, mode == ZEROPAGE_X ? HOST_X : HOST_Y);
+        emit.op({0x81}, false, 0, RDX);
+        emit.u32(operand);
+        load_through_pages(reg, RDX);
+    } else {
+        // the page is known up front, only its pointer has to be loaded
+        // since bank switching can change it
+        emit.op({0x8B}, true, RAX, Memory{HOST_PAGES, -1, (operand >> 8) * 8});
+        emit.op({0x0F, 0xB6}, false, reg, Memory{RAX, -1, operand & 0xFF});
+    }
+}
+
+// Puts the address an instruction writes to in esi, where the write helper
+// takes it
+void Translator::address_to_temp(AddressingMode mode, uint16_t operand) {
+    if (mode == ZEROPAGE_X || mode == ZEROPAGE_Y) {
+        emit.op({0x8B}, false, RSI, mode == ZEROPAGE_X ? HOST_X : HOST_Y);
+        emit.op({0x81}, false, 0, RSI);
+        emit.u32(operand);
+    } else {
+        emit.mov_imm32(RSI, operand);
+    }
+}
+
+// Calls Dynarec::write(state, esi, value_reg, pending_cycles), leaving the
+// block if the write went to a page with code or stopped the run
+void Translator::call_write(int value_reg, uint16_t next,
+                            uint32_t pending_cycles) {
+    emit.op({0x8B}, false, RDX, value_reg);
+    emit.mov_imm32(RCX, pending_cycles);
+    emit.op({0x8B}, true, RDI, HOST_STATE);
+    emit.mov_imm64(RAX, reinterpret_cast<uint64_t>(&Dynarec::write));
+    emit.op({0xFF}, false, 2, RAX);
+
+    emit.op({0x84}, false, RAX, RAX);
+    uint8_t *skip = emit.jcc(CONDITION_Z);
+    exit_to(next, pending_cycles);
+    Emitter::patch(skip, emit.position());
+}
+
+bool Translator::translate_instruction(const OpCode &opcode, uint16_t pc,
+                                       uint16_t operand,
+                                       uint32_t &pending_cycles,
+                                       bool &ended) {
+    Mnemonic mnemonic = opcode.mnemonic;
+    AddressingMode mode = opcode.mode;
+    uint16_t next = pc + opcode.bytes;
+    int reg = register_for(mnemonic);
+
+    switch (mnemonic) {
+        case NOP:
+            pending_cycles += opcode.cycles;
+            return true;
+        case LDA:
+        case LDX:
+        case LDY:
+            if (!can_read(mode, operand)) {
+                return false;
+            }
+            pending_cycles += opcode.cycles;
+            load_operand(reg, mode, operand);
+            flags_source = reg;
+            return true;
+        case STA:
+        case STX:
+        case STY:
+            if (!is_writable(mode)) {
+                return false;
+            }
+            pending_cycles += opcode.cycles;
+            // esi is about to be overwritten and the helper may clobber it
+            if (flags_source == HOST_TEMP) {
+                materialize_flags();
+            }
+            address_to_temp(mode, operand);
+            call_write(reg, next, pending_cycles);
+            return true;
+        case INC:
+        case DEC:
+            if (!is_writable(mode) || mode == ZEROPAGE_Y ||
+                !can_read(mode, operand)) {
+                return false;
+            }
+            pending_cycles += opcode.cycles;
+            materialize_flags();
+            address_to_temp(mode, operand);
+            load_through_pages(RDX, RSI);
+            emit.op({0xFE}, false, mnemonic == INC ? 0 : 1, RDX);
+            // the helper call clobbers edx, so the flags have to be set now
+            flags_source = RDX;
+            materialize_flags();
+            call_write(RDX, next, pending_cycles);
+            return true;
+        case TAX:
+        case TAY:
+            pending_cycles += opcode.cycles;
+            emit.op({0x8B}, false, reg, HOST_A);
+            flags_source = reg;
+            return true;
+        case TXA:
+        case TYA:
+            pending_cycles += opcode.cycles;
+            emit.op({0x8B}, false, HOST_A, reg);
+            flags_source = HOST_A;
+            return true;
+        case INX:
+        case INY:
+        case DEX:
+        case DEY:
+            pending_cycles += opcode.cycles;
+            emit.op({0xFE}, false, mnemonic == INX || mnemonic == INY ? 0 : 1,
+                    reg);
+            flags_source = reg;
+            return true;
+        case AND:
+        case ORA:
+        case EOR: {
+            if (!can_read(mode, operand)) {
+                return false;
+            }
+            pending_cycles += opcode.cycles;
+            AluOpcode alu = mnemonic == AND   ? ALU_AND
+                            : mnemonic == ORA ? ALU_OR
+                                              : ALU_XOR;
+            if (mode == IMMEDIATE) {
+                emit.op({0x80}, false, alu.immediate_digit, HOST_A);
+                emit.byte(operand);
+            } else {
+                load_operand(RAX, mode, operand);
+                emit.op({alu.reg_memory}, false, HOST_A, RAX);
+            }
+            flags_source = HOST_A;
+            return true;
+        }
+        case CMP:
+        case CPX:
+        case CPY:
+            if (!can_read(mode, operand)) {
+                return false;
+            }
+            pending_cycles += opcode.cycles;
+            // esi = reg - value, and the borrow out of that is !carry
+            emit.op({0x8B}, false, HOST_TEMP, reg);
+            if (mode == IMMEDIATE) {
+                emit.op({0x80}, false, ALU_SUB.immediate_digit, HOST_TEMP);
+                emit.byte(operand);
+            } else {
+                load_operand(RAX, mode, operand);
+                emit.op({ALU_SUB.reg_memory}, false, HOST_TEMP, RAX);
+            }
+            emit.op({0x0F, 0x90 + CONDITION_AE}, false, 0, RAX);
+            emit.op({0x80}, false, 4, HOST_STATUS);
+            emit.byte(~CARRY_FLAG & 0xFF);
+            emit.op({0x08}, false, RAX, HOST_STATUS);
+            flags_source = HOST_TEMP;
+            return true;
+        case CLC:
+        case SEC:
+        case CLV:
+            pending_cycles += opcode.cycles;
+            if (mnemonic == SEC) {
+                emit.op({0x80}, false, 1, HOST_STATUS);
+                emit.byte(CARRY_FLAG);
+            } else {
+                emit.op({0x80}, false, 4, HOST_STATUS);
+                emit.byte(~(mnemonic == CLC ? CARRY_FLAG : OVERFLOW_FLAG) &
+                          0xFF);
+            }
+            return true;
+        case BCC:
+        case BCS:
+        case BEQ:
+        case BNE:
+        case BMI:
+        case BPL:
+        case BVC:
+        case BVS: {
+            pending_cycles += opcode.cycles;
+            uint8_t flag;
+            bool taken_when_set;
+            switch (mnemonic) {
+                case BCC:
+                case BCS:
+                    flag = CARRY_FLAG;
+                    taken_when_set = mnemonic == BCS;
+                    break;
+                case BEQ:
+                case BNE:
+                    flag = ZERO_FLAG;
+                    taken_when_set = mnemonic == BEQ;
+                    break;
+                case BMI:
+                case BPL:
+                    flag = NEGATIVE_FLAG;
+                    taken_when_set = mnemonic == BMI;
+                    break;
+                default:
+                    flag = OVERFLOW_FLAG;
+                    taken_when_set = mnemonic == BVS;
+                    break;
+            }
+            int8_t offset = operand;
+            uint16_t target = next + offset;
+            // same penalties as CPU::branch(), known up front here
+            uint32_t taken_cycles = pending_cycles + 1;
+            if ((next & 0xFF00) != (target & 0xFF00)) {
+                taken_cycles++;
+            }
+
+            materialize_flags();
+            emit.op({0xF6}, false, 0, HOST_STATUS);
+            emit.byte(flag);
+            uint8_t *not_taken =
+                emit.jcc(taken_when_set ? CONDITION_Z : CONDITION_NZ);
+            if (target == start) {
+                loop_back(taken_cycles);
+            } else {
+                exit_to(target, taken_cycles);
+            }
+            Emitter::patch(not_taken, emit.position());
+            exit_to(next, pending_cycles);
+            ended = true;
+            return true;
+        }
+        case JMP:
+            if (mode != ABSOLUTE) {
+                return false;
+            }
+            pending_cycles += opcode.cycles;
+            if (operand == start) {
+                loop_back(pending_cycles);
+            } else {
+                exit_to(operand, pending_cycles);
+            }
+            ended = true;
+            return true;
+        default:
+            return false;
+    }
+}
+
+uint32_t Translator::translate(uint16_t &last_byte) {
+    // keep everything the block uses in callee saved registers so the write
+    // helper does not clobber it. Six pushes and the return address leave the
+    // stack 8 bytes off the 16 byte alignment calls need.
+    for (int reg : {RBX, RBP, R12, R13, R14, R15}) {
+        emit.push(reg);
+    }
+    emit.op({0x83}, true, 5, RSP);
+    emit.byte(8);
+
+    emit.op({0x8B}, true, HOST_STATE, RDI);
+    emit.op({0x8B}, true, HOST_PAGES,
+            state_field(offsetof(NativeState, read_pages)));
+    emit.op({0x0F, 0xB6}, false, HOST_A,
+            state_field(offsetof(NativeState, register_a)));
+    emit.op({0x0F, 0xB6}, false, HOST_X,
+            state_field(offsetof(NativeState, register_x)));
+    emit.op({0x0F, 0xB6}, false, HOST_Y,
+            state_field(offsetof(NativeState, register_y)));
+    emit.op({0x0F, 0xB6}, false, HOST_STATUS,
+            state_field(offsetof(NativeState, status)));
+
+    body = emit.position();
+
+    uint16_t pc = start;
+    uint32_t pending_cycles = 0;
+    uint32_t translated = 0;
+    bool ended = false;
+    Bus &bus = cpu.get_bus();
+    while (!ended && translated < MAX_BLOCK_LENGTH) {
+        // code is read with peek() so MMIO handlers and observers do not see
+        // it, code on MMIO pages is left to the interpreter
+        uint16_t operand_end = pc + 2;
+        if (!bus.is_direct(pc >> 8) || !bus.is_direct(operand_end >> 8)) {
+            break;
+        }
+        const OpCode &opcode = opcodes[bus.peek(pc)];
+        uint16_t operand = 0;
+        if (opcode.bytes == 3) {
+            operand = bus.peek(pc + 1) | (bus.peek(pc + 2) << 8);
+        } else if (opcode.bytes == 2) {
+            operand = bus.peek(pc + 1);
+        }
+
+        if (!translate_instruction(opcode, pc, operand, pending_cycles,
+                                   ended)) {
+            break;
+        }
+        translated++;
+        last_byte = pc + opcode.bytes - 1;
+        pc += opcode.bytes;
+    }
+
+    if (translated == 0) {
+        return 0;
+    }
+    if (!ended) {
+        // the interpreter takes over at the first instruction we could not
+        // translate
+        exit_to(pc, pending_cycles);
+    }
+
+    uint8_t *epilogue = emit.position();
+    for (uint8_t *exit : exits) {
+        Emitter::patch(exit, epilogue);
+    }
+    emit.op({0x88}, false, HOST_A,
+            state_field(offsetof(NativeState, register_a)));
+    emit.op({0x88}, false, HOST_X,
+            state_field(offsetof(NativeState, register_x)));
+    emit.op({0x88}, false, HOST_Y,
+            state_field(offsetof(NativeState, register_y)));
+    emit.op({0x88}, false, HOST_STATUS,
+            state_field(offsetof(NativeState, status)));
+    emit.op({0x83}, true, 0, RSP);
+    emit.byte(8);
+    for (int reg : {R15, R14, R13, R12, RBP, RBX}) {
+        emit.pop(reg);
+    }
+    emit.byte(0xC3);
+
+    return translated;
+}
+
+}  // namespace
+
+// Changes the protection of the whole pages of the code buffer that size
+// bytes from start are on
+static bool protect(uint8_t *start, size_t size, int protection) {
+    static const uintptr_t page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t first = reinterpret_cast<uintptr_t>(start) & ~(page_size - 1);
+    uintptr_t end = reinterpret_cast<uintptr_t>(start) + size;
+    return mprotect(reinterpret_cast<void *>(first), end - first,
+                    protection) == 0;
+}
+
+NativeBlock Dynarec::translate(CPU &cpu, uint16_t address) {
+    if (page_invalidations[address >> 8] >= DYNAREC_MAX_PAGE_INVALIDATIONS) {
+        hits[address] = UINT32_MAX;
+        return nullptr;
+    }
+    if (code_used + MAX_TRANSLATED_BLOCK_SIZE > CODE_BUFFER_SIZE) {
+        clear();
+    }
+
+    // the pages can share blocks translated before, which is fine since no
+    // translated code runs while we translate
+    uint8_t *start = code + code_used;
+    if (!protect(start, MAX_TRANSLATED_BLOCK_SIZE, PROT_READ | PROT_WRITE)) {
+        hits[address] = UINT32_MAX;
+        return nullptr;
+    }
+    Translator translator(cpu, start, address);
+    uint16_t last_byte = address;
+    uint32_t translated = translator.translate(last_byte);
+    if (!protect(start, MAX_TRANSLATED_BLOCK_SIZE, PROT_READ | PROT_EXEC) ||
+        translated == 0) {
+        hits[address] = UINT32_MAX;
+        return nullptr;
+    }
+
+    NativeBlock block = reinterpret_cast<NativeBlock>(start);
+    code_used += translator.size();
+    native_at[address] = block;
+
+    // writes to these pages now have to tell us
+    blocks_in_page[address >> 8].push_back(address);
+    cpu.code_pages.set(address >> 8);
+    if ((last_byte >> 8) != (address >> 8)) {
+        blocks_in_page[last_byte >> 8].push_back(address);
+        cpu.code_pages.set(last_byte >> 8);
+    }
+    return block;
+}
+
+#endif
@@ -0,0 +1,94 @@
+#pragma once
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class CPU;
+
+// What a translated block sees of the CPU. The registers are loaded into host
+// registers on entry and written back on exit, so the block never touches the
+// CPU object itself except through the write helper.
+struct NativeState {
+    // the page table of the bus, loads go straight through it
+    const uint8_t *const *read_pages;
+    CPU *cpu;
+    uint64_t cycles;
+    // blocks that loop back to themselves stop once cycles reaches this
+    uint64_t target_cycle;
+    uint16_t program_counter;
+    uint8_t register_a;
+    uint8_t register_x;
+    uint8_t register_y;
+    uint8_t status;
+};
+
+using NativeBlock = void (*)(NativeState *state);
+
+// Number of times a block has to run in the interpreter before we translate it
+#ifndef CPU_DYNAREC_THRESHOLD
+#define CPU_DYNAREC_THRESHOLD 16
+#endif
+
+// A page that had its code overwritten this many times is left to the
+// interpreter for good
+const static uint8_t DYNAREC_MAX_PAGE_INVALIDATIONS = 4;
+
+// Translates hot 6502 basic blocks into x86-64 code.
+//
+// Only a subset of instructions is translated: loads, stores, transfers,
+// increments, logic, compares, flag instructions, branches and JMP. A block is
+// translated up to the first instruction outside that subset, which then runs
+// in the interpreter. Loads read through the page table of the bus, so only
+// those from pages that are direct memory when the block is translated are,
+// MMIO reads are left to the interpreter. Stores go through CPU::mem_write so
+// MMIO and self modifying code are still handled, and a store to a page with
+// code ends the block right away.
+//
+// On anything other than x86-64 Linux, or if we cannot get executable memory,
+// is_available() is false and lookup() always returns nullptr.
+class Dynarec {
+   public:
+    Dynarec();
+    ~Dynarec();
+
+    Dynarec(const Dynarec &) = delete;
+    Dynarec &operator=(const Dynarec &) = delete;
+
+    bool is_available() { return code != nullptr; }
+
+    // Returns the translated block starting at address, translating it once
+    // it is hot. nullptr means the interpreter has to run it.
+    NativeBlock lookup(CPU &cpu, uint16_t address);
+
+    // written is true when the CPU wrote to the page, and false when it only
+    // got a different bank mapped in. Only writes count towards giving up on
+    // a page.
+    void invalidate_page(uint8_t page, bool written);
+    void clear();
+
+    void set_threshold(uint32_t value) { threshold = value; }
+
+    // Translated code calls this for every store
+    static bool write(NativeState *state, uint16_t address, uint8_t value,
+                      uint32_t pending_cycles);
+
+   private:
+    NativeBlock translate(CPU &cpu, uint16_t address);
+
+    // buffer translated blocks are bump allocated from, its pages are
+    // either writable or executable but never both
+    uint8_t *code;
+    size_t code_used;
+
+    uint32_t threshold;
+    std::vector<NativeBlock> native_at;
+    // times each address started an interpreted block, UINT32_MAX once we
+    // know it cannot be translated
+    std::vector<uint32_t> hits;
+    // pages with a non zero count in hits
+    std::bitset<256> counted_pages;
+    std::array<std::vector<uint16_t>, 256> blocks_in_page;
+    std::array<uint8_t, 256> page_invalidations;
+};
@@ -0,0 +1,216 @@
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "cpu/cpu.h"
+#include "ppu/pattern_cache.h"
+#include "snake.h"
+#include "state/save_state.h"
+
+// Runs the snake game without any front end for a fixed amount of time and
+// reports how many instructions per second the given interpreter core managed.
+// The game restarts whenever it hits a BRK (the snake dying).
+template <bool (CPU::*Step)()>
+double measure(std::vector<uint8_t> &game_code, std::chrono::seconds duration) {
+    CPU cpu;
+    cpu.load(game_code);
+    cpu.reset();
+
+    uint64_t instructions = 0;
+    uint8_t random = 1;
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed = std::chrono::steady_clock::duration::zero();
+
+    while (elapsed < duration) {
+        // only check the clock and feed a new "random" byte every so often so
+        // the measurement is dominated by the interpreter itself
+        for (int i = 0; i < 10000; i++) {
+            if (!(cpu.*Step)()) {
+                cpu.load(game_code);
+                cpu.reset();
+            }
+        }
+        instructions += 10000;
+
+        // xorshift so the apple does not always land on the same spot
+        random ^= random << 3;
+        random ^= random >> 5;
+        random ^= random << 1;
+        cpu.mem_write(0xFE, random);
+
+        elapsed = std::chrono::steady_clock::now() - start;
+    }
+
+    return instructions / std::chrono::duration<double>(elapsed).count();
+}
+
+// The callback run_with_callback() calls before every instruction. It only
+// feeds a new "random" byte every so often, so what we measure is the cost of
+// the per-instruction loop itself.
+uint32_t callback_count = 0;
+void bench_callback(CPU &cpu) {
+    if (++callback_count % 10000 == 0) {
+        cpu.mem_write(0xFE, callback_count >> 10);
+    }
+}
+
+// Emulated cycles per second for one of the whole-run entry points. run(cpu)
+// returns false once the game ended, and we start a new one.
+template <typename Run>
+double measure_cycles(std::vector<uint8_t> &game_code,
+                      std::chrono::seconds duration, Run run) {
+    CPU cpu;
+    cpu.load(game_code);
+    cpu.reset();
+
+    uint64_t total_cycles = 0;
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed = std::chrono::steady_clock::duration::zero();
+
+    while (elapsed < duration) {
+        uint64_t before = cpu.get_cycles();
+        bool running = run(cpu);
+        total_cycles += cpu.get_cycles() - before;
+        if (!running) {
+            cpu.load(game_code);
+            cpu.reset();
+        }
+        elapsed = std::chrono::steady_clock::now() - start;
+    }
+
+    return total_cycles / std::chrono::duration<double>(elapsed).count();
+}
+
+// Tiles per second one of the CHR decoders manages, decoding 8 KiB of CHR (a
+// whole pattern table pair) over and over
+double measure_decode(void (*decode)(const uint8_t *, uint8_t *, size_t),
+                      std::chrono::seconds duration) {
+    const size_t tiles = 512;
+    std::vector<uint8_t> chr(tiles * CHR_TILE_SIZE);
+    for (size_t i = 0; i < chr.size(); i++) {
+        chr[i] = i * 73 + (i >> 4);
+    }
+    std::vector<uint8_t> out(tiles * DECODED_TILE_SIZE);
+
+    uint64_t decoded = 0;
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed = std::chrono::steady_clock::duration::zero();
+    while (elapsed < duration) {
+        for (int i = 0; i < 100; i++) {
+            decode(chr.data(), out.data(), tiles);
+            // keep the compiler from skipping decodes nobody looks at
+            chr[i] ^= out[i];
+        }
+        decoded += 100 * tiles;
+        elapsed = std::chrono::steady_clock::now() - start;
+    }
+
+    return decoded / std::chrono::duration<double>(elapsed).count();
+}
+
+// Microseconds one snapshot() or restore() takes, one per snake frame of 400
+// cycles. With one state the snapshots only copy the pages the frame wrote,
+// alternating between two makes every one of them copy all of memory.
+// Restoring the state just taken only copies back what the frame wrote.
+enum SnapshotKind { SNAPSHOT_DIRTY, SNAPSHOT_FULL, RESTORE_DIRTY };
+double measure_snapshot(std::vector<uint8_t> &game_code, SnapshotKind kind,
+                        std::chrono::seconds duration) {
+    CPU cpu;
+    cpu.load(game_code);
+    cpu.reset();
+    SaveState states[2];
+    cpu.snapshot(states[0]);
+
+    uint64_t count = 0;
+    auto timed = std::chrono::steady_clock::duration::zero();
+    auto start = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - start < duration) {
+        cpu.mem_write(0xFE, count * 7 + 1);
+        if (!cpu.run_until_cycle(cpu.get_cycles() + 400)) {
+            cpu.load(game_code);
+            cpu.reset();
+        }
+        SaveState &state = states[kind == SNAPSHOT_FULL ? count & 1 : 0];
+        auto before = std::chrono::steady_clock::now();
+        if (kind == RESTORE_DIRTY) {
+            cpu.restore(state);
+        } else {
+            cpu.snapshot(state);
+        }
+        timed += std::chrono::steady_clock::now() - before;
+        if (kind == RESTORE_DIRTY) {
+            // the next frame goes on from the restored one
+            cpu.snapshot(state);
+        }
+        count++;
+    }
+    return std::chrono::duration<double, std::micro>(timed).count() / count;
+}
+
+int main() {
+    std::vector<uint8_t> game_code = get_game_code();
+    auto duration = std::chrono::seconds(2);
+
+    double switch_ips = measure<&CPU::step_switch>(game_code, duration);
+    double table_ips = measure<&CPU::step_table>(game_code, duration);
+    double cached_ips = measure<&CPU::step_cached>(game_code, duration);
+
+    std::cout << "switch core: " << switch_ips / 1e6 << " M instructions/sec\n";
+    std::cout << "table core:  " << table_ips / 1e6 << " M instructions/sec ("
+              << table_ips / switch_ips << "x)\n";
+    std::cout << "cached core: " << cached_ips / 1e6 << " M instructions/sec ("
+              << cached_ips / switch_ips << "x)\n";
+
+    // the per-instruction loop against running whole basic blocks
+    double callback_cps =
+        measure_cycles(game_code, duration, [](CPU &cpu) {
+            cpu.run_with_callback(bench_callback);
+            return false;
+        });
+    double hookless_cps = measure_cycles(game_code, duration, [](CPU &cpu) {
+        NoHooks hooks;
+        bool running = cpu.run(hooks, cpu.get_cycles() + 100000);
+        cpu.mem_write(0xFE, cpu.get_cycles() >> 10);
+        return running;
+    });
+    double block_cps = measure_cycles(game_code, duration, [](CPU &cpu) {
+        bool running = cpu.run_blocks_until_cycle(cpu.get_cycles() + 100000);
+        cpu.mem_write(0xFE, cpu.get_cycles() >> 10);
+        return running;
+    });
+    double native_cps = measure_cycles(game_code, duration, [](CPU &cpu) {
+        bool running = cpu.run_native_until_cycle(cpu.get_cycles() + 100000);
+        cpu.mem_write(0xFE, cpu.get_cycles() >> 10);
+        return running;
+    });
+
+    std::cout << "run_with_callback: " << callback_cps / 1e6
+              << " M cycles/sec\n";
+    std::cout << "run, no hooks:     " << hookless_cps / 1e6
+              << " M cycles/sec (" << hookless_cps / callback_cps << "x)\n";
+    std::cout << "blocks:            " << block_cps / 1e6 << " M cycles/sec ("
+              << block_cps / callback_cps << "x)\n";
+    std::cout << "dynarec:           " << native_cps / 1e6 << " M cycles/sec ("
+              << native_cps / callback_cps << "x)\n";
+
+    std::cout << "snapshot, dirty pages: "
+              << measure_snapshot(game_code, SNAPSHOT_DIRTY, duration)
+              << " us\n";
+    std::cout << "snapshot, all pages:   "
+              << measure_snapshot(game_code, SNAPSHOT_FULL, duration)
+              << " us\n";
+    std::cout << "restore, dirty pages:  "
+              << measure_snapshot(game_code, RESTORE_DIRTY, duration)
+              << " us\n";
+
+    double scalar_tps = measure_decode(&decode_tiles_scalar, duration);
+    double sse2_tps = measure_decode(&decode_tiles_sse2, duration);
+    double avx2_tps = measure_decode(&decode_tiles_avx2, duration);
+
+    std::cout << "decode scalar: " << scalar_tps / 1e6 << " M tiles/sec\n";
+    std::cout << "decode sse2:   " << sse2_tps / 1e6 << " M tiles/sec ("
+              << sse2_tps / scalar_tps << "x)\n";
+    std::cout << "decode avx2:   " << avx2_tps / 1e6 << " M tiles/sec ("
+              << avx2_tps / scalar_tps << "x)\n";
+}
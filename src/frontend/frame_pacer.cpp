@@ -0,0 +1,35 @@
+#include "frame_pacer.h"
+
+#include <thread>
+
+FramePacer::FramePacer(double frames_per_second)
+    : period(frames_per_second > 0
+                 ? std::chrono::duration_cast<Clock::duration>(
+                       std::chrono::duration<double>(1 / frames_per_second))
+                 : Clock::duration::zero()),
+      next_frame(Clock::now()),
+      uncapped(frames_per_second <= 0),
+      dropped_frames(0) {}
+
+// Sleeps through most of the wait, then spins through the last SPIN_MARGIN
+void FramePacer::wait_for_next_frame() {
+    if (uncapped) {
+        return;
+    }
+
+    next_frame += period;
+    Clock::time_point now = Clock::now();
+    if (now > next_frame + period) {
+        dropped_frames++;
+        next_frame = now;
+        return;
+    }
+
+    if (next_frame - now > SPIN_MARGIN) {
+        std::this_thread::sleep_until(next_frame - SPIN_MARGIN);
+    }
+    while (Clock::now() < next_frame) {
+        // lets a hyperthread sibling or the OS have the core meanwhile
+        std::this_thread::yield();
+    }
+}
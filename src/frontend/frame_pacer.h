@@ -0,0 +1,41 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+
+// How long before a frame is due the pacer stops sleeping and spins instead.
+// Sleeps on desktop systems overshoot by up to a millisecond or so, spinning
+// through the last stretch makes frames start within microseconds of when
+// they should.
+const static std::chrono::microseconds SPIN_MARGIN{2000};
+
+// Keeps a front end at a steady frame rate. Call wait_for_next_frame() once
+// per frame, after the frame is presented.
+//
+// Frames are due at fixed points in time rather than a frame period after
+// the last one ended, so time spent emulating and drawing does not add up
+// into drift. If the front end falls behind by more than a frame it does not
+// try to catch up with a burst of frames, the schedule starts over from now.
+//
+// A pacer made with 0 frames per second (or set_uncapped(true)) never waits,
+// for running as fast as the host can.
+class FramePacer {
+   public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit FramePacer(double frames_per_second);
+
+    void set_uncapped(bool uncapped) { this->uncapped = uncapped; }
+    bool is_uncapped() { return uncapped; }
+
+    // Returns once the next frame is due
+    void wait_for_next_frame();
+
+    // Frames the schedule was started over for because they were late
+    uint64_t get_dropped_frames() { return dropped_frames; }
+
+   private:
+    Clock::duration period;
+    Clock::time_point next_frame;
+    bool uncapped;
+    uint64_t dropped_frames;
+};
@@ -0,0 +1,48 @@
+#include "frame_writer.h"
+
+#include <stdexcept>
+
+FrameWriter::FrameWriter(FrameFormat format, const std::string &path)
+    : format(format), path(path), file(nullptr), frames_written(0) {
+    if (format == FRAME_RAW) {
+        file = std::fopen(path.c_str(), "wb");
+        if (file == nullptr) {
+            throw std::runtime_error("could not create " + path);
+        }
+    }
+}
+
+FrameWriter::~FrameWriter() {
+    if (file != nullptr) {
+        std::fclose(file);
+    }
+}
+
+void FrameWriter::write(const uint32_t *pixels, uint16_t width,
+                        uint16_t height) {
+    size_t count = size_t{width} * height;
+    rgb.resize(count * 3);
+    for (size_t i = 0; i < count; i++) {
+        rgb[i * 3] = pixels[i] >> 16;
+        rgb[i * 3 + 1] = pixels[i] >> 8;
+        rgb[i * 3 + 2] = pixels[i];
+    }
+
+    if (format == FRAME_RAW) {
+        std::fwrite(rgb.data(), 1, rgb.size(), file);
+    } else {
+        char name[16];
+        std::snprintf(name, sizeof(name), "_%06llu.ppm",
+                      static_cast<unsigned long long>(frames_written));
+        std::string ppm_path = path + name;
+        FILE *ppm = std::fopen(ppm_path.c_str(), "wb");
+        if (ppm == nullptr) {
+            throw std::runtime_error("could not create " + ppm_path);
+        }
+        // https://netpbm.sourceforge.net/doc/ppm.html
+        std::fprintf(ppm, "P6\n%u %u\n255\n", width, height);
+        std::fwrite(rgb.data(), 1, rgb.size(), ppm);
+        std::fclose(ppm);
+    }
+    frames_written++;
+}
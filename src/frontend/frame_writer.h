@@ -0,0 +1,43 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+enum FrameFormat {
+    // one binary .ppm per frame, numbered from 0
+    FRAME_PPM,
+    // every frame as 24 bit RGB, row by row, one after the other in a single
+    // file. ffmpeg reads it with -f rawvideo -pixel_format rgb24.
+    FRAME_RAW,
+};
+
+// Writes frames to disk, the video sink for running without a display.
+// Frames come in as 0xAARRGGBB pixels, what expand_pixels() and
+// expand_nes_pixels() make, and the alpha is dropped.
+//
+// For FRAME_PPM path is a prefix, "out/frame" writes out/frame_000000.ppm,
+// out/frame_000001.ppm and so on. For FRAME_RAW it is the file.
+class FrameWriter {
+   public:
+    // Throws std::runtime_error if the raw file cannot be created
+    FrameWriter(FrameFormat format, const std::string &path);
+    ~FrameWriter();
+
+    FrameWriter(const FrameWriter &) = delete;
+    FrameWriter &operator=(const FrameWriter &) = delete;
+
+    // Throws std::runtime_error if a .ppm cannot be created
+    void write(const uint32_t *pixels, uint16_t width, uint16_t height);
+
+    uint64_t get_frames_written() { return frames_written; }
+
+   private:
+    FrameFormat format;
+    std::string path;
+    // only for FRAME_RAW
+    FILE *file;
+    // the frame being written, as RGB
+    std::vector<uint8_t> rgb;
+    uint64_t frames_written;
+};
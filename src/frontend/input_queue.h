@@ -0,0 +1,19 @@
+#pragma once
+#include <cstdint>
+
+#include "spsc_ring.h"
+
+// Events the queue holds at most, far more than anyone presses in a frame
+const static uint16_t INPUT_QUEUE_SIZE = 64;
+
+// A byte the front end wants written into memory, which is how the snake
+// game reads its keys (0xFF)
+struct InputEvent {
+    uint16_t address;
+    uint8_t value;
+};
+
+// Input on its way from the thread polling the window system to the
+// emulation thread, which takes it between frames. An event that does not
+// fit is dropped and push() says so.
+using InputQueue = SpscRing<InputEvent, INPUT_QUEUE_SIZE>;
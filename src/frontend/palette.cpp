@@ -0,0 +1,87 @@
+#include "palette.h"
+
+#include <algorithm>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define PALETTE_SSSE3 1
+#include <immintrin.h>
+#endif
+
+void expand_pixels_scalar(const uint8_t *indexes, uint32_t *pixels,
+                          size_t count, const Palette &palette) {
+    for (size_t i = 0; i < count; i++) {
+        pixels[i] = palette[std::min<uint8_t>(indexes[i], 15)];
+    }
+}
+
+#if defined(PALETTE_SSSE3)
+// 16 pixels at a time. The palette is split into one 16 byte table per
+// channel, so pshufb looks up a channel for all 16 indexes at once, and the
+// channels are then interleaved into pixels. SSSE3 is not part of the x86-64
+// baseline, so this is built for it on its own and only run when the CPU
+// says it has it.
+[[gnu::target("ssse3")]]
+static void expand_pixels_ssse3_kernel(const uint8_t *indexes,
+                                       uint32_t *pixels, size_t count,
+                                       const Palette &palette) {
+    alignas(16) uint8_t channels[4][16];
+    for (int i = 0; i < 16; i++) {
+        for (int channel = 0; channel < 4; channel++) {
+            channels[channel][i] = palette[i] >> (channel * 8);
+        }
+    }
+    const __m128i *tables = reinterpret_cast<const __m128i *>(channels);
+    const __m128i blue = _mm_load_si128(tables);
+    const __m128i green = _mm_load_si128(tables + 1);
+    const __m128i red = _mm_load_si128(tables + 2);
+    const __m128i alpha = _mm_load_si128(tables + 3);
+    const __m128i last = _mm_set1_epi8(15);
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i index =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(indexes + i));
+        index = _mm_min_epu8(index, last);
+        __m128i b = _mm_shuffle_epi8(blue, index);
+        __m128i g = _mm_shuffle_epi8(green, index);
+        __m128i r = _mm_shuffle_epi8(red, index);
+        __m128i a = _mm_shuffle_epi8(alpha, index);
+        // b g b g ... and r a r a ..., then b g r a, which is 0xAARRGGBB in
+        // a little endian word
+        __m128i bg_low = _mm_unpacklo_epi8(b, g);
+        __m128i bg_high = _mm_unpackhi_epi8(b, g);
+        __m128i ra_low = _mm_unpacklo_epi8(r, a);
+        __m128i ra_high = _mm_unpackhi_epi8(r, a);
+        __m128i *out = reinterpret_cast<__m128i *>(pixels + i);
+        _mm_storeu_si128(out, _mm_unpacklo_epi16(bg_low, ra_low));
+        _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(bg_low, ra_low));
+        _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(bg_high, ra_high));
+        _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(bg_high, ra_high));
+    }
+    expand_pixels_scalar(indexes + i, pixels + i, count - i, palette);
+}
+#endif
+
+void expand_pixels_ssse3(const uint8_t *indexes, uint32_t *pixels,
+                         size_t count, const Palette &palette) {
+#if defined(PALETTE_SSSE3)
+    static const bool supported = __builtin_cpu_supports("ssse3");
+    if (supported) {
+        expand_pixels_ssse3_kernel(indexes, pixels, count, palette);
+        return;
+    }
+#endif
+    expand_pixels_scalar(indexes, pixels, count, palette);
+}
+
+void expand_pixels(const uint8_t *indexes, uint32_t *pixels, size_t count,
+                   const Palette &palette) {
+    expand_pixels_ssse3(indexes, pixels, count, palette);
+}
+
+void expand_nes_pixels(const uint8_t *indexes, uint32_t *pixels,
+                       size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        pixels[i] = NES_PALETTE[indexes[i] & 0x3F];
+    }
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Colors are 0xAARRGGBB, which is SDL_PIXELFORMAT_ARGB8888
+using Palette = std::array<uint32_t, 16>;
+
+// The 16 colors of the screen the snake game draws on, a color index per
+// byte at 0x0200-0x05FF. Anything over 15 shows as 15.
+const static Palette SNAKE_PALETTE = {
+    0xFF000000,  // black
+    0xFFFFFFFF,  // white
+    0xFF808080,  // grey
+    0xFFFF0000,  // red
+    0xFF00FF00,  // green
+    0xFF0000FF,  // blue
+    0xFFFF00FF,  // magenta
+    0xFFFFFF00,  // yellow
+    0xFF00FFFF,  // cyan
+    0xFF808080,  // and the same again from 9 on
+    0xFFFF0000,
+    0xFF00FF00,
+    0xFF0000FF,
+    0xFFFF00FF,
+    0xFFFFFF00,
+    0xFF00FFFF,
+};
+
+// Turns count color indexes into pixels through palette. expand_pixels()
+// uses the SSSE3 kernel when the CPU has it, both are there so they can be
+// checked against each other.
+void expand_pixels(const uint8_t *indexes, uint32_t *pixels, size_t count,
+                   const Palette &palette);
+void expand_pixels_scalar(const uint8_t *indexes, uint32_t *pixels,
+                          size_t count, const Palette &palette);
+void expand_pixels_ssse3(const uint8_t *indexes, uint32_t *pixels,
+                         size_t count, const Palette &palette);
+
+// The 64 colors of the NES PPU, what the palette indices in
+// PPU::get_framebuffer() stand for. These are the common 2C02 values, real
+// TVs all showed them a little differently.
+using NesPalette = std::array<uint32_t, 64>;
+const static NesPalette NES_PALETTE = {
+    0xFF666666, 0xFF002A88, 0xFF1412A7, 0xFF3B00A4, 0xFF5C007E, 0xFF6E0040,
+    0xFF6C0600, 0xFF561D00, 0xFF333500, 0xFF0B4800, 0xFF005200, 0xFF004F08,
+    0xFF00404D, 0xFF000000, 0xFF000000, 0xFF000000, 0xFFADADAD, 0xFF155FD9,
+    0xFF4240FF, 0xFF7527FE, 0xFFA01ACC, 0xFFB71E7B, 0xFFB53120, 0xFF994E00,
+    0xFF6B6D00, 0xFF388700, 0xFF0C9300, 0xFF008F32, 0xFF007C8D, 0xFF000000,
+    0xFF000000, 0xFF000000, 0xFFFFFEFF, 0xFF64B0FF, 0xFF9290FF, 0xFFC676FF,
+    0xFFF36AFF, 0xFFFE6ECC, 0xFFFE8170, 0xFFEA9E22, 0xFFBCBE00, 0xFF88D800,
+    0xFF5CE430, 0xFF45E082, 0xFF48CDDE, 0xFF4F4F4F, 0xFF000000, 0xFF000000,
+    0xFFFFFEFF, 0xFFC0DFFF, 0xFFD3D2FF, 0xFFE8C8FF, 0xFFFBC2FF, 0xFFFEC4EA,
+    0xFFFECCC5, 0xFFF7D8A5, 0xFFE4E594, 0xFFCFEF96, 0xFFBDF4AB, 0xFFB3F3CC,
+    0xFFB5EBF2, 0xFFB8B8B8, 0xFF000000, 0xFF000000,
+};
+
+// Same as expand_pixels() for a PPU framebuffer, only the low 6 bits of
+// each index are looked at
+void expand_nes_pixels(const uint8_t *indexes, uint32_t *pixels,
+                       size_t count);
@@ -0,0 +1,56 @@
+#pragma once
+#include <cstdint>
+
+#include "state/save_state.h"
+
+// Hides frames of input lag by showing the future. Games usually take a
+// frame or more to show what a key press did, run-ahead runs that many
+// frames further with the input as it is now, shows the last of them and
+// goes back.
+//
+// Each call to run() runs the real frame, takes a snapshot, runs the
+// frames ahead and restores the snapshot, so the machine is only ever one
+// real frame further. Only the last frame ahead is shown, the others should
+// skip drawing and sound to save the time. With 0 frames run() is just the
+// real frame, shown.
+//
+// It costs frames + 1 frames of emulation per frame plus a snapshot and a
+// restore, which only copy the memory those frames wrote (see
+// CPU::snapshot()).
+class RunAhead {
+   public:
+    explicit RunAhead(uint32_t frames) : frames(frames) {}
+
+    RunAhead(const RunAhead &) = delete;
+    RunAhead &operator=(const RunAhead &) = delete;
+
+    void set_frames(uint32_t frames) { this->frames = frames; }
+    uint32_t get_frames() { return frames; }
+
+    // Machine has snapshot(SaveState &) and restore(SaveState &), like CPU.
+    // run_frame(bool shown) runs a frame, draws and plays it only if shown
+    // and returns false if the machine stopped. Returns false if the real
+    // frame stopped it, a frame ahead stopping only ends the frames ahead.
+    template <typename Machine, typename RunFrame>
+    bool run(Machine &machine, RunFrame run_frame) {
+        if (frames == 0) {
+            return run_frame(true);
+        }
+        if (!run_frame(false)) {
+            return false;
+        }
+        machine.snapshot(state);
+        for (uint32_t i = 1; i <= frames; i++) {
+            if (!run_frame(i == frames)) {
+                break;
+            }
+        }
+        machine.restore(state);
+        return true;
+    }
+
+   private:
+    uint32_t frames;
+    // the real frame, kept across calls so the snapshots stay cheap
+    SaveState state;
+};
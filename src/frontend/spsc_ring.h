@@ -0,0 +1,52 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// A fixed size queue from one thread to another, lock free and without
+// either side ever waiting.
+//
+// Only one thread may push() and only one pop(). The producer owns head and
+// the consumer tail. Both only ever go up and wrap around the items with a
+// mask, so full and empty are told apart without a spare slot, and each is
+// on its own cache line so the two threads do not fight over it. AudioRing
+// and PPUWorker lay out their indexes the same way.
+template <typename T, size_t SIZE>
+class SpscRing {
+    static_assert((SIZE & (SIZE - 1)) == 0,
+                  "the ring wraps around with a mask");
+
+   public:
+    SpscRing() : items{}, head(0), tail(0) {}
+
+    SpscRing(const SpscRing &) = delete;
+    SpscRing &operator=(const SpscRing &) = delete;
+
+    // Producer side. Returns false if the ring was full.
+    bool push(const T &item) {
+        uint64_t position = head.load(std::memory_order_relaxed);
+        if (position - tail.load(std::memory_order_acquire) == SIZE) {
+            return false;
+        }
+        items[position & (SIZE - 1)] = item;
+        head.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Returns false if there was nothing to take.
+    bool pop(T &item) {
+        uint64_t position = tail.load(std::memory_order_relaxed);
+        if (position == head.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = items[position & (SIZE - 1)];
+        tail.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+   private:
+    std::array<T, SIZE> items;
+    alignas(64) std::atomic<uint64_t> head;
+    alignas(64) std::atomic<uint64_t> tail;
+};
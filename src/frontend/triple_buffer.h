@@ -0,0 +1,60 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Hands whole frames from the thread that draws them to the thread that
+// shows them, without either ever waiting for the other.
+//
+// There are three frames. The producer draws into the back one and
+// publish() swaps it with the middle one, the consumer's update() swaps the
+// middle one with the front one it shows from. The middle frame's index
+// lives in a single atomic together with a bit saying whether it was
+// published since the consumer last took it, so both swaps are one
+// exchange. A producer that is faster than the consumer simply replaces the
+// middle frame, frames the consumer never saw are dropped, and a consumer
+// that is faster keeps showing the front frame.
+//
+// Only one thread may call back() and publish(), and only one front() and
+// update(). The back frame still holds whatever was in it when it was last
+// the middle or front frame, not the last frame published.
+template <typename Frame>
+class TripleBuffer {
+   public:
+    TripleBuffer() : back_index(0), middle(1), front_index(2) {}
+
+    TripleBuffer(const TripleBuffer &) = delete;
+    TripleBuffer &operator=(const TripleBuffer &) = delete;
+
+    // Producer side
+    Frame &back() { return frames[back_index]; }
+    void publish() {
+        uint8_t old = middle.exchange(back_index | FRESH,
+                                      std::memory_order_acq_rel);
+        back_index = old & INDEX;
+    }
+
+    // Consumer side. update() makes the latest published frame the front
+    // one and returns true, or returns false if nothing was published since
+    // the last time.
+    const Frame &front() { return frames[front_index]; }
+    bool update() {
+        if (!(middle.load(std::memory_order_relaxed) & FRESH)) {
+            return false;
+        }
+        uint8_t old = middle.exchange(front_index, std::memory_order_acq_rel);
+        front_index = old & INDEX;
+        return true;
+    }
+
+   private:
+    const static uint8_t INDEX = 0x03;
+    const static uint8_t FRESH = 0x04;
+
+    std::array<Frame, 3> frames;
+    // each side's own index next to the frames, the shared one on a cache
+    // line of its own
+    uint8_t back_index;
+    alignas(64) std::atomic<uint8_t> middle;
+    alignas(64) uint8_t front_index;
+};
@@ -0,0 +1,298 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "apu/audio_ring.h"
+#include "apu/wav_writer.h"
+#include "console/console.h"
+#include "cpu/cpu.h"
+#include "frontend/frame_writer.h"
+#include "frontend/palette.h"
+#include "frontend/run_ahead.h"
+#include "snake.h"
+
+// Runs a ROM or a bare 6502 program as fast as it goes, with no display and
+// no SDL, and says how fast that was. For build servers and profiling.
+//
+// A bare program is loaded at 0x0600 like the snake game and gets a frame
+// every PROGRAM_CYCLES_PER_FRAME cycles, the same as the SDL front end gives
+// the snake, with a new random byte at 0xFE each frame. Its frames are the
+// 32x32 screen at 0x0200. The random bytes come from a fixed seed so runs
+// can be compared.
+const static uint64_t PROGRAM_CYCLES_PER_FRAME = 400;
+const static uint16_t PROGRAM_SCREEN_START = 0x0200;
+const static uint16_t PROGRAM_SCREEN_SIZE = 32;
+
+const static uint64_t DEFAULT_FRAMES = 600;
+const static uint32_t WAV_SAMPLE_RATE = 48000;
+
+struct Options {
+    std::string path;
+    bool snake = false;
+    uint64_t frames = DEFAULT_FRAMES;
+    // UINT64_MAX when the run is limited by frames
+    uint64_t cycles = UINT64_MAX;
+    std::string ppm_prefix;
+    std::string raw_path;
+    std::string wav_path;
+    bool ppu_thread = false;
+    uint32_t run_ahead = 0;
+};
+
+// How far a run got, what the report is made from
+struct RunResult {
+    uint64_t frames = 0;
+    uint64_t cycles = 0;
+    // frames ahead included, so more than the cycles took with run-ahead.
+    // nullopt if the core does not count them.
+    std::optional<uint64_t> instructions;
+    // the CPU hit a BRK or an illegal opcode before the limit
+    bool stopped = false;
+    uint16_t program_counter = 0;
+};
+
+void print_usage() {
+    std::cerr
+        << "usage: nes_headless [options] <rom.nes | program.bin | --snake>\n"
+           "  --frames N      run for N frames (default 600)\n"
+           "  --cycles N      run until CPU cycle N instead, the last frame\n"
+           "                  is finished\n"
+           "  --ppm PREFIX    write every frame to PREFIX_000000.ppm, ...\n"
+           "  --raw FILE      write every frame to FILE as raw RGB24\n"
+           "  --wav FILE      write the sound to FILE (ROMs only)\n"
+           "  --ppu-thread    run the PPU on a thread of its own (ROMs "
+           "only)\n"
+           "  --run-ahead N   run N frames ahead and show the last of them\n"
+           "                  (programs only)\n";
+}
+
+// Returns false, after saying why, if the command line makes no sense
+bool parse_options(int argc, char *argv[], Options &options) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        // the options that take a value
+        bool has_value = i + 1 < argc;
+        if (std::strcmp(arg, "--snake") == 0) {
+            options.snake = true;
+        } else if (std::strcmp(arg, "--ppu-thread") == 0) {
+            options.ppu_thread = true;
+        } else if (std::strcmp(arg, "--frames") == 0 && has_value) {
+            options.frames = std::strtoull(argv[++i], nullptr, 10);
+        } else if (std::strcmp(arg, "--cycles") == 0 && has_value) {
+            options.cycles = std::strtoull(argv[++i], nullptr, 10);
+            options.frames = UINT64_MAX;
+        } else if (std::strcmp(arg, "--ppm") == 0 && has_value) {
+            options.ppm_prefix = argv[++i];
+        } else if (std::strcmp(arg, "--raw") == 0 && has_value) {
+            options.raw_path = argv[++i];
+        } else if (std::strcmp(arg, "--wav") == 0 && has_value) {
+            options.wav_path = argv[++i];
+        } else if (std::strcmp(arg, "--run-ahead") == 0 && has_value) {
+            options.run_ahead = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg[0] != '-' && options.path.empty()) {
+            options.path = arg;
+        } else {
+            std::cerr << "unknown or incomplete option " << arg << '\n';
+            return false;
+        }
+    }
+    if (options.path.empty() == !options.snake) {
+        std::cerr << "need one ROM, program or --snake\n";
+        return false;
+    }
+    return true;
+}
+
+bool is_rom(const std::string &path) {
+    return path.size() >= 4 && path.compare(path.size() - 4, 4, ".nes") == 0;
+}
+
+std::vector<uint8_t> read_program(const std::string &path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("could not open " + path);
+    }
+    return std::vector<uint8_t>((std::istreambuf_iterator<char>(in)),
+                                std::istreambuf_iterator<char>());
+}
+
+// Both sinks are optional, frames go to all there are
+void write_frame(std::vector<std::unique_ptr<FrameWriter>> &writers,
+                 const uint32_t *pixels, uint16_t width, uint16_t height) {
+    for (auto &writer : writers) {
+        writer->write(pixels, width, height);
+    }
+}
+
+RunResult run_rom(const Options &options,
+                  std::vector<std::unique_ptr<FrameWriter>> &writers) {
+    if (options.run_ahead != 0) {
+        throw std::runtime_error(
+            "run-ahead needs save states of the PPU and APU, which there "
+            "are none of yet");
+    }
+    Console console(options.path);
+    if (options.ppu_thread && !console.set_ppu_thread(true)) {
+        std::cerr << "this mapper needs the PPU on the CPU thread\n";
+    }
+
+    // the ring only has to hold a frame's worth, it is emptied every frame
+    std::unique_ptr<AudioRing> ring;
+    std::unique_ptr<WavWriter> wav;
+    std::vector<int16_t> samples;
+    if (!options.wav_path.empty()) {
+        ring = std::make_unique<AudioRing>(WAV_SAMPLE_RATE / 10);
+        wav = std::make_unique<WavWriter>(options.wav_path, WAV_SAMPLE_RATE);
+        samples.resize(ring->capacity());
+        console.get_apu().set_output(ring.get(), WAV_SAMPLE_RATE);
+    }
+
+    std::vector<uint32_t> pixels(SCREEN_WIDTH * SCREEN_HEIGHT);
+    RunResult result;
+    CPU &cpu = console.get_cpu();
+    uint64_t start_cycle = cpu.get_cycles();
+    while (result.frames < options.frames &&
+           cpu.get_cycles() < options.cycles) {
+        if (!console.run_frame()) {
+            result.stopped = true;
+            break;
+        }
+        result.frames++;
+
+        if (!writers.empty()) {
+            expand_nes_pixels(console.get_ppu().get_framebuffer(),
+                              pixels.data(), pixels.size());
+            write_frame(writers, pixels.data(), SCREEN_WIDTH, SCREEN_HEIGHT);
+        }
+        if (wav != nullptr) {
+            wav->write(samples.data(),
+                       ring->read(samples.data(), samples.size()));
+        }
+    }
+
+    result.cycles = cpu.get_cycles() - start_cycle;
+#if !defined(CPU_DYNAREC)
+    result.instructions = console.get_instructions();
+#endif
+    result.program_counter = cpu.get_program_counter();
+    return result;
+}
+
+RunResult run_program(const Options &options,
+                      std::vector<std::unique_ptr<FrameWriter>> &writers) {
+    std::vector<uint8_t> program =
+        options.snake ? get_game_code() : read_program(options.path);
+    CPU cpu;
+    cpu.load(program);
+    cpu.reset();
+
+    const size_t screen_size = PROGRAM_SCREEN_SIZE * PROGRAM_SCREEN_SIZE;
+    std::vector<uint8_t> indexes(screen_size);
+    std::vector<uint32_t> pixels(screen_size);
+    InstructionCounter counter;
+    RunAhead run_ahead(options.run_ahead);
+    // drawn once per real frame and the frames ahead get the same byte, so
+    // the real frames play out the same with any number of frames ahead
+    uint32_t random = 0x12345678;
+    // frames ahead only write out the one that is shown
+    auto run_frame = [&](bool shown) {
+        cpu.mem_write(0xFE, random);
+        if (!cpu.run(counter, cpu.get_cycles() + PROGRAM_CYCLES_PER_FRAME)) {
+            return false;
+        }
+        if (shown && !writers.empty()) {
+            for (size_t i = 0; i < screen_size; i++) {
+                indexes[i] = cpu.mem_read(PROGRAM_SCREEN_START + i);
+            }
+            expand_pixels(indexes.data(), pixels.data(), screen_size,
+                          SNAKE_PALETTE);
+            write_frame(writers, pixels.data(), PROGRAM_SCREEN_SIZE,
+                        PROGRAM_SCREEN_SIZE);
+        }
+        return true;
+    };
+
+    RunResult result;
+    uint64_t start_cycle = cpu.get_cycles();
+    while (result.frames < options.frames &&
+           cpu.get_cycles() < options.cycles) {
+        // xorshift
+        random ^= random << 13;
+        random ^= random >> 17;
+        random ^= random << 5;
+        if (!run_ahead.run(cpu, run_frame)) {
+            result.stopped = true;
+            break;
+        }
+        result.frames++;
+    }
+
+    result.cycles = cpu.get_cycles() - start_cycle;
+    result.instructions = counter.count;
+    result.program_counter = cpu.get_program_counter();
+    return result;
+}
+
+void report(const RunResult &result, double seconds) {
+    std::cout << "frames:           " << result.frames << '\n'
+              << "cycles:           " << result.cycles << '\n'
+              << "instructions:     ";
+    if (result.instructions) {
+        std::cout << *result.instructions << '\n';
+    } else {
+        std::cout << "not counted by the dynarec\n";
+    }
+    std::cout << "time:             " << seconds << " s\n";
+    if (result.instructions) {
+        std::cout << "instructions/sec: "
+                  << *result.instructions / seconds / 1e6 << " M\n";
+    }
+    std::cout << "cycles/sec:       " << result.cycles / seconds / 1e6
+              << " M (" << result.cycles / seconds / CPU_CLOCK_RATE
+              << "x a real NES)\n"
+              << "frames/sec:       " << result.frames / seconds << '\n';
+    if (result.stopped) {
+        std::cout << "stopped on BRK or an illegal opcode at $" << std::hex
+                  << result.program_counter << std::dec << '\n';
+    }
+}
+
+int main(int argc, char *argv[]) {
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        print_usage();
+        return 2;
+    }
+
+    try {
+        std::vector<std::unique_ptr<FrameWriter>> writers;
+        if (!options.ppm_prefix.empty()) {
+            writers.push_back(
+                std::make_unique<FrameWriter>(FRAME_PPM, options.ppm_prefix));
+        }
+        if (!options.raw_path.empty()) {
+            writers.push_back(
+                std::make_unique<FrameWriter>(FRAME_RAW, options.raw_path));
+        }
+
+        bool rom = !options.snake && is_rom(options.path);
+        auto start = std::chrono::steady_clock::now();
+        RunResult result = rom ? run_rom(options, writers)
+                               : run_program(options, writers);
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        report(result, elapsed.count());
+    } catch (const std::exception &error) {
+        std::cerr << error.what() << '\n';
+        return 1;
+    }
+}
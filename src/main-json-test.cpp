@@ -1,98 +1,548 @@
-#include <gtest/gtest.h>
-
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
-#include <iomanip>
 #include <iostream>
 #include <nlohmann/json.hpp>
 #include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
 #include "cpu/cpu.h"
+#include "cpu/opcode.h"
+
+// Runs the single instruction tests from
+// https://github.com/SingleStepTests/ProcessorTests against the CPU, a file
+// of 10,000 cases per opcode, and prints which opcodes pass.
+//
+// Each case sets the registers and the memory the instruction touches, runs
+// it with step() and compares the registers, the memory and the cycle count
+// with what they should be. The files are hundreds of megabytes of JSON all
+// together, so they are parsed as a stream of SAX events straight into the
+// case being built, without a DOM, and the files are shared out between
+// threads that have a CPU each.
+//
+// The nes6502 tests are the default, they leave out the decimal mode the
+// NES does not have.
+const static char *DEFAULT_TEST_DIRECTORY = "../ProcessorTests/nes6502/v1";
+const static int OPCODE_COUNT = 256;
 
 using json = nlohmann::json;
-using namespace std;
 
-template <typename T>
-void compare(string title, T check, T expected);
+struct Options {
+    std::string directory = DEFAULT_TEST_DIRECTORY;
+    // 0 for one per hardware thread
+    uint32_t threads = 0;
+    bool (CPU::*step)() = &CPU::step;
+    // skips the opcodes the CPU stops on
+    bool legal_only = false;
+};
 
-int main() {
-    for (int i = 0; i < 0x01; i++) {
-        stringstream ss;
-        // 7 = 2 for the hex code + len('.json')
-        ss << "../ProcessorTests/6502/v1/" << setfill('0') << setw(2)
-           << std::hex << i << ".json";
+// The registers and memory before or after a case
+struct TestState {
+    uint16_t program_counter;
+    uint8_t s, a, x, y, p;
+    std::vector<std::pair<uint16_t, uint8_t>> ram;
+};
 
-        string file_name = ss.str();
+struct TestCase {
+    std::string name;
+    TestState initial;
+    TestState final;
+    // the test lists every bus cycle, only how many there are is checked
+    uint32_t cycles;
+};
 
-        ifstream file_stream;
+// How one opcode's file went
+struct OpcodeResult {
+    bool found = false;
+    // the file is there but is not JSON of the expected shape
+    bool broken = false;
+    uint32_t cases = 0;
+    uint32_t passed = 0;
+    // failed cases that only got the cycle count wrong
+    uint32_t cycles_only = 0;
+    std::string first_failure;
+};
 
-        file_stream.open(file_name);
+// The JSON fields the parser cares about, by where they are
+enum TestField {
+    FIELD_OTHER,
+    FIELD_NAME,
+    FIELD_INITIAL,
+    FIELD_FINAL,
+    FIELD_CYCLES,
+    FIELD_PC,
+    FIELD_S,
+    FIELD_A,
+    FIELD_X,
+    FIELD_Y,
+    FIELD_P,
+    FIELD_RAM
+};
 
-        if (file_stream.fail()) {
-            cerr << "Failed to open the file, " << file_name << endl;
-            continue;
-        }
+// Depth of the containers in a test file:
+//
+//   [                              1  the cases
+//     {"name": ...,                2  a case
+//      "initial": {"pc": ...,      3  a state
+//                  "ram": [        4
+//                          [a, v]  5  a byte of memory
+//      "cycles": [                 3
+//                 [a, v, "read"]   4  a bus cycle
+const static int DEPTH_CASE = 2;
+const static int DEPTH_STATE = 3;
+const static int DEPTH_CYCLE = 4;
+const static int DEPTH_RAM_BYTE = 5;
 
-        json jobject = json::parse(file_stream);
-        file_stream.close();
+// Runs cases and keeps score for an opcode, with a CPU kept from case to
+// case so there is no setting one up 10,000 times
+class CaseRunner {
+   public:
+    explicit CaseRunner(bool (CPU::*step)()) : step(step) {}
+
+    void run(const TestCase &test, OpcodeResult &result);
+
+   private:
+    template <typename T>
+    void compare(const char *what, T got, T expected);
+
+    bool (CPU::*step)();
+    CPU cpu;
+    // what the case got wrong, or empty
+    std::string failure;
+    bool cycles_wrong;
+};
+
+// The SAX side of nlohmann::json. Builds each case in place and hands it to
+// the CaseRunner as soon as its object closes, so memory stays at one case
+// whatever the size of the file.
+class TestFileParser {
+   public:
+    TestFileParser(CaseRunner &runner, OpcodeResult &result)
+        : runner(runner), result(result), depth(0), ram_index(0) {
+        fields.fill(FIELD_OTHER);
+    }
 
-        string name = jobject[0]["name"];
-        stringstream split_string(name);
-        string temp;
-        vector<uint8_t> program;
-        while (getline(split_string, temp, ' ')) {
-            int hex_code = stoi(temp, nullptr, 16);
-            program.push_back(hex_code);
+    bool null() { return true; }
+    bool boolean(bool) { return true; }
+    bool number_integer(json::number_integer_t value) {
+        return number(value);
+    }
+    bool number_unsigned(json::number_unsigned_t value) {
+        return number(value);
+    }
+    bool number_float(json::number_float_t, const json::string_t &) {
+        return true;
+    }
+    bool string(json::string_t &value) {
+        if (depth == DEPTH_CASE && fields[DEPTH_CASE] == FIELD_NAME) {
+            test.name = value;
         }
+        return true;
+    }
+    bool binary(json::binary_t &) { return true; }
 
-        CPU cpu;
-        cpu.load(program);
-        // cout << jobject[0]["initial"]["pc"] << '\n';
-        cpu.set_program_counter(jobject[0]["initial"]["pc"]);
+    bool start_object(size_t) {
+        if (++depth >= MAX_DEPTH) {
+            return false;
+        }
+        fields[depth] = FIELD_OTHER;
+        if (depth == DEPTH_CASE) {
+            test.name.clear();
+            test.initial.ram.clear();
+            test.final.ram.clear();
+            test.cycles = 0;
+        }
+        return true;
+    }
 
-        cpu.set_register_a(jobject[0]["initial"]["a"]);
-        cpu.set_register_x(jobject[0]["initial"]["x"]);
-        cpu.set_register_y(jobject[0]["initial"]["y"]);
+    bool end_object() {
+        if (depth == DEPTH_CASE) {
+            runner.run(test, result);
+        }
+        depth--;
+        return true;
+    }
 
-        cpu.set_stack_pointer(jobject[0]["initial"]["s"]);
+    bool key(json::string_t &value) {
+        fields[depth] = field_of(value);
+        return true;
+    }
 
-        cpu.set_status(jobject[0]["initial"]["p"]);
+    bool start_array(size_t) {
+        if (++depth >= MAX_DEPTH) {
+            return false;
+        }
+        fields[depth] = FIELD_OTHER;
+        if (depth == DEPTH_CYCLE && fields[DEPTH_CASE] == FIELD_CYCLES) {
+            test.cycles++;
+        }
+        ram_index = 0;
+        return true;
+    }
 
-        for (auto& val : jobject[0]["initial"]["ram"]) {
-            cpu.mem_write(val[0], val[1]);
+    bool end_array() {
+        TestState *current = state();
+        if (current != nullptr && depth == DEPTH_RAM_BYTE &&
+            fields[DEPTH_STATE] == FIELD_RAM) {
+            current->ram.emplace_back(ram_address, ram_value);
         }
+        depth--;
+        return true;
+    }
 
-        cpu.run();
+    bool parse_error(size_t, const std::string &,
+                     const nlohmann::detail::exception &error) {
+        result.broken = true;
+        result.first_failure = error.what();
+        return false;
+    }
 
-        auto final_result = jobject[0]["final"];
-        
-        compare<int>("Program Counter", cpu.get_program_counter(), final_result["pc"]);
-        
-        compare<int>("Register A", cpu.get_register_a(), final_result["a"]);
-        compare<int>("Register X", cpu.get_register_x(), final_result["x"]);
-        compare<int>("Register Y", cpu.get_register_y(), final_result["y"]);
+   private:
+    const static int MAX_DEPTH = 8;
 
-        compare<int>("Stack pointer", cpu.get_status(), final_result["s"]);
+    static TestField field_of(const std::string &key) {
+        const static std::pair<const char *, TestField> names[] = {
+            {"name", FIELD_NAME}, {"initial", FIELD_INITIAL},
+            {"final", FIELD_FINAL}, {"cycles", FIELD_CYCLES},
+            {"pc", FIELD_PC},     {"s", FIELD_S},
+            {"a", FIELD_A},       {"x", FIELD_X},
+            {"y", FIELD_Y},       {"p", FIELD_P},
+            {"ram", FIELD_RAM}};
+        for (auto &[name, field] : names) {
+            if (key == name) {
+                return field;
+            }
+        }
+        return FIELD_OTHER;
+    }
 
-        compare<int>("CPU status", cpu.get_status(), final_result["p"]);
+    // the state the parser is in, nullptr outside of one
+    TestState *state() {
+        if (depth < DEPTH_STATE) {
+            return nullptr;
+        }
+        switch (fields[DEPTH_CASE]) {
+            case FIELD_INITIAL:
+                return &test.initial;
+            case FIELD_FINAL:
+                return &test.final;
+            default:
+                return nullptr;
+        }
+    }
 
+    bool number(uint64_t value) {
+        TestState *current = state();
+        if (current == nullptr) {
+            return true;
+        }
+        if (depth == DEPTH_STATE) {
+            switch (fields[DEPTH_STATE]) {
+                case FIELD_PC:
+                    current->program_counter = value;
+                    break;
+                case FIELD_S:
+                    current->s = value;
+                    break;
+                case FIELD_A:
+                    current->a = value;
+                    break;
+                case FIELD_X:
+                    current->x = value;
+                    break;
+                case FIELD_Y:
+                    current->y = value;
+                    break;
+                case FIELD_P:
+                    current->p = value;
+                    break;
+                default:
+                    break;
+            }
+        } else if (depth == DEPTH_RAM_BYTE &&
+                   fields[DEPTH_STATE] == FIELD_RAM) {
+            if (ram_index == 0) {
+                ram_address = value;
+            } else {
+                ram_value = value;
+            }
+            ram_index++;
+        }
+        return true;
+    }
 
-        for (auto & val : final_result["ram"]) {
-            uint8_t read_val = cpu.mem_read(val[0]);
-            stringstream ss;
-            ss << "Ram at " << val[0];
+    CaseRunner &runner;
+    OpcodeResult &result;
+    TestCase test;
+    int depth;
+    // the key last seen at each depth
+    std::array<TestField, MAX_DEPTH> fields;
+    int ram_index;
+    uint16_t ram_address;
+    uint8_t ram_value;
+};
 
-            compare<int>(ss.str(), read_val, val[1]);
+void CaseRunner::run(const TestCase &test, OpcodeResult &result) {
+    // the registers first, setting A, X and Y changes the status
+    cpu.set_register_a(test.initial.a);
+    cpu.set_register_x(test.initial.x);
+    cpu.set_register_y(test.initial.y);
+    cpu.set_stack_pointer(test.initial.s);
+    cpu.set_status(test.initial.p);
+    cpu.set_program_counter(test.initial.program_counter);
+    // every address the instruction reads is in here, so what earlier
+    // cases left behind elsewhere does not matter
+    for (auto [address, value] : test.initial.ram) {
+        cpu.mem_write(address, value);
+    }
+
+    uint64_t start = cpu.get_cycles();
+    (cpu.*step)();
+
+    failure.clear();
+    cycles_wrong = false;
+    compare("PC", cpu.get_program_counter(), test.final.program_counter);
+    compare("A", cpu.get_register_a(), test.final.a);
+    compare("X", cpu.get_register_x(), test.final.x);
+    compare("Y", cpu.get_register_y(), test.final.y);
+    compare("S", cpu.get_stack_pointer(), test.final.s);
+    compare("P", cpu.get_status(), test.final.p);
+    for (auto [address, value] : test.final.ram) {
+        if (cpu.mem_read(address) != value && failure.empty()) {
+            std::ostringstream what;
+            what << "RAM $" << std::hex << address;
+            compare(what.str().c_str(), cpu.mem_read(address), value);
         }
-        
+    }
+    bool registers_wrong = !failure.empty();
+    uint64_t cycles = cpu.get_cycles() - start;
+    if (cycles != test.cycles) {
+        compare("cycles", cycles, static_cast<uint64_t>(test.cycles));
+        cycles_wrong = true;
+    }
+
+    result.cases++;
+    if (failure.empty()) {
+        result.passed++;
+        return;
+    }
+    if (cycles_wrong && !registers_wrong) {
+        result.cycles_only++;
+    }
+    if (result.first_failure.empty()) {
+        result.first_failure = "\"" + test.name + "\": " + failure;
     }
 }
 
+// Only describes the first thing a case got wrong
 template <typename T>
-void compare(string title, T check, T expected) {
-    if (check != expected) {
-        cerr << title << " is not equivelant.\nExpected: " << expected
-             << "\nGot: " << check << '\n';
+void CaseRunner::compare(const char *what, T got, T expected) {
+    if (got == expected || !failure.empty()) {
+        return;
+    }
+    std::ostringstream description;
+    description << what << " is $" << std::hex << +got << ", expected $"
+                << +expected;
+    failure = description.str();
+}
+
+std::string test_file_name(const std::string &directory, int opcode) {
+    char name[16];
+    std::snprintf(name, sizeof(name), "/%02x.json", opcode);
+    return directory + name;
+}
+
+void run_file(const Options &options, int opcode, CaseRunner &runner,
+              OpcodeResult &result) {
+    std::ifstream file(test_file_name(options.directory, opcode),
+                       std::ios::binary | std::ios::ate);
+    if (!file) {
+        return;
+    }
+    result.found = true;
+    // all of it at once, parsing from memory is a lot faster than from a
+    // stream
+    std::string text(file.tellg(), '\0');
+    file.seekg(0);
+    file.read(text.data(), text.size());
+
+    TestFileParser parser(runner, result);
+    if (!json::sax_parse(text.begin(), text.end(), &parser)) {
+        result.broken = true;
+    }
+}
+
+// The matrix, a character per opcode with the low nibble across:
+//
+//   .  every case passed       c  only cycle counts were wrong
+//   X  cases failed            !  the file is broken
+//   ?  no file                    (blank) skipped
+void print_matrix(const std::vector<OpcodeResult> &results,
+                  const std::vector<bool> &skipped) {
+    std::cout << "   ";
+    for (int low = 0; low < 16; low++) {
+        std::cout << ' ' << std::hex << std::uppercase << low;
+    }
+    std::cout << '\n';
+    for (int high = 0; high < 16; high++) {
+        std::cout << ' ' << std::hex << std::uppercase << high << '_';
+        for (int low = 0; low < 16; low++) {
+            int opcode = high << 4 | low;
+            const OpcodeResult &result = results[opcode];
+            char mark;
+            if (skipped[opcode]) {
+                mark = ' ';
+            } else if (!result.found) {
+                mark = '?';
+            } else if (result.broken) {
+                mark = '!';
+            } else if (result.passed == result.cases) {
+                mark = '.';
+            } else if (result.passed + result.cycles_only == result.cases) {
+                mark = 'c';
+            } else {
+                mark = 'X';
+            }
+            std::cout << ' ' << mark;
+        }
+        std::cout << '\n';
+    }
+    std::cout << std::dec << std::nouppercase;
+}
+
+void print_usage() {
+    std::cerr << "usage: json_test [options] [directory]\n"
+                 "  directory       the ProcessorTests files, 00.json to "
+                 "ff.json\n"
+                 "                  (default "
+              << DEFAULT_TEST_DIRECTORY
+              << ")\n"
+                 "  --threads N     how many threads to run files on "
+                 "(default one\n"
+                 "                  per hardware thread)\n"
+                 "  --core NAME     switch, table or cached (default the "
+                 "one step()\n"
+                 "                  uses)\n"
+                 "  --legal         only the official opcodes\n";
+}
+
+// Returns false, after saying why, if the command line makes no sense
+bool parse_options(int argc, char *argv[], Options &options) {
+    bool has_directory = false;
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        // the options that take a value
+        bool has_value = i + 1 < argc;
+        if (std::strcmp(arg, "--legal") == 0) {
+            options.legal_only = true;
+        } else if (std::strcmp(arg, "--threads") == 0 && has_value) {
+            options.threads = std::strtoul(argv[++i], nullptr, 10);
+        } else if (std::strcmp(arg, "--core") == 0 && has_value) {
+            const char *core = argv[++i];
+            if (std::strcmp(core, "switch") == 0) {
+                options.step = &CPU::step_switch;
+            } else if (std::strcmp(core, "table") == 0) {
+                options.step = &CPU::step_table;
+            } else if (std::strcmp(core, "cached") == 0) {
+                options.step = &CPU::step_cached;
+            } else {
+                std::cerr << "unknown core " << core << '\n';
+                return false;
+            }
+        } else if (arg[0] != '-' && !has_directory) {
+            options.directory = arg;
+            has_directory = true;
+        } else {
+            std::cerr << "unknown or incomplete option " << arg << '\n';
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        print_usage();
+        return 2;
+    }
+
+    std::vector<bool> skipped(OPCODE_COUNT, false);
+    std::vector<int> queue;
+    for (int opcode = 0; opcode < OPCODE_COUNT; opcode++) {
+        skipped[opcode] =
+            options.legal_only && opcodes[opcode].mnemonic == ILLEGAL;
+        if (!skipped[opcode]) {
+            queue.push_back(opcode);
+        }
+    }
+    uint32_t threads = options.threads != 0
+                           ? options.threads
+                           : std::max(std::thread::hardware_concurrency(), 1u);
+    threads = std::min<uint32_t>(threads, queue.size());
+
+    // each file goes to whichever thread asks first, and only that thread
+    // touches its result
+    std::vector<OpcodeResult> results(OPCODE_COUNT);
+    std::atomic<size_t> next(0);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (uint32_t i = 0; i < threads; i++) {
+        workers.emplace_back([&] {
+            CaseRunner runner(options.step);
+            for (size_t index = next++; index < queue.size();
+                 index = next++) {
+                run_file(options, queue[index], runner,
+                         results[queue[index]]);
+            }
+        });
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    print_matrix(results, skipped);
+
+    // a missing file fails the run too, a half downloaded test suite should
+    // not pass
+    uint64_t cases = 0, passed = 0;
+    int files = 0, failed_files = 0;
+    for (int opcode : queue) {
+        const OpcodeResult &result = results[opcode];
+        cases += result.cases;
+        passed += result.passed;
+        if (!result.found) {
+            failed_files++;
+            std::printf("%02x no file\n", opcode);
+            continue;
+        }
+        files++;
+        if (result.broken || result.passed != result.cases) {
+            failed_files++;
+            std::printf("%02x %5u/%-5u passed, %5u wrong on cycles only  "
+                        "%s\n",
+                        opcode, result.passed, result.cases,
+                        result.cycles_only, result.first_failure.c_str());
+        }
+    }
+    std::cout << files << " files, " << passed << '/' << cases
+              << " cases passed in " << elapsed.count() << " s on "
+              << threads << " threads\n";
+
+    if (files == 0) {
+        std::cerr << "no test files in " << options.directory << '\n';
+        return 1;
     }
+    return failed_files == 0 ? 0 : 1;
 }
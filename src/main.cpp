@@ -2,32 +2,78 @@
 #include <SDL_image.h>
 #include <SDL_ttf.h>
 
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
 #include <iostream>
 #include <random>
-#include <vector>
-#include <chrono>
 #include <thread>
+#include <vector>
 
 #include "cpu/cpu.h"
-
-void cpu_callback(CPU& cpu);
-void handle_user_input(CPU& cpu);
-
-SDL_Color get_color(uint8_t byte);
-bool read_screen_state(CPU& cpu, uint8_t* frame);
-
-std::vector<uint8_t> get_game_code();
+#include "frontend/frame_pacer.h"
+#include "frontend/input_queue.h"
+#include "frontend/palette.h"
+#include "frontend/run_ahead.h"
+#include "frontend/triple_buffer.h"
+#include "snake.h"
+
+// The snake game has no clock of its own, it moves once per pass through a
+// busy loop of about 2600 cycles. 400 cycles per frame at 60 frames per
+// second makes that about 9 moves a second.
+const static double FRAMES_PER_SECOND = 60;
+const static uint64_t CYCLES_PER_FRAME = 400;
+
+// The game draws a color index per byte into a 32x32 screen
+const static uint16_t SCREEN_START = 0x0200;
+const static int SCREEN_SIZE = 32;
+
+// The game reads the last key pressed from here
+const static uint16_t KEY_ADDRESS = 0xFF;
+
+using Screen = std::array<uint32_t, SCREEN_SIZE * SCREEN_SIZE>;
+
+// Everything the emulation thread and the main thread share
+struct Shared {
+    TripleBuffer<Screen> screens;
+    InputQueue input;
+    // either thread clears it to end the game
+    std::atomic<bool> running{true};
+};
+
+void emulate(Shared& shared, bool uncapped, uint32_t run_ahead_frames);
+bool handle_user_input(InputQueue& input, uint8_t& last_key);
+bool update_screen(CPU& cpu, Screen& screen);
 
 std::random_device dev;
 std::mt19937 gen(dev());
 std::uniform_int_distribution<> dis(1, 16);  // distribution in range [1, 16]
 
-uint8_t screen_state[32 * 3 * 32] = {0};
-SDL_Renderer* renderer;
-SDL_Texture* texture;
+// The game runs on a thread of its own, one frame at a time: the input that
+// came in, a fixed budget of CPU cycles, then the screen goes out through a
+// triple buffer and the pacer waits for the next frame. This thread only
+// polls SDL for input and presents whatever frame is newest, so waiting for
+// vsync or a slow driver never holds up the game. With --uncapped the pacer
+// never waits, and the instructions run per second are printed once a
+// second. --run-ahead N shows every frame as it will be N frames later,
+// which takes N frames of lag out of the controls (see RunAhead).
+int main(int argc, char* argv[]) {
+    bool uncapped = false;
+    uint32_t run_ahead_frames = 0;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--uncapped") == 0) {
+            uncapped = true;
+        } else if (std::strcmp(argv[i], "--run-ahead") == 0 &&
+                   i + 1 < argc) {
+            run_ahead_frames = std::strtoul(argv[++i], nullptr, 10);
+        }
+    }
 
-int main() {
     if (SDL_Init(SDL_INIT_VIDEO) < 0) {
         SDL_Log("SDL could not initialize! SDL_Error: %s\n", SDL_GetError());
         return 1;
@@ -42,7 +88,8 @@ int main() {
         return 1;
     }
 
-    renderer = SDL_CreateRenderer(
+    // vsync only holds up this thread, the game keeps its own pace
+    SDL_Renderer* renderer = SDL_CreateRenderer(
         window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
 
     if (renderer == nullptr) {
@@ -53,20 +100,36 @@ int main() {
 
     SDL_RenderSetScale(renderer, 10, 10);
 
-    texture = SDL_CreateTexture(
-        renderer, SDL_PIXELFORMAT_RGB24, SDL_TEXTUREACCESS_STREAMING, 32, 32);
+    SDL_Texture* texture = SDL_CreateTexture(
+        renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+        SCREEN_SIZE, SCREEN_SIZE);
     if (texture == nullptr) {
         SDL_Log("Texture could not be created! SDL_Error: %s\n",
                 SDL_GetError());
         return 1;
     }
 
-    std::vector<uint8_t> game_code = get_game_code();
-    CPU cpu;
-    cpu.load(game_code);
-    cpu.reset();
-    cpu.run_with_callback(cpu_callback);
+    Shared shared;
+    std::thread emulation(emulate, std::ref(shared), uncapped,
+                          run_ahead_frames);
 
+    uint8_t last_key = 0;
+    while (shared.running.load(std::memory_order_relaxed)) {
+        if (!handle_user_input(shared.input, last_key)) {
+            shared.running.store(false, std::memory_order_relaxed);
+        }
+
+        if (shared.screens.update()) {
+            SDL_UpdateTexture(texture, nullptr, shared.screens.front().data(),
+                              SCREEN_SIZE * sizeof(uint32_t));
+            SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+            SDL_RenderPresent(renderer);
+        } else {
+            // nothing new to show, and no vsync to wait on either
+            SDL_Delay(1);
+        }
+    }
+    emulation.join();
 
     SDL_DestroyTexture(texture);
     SDL_DestroyRenderer(renderer);
@@ -74,111 +137,113 @@ int main() {
     SDL_Quit();
 }
 
-void cpu_callback(CPU& cpu) {
-    handle_user_input(cpu);
-    // TODO:
-    int lol = dis(gen);
-    cpu.mem_write(0xFE, lol);
-    if (read_screen_state(cpu, screen_state)) {
+// The emulation thread, runs until the game is over or the main thread says
+// to stop
+void emulate(Shared& shared, bool uncapped, uint32_t run_ahead_frames) {
+    std::vector<uint8_t> game_code = get_game_code();
+    CPU cpu;
+    cpu.load(game_code);
+    cpu.reset();
+    // one chunk per row of the screen
+    cpu.watch_writes(SCREEN_START, SCREEN_SIZE * SCREEN_SIZE);
+
+    // the screen as of the last frame, the back buffer is older than that
+    Screen screen;
+    FramePacer pacer(uncapped ? 0 : FRAMES_PER_SECOND);
+    InstructionCounter counter;
+    RunAhead run_ahead(run_ahead_frames);
+    // the game reads a random byte from 0xFE, once a frame is as often as
+    // it ever looks. It is drawn once per real frame and the frames ahead
+    // get the same one, or they would show a future that never happens.
+    uint8_t random = 0;
+    // frames ahead only draw the last one, the dirty rows of the others
+    // stay marked until then
+    auto run_frame = [&](bool shown) {
+        cpu.mem_write(0xFE, random);
+        bool running = cpu.run(counter, cpu.get_cycles() + CYCLES_PER_FRAME);
+        if (shown && update_screen(cpu, screen)) {
+            shared.screens.back() = screen;
+            shared.screens.publish();
+        }
+        return running;
+    };
+    auto report_start = std::chrono::steady_clock::now();
+    while (shared.running.load(std::memory_order_relaxed)) {
+        InputEvent event;
+        while (shared.input.pop(event)) {
+            cpu.mem_write(event.address, event.value);
+        }
 
-        SDL_UpdateTexture(texture, nullptr, screen_state, 32 * 3);
-        SDL_RenderCopy(renderer, texture, nullptr, nullptr);
-        SDL_RenderPresent(renderer);
-    }
+        random = dis(gen);
+        if (!run_ahead.run(cpu, run_frame)) {
+            // BRK, the game is over
+            shared.running.store(false, std::memory_order_relaxed);
+        }
 
-    std::this_thread::sleep_for(std::chrono::microseconds(70000));
+        if (uncapped) {
+            auto now = std::chrono::steady_clock::now();
+            std::chrono::duration<double> elapsed = now - report_start;
+            if (elapsed.count() >= 1) {
+                std::cout << counter.count / elapsed.count() / 1e6
+                          << " M instructions/sec" << std::endl;
+                counter.count = 0;
+                report_start = now;
+            }
+        }
+        pacer.wait_for_next_frame();
+    }
 }
 
-void handle_user_input(CPU& cpu) {
-    SDL_PumpEvents();
+// Returns false once the window is closed or escape is pressed. Keys go to
+// the game only when they change, it keeps the last one anyway.
+bool handle_user_input(InputQueue& input, uint8_t& last_key) {
+    SDL_Event event;
+    while (SDL_PollEvent(&event)) {
+        if (event.type == SDL_QUIT) {
+            return false;
+        }
+    }
     const Uint8* keyboard = SDL_GetKeyboardState(nullptr);
 
+    uint8_t key = last_key;
     if (keyboard[SDL_SCANCODE_ESCAPE]) {
-        exit(0);
+        return false;
     } else if (keyboard[SDL_SCANCODE_W]) {
-        cpu.mem_write(0xFF, 0x77);
+        key = 0x77;
     } else if (keyboard[SDL_SCANCODE_A]) {
-        cpu.mem_write(0xFF, 0x61);
+        key = 0x61;
     } else if (keyboard[SDL_SCANCODE_S]) {
-        cpu.mem_write(0xFF, 0x73);
+        key = 0x73;
     } else if (keyboard[SDL_SCANCODE_D]) {
-        cpu.mem_write(0xFF, 0x64);
+        key = 0x64;
+    }
+    // a key that did not fit is sent again on the next poll
+    if (key != last_key && input.push({KEY_ADDRESS, key})) {
+        last_key = key;
     }
+    return true;
 }
 
-SDL_Color get_color(uint8_t byte) {
-    switch (byte) {
-        case 0:
-            return SDL_Color{0, 0, 0, 255};
-        case 1:
-            return SDL_Color{255, 255, 255, 255};
-        case 2:
-        case 9:
-            return SDL_Color{128, 128, 128, 255};
-        case 3:
-        case 10:
-            return SDL_Color{255, 0, 0, 255};
-        case 4:
-        case 11:
-            return SDL_Color{0, 255, 0, 255};
-        case 5:
-        case 12:
-            return SDL_Color{0, 0, 255, 255};
-        case 6:
-        case 13:
-            return SDL_Color{255, 0, 255, 255};
-        case 7:
-        case 14:
-            return SDL_Color{255, 255, 0, 255};
-        default:
-            return SDL_Color{0, 255, 255, 255};
+// Converts the rows the CPU wrote to since the last frame into screen.
+// Returns false if nothing was drawn, then there is nothing new to show.
+bool update_screen(CPU& cpu, Screen& screen) {
+    uint64_t dirty = cpu.take_dirty_chunks();
+    if (dirty == 0) {
+        return false;
     }
-}
-bool read_screen_state(CPU& cpu, uint8_t* frame) {
-    int frame_i = 0;
-    bool update = false;
-    for (uint16_t i = 0x0200; i < 0x0600; i++) {
-        uint8_t color_i = cpu.mem_read(i);
-        // print out color_i
-        SDL_Color color = get_color(color_i);
-        if (frame[frame_i] != color.r || frame[frame_i + 1] != color.g || frame[frame_i + 2] != color.b) {
-        std::cout << "color_i: " << (int)color_i << std::endl;
-            frame[frame_i] = color.r;
-            frame[frame_i + 1] = color.g;
-            frame[frame_i + 2] = color.b;
-            update = true;
+
+    int first = std::countr_zero(dirty);
+    int last = 63 - std::countl_zero(dirty);
+    uint8_t row[SCREEN_SIZE];
+    for (int y = first; y <= last; y++) {
+        if (!(dirty & (uint64_t{1} << y))) {
+            continue;
         }
-        frame_i += 3;
+        for (int x = 0; x < SCREEN_SIZE; x++) {
+            row[x] = cpu.mem_read(SCREEN_START + y * SCREEN_SIZE + x);
+        }
+        expand_pixels(row, &screen[y * SCREEN_SIZE], SCREEN_SIZE,
+                      SNAKE_PALETTE);
     }
-    return update;
+    return true;
 }
-
-std::vector<uint8_t> get_game_code() {
-    return {
-        0x20, 0x06, 0x06, 0x20, 0x38, 0x06, 0x20, 0x0d, 0x06, 0x20, 0x2a, 0x06,
-        0x60, 0xa9, 0x02, 0x85, 0x02, 0xa9, 0x04, 0x85, 0x03, 0xa9, 0x11, 0x85,
-        0x10, 0xa9, 0x10, 0x85, 0x12, 0xa9, 0x0f, 0x85, 0x14, 0xa9, 0x04, 0x85,
-        0x11, 0x85, 0x13, 0x85, 0x15, 0x60, 0xa5, 0xfe, 0x85, 0x00, 0xa5, 0xfe,
-        0x29, 0x03, 0x18, 0x69, 0x02, 0x85, 0x01, 0x60, 0x20, 0x4d, 0x06, 0x20,
-        0x8d, 0x06, 0x20, 0xc3, 0x06, 0x20, 0x19, 0x07, 0x20, 0x20, 0x07, 0x20,
-        0x2d, 0x07, 0x4c, 0x38, 0x06, 0xa5, 0xff, 0xc9, 0x77, 0xf0, 0x0d, 0xc9,
-        0x64, 0xf0, 0x14, 0xc9, 0x73, 0xf0, 0x1b, 0xc9, 0x61, 0xf0, 0x22, 0x60,
-        0xa9, 0x04, 0x24, 0x02, 0xd0, 0x26, 0xa9, 0x01, 0x85, 0x02, 0x60, 0xa9,
-        0x08, 0x24, 0x02, 0xd0, 0x1b, 0xa9, 0x02, 0x85, 0x02, 0x60, 0xa9, 0x01,
-        0x24, 0x02, 0xd0, 0x10, 0xa9, 0x04, 0x85, 0x02, 0x60, 0xa9, 0x02, 0x24,
-        0x02, 0xd0, 0x05, 0xa9, 0x08, 0x85, 0x02, 0x60, 0x60, 0x20, 0x94, 0x06,
-        0x20, 0xa8, 0x06, 0x60, 0xa5, 0x00, 0xc5, 0x10, 0xd0, 0x0d, 0xa5, 0x01,
-        0xc5, 0x11, 0xd0, 0x07, 0xe6, 0x03, 0xe6, 0x03, 0x20, 0x2a, 0x06, 0x60,
-        0xa2, 0x02, 0xb5, 0x10, 0xc5, 0x10, 0xd0, 0x06, 0xb5, 0x11, 0xc5, 0x11,
-        0xf0, 0x09, 0xe8, 0xe8, 0xe4, 0x03, 0xf0, 0x06, 0x4c, 0xaa, 0x06, 0x4c,
-        0x35, 0x07, 0x60, 0xa6, 0x03, 0xca, 0x8a, 0xb5, 0x10, 0x95, 0x12, 0xca,
-        0x10, 0xf9, 0xa5, 0x02, 0x4a, 0xb0, 0x09, 0x4a, 0xb0, 0x19, 0x4a, 0xb0,
-        0x1f, 0x4a, 0xb0, 0x2f, 0xa5, 0x10, 0x38, 0xe9, 0x20, 0x85, 0x10, 0x90,
-        0x01, 0x60, 0xc6, 0x11, 0xa9, 0x01, 0xc5, 0x11, 0xf0, 0x28, 0x60, 0xe6,
-        0x10, 0xa9, 0x1f, 0x24, 0x10, 0xf0, 0x1f, 0x60, 0xa5, 0x10, 0x18, 0x69,
-        0x20, 0x85, 0x10, 0xb0, 0x01, 0x60, 0xe6, 0x11, 0xa9, 0x06, 0xc5, 0x11,
-        0xf0, 0x0c, 0x60, 0xc6, 0x10, 0xa5, 0x10, 0x29, 0x1f, 0xc9, 0x1f, 0xf0,
-        0x01, 0x60, 0x4c, 0x35, 0x07, 0xa0, 0x00, 0xa5, 0xfe, 0x91, 0x00, 0x60,
-        0xa6, 0x03, 0xa9, 0x00, 0x81, 0x10, 0xa2, 0x00, 0xa9, 0x01, 0x81, 0x10,
-        0x60, 0xa2, 0x00, 0xea, 0xea, 0xca, 0xd0, 0xfb, 0x60};
-}
\ No newline at end of file
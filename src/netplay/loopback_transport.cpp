@@ -0,0 +1,63 @@
+#include "loopback_transport.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+LoopbackTransport::LoopbackTransport(NetworkConditions conditions)
+    : conditions(conditions),
+      peer(nullptr),
+      now(0),
+      // xorshift gets stuck at 0
+      random(conditions.seed != 0 ? conditions.seed : 1),
+      sent(0),
+      lost(0) {}
+
+void LoopbackTransport::connect(LoopbackTransport &peer) {
+    this->peer = &peer;
+    peer.peer = this;
+}
+
+uint32_t LoopbackTransport::next_random() {
+    random ^= random << 13;
+    random ^= random >> 17;
+    random ^= random << 5;
+    return random;
+}
+
+void LoopbackTransport::send(const uint8_t *data, size_t size) {
+    sent++;
+    if (peer == nullptr ||
+        next_random() % 1000 < conditions.loss_per_mille) {
+        lost++;
+        return;
+    }
+    uint64_t delay = conditions.latency;
+    if (conditions.jitter != 0) {
+        delay += next_random() % (conditions.jitter + 1);
+    }
+    // the clocks of the two ends may differ, the packet arrives after the
+    // delay on the receiving end's clock
+    Packet packet;
+    packet.arrival = peer->now + delay;
+    packet.bytes.assign(data, data + size);
+    peer->in_flight.push_back(std::move(packet));
+}
+
+size_t LoopbackTransport::receive(uint8_t *data) {
+    // the first packet to have arrived, and of those the first sent
+    auto arrived = in_flight.end();
+    for (auto it = in_flight.begin(); it != in_flight.end(); ++it) {
+        if (it->arrival <= now &&
+            (arrived == in_flight.end() || it->arrival < arrived->arrival)) {
+            arrived = it;
+        }
+    }
+    if (arrived == in_flight.end()) {
+        return 0;
+    }
+    size_t size = std::min(arrived->bytes.size(), NETPLAY_PACKET_SIZE);
+    std::memcpy(data, arrived->bytes.data(), size);
+    in_flight.erase(arrived);
+    return size;
+}
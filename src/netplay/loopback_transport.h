@@ -0,0 +1,64 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "transport.h"
+
+// What the network between two LoopbackTransports is like. Times are in
+// ticks, which the tests make one per frame.
+struct NetworkConditions {
+    // ticks every packet takes to arrive
+    uint32_t latency = 0;
+    // up to this many more ticks, picked at random per packet, which also
+    // makes packets overtake each other
+    uint32_t jitter = 0;
+    // out of 1000 packets, how many are lost
+    uint32_t loss_per_mille = 0;
+    // the random numbers for jitter and loss, so a test plays out the same
+    // every time
+    uint32_t seed = 1;
+};
+
+// Both ends of a pretend network in one process, for testing netplay
+// without sockets or real time. Each end holds the packets on their way to
+// it, and tick() moves its clock on. Not thread safe, both ends belong on
+// the same thread.
+class LoopbackTransport : public Transport {
+   public:
+    explicit LoopbackTransport(NetworkConditions conditions = {});
+
+    LoopbackTransport(const LoopbackTransport &) = delete;
+    LoopbackTransport &operator=(const LoopbackTransport &) = delete;
+
+    // Connects the two ends both ways. Packets sent before then are lost.
+    void connect(LoopbackTransport &peer);
+
+    // Lets a tick of time pass on this end
+    void tick() { now++; }
+
+    void send(const uint8_t *data, size_t size) override;
+    size_t receive(uint8_t *data) override;
+
+    uint64_t get_sent() { return sent; }
+    uint64_t get_lost() { return lost; }
+
+   private:
+    struct Packet {
+        // the tick of the receiving end it shows up at
+        uint64_t arrival;
+        std::vector<uint8_t> bytes;
+    };
+
+    // xorshift
+    uint32_t next_random();
+
+    NetworkConditions conditions;
+    LoopbackTransport *peer;
+    uint64_t now;
+    uint32_t random;
+    // on their way to this end, in the order they were sent
+    std::vector<Packet> in_flight;
+    uint64_t sent;
+    uint64_t lost;
+};
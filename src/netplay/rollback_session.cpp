@@ -0,0 +1,163 @@
+#include "rollback_session.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+// A packet is the local inputs the other side does not have yet and how far
+// this side has theirs:
+//
+//   u32 frame of the first input, u8 input count, the inputs,
+//   u32 remote inputs this side has every one of before
+const static size_t PACKET_HEADER_SIZE = 5;
+const static size_t PACKET_ACK_SIZE = 4;
+static_assert(PACKET_HEADER_SIZE + NETPLAY_INPUT_HISTORY + PACKET_ACK_SIZE <=
+              NETPLAY_PACKET_SIZE);
+
+// Not any frame there is, so a fresh history has no remote input in it
+const static uint32_t NO_FRAME = UINT32_MAX;
+
+RollbackSession::RollbackSession(CPU &cpu, FrameRunner runner,
+                                 Transport &transport, uint8_t local_player,
+                                 uint32_t input_delay)
+    : cpu(cpu),
+      runner(runner),
+      transport(transport),
+      local_player(local_player),
+      remote_player(local_player ^ 1),
+      frame(0),
+      local_frame(input_delay),
+      remote_frame(0),
+      acknowledged_frame(0),
+      rollback_frame(0) {
+    if (local_player >= NETPLAY_PLAYERS) {
+        throw std::runtime_error("netplay is for players 0 and 1");
+    }
+    if (input_delay > NETPLAY_MAX_INPUT_DELAY) {
+        throw std::runtime_error("netplay input delay is too long");
+    }
+    // the frames before the input delay is over have no input
+    for (FrameInputs &inputs : history) {
+        inputs.inputs.fill(0);
+        inputs.remote_frame = NO_FRAME;
+    }
+}
+
+uint32_t RollbackSession::get_confirmed_frame() {
+    return std::min(frame, remote_frame);
+}
+
+bool RollbackSession::advance(uint8_t local_input) {
+    receive();
+    roll_back();
+    if (frame >= remote_frame + NETPLAY_MAX_PREDICTION) {
+        // any further and a wrong guess could need a state that is gone
+        stats.stalls++;
+        send();
+        return false;
+    }
+
+    inputs_of(local_frame).inputs[local_player] = local_input;
+    local_frame++;
+    send();
+
+    run_frame(frame);
+    frame++;
+    rollback_frame = frame;
+    return true;
+}
+
+void RollbackSession::poll() {
+    receive();
+    roll_back();
+    send();
+}
+
+void RollbackSession::receive() {
+    uint8_t packet[NETPLAY_PACKET_SIZE];
+    while (size_t size = transport.receive(packet)) {
+        // anything that does not add up is not ours, or got mangled
+        if (size < PACKET_HEADER_SIZE + PACKET_ACK_SIZE ||
+            size != PACKET_HEADER_SIZE + packet[4] + PACKET_ACK_SIZE) {
+            continue;
+        }
+        uint32_t first = get_u32(packet);
+        uint8_t count = packet[4];
+        for (uint8_t i = 0; i < count; i++) {
+            add_remote_input(first + i, packet[PACKET_HEADER_SIZE + i]);
+        }
+        // they cannot have inputs that were never sent
+        uint32_t acknowledged = get_u32(packet + PACKET_HEADER_SIZE + count);
+        if (acknowledged > acknowledged_frame && acknowledged <= local_frame) {
+            acknowledged_frame = acknowledged;
+        }
+    }
+}
+
+void RollbackSession::add_remote_input(uint32_t input_frame, uint8_t input) {
+    // too old to matter, or so far ahead its place in the history is still
+    // taken. The far ahead ones come again once there is room.
+    if (input_frame < remote_frame ||
+        input_frame - remote_frame >= NETPLAY_INPUT_HISTORY ||
+        is_confirmed(input_frame)) {
+        return;
+    }
+
+    FrameInputs &inputs = inputs_of(input_frame);
+    if (input_frame < frame && inputs.inputs[remote_player] != input) {
+        // that frame ran on a wrong guess, and everything after it with it
+        rollback_frame = std::min(rollback_frame, input_frame);
+    }
+    inputs.inputs[remote_player] = input;
+    inputs.remote_frame = input_frame;
+
+    while (is_confirmed(remote_frame)) {
+        remote_frame++;
+    }
+}
+
+void RollbackSession::send() {
+    uint8_t packet[NETPLAY_PACKET_SIZE];
+    uint32_t first = std::max(acknowledged_frame,
+                              local_frame > NETPLAY_INPUT_HISTORY
+                                  ? local_frame - NETPLAY_INPUT_HISTORY
+                                  : 0);
+    uint8_t count = local_frame - first;
+    put_u32(packet, first);
+    packet[4] = count;
+    for (uint8_t i = 0; i < count; i++) {
+        packet[PACKET_HEADER_SIZE + i] =
+            inputs_of(first + i).inputs[local_player];
+    }
+    put_u32(packet + PACKET_HEADER_SIZE + count, remote_frame);
+    transport.send(packet, PACKET_HEADER_SIZE + count + PACKET_ACK_SIZE);
+}
+
+void RollbackSession::roll_back() {
+    if (rollback_frame >= frame) {
+        return;
+    }
+    uint32_t frames = frame - rollback_frame;
+    stats.rollbacks++;
+    stats.frames_rerun += frames;
+    stats.max_rollback = std::max(stats.max_rollback, frames);
+
+    // the state was taken because the frame ran on a guess, and the ring
+    // still has it since frame never gets more than NETPLAY_MAX_PREDICTION
+    // past a frame without the remote input
+    cpu.restore(states[rollback_frame % states.size()]);
+    for (uint32_t i = rollback_frame; i < frame; i++) {
+        run_frame(i);
+    }
+    rollback_frame = frame;
+}
+
+void RollbackSession::run_frame(uint32_t number) {
+    FrameInputs &inputs = inputs_of(number);
+    if (!is_confirmed(number)) {
+        // the other player most likely still holds what they held last
+        inputs.inputs[remote_player] =
+            number == 0 ? 0 : inputs_of(number - 1).inputs[remote_player];
+        cpu.snapshot(states[number % states.size()]);
+    }
+    runner.run(runner.context, cpu, inputs.inputs.data());
+}
@@ -0,0 +1,130 @@
+#pragma once
+#include <array>
+#include <cstdint>
+
+#include "cpu/cpu.h"
+#include "state/save_state.h"
+#include "transport.h"
+
+const static uint8_t NETPLAY_PLAYERS = 2;
+
+// Frames a session runs past the last frame it has the other player's input
+// for before it waits for them. Also the most frames a rollback ever
+// re-runs.
+const static uint32_t NETPLAY_MAX_PREDICTION = 8;
+const static uint32_t NETPLAY_MAX_INPUT_DELAY = 8;
+
+// Frames of input kept, enough for every frame that can still be rolled
+// back or that the other side might not have yet
+const static uint32_t NETPLAY_INPUT_HISTORY = 64;
+
+// Runs a frame of the game with the input of each player, one byte each
+// like a controller
+struct FrameRunner {
+    void (*run)(void *context, CPU &cpu, const uint8_t *inputs);
+    void *context;
+};
+
+struct RollbackStats {
+    // times the other player's input turned out to be guessed wrong and the
+    // session went back
+    uint64_t rollbacks = 0;
+    // frames run again by rollbacks
+    uint64_t frames_rerun = 0;
+    // the most frames a single rollback ran again
+    uint32_t max_rollback = 0;
+    // calls to advance() that had to wait for the other player
+    uint64_t stalls = 0;
+};
+
+// Rollback netplay for two players, each with a session of their own on
+// their own machine.
+//
+// Every frame runs at once with the local input and a prediction of the
+// remote one, the last input that came from them. Both go out to the other
+// side in every packet until it says it has them, so lost packets need no
+// resending of their own. When the real remote input for a frame that
+// already ran turns out to be something else than predicted, the session
+// restores the state from before that frame and runs it and every frame
+// after it again, the player only ever sees the corrected present.
+//
+// States are taken before each frame that runs on a prediction, into a ring
+// of NETPLAY_MAX_PREDICTION + 1 of them. Frames whose input is all known
+// already, because the other side is within the input delay, need none.
+//
+// Both machines stay identical as long as the game is deterministic and
+// gets nothing from outside but the inputs handed to the FrameRunner.
+class RollbackSession {
+   public:
+    // local_player is 0 or 1, the other side has the other one.
+    // input_delay frames pass before local input takes effect, which hides
+    // that much latency without rollbacks. The CPU, runner and transport
+    // have to outlive the session. Throws std::runtime_error for a player
+    // or delay out of range.
+    RollbackSession(CPU &cpu, FrameRunner runner, Transport &transport,
+                    uint8_t local_player, uint32_t input_delay = 0);
+
+    RollbackSession(const RollbackSession &) = delete;
+    RollbackSession &operator=(const RollbackSession &) = delete;
+
+    // Takes in the packets that arrived, rolls back if a prediction was
+    // wrong and runs the next frame with local_input. Returns false, and
+    // drops local_input, if the other player is too far behind, in which
+    // case it should be called again next frame.
+    bool advance(uint8_t local_input);
+
+    // The same without running a frame, for when there are no more local
+    // frames to run but the other side still needs to hear from this one
+    void poll();
+
+    // the next frame to run
+    uint32_t get_frame() { return frame; }
+    // frames up to here ran with the inputs of both players and will never
+    // be rolled back
+    uint32_t get_confirmed_frame();
+    RollbackStats &get_stats() { return stats; }
+
+   private:
+    struct FrameInputs {
+        std::array<uint8_t, NETPLAY_PLAYERS> inputs;
+        // the frame the remote input in here is the real one for, anything
+        // else means it is a prediction
+        uint32_t remote_frame;
+    };
+
+    FrameInputs &inputs_of(uint32_t number) {
+        return history[number % NETPLAY_INPUT_HISTORY];
+    }
+    bool is_confirmed(uint32_t number) {
+        return inputs_of(number).remote_frame == number;
+    }
+
+    void receive();
+    void add_remote_input(uint32_t input_frame, uint8_t input);
+    void send();
+    void roll_back();
+    void run_frame(uint32_t number);
+
+    CPU &cpu;
+    FrameRunner runner;
+    Transport &transport;
+    uint8_t local_player;
+    uint8_t remote_player;
+
+    // the next frame to run
+    uint32_t frame;
+    // the next frame to take local input for, input_delay ahead of frame
+    uint32_t local_frame;
+    // every remote input before this one is in
+    uint32_t remote_frame;
+    // the other side has every local input before this one
+    uint32_t acknowledged_frame;
+    // the earliest frame that ran with a wrong prediction, frame if none
+    uint32_t rollback_frame;
+
+    std::array<FrameInputs, NETPLAY_INPUT_HISTORY> history;
+    // the state before each frame that ran on a prediction
+    std::array<SaveState, NETPLAY_MAX_PREDICTION + 1> states;
+
+    RollbackStats stats;
+};
@@ -0,0 +1,25 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Big enough for any packet RollbackSession sends
+const static size_t NETPLAY_PACKET_SIZE = 256;
+
+// How netplay packets get to the other player: UDP, a relay server, or
+// LoopbackTransport in the tests.
+//
+// Delivery is best effort, like UDP. A packet may be lost, arrive late or
+// arrive after one sent later, and RollbackSession copes with all of it by
+// sending every input until the other side has it.
+class Transport {
+   public:
+    virtual ~Transport() = default;
+
+    // Sends size bytes, at most NETPLAY_PACKET_SIZE, to the other player
+    virtual void send(const uint8_t *data, size_t size) = 0;
+
+    // Takes the next packet that arrived into data, which has room for
+    // NETPLAY_PACKET_SIZE bytes. Returns its size, or 0 if there is none.
+    // Never blocks.
+    virtual size_t receive(uint8_t *data) = 0;
+};
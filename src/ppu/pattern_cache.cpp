@@ -0,0 +1,191 @@
+#include "pattern_cache.h"
+
+#include <array>
+#include <bit>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define PATTERN_CACHE_SSE2 1
+#include <immintrin.h>
+// AVX2 is not part of the baseline, its kernel is built for it on its own
+// and only run when the CPU says it has it
+#if defined(__GNUC__)
+#define PATTERN_CACHE_AVX2 1
+#endif
+#endif
+
+// Every byte of a bit plane row spread out to one byte per pixel, bit 7 (the
+// leftmost pixel) going to the first byte in memory
+static constexpr std::array<uint64_t, 256> make_spread_table() {
+    std::array<uint64_t, 256> table{};
+    for (int byte = 0; byte < 256; byte++) {
+        for (int pixel = 0; pixel < 8; pixel++) {
+            if (byte & (0x80 >> pixel)) {
+                int shift = std::endian::native == std::endian::little
+                                ? pixel * 8
+                                : (7 - pixel) * 8;
+                table[byte] |= uint64_t{1} << shift;
+            }
+        }
+    }
+    return table;
+}
+
+static constexpr std::array<uint64_t, 256> spread_table = make_spread_table();
+
+void decode_tiles_scalar(const uint8_t *chr, uint8_t *out, size_t count) {
+    for (size_t tile = 0; tile < count; tile++) {
+        for (int row = 0; row < 8; row++) {
+            uint64_t pixels =
+                spread_table[chr[row]] | (spread_table[chr[row + 8]] << 1);
+            std::memcpy(out + row * 8, &pixels, 8);
+        }
+        chr += CHR_TILE_SIZE;
+        out += DECODED_TILE_SIZE;
+    }
+}
+
+#if defined(PATTERN_CACHE_SSE2)
+// Takes a vector of bit plane bytes each repeated 8 times and gives value for
+// every pixel whose bit is set, 0 for the others
+static inline __m128i select_bits(__m128i rows, __m128i bits, __m128i value) {
+    __m128i set = _mm_cmpeq_epi8(_mm_and_si128(rows, bits), bits);
+    return _mm_and_si128(set, value);
+}
+#endif
+
+// Two rows per 16 byte vector. The row bytes are repeated 8 times each by
+// unpacking them with themselves 3 times, then every byte is tested against
+// the bit of the pixel it is for.
+void decode_tiles_sse2(const uint8_t *chr, uint8_t *out, size_t count) {
+#if defined(PATTERN_CACHE_SSE2)
+    const __m128i bits = _mm_setr_epi8(
+        (char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01, (char)0x80,
+        0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+    const __m128i ones = _mm_set1_epi8(1);
+    const __m128i twos = _mm_set1_epi8(2);
+
+    for (size_t tile = 0; tile < count; tile++) {
+        __m128i planes =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(chr));
+        // both planes as pairs, l0 l0 l1 l1 ... and h0 h0 h1 h1 ...
+        __m128i low = _mm_unpacklo_epi8(planes, planes);
+        __m128i high = _mm_unpackhi_epi8(planes, planes);
+        // then as runs of 4, rows 0-3 and rows 4-7
+        __m128i low_quads[2] = {_mm_unpacklo_epi16(low, low),
+                                _mm_unpackhi_epi16(low, low)};
+        __m128i high_quads[2] = {_mm_unpacklo_epi16(high, high),
+                                 _mm_unpackhi_epi16(high, high)};
+
+        for (int half = 0; half < 2; half++) {
+            // and finally runs of 8, two rows at a time
+            __m128i low_rows[2] = {
+                _mm_unpacklo_epi32(low_quads[half], low_quads[half]),
+                _mm_unpackhi_epi32(low_quads[half], low_quads[half])};
+            __m128i high_rows[2] = {
+                _mm_unpacklo_epi32(high_quads[half], high_quads[half]),
+                _mm_unpackhi_epi32(high_quads[half], high_quads[half])};
+            for (int pair = 0; pair < 2; pair++) {
+                __m128i pixels =
+                    _mm_or_si128(select_bits(low_rows[pair], bits, ones),
+                                 select_bits(high_rows[pair], bits, twos));
+                _mm_storeu_si128(
+                    reinterpret_cast<__m128i *>(out + (half * 2 + pair) * 16),
+                    pixels);
+            }
+        }
+        chr += CHR_TILE_SIZE;
+        out += DECODED_TILE_SIZE;
+    }
+#else
+    decode_tiles_scalar(chr, out, count);
+#endif
+}
+
+#if defined(PATTERN_CACHE_AVX2)
+// Four rows per 32 byte vector. The tile is copied into both 128 bit lanes
+// and one pshufb repeats each row byte 8 times.
+[[gnu::target("avx2")]]
+static void decode_tiles_avx2_kernel(const uint8_t *chr, uint8_t *out,
+                                     size_t count) {
+    const __m256i bits = _mm256_set1_epi64x(0x0102040810204080);
+    const __m256i ones = _mm256_set1_epi8(1);
+    const __m256i twos = _mm256_set1_epi8(2);
+    // rows 0-3 and rows 4-7 of the low plane, the high plane is 8 bytes on
+    const __m256i low_rows[2] = {
+        _mm256_setr_epi64x(0x0000000000000000, 0x0101010101010101,
+                           0x0202020202020202, 0x0303030303030303),
+        _mm256_setr_epi64x(0x0404040404040404, 0x0505050505050505,
+                           0x0606060606060606, 0x0707070707070707)};
+    const __m256i high_offset = _mm256_set1_epi8(8);
+
+    for (size_t tile = 0; tile < count; tile++) {
+        __m256i planes = _mm256_broadcastsi128_si256(
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(chr)));
+        for (int half = 0; half < 2; half++) {
+            __m256i low = _mm256_shuffle_epi8(planes, low_rows[half]);
+            __m256i high = _mm256_shuffle_epi8(
+                planes, _mm256_add_epi8(low_rows[half], high_offset));
+            __m256i low_set =
+                _mm256_cmpeq_epi8(_mm256_and_si256(low, bits), bits);
+            __m256i high_set =
+                _mm256_cmpeq_epi8(_mm256_and_si256(high, bits), bits);
+            __m256i pixels = _mm256_or_si256(_mm256_and_si256(low_set, ones),
+                                             _mm256_and_si256(high_set, twos));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + half * 32),
+                                pixels);
+        }
+        chr += CHR_TILE_SIZE;
+        out += DECODED_TILE_SIZE;
+    }
+}
+#endif
+
+void decode_tiles_avx2(const uint8_t *chr, uint8_t *out, size_t count) {
+#if defined(PATTERN_CACHE_AVX2)
+    if (__builtin_cpu_supports("avx2")) {
+        decode_tiles_avx2_kernel(chr, out, count);
+        return;
+    }
+#endif
+    decode_tiles_sse2(chr, out, count);
+}
+
+using DecodeKernel = void (*)(const uint8_t *chr, uint8_t *out, size_t count);
+
+static DecodeKernel pick_kernel() {
+#if defined(PATTERN_CACHE_AVX2)
+    if (__builtin_cpu_supports("avx2")) {
+        return &decode_tiles_avx2_kernel;
+    }
+#endif
+#if defined(PATTERN_CACHE_SSE2)
+    return &decode_tiles_sse2;
+#else
+    return &decode_tiles_scalar;
+#endif
+}
+
+void decode_tiles(const uint8_t *chr, uint8_t *out, size_t count) {
+    static const DecodeKernel kernel = pick_kernel();
+    kernel(chr, out, count);
+}
+
+PatternCache::PatternCache(Mapper &mapper) : mapper(mapper) {
+    Cartridge &cartridge = mapper.get_cartridge();
+    chr = cartridge.get_chr();
+    size_t tiles = cartridge.get_chr_size() / CHR_TILE_SIZE;
+    pixels.resize(tiles * DECODED_TILE_SIZE);
+    stale.assign(tiles, false);
+    decode_tiles(chr, pixels.data(), tiles);
+}
+
+void PatternCache::invalidate(uint16_t address) {
+    stale[mapper.get_chr_offset(address) / CHR_TILE_SIZE] = true;
+}
+
+void PatternCache::refresh(uint32_t tile) {
+    decode_tiles(chr + tile * CHR_TILE_SIZE,
+                 &pixels[tile * DECODED_TILE_SIZE], 1);
+    stale[tile] = false;
+}
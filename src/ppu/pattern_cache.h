@@ -0,0 +1,60 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "cartridge/mapper.h"
+
+// A tile is 16 bytes of CHR, 8 rows of the low bit plane followed by 8 rows
+// of the high one. Decoded it is 64 bytes, one 2 bit color per pixel, row by
+// row with the leftmost pixel first.
+const static uint8_t CHR_TILE_SIZE = 16;
+const static uint8_t DECODED_TILE_SIZE = 64;
+
+// Decodes count tiles from chr into out, with the fastest kernel the CPU we
+// are running on has
+void decode_tiles(const uint8_t *chr, uint8_t *out, size_t count);
+
+// The kernels decode_tiles() picks from. Those the build or the CPU does not
+// have fall back to the scalar one, so they can all be checked against each
+// other anywhere.
+void decode_tiles_scalar(const uint8_t *chr, uint8_t *out, size_t count);
+void decode_tiles_sse2(const uint8_t *chr, uint8_t *out, size_t count);
+void decode_tiles_avx2(const uint8_t *chr, uint8_t *out, size_t count);
+
+// Every tile of the cartridge's CHR, decoded.
+//
+// Tiles are kept by where they are in CHR rather than by pattern table
+// address, so bank switching never costs anything here. CHR ROM is decoded
+// once up front. A write to CHR RAM only marks its tile stale, and the tile
+// is decoded again the next time someone asks for it, so games that do not
+// write CHR while playing never decode anything after loading.
+class PatternCache {
+   public:
+    explicit PatternCache(Mapper &mapper);
+
+    PatternCache(const PatternCache &) = delete;
+    PatternCache &operator=(const PatternCache &) = delete;
+
+    // The decoded tile at pattern table address (0x0000-0x1FFF, the row bits
+    // are ignored), with the banks the mapper has right now
+    const uint8_t *get_tile(uint16_t address) {
+        uint32_t tile = mapper.get_chr_offset(address) / CHR_TILE_SIZE;
+        if (stale[tile]) [[unlikely]] {
+            refresh(tile);
+        }
+        return &pixels[tile * DECODED_TILE_SIZE];
+    }
+
+    // Called for every write to the pattern tables
+    void invalidate(uint16_t address);
+
+   private:
+    void refresh(uint32_t tile);
+
+    Mapper &mapper;
+    const uint8_t *chr;
+    std::vector<uint8_t> pixels;
+    // one per tile, true when CHR RAM changed since it was decoded
+    std::vector<uint8_t> stale;
+};
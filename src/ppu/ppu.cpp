@@ -0,0 +1,777 @@
+#include "ppu.h"
+
+#include <algorithm>
+#include <bit>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "cartridge/mapper.h"
+
+PPU::PPU(Mapper &mapper)
+    : mapper(mapper), patterns(mapper), render_mode(RENDER_DOTS) {
+    vram.fill(0);
+    palette.fill(0);
+    for (auto &bytes : oam) {
+        bytes.fill(0);
+    }
+    reset();
+}
+
+void PPU::reset() {
+    clock = 0;
+    target_clock = 0;
+    write_log.clear();
+    log_position = 0;
+    scanline = 0;
+    dot = 0;
+    frame = 0;
+    odd_frame = false;
+    nmi_pending = false;
+
+    ctrl = 0;
+    mask = 0;
+    status = 0;
+    oam_address = 0;
+    v = 0;
+    t = 0;
+    fine_x = 0;
+    w = false;
+    read_buffer = 0;
+    open_bus = 0;
+
+    next_tile = 0;
+    next_attribute = 0;
+    next_pattern_low = 0;
+    next_pattern_high = 0;
+    pattern_low = 0;
+    pattern_high = 0;
+    attribute_low = 0;
+    attribute_high = 0;
+
+    sprite_count = 0;
+    sprite_zero_on_line = false;
+    last_a12 = false;
+
+    framebuffer.fill(0);
+}
+
+void PPU::set_render_mode(RenderMode mode) {
+    run(true);
+    render_mode = mode;
+}
+
+void PPU::catch_up(uint64_t cpu_cycle) {
+    target_clock = std::max(target_clock, cpu_cycle * DOTS_PER_CPU_CYCLE);
+    run(false);
+}
+
+// Runs up to target_clock. In RENDER_SCANLINES mode a visible line that
+// target_clock is in the middle of the pixels of is left waiting at its
+// start, unless finish is set.
+void PPU::run(bool finish) {
+    // dot 0 is idle and dots 1-256 draw the pixels
+    const static uint16_t SCANLINE_DOTS = SCREEN_WIDTH + 1;
+
+    apply_logged_writes();
+    while (clock < target_clock) {
+        bool rendering_line =
+            scanline < SCREEN_HEIGHT || scanline == PRERENDER_SCANLINE;
+        if (!rendering_line || !is_rendering_enabled()) {
+            // not past the next logged write, it could turn rendering on
+            uint64_t target = target_clock;
+            if (log_position < write_log.size()) {
+                target = std::min(target, write_log[log_position].clock);
+            }
+            skip(target);
+        } else if (render_mode == RENDER_SCANLINES && dot == 0 &&
+                   scanline < SCREEN_HEIGHT && write_log.empty()) {
+            if (clock + SCANLINE_DOTS <= target_clock) {
+                render_scanline();
+            } else if (!finish) {
+                return;
+            } else {
+                tick();
+            }
+        } else {
+            tick();
+        }
+        apply_logged_writes();
+    }
+}
+
+// Makes the logged writes whose dot has come
+void PPU::apply_logged_writes() {
+    while (log_position < write_log.size() &&
+           write_log[log_position].clock <= clock) {
+        apply_write(write_log[log_position].address,
+                    write_log[log_position].data);
+        log_position++;
+    }
+    if (log_position == write_log.size() && log_position != 0) {
+        write_log.clear();
+        log_position = 0;
+    }
+}
+
+uint64_t PPU::next_event_cycle() {
+    const static uint32_t FRAME_DOTS =
+        SCANLINES_PER_FRAME * DOTS_PER_SCANLINE;
+    uint32_t position = scanline * DOTS_PER_SCANLINE + dot;
+    uint32_t vblank = VBLANK_SCANLINE * DOTS_PER_SCANLINE + 1;
+    uint32_t dots = vblank >= position ? vblank - position
+                                       : vblank + FRAME_DOTS - position;
+
+    if (is_rendering_enabled() && mapper.counts_scanlines()) {
+        // A12 rises with the first sprite pattern fetch when sprites use
+        // $1000, or with the first background fetch for the next line when
+        // the background does. Writes still in the log can change which, so
+        // take the earlier one until they are made.
+        uint16_t rise = (ctrl & CTRL_BACKGROUND_TABLE) ? 325 : 261;
+        if (!write_log.empty()) {
+            rise = 261;
+        }
+        dots = std::min<uint32_t>(
+            dots, rise >= dot ? rise - dot : DOTS_PER_SCANLINE - dot + rise);
+    }
+
+    // the event happens while running dot clock + dots, which catch_up()
+    // only does once it is asked for the cycle after
+    return (clock + dots) / DOTS_PER_CPU_CYCLE + 1;
+}
+
+// One dot on a scanline that is being rendered
+void PPU::tick() {
+    if (scanline == PRERENDER_SCANLINE && dot == 1) {
+        status &=
+            ~(STATUS_VBLANK | STATUS_SPRITE_ZERO_HIT | STATUS_SPRITE_OVERFLOW);
+    }
+
+    render_dot();
+
+    clock++;
+    dot++;
+    // odd frames are a dot shorter while rendering, the last dot of the
+    // pre-render line is skipped
+    if (scanline == PRERENDER_SCANLINE && dot == DOTS_PER_SCANLINE - 1 &&
+        odd_frame) {
+        dot++;
+    }
+    if (dot == DOTS_PER_SCANLINE) {
+        dot = 0;
+        scanline++;
+        if (scanline == SCANLINES_PER_FRAME) {
+            scanline = 0;
+            odd_frame = !odd_frame;
+        }
+    }
+}
+
+// Nothing gets fetched on this scanline, so run up to the end of it (or up to
+// target) at once. Only stops on the way for dot 1 of the lines where vblank
+// starts and ends.
+void PPU::skip(uint64_t target) {
+    uint16_t end = DOTS_PER_SCANLINE;
+    if (dot <= 1) {
+        if (scanline == VBLANK_SCANLINE || scanline == PRERENDER_SCANLINE) {
+            end = dot + 1;
+        }
+        if (dot == 1 && scanline == VBLANK_SCANLINE) {
+            status |= STATUS_VBLANK;
+            frame++;
+            if (ctrl & CTRL_NMI) {
+                nmi_pending = true;
+            }
+        } else if (dot == 1 && scanline == PRERENDER_SCANLINE) {
+            status &= ~(STATUS_VBLANK | STATUS_SPRITE_ZERO_HIT |
+                        STATUS_SPRITE_OVERFLOW);
+        }
+    }
+    uint16_t count = std::min<uint64_t>(end - dot, target - clock);
+
+    // with rendering off the screen shows the backdrop color, or whichever
+    // palette entry v points at
+    if (scanline < SCREEN_HEIGHT) {
+        uint16_t first = std::max<uint16_t>(dot, 1) - 1;
+        uint16_t last = std::min<uint16_t>(dot + count, SCREEN_WIDTH + 1) - 1;
+        if (first < last) {
+            uint8_t backdrop = (v & 0x3F00) == 0x3F00
+                                   ? palette[palette_offset(v)]
+                                   : palette[0];
+            std::fill(framebuffer.begin() + scanline * SCREEN_WIDTH + first,
+                      framebuffer.begin() + scanline * SCREEN_WIDTH + last,
+                      backdrop & 0x3F);
+        }
+    }
+
+    clock += count;
+    dot += count;
+    if (dot == DOTS_PER_SCANLINE) {
+        dot = 0;
+        scanline++;
+        if (scanline == SCANLINES_PER_FRAME) {
+            scanline = 0;
+            odd_frame = !odd_frame;
+        }
+    }
+}
+
+// Dots 0-256 of a visible scanline in one go. It ends up exactly where running
+// them one at a time does: the same pixels, sprite 0 hit, v and shift
+// registers, and the mapper sees the same A12 edges.
+void PPU::render_scanline() {
+    const static uint8_t TILES = 34;
+    uint16_t table = (ctrl & CTRL_BACKGROUND_TABLE) ? 0x1000 : 0;
+    uint8_t fine_y = (v >> 12) & 0b111;
+
+    // Every background pixel of the tiles the line is drawn from, palette in
+    // bits 2-3 and color in bits 0-1. The first 2 tiles were fetched at the
+    // end of the line before and are in the shift registers already.
+    std::array<uint8_t, TILES * 8> background;
+    for (int i = 0; i < 16; i++) {
+        uint16_t bit = 0x8000 >> i;
+        background[i] = ((pattern_low & bit) ? 1 : 0) |
+                        ((pattern_high & bit) ? 2 : 0) |
+                        ((attribute_low & bit) ? 4 : 0) |
+                        ((attribute_high & bit) ? 8 : 0);
+    }
+    // all 64 pattern fetches are from the same table, so A12 can only change
+    // on the first one
+    watch_a12(table);
+    std::array<uint8_t, TILES - 2> tiles;
+    std::array<uint8_t, TILES - 2> attributes;
+    for (int i = 0; i < TILES - 2; i++) {
+        tiles[i] = read(0x2000 | (v & 0x0FFF));
+        attributes[i] = read_attribute();
+        const uint8_t *pixels =
+            patterns.get_tile(table + tiles[i] * 16) + fine_y * 8;
+        uint8_t *out = &background[(i + 2) * 8];
+        for (int pixel = 0; pixel < 8; pixel++) {
+            out[pixel] = pixels[pixel] | (attributes[i] << 2);
+        }
+        increment_x();
+    }
+
+    // The sprites picked on the line before, laid out the same way with bit
+    // 4 set when behind the background and bit 5 for sprite 0. Lower OAM
+    // indexes are drawn last so they win, even if they end up behind the
+    // background.
+    std::array<uint8_t, SCREEN_WIDTH> sprites{};
+    for (int i = sprite_count - 1; i >= 0; i--) {
+        uint8_t flags = ((sprite_attribute[i] & 0b11) << 2) |
+                        ((sprite_attribute[i] & 0x20) ? 0x10 : 0) |
+                        ((i == 0 && sprite_zero_on_line) ? 0x20 : 0);
+        for (int offset = 0; offset < 8; offset++) {
+            int x = sprite_x[i] + offset;
+            if (x >= SCREEN_WIDTH) {
+                break;
+            }
+            uint8_t shift = 7 - offset;
+            uint8_t pixel = ((sprite_pattern_low[i] >> shift) & 1) |
+                            (((sprite_pattern_high[i] >> shift) & 1) << 1);
+            if (pixel != 0) {
+                sprites[x] = pixel | flags;
+            }
+        }
+    }
+
+    uint16_t background_from = 256;
+    if (mask & MASK_BACKGROUND) {
+        background_from = (mask & MASK_BACKGROUND_LEFT) ? 0 : 8;
+    }
+    uint16_t sprites_from = 256;
+    if (mask & MASK_SPRITES) {
+        sprites_from = (mask & MASK_SPRITES_LEFT) ? 0 : 8;
+    }
+    uint8_t grey = (mask & MASK_GREYSCALE) ? 0x30 : 0x3F;
+    uint8_t *line = &framebuffer[scanline * SCREEN_WIDTH];
+    for (int x = 0; x < SCREEN_WIDTH; x++) {
+        uint8_t back = x >= background_from ? background[x + fine_x] : 0;
+        uint8_t sprite = x >= sprites_from ? sprites[x] : 0;
+        bool back_opaque = (back & 0b11) != 0;
+        uint8_t index = 0;
+        if ((sprite & 0b11) && (!back_opaque || !(sprite & 0x10))) {
+            index = 0x10 | (sprite & 0x0F);
+        } else if (back_opaque) {
+            index = back & 0x0F;
+        }
+        if ((sprite & 0x20) && back_opaque && x != 255) {
+            status |= STATUS_SPRITE_ZERO_HIT;
+        }
+        line[x] = palette[index] & grey;
+    }
+
+    // What going dot by dot leaves behind at dot 256: tiles 31 and 32 in the
+    // shift registers 7 dots after they were loaded, and tile 33 fetched.
+    auto pattern = [&](int i, uint8_t plane) {
+        return mapper.read_chr(table + tiles[i] * 16 + fine_y + plane);
+    };
+    auto attribute = [&](int i, uint8_t bit) {
+        return (attributes[i] & bit) ? 0xFF : 0x00;
+    };
+    pattern_low = ((pattern(29, 0) << 8) | pattern(30, 0)) << 7;
+    pattern_high = ((pattern(29, 8) << 8) | pattern(30, 8)) << 7;
+    attribute_low = ((attribute(29, 1) << 8) | attribute(30, 1)) << 7;
+    attribute_high = ((attribute(29, 2) << 8) | attribute(30, 2)) << 7;
+    next_tile = tiles[31];
+    next_attribute = attributes[31];
+    next_pattern_low = pattern(31, 0);
+    next_pattern_high = pattern(31, 8);
+    increment_y();
+
+    clock += SCREEN_WIDTH + 1;
+    dot = SCREEN_WIDTH + 1;
+}
+
+// https://www.nesdev.org/wiki/PPU_rendering and the frame timing diagram
+// there
+void PPU::render_dot() {
+    // the shift registers move every dot the background is fetched and drawn
+    // on, and take in the next tile every 8 dots
+    if ((dot >= 2 && dot <= 257) || (dot >= 322 && dot <= 337)) {
+        pattern_low <<= 1;
+        pattern_high <<= 1;
+        attribute_low <<= 1;
+        attribute_high <<= 1;
+        if (((dot - 1) & 7) == 0) {
+            pattern_low = (pattern_low & 0xFF00) | next_pattern_low;
+            pattern_high = (pattern_high & 0xFF00) | next_pattern_high;
+            attribute_low =
+                (attribute_low & 0xFF00) | ((next_attribute & 1) ? 0xFF : 0);
+            attribute_high =
+                (attribute_high & 0xFF00) | ((next_attribute & 2) ? 0xFF : 0);
+        }
+    }
+
+    if (scanline < SCREEN_HEIGHT && dot >= 1 && dot <= SCREEN_WIDTH) {
+        draw_pixel();
+    }
+
+    if ((dot >= 1 && dot <= 256) || (dot >= 321 && dot <= 336)) {
+        fetch_background();
+    }
+    if (dot == 256) {
+        increment_y();
+    } else if (dot == 257) {
+        // back to the left edge of the screen
+        v = (v & ~0x041F) | (t & 0x041F);
+        if (scanline < SCREEN_HEIGHT) {
+            evaluate_sprites();
+        } else {
+            // the pre-render line picks no sprites for line 0 but still
+            // fetches
+            sprite_count = 0;
+            sprite_zero_on_line = false;
+        }
+    } else if (scanline == PRERENDER_SCANLINE && dot >= 280 && dot <= 304) {
+        // back to the top of the screen
+        v = (v & ~0x7BE0) | (t & 0x7BE0);
+    }
+
+    // 8 dots per sprite slot, the pattern bytes are fetched on the 5th and
+    // 7th of them
+    if (dot >= 257 && dot <= 320) {
+        uint8_t phase = (dot - 257) & 7;
+        if (phase == 4 || phase == 6) {
+            fetch_sprite((dot - 257) >> 3, phase == 6);
+        }
+    }
+}
+
+void PPU::draw_pixel() {
+    uint8_t x = dot - 1;
+
+    uint8_t background = 0;
+    uint8_t background_palette = 0;
+    if ((mask & MASK_BACKGROUND) && (x >= 8 || (mask & MASK_BACKGROUND_LEFT))) {
+        uint16_t bit = 0x8000 >> fine_x;
+        background = ((pattern_low & bit) ? 1 : 0) |
+                     ((pattern_high & bit) ? 2 : 0);
+        background_palette = ((attribute_low & bit) ? 1 : 0) |
+                             ((attribute_high & bit) ? 2 : 0);
+    }
+
+    uint8_t sprite = 0;
+    uint8_t sprite_palette = 0;
+    bool behind_background = false;
+    if ((mask & MASK_SPRITES) && (x >= 8 || (mask & MASK_SPRITES_LEFT))) {
+        // lower OAM index wins, even if it ends up behind the background
+        for (uint8_t i = 0; i < sprite_count; i++) {
+            // sprites near the right edge do not wrap around to the left
+            if (x < sprite_x[i] || x - sprite_x[i] >= 8) {
+                continue;
+            }
+            uint8_t offset = x - sprite_x[i];
+            uint8_t shift = 7 - offset;
+            uint8_t pixel = ((sprite_pattern_low[i] >> shift) & 1) |
+                            (((sprite_pattern_high[i] >> shift) & 1) << 1);
+            if (pixel == 0) {
+                continue;
+            }
+            if (i == 0 && sprite_zero_on_line && background != 0 &&
+                x != 255) {
+                status |= STATUS_SPRITE_ZERO_HIT;
+            }
+            sprite = pixel;
+            sprite_palette = 4 + (sprite_attribute[i] & 0b11);
+            behind_background = (sprite_attribute[i] & 0x20) != 0;
+            break;
+        }
+    }
+
+    uint8_t index = 0;
+    if (sprite != 0 && (background == 0 || !behind_background)) {
+        index = sprite_palette * 4 + sprite;
+    } else if (background != 0) {
+        index = background_palette * 4 + background;
+    }
+    uint8_t color = palette[index] & ((mask & MASK_GREYSCALE) ? 0x30 : 0x3F);
+    framebuffer[scanline * SCREEN_WIDTH + x] = color;
+}
+
+// Nametable byte, attribute byte and the two pattern bytes for the tile at v,
+// then on to the next tile
+void PPU::fetch_background() {
+    switch ((dot - 1) & 7) {
+        case 0:
+            next_tile = read(0x2000 | (v & 0x0FFF));
+            break;
+        case 2:
+            next_attribute = read_attribute();
+            break;
+        case 4:
+        case 6: {
+            uint16_t address = ((ctrl & CTRL_BACKGROUND_TABLE) ? 0x1000 : 0) +
+                               next_tile * 16 + ((v >> 12) & 0b111);
+            if (((dot - 1) & 7) == 4) {
+                next_pattern_low = read_pattern(address);
+            } else {
+                next_pattern_high = read_pattern(address + 8);
+            }
+        } break;
+        case 7:
+            increment_x();
+            break;
+    }
+}
+
+// The 2 palette bits for the tile at v
+uint8_t PPU::read_attribute() {
+    uint8_t attribute = read(0x23C0 | (v & 0x0C00) | ((v >> 4) & 0x38) |
+                             ((v >> 2) & 0x07));
+    // each attribute byte covers 4x4 tiles, 2 bits per 2x2 of them
+    uint8_t shift = ((v >> 4) & 0b100) | (v & 0b10);
+    return (attribute >> shift) & 0b11;
+}
+
+static uint8_t reverse_bits(uint8_t byte) {
+    byte = (byte & 0xF0) >> 4 | (byte & 0x0F) << 4;
+    byte = (byte & 0xCC) >> 2 | (byte & 0x33) << 2;
+    byte = (byte & 0xAA) >> 1 | (byte & 0x55) << 1;
+    return byte;
+}
+
+// Empty slots still fetch tile $FF, which matters to mappers watching A12
+void PPU::fetch_sprite(uint8_t slot, bool high) {
+    uint8_t height = (ctrl & CTRL_SPRITE_16) ? 16 : 8;
+    uint8_t y = 0xFF;
+    uint8_t tile = 0xFF;
+    uint8_t attribute = 0xFF;
+    uint8_t x = 0xFF;
+    uint8_t row = 0;
+    if (slot < sprite_count) {
+        uint8_t sprite = line_sprites[slot];
+        y = oam[OAM_Y][sprite];
+        tile = oam[OAM_TILE][sprite];
+        attribute = oam[OAM_ATTRIBUTE][sprite];
+        x = oam[OAM_X][sprite];
+        row = scanline - y;
+        if (attribute & 0x80) {
+            row = height - 1 - row;
+        }
+    }
+
+    uint16_t address;
+    if (height == 16) {
+        // the table comes from bit 0 of the tile, the bottom half is the
+        // next tile
+        address = ((tile & 1) ? 0x1000 : 0) + (tile & 0xFE) * 16;
+        if (row >= 8) {
+            address += 16;
+            row -= 8;
+        }
+    } else {
+        address = ((ctrl & CTRL_SPRITE_TABLE) ? 0x1000 : 0) + tile * 16;
+    }
+    address += row;
+
+    uint8_t pattern = read_pattern(address + (high ? 8 : 0));
+    if (slot >= sprite_count) {
+        pattern = 0;
+    } else if (attribute & 0x40) {
+        pattern = reverse_bits(pattern);
+    }
+    if (high) {
+        sprite_pattern_high[slot] = pattern;
+    } else {
+        sprite_pattern_low[slot] = pattern;
+        sprite_x[slot] = x;
+        sprite_attribute[slot] = attribute;
+    }
+}
+
+// One bit per sprite, set for those on the line below scanline: Y <=
+// scanline < Y + height, without wrapping around. 16 sprites per compare.
+static uint64_t find_sprites(const uint8_t *ys, uint8_t scanline,
+                             uint8_t height) {
+    uint64_t found = 0;
+#if defined(__SSE2__)
+    // SSE2 only compares signed bytes, so unsigned a <= b is max(a, b) == b
+    const __m128i line = _mm_set1_epi8(scanline);
+    const __m128i last_row = _mm_set1_epi8(height - 1);
+    for (int i = 0; i < SPRITES / 16; i++) {
+        __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ys) + i);
+        __m128i row = _mm_sub_epi8(line, y);
+        __m128i started = _mm_cmpeq_epi8(_mm_max_epu8(line, y), line);
+        __m128i not_ended = _mm_cmpeq_epi8(_mm_min_epu8(row, last_row), row);
+        uint16_t bits = _mm_movemask_epi8(_mm_and_si128(started, not_ended));
+        found |= static_cast<uint64_t>(bits) << (i * 16);
+    }
+#else
+    for (int i = 0; i < SPRITES; i++) {
+        if (ys[i] <= scanline && scanline - ys[i] < height) {
+            found |= uint64_t{1} << i;
+        }
+    }
+#endif
+    return found;
+}
+
+// Picks the first 8 sprites that show up on the next scanline. The real PPU
+// does this over dots 65-256 but nothing can see it before dot 257 other
+// than through OAM writes while rendering, which games do not do.
+void PPU::evaluate_sprites() {
+    uint8_t height = (ctrl & CTRL_SPRITE_16) ? 16 : 8;
+    uint64_t found = find_sprites(oam[OAM_Y].data(), scanline, height);
+
+    sprite_zero_on_line = found & 1;
+    int count = std::popcount(found);
+    if (count > 8) {
+        // without the hardware bug that makes this flag unreliable
+        status |= STATUS_SPRITE_OVERFLOW;
+        count = 8;
+    }
+    sprite_count = count;
+    for (uint8_t slot = 0; slot < sprite_count; slot++) {
+        line_sprites[slot] = std::countr_zero(found);
+        found &= found - 1;
+    }
+}
+
+// https://www.nesdev.org/wiki/PPU_scrolling#Wrapping_around
+void PPU::increment_x() {
+    if ((v & 0x001F) == 31) {
+        v &= ~0x001F;
+        v ^= 0x0400;
+    } else {
+        v++;
+    }
+}
+
+void PPU::increment_y() {
+    if ((v & 0x7000) != 0x7000) {
+        v += 0x1000;
+        return;
+    }
+    v &= ~0x7000;
+    uint16_t coarse_y = (v & 0x03E0) >> 5;
+    if (coarse_y == 29) {
+        coarse_y = 0;
+        v ^= 0x0800;
+    } else if (coarse_y == 31) {
+        // out of bounds scroll wraps without switching nametables
+        coarse_y = 0;
+    } else {
+        coarse_y++;
+    }
+    v = (v & ~0x03E0) | (coarse_y << 5);
+}
+
+uint8_t PPU::read_register(uint16_t address) {
+    // what the CPU reads depends on everything up to now
+    run(true);
+    switch (address & 7) {
+        case 2: {
+            uint8_t value = (status & 0xE0) | (open_bus & 0x1F);
+            status &= ~STATUS_VBLANK;
+            w = false;
+            open_bus = value;
+        } break;
+        case 4:
+            open_bus = oam[oam_address & 3][oam_address >> 2];
+            break;
+        case 7: {
+            uint16_t vram_address = v & 0x3FFF;
+            if (vram_address >= 0x3F00) {
+                // palette reads are not buffered, but still fill the buffer
+                // with the nametable byte underneath
+                open_bus = (read(vram_address) & 0x3F) | (open_bus & 0xC0);
+                read_buffer = read(vram_address - 0x1000);
+            } else {
+                open_bus = read_buffer;
+                read_buffer = vram_address < 0x2000
+                                  ? read_pattern(vram_address)
+                                  : read(vram_address);
+            }
+            v += (ctrl & CTRL_INCREMENT_32) ? 32 : 1;
+        } break;
+    }
+    // write only registers read back whatever was last on the bus
+    return open_bus;
+}
+
+void PPU::write_register(uint16_t address, uint8_t data) {
+    if (clock < target_clock) {
+        // the line is waiting to be drawn, the write happens when the PPU
+        // gets to its dot
+        write_log.push_back({target_clock, address, data});
+        return;
+    }
+    apply_write(address, data);
+}
+
+void PPU::apply_write(uint16_t address, uint8_t data) {
+    open_bus = data;
+    switch (address & 7) {
+        case 0: {
+            bool was_enabled = ctrl & CTRL_NMI;
+            ctrl = data;
+            t = (t & ~0x0C00) | ((data & CTRL_NAMETABLE) << 10);
+            // turning NMIs on during vblank raises one right away
+            if (!was_enabled && (ctrl & CTRL_NMI) && (status & STATUS_VBLANK)) {
+                nmi_pending = true;
+            }
+        } break;
+        case 1:
+            mask = data;
+            break;
+        case 3:
+            oam_address = data;
+            break;
+        case 4:
+            oam[oam_address & 3][oam_address >> 2] = data;
+            oam_address++;
+            break;
+        case 5:
+            if (!w) {
+                t = (t & ~0x001F) | (data >> 3);
+                fine_x = data & 0b111;
+            } else {
+                t = (t & ~0x73E0) | ((data & 0b111) << 12) |
+                    ((data & 0xF8) << 2);
+            }
+            w = !w;
+            break;
+        case 6:
+            if (!w) {
+                t = (t & 0x00FF) | ((data & 0x3F) << 8);
+            } else {
+                t = (t & 0xFF00) | data;
+                v = t;
+            }
+            w = !w;
+            break;
+        case 7:
+            write(v, data);
+            v += (ctrl & CTRL_INCREMENT_32) ? 32 : 1;
+            break;
+    }
+}
+
+void PPU::write_oam_dma(const uint8_t *page) {
+    run(true);
+    for (int i = 0; i < 0x100; i++) {
+        uint8_t address = oam_address + i;
+        oam[address & 3][address >> 2] = page[i];
+    }
+}
+
+uint8_t PPU::peek(uint16_t address) {
+    run(true);
+    return read(address);
+}
+
+uint8_t PPU::peek_oam(uint8_t address) {
+    run(true);
+    return oam[address & 3][address >> 2];
+}
+
+uint8_t PPU::read(uint16_t address) {
+    address &= 0x3FFF;
+    if (address < 0x2000) {
+        return mapper.read_chr(address);
+    }
+    if (address < 0x3F00) {
+        return vram[nametable_offset(address)];
+    }
+    return palette[palette_offset(address)];
+}
+
+void PPU::write(uint16_t address, uint8_t data) {
+    address &= 0x3FFF;
+    if (address < 0x2000) {
+        mapper.write_chr(address, data);
+        patterns.invalidate(address);
+    } else if (address < 0x3F00) {
+        vram[nametable_offset(address)] = data;
+    } else {
+        palette[palette_offset(address)] = data & 0x3F;
+    }
+}
+
+// Same as read() for the pattern tables, but lets the mapper see A12 rise
+uint8_t PPU::read_pattern(uint16_t address) {
+    watch_a12(address);
+    return mapper.read_chr(address);
+}
+
+void PPU::watch_a12(uint16_t address) {
+    bool a12 = (address & 0x1000) != 0;
+    if (a12 && !last_a12) {
+        mapper.ppu_a12_rising();
+    }
+    last_a12 = a12;
+}
+
+// The 4 nametables at $2000-$2FFF (mirrored up to $3EFF) share 2 KiB of VRAM
+// in whichever way the cartridge wires it up
+uint16_t PPU::nametable_offset(uint16_t address) {
+    uint16_t table = (address >> 10) & 0b11;
+    switch (mapper.get_mirroring()) {
+        case HORIZONTAL:
+            table >>= 1;
+            break;
+        case VERTICAL:
+            table &= 1;
+            break;
+        case SINGLE_SCREEN_LOWER:
+            table = 0;
+            break;
+        case SINGLE_SCREEN_UPPER:
+            table = 1;
+            break;
+        case FOUR_SCREEN:
+            break;
+    }
+    return table * 0x400 + (address & 0x03FF);
+}
+
+// $3F10, $3F14, $3F18 and $3F1C are the same bytes as $3F00, $3F04, ...
+uint8_t PPU::palette_offset(uint16_t address) {
+    uint8_t offset = address & 0x1F;
+    if ((offset & 0x13) == 0x10) {
+        offset &= 0x0F;
+    }
+    return offset;
+}
@@ -0,0 +1,235 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "pattern_cache.h"
+
+// PPUCTRL ($2000)
+const static uint8_t CTRL_NAMETABLE = 0b11;
+const static uint8_t CTRL_INCREMENT_32 = 1 << 2;
+const static uint8_t CTRL_SPRITE_TABLE = 1 << 3;
+const static uint8_t CTRL_BACKGROUND_TABLE = 1 << 4;
+const static uint8_t CTRL_SPRITE_16 = 1 << 5;
+const static uint8_t CTRL_NMI = 1 << 7;
+
+// PPUMASK ($2001)
+const static uint8_t MASK_GREYSCALE = 1 << 0;
+const static uint8_t MASK_BACKGROUND_LEFT = 1 << 1;
+const static uint8_t MASK_SPRITES_LEFT = 1 << 2;
+const static uint8_t MASK_BACKGROUND = 1 << 3;
+const static uint8_t MASK_SPRITES = 1 << 4;
+
+// PPUSTATUS ($2002)
+const static uint8_t STATUS_SPRITE_OVERFLOW = 1 << 5;
+const static uint8_t STATUS_SPRITE_ZERO_HIT = 1 << 6;
+const static uint8_t STATUS_VBLANK = 1 << 7;
+
+const static uint16_t SCREEN_WIDTH = 256;
+const static uint16_t SCREEN_HEIGHT = 240;
+
+// NTSC timing, the PPU runs 3 dots for every CPU cycle
+const static uint16_t DOTS_PER_SCANLINE = 341;
+const static uint16_t SCANLINES_PER_FRAME = 262;
+const static uint16_t VBLANK_SCANLINE = 241;
+const static uint16_t PRERENDER_SCANLINE = 261;
+const static uint8_t DOTS_PER_CPU_CYCLE = 3;
+
+// The 4 bytes of a sprite in OAM, at address sprite * 4 + byte
+const static uint8_t SPRITES = 64;
+const static uint8_t OAM_Y = 0;
+const static uint8_t OAM_TILE = 1;
+const static uint8_t OAM_ATTRIBUTE = 2;
+const static uint8_t OAM_X = 3;
+
+// How visible scanlines are drawn. RENDER_DOTS runs every dot the way the PPU
+// does. RENDER_SCANLINES draws the visible part of a line in one go whenever
+// the CPU leaves the PPU alone while it is being drawn, and goes dot by dot
+// only for the lines where it does not. The picture comes out the same for
+// anything that does not change CHR banks mid line.
+enum RenderMode {
+    RENDER_DOTS,
+    RENDER_SCANLINES,
+};
+
+// The 2C02. https://www.nesdev.org/wiki/PPU
+//
+// It does not run in lockstep with the CPU. The PPU only remembers the CPU
+// cycle it got to and sits idle until someone calls catch_up(), which runs
+// every dot from there to the cycle asked for in one go. Whoever owns the PPU
+// catches it up before every register access, and asks next_event_cycle()
+// how far the CPU can run before the PPU has something to say, like an NMI.
+// Scanlines with rendering off, vblank included, are skipped a whole stretch
+// at a time instead of dot by dot.
+//
+// Rendering itself is dot accurate: background fetches, shift registers and
+// sprite fetches happen on the dots the real PPU does them on, so mid
+// scanline register writes, sprite 0 hit and MMC3 scanline counting all come
+// out right as long as the PPU is caught up before them.
+//
+// In RENDER_SCANLINES mode catch_up() does not start on a visible line it
+// cannot finish drawing. It waits at the start of the line, register writes
+// made in the meantime go into a log, and once the line is caught up past its
+// last pixel it is drawn in one go if the log is empty, or dot by dot with
+// the writes replayed on the dots they were made on if it is not. Register
+// reads cannot wait, they finish the line dot by dot up to where the CPU is.
+//
+// The picture is kept as palette indices, one byte per pixel, turning them
+// into colors is up to whoever shows it.
+class PPU {
+   public:
+    explicit PPU(Mapper &mapper);
+
+    PPU(const PPU &) = delete;
+    PPU &operator=(const PPU &) = delete;
+
+    void reset();
+
+    void set_render_mode(RenderMode mode);
+    RenderMode get_render_mode() { return render_mode; }
+
+    // Runs every dot up to the start of cpu_cycle
+    void catch_up(uint64_t cpu_cycle);
+
+    // Draws the line catch_up() left waiting up to where it was asked to go,
+    // for when something the write log does not see is about to change, like
+    // a CHR bank
+    void flush() { run(true); }
+
+    // The CPU cycle by which the next event happens: the start of vblank,
+    // which is where NMIs come from and frames end, or while rendering with a
+    // mapper that counts scanlines, the next scanline. Only a guess once
+    // registers change, catching up to it and asking again is always safe.
+    uint64_t next_event_cycle();
+
+    // $2000-$2007, mirrored every 8 bytes up to $3FFF. The PPU has to be
+    // caught up first.
+    uint8_t read_register(uint16_t address);
+    void write_register(uint16_t address, uint8_t data);
+
+    // $4014, the CPU copying a whole page into OAM
+    void write_oam_dma(const uint8_t *page);
+
+    // Returns whether an NMI is waiting for the CPU, and forgets it
+    bool take_nmi() {
+        bool pending = nmi_pending;
+        nmi_pending = false;
+        return pending;
+    }
+    bool is_nmi_pending() { return nmi_pending; }
+
+    // Frames finished so far, one more every time vblank starts. While a line
+    // is waiting to be drawn, the position is the start of that line.
+    uint64_t get_frame() { return frame; }
+    uint16_t get_scanline() { return scanline; }
+    uint16_t get_dot() { return dot; }
+    bool is_rendering_enabled() {
+        return (mask & (MASK_BACKGROUND | MASK_SPRITES)) != 0;
+    }
+
+    // SCREEN_WIDTH x SCREEN_HEIGHT palette indices (0x00-0x3F), row by row
+    const uint8_t *get_framebuffer() { return framebuffer.data(); }
+
+    // Straight access to PPU memory and OAM, without the side effects of
+    // PPUDATA and OAMDATA
+    uint8_t peek(uint16_t address);
+    uint8_t peek_oam(uint8_t address);
+
+    PatternCache &get_pattern_cache() { return patterns; }
+
+   private:
+    // A register write made while a line was waiting to be drawn
+    struct LoggedWrite {
+        uint64_t clock;
+        uint16_t address;
+        uint8_t data;
+    };
+
+    void run(bool finish);
+    void apply_logged_writes();
+    void apply_write(uint16_t address, uint8_t data);
+    void tick();
+    void skip(uint64_t target);
+    void render_scanline();
+    void render_dot();
+    void draw_pixel();
+    void fetch_background();
+    uint8_t read_attribute();
+    void fetch_sprite(uint8_t slot, bool high);
+    void evaluate_sprites();
+    void increment_x();
+    void increment_y();
+
+    uint8_t read(uint16_t address);
+    void write(uint16_t address, uint8_t data);
+    uint8_t read_pattern(uint16_t address);
+    void watch_a12(uint16_t address);
+    uint16_t nametable_offset(uint16_t address);
+    uint8_t palette_offset(uint16_t address);
+
+    Mapper &mapper;
+    PatternCache patterns;
+
+    RenderMode render_mode;
+
+    // dots run since power on, and how far catch_up() was asked to go. They
+    // are only apart while a line is waiting to be drawn.
+    uint64_t clock;
+    uint64_t target_clock;
+    std::vector<LoggedWrite> write_log;
+    // the first write in the log that has not happened yet
+    size_t log_position;
+    uint16_t scanline;
+    uint16_t dot;
+    uint64_t frame;
+    bool odd_frame;
+    bool nmi_pending;
+
+    uint8_t ctrl;
+    uint8_t mask;
+    uint8_t status;
+    uint8_t oam_address;
+    // https://www.nesdev.org/wiki/PPU_scrolling#PPU_internal_registers
+    uint16_t v;
+    uint16_t t;
+    uint8_t fine_x;
+    bool w;
+    // what PPUDATA reads return, one read behind
+    uint8_t read_buffer;
+    // the last value written to any register, which unused status bits show
+    uint8_t open_bus;
+
+    // background fetches for the next tile, then the shift registers they
+    // are loaded into every 8 dots
+    uint8_t next_tile;
+    uint8_t next_attribute;
+    uint8_t next_pattern_low;
+    uint8_t next_pattern_high;
+    uint16_t pattern_low;
+    uint16_t pattern_high;
+    uint16_t attribute_low;
+    uint16_t attribute_high;
+
+    // up to 8 sprites on the scanline being drawn, picked on the one before.
+    // Pattern bytes are already flipped horizontally.
+    uint8_t sprite_count;
+    bool sprite_zero_on_line;
+    std::array<uint8_t, 8> line_sprites;
+    std::array<uint8_t, 8> sprite_x;
+    std::array<uint8_t, 8> sprite_attribute;
+    std::array<uint8_t, 8> sprite_pattern_low;
+    std::array<uint8_t, 8> sprite_pattern_high;
+
+    // A12 of the last pattern fetch, mappers count scanlines on its rising
+    // edge
+    bool last_a12;
+
+    // 2 KiB on the console, 4 KiB for the few four screen boards
+    std::array<uint8_t, 0x1000> vram;
+    std::array<uint8_t, 0x20> palette;
+    // OAM kept as structure of arrays, oam[OAM_Y] is the Y of all 64 sprites
+    // next to each other so sprite evaluation can compare them all at once
+    std::array<std::array<uint8_t, SPRITES>, 4> oam;
+
+    std::array<uint8_t, SCREEN_WIDTH * SCREEN_HEIGHT> framebuffer;
+};
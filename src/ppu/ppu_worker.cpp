@@ -0,0 +1,75 @@
+#include "ppu_worker.h"
+
+#include <algorithm>
+
+PPUWorker::PPUWorker(PPU &ppu)
+    : ppu(ppu), log_head(0), log_tail(0), stopping(false), logged_cycle(0) {
+    thread = std::thread(&PPUWorker::run, this);
+}
+
+PPUWorker::~PPUWorker() {
+    stopping.store(true, std::memory_order_release);
+    // wakes the worker up, it stops once the log is empty
+    push(logged_cycle, 0, 0);
+    thread.join();
+}
+
+void PPUWorker::catch_up(uint64_t cpu_cycle) {
+    if (cpu_cycle > logged_cycle) {
+        logged_cycle = cpu_cycle;
+        push(cpu_cycle, 0, 0);
+    }
+}
+
+void PPUWorker::write_register(uint64_t cpu_cycle, uint16_t address,
+                               uint8_t data) {
+    logged_cycle = std::max(logged_cycle, cpu_cycle);
+    push(cpu_cycle, address, data);
+}
+
+void PPUWorker::sync(uint64_t cpu_cycle) {
+    catch_up(cpu_cycle);
+    uint64_t head = log_head.load(std::memory_order_relaxed);
+    uint64_t tail = log_tail.load(std::memory_order_acquire);
+    while (tail != head) {
+        log_tail.wait(tail, std::memory_order_acquire);
+        tail = log_tail.load(std::memory_order_acquire);
+    }
+}
+
+void PPUWorker::push(uint64_t cpu_cycle, uint16_t address, uint8_t data) {
+    uint64_t head = log_head.load(std::memory_order_relaxed);
+    uint64_t tail = log_tail.load(std::memory_order_acquire);
+    while (head - tail == PPU_LOG_SIZE) {
+        log_tail.wait(tail, std::memory_order_acquire);
+        tail = log_tail.load(std::memory_order_acquire);
+    }
+    log[head % PPU_LOG_SIZE] = {cpu_cycle, address, data};
+    log_head.store(head + 1, std::memory_order_release);
+    log_head.notify_one();
+}
+
+// Replays the log as it comes in. Slots are handed back a batch at a time,
+// which is also when a waiting CPU thread gets woken up.
+void PPUWorker::run() {
+    uint64_t tail = 0;
+    while (true) {
+        uint64_t head = log_head.load(std::memory_order_acquire);
+        if (tail == head) {
+            if (stopping.load(std::memory_order_acquire)) {
+                return;
+            }
+            log_head.wait(head, std::memory_order_acquire);
+            continue;
+        }
+        for (; tail != head; tail++) {
+            const LoggedWrite &write = log[tail % PPU_LOG_SIZE];
+            ppu.catch_up(write.cpu_cycle);
+            if (write.address != 0) {
+                ppu.write_register(write.address, write.data);
+            }
+        }
+        log_tail.store(tail, std::memory_order_release);
+        log_tail.notify_all();
+    }
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+#include "ppu.h"
+
+// Register writes the CPU can get ahead of the worker by before it has to
+// wait, a whole OAM DMA is 256 of them
+const static uint16_t PPU_LOG_SIZE = 4096;
+
+// Runs a PPU on a thread of its own, so drawing the picture takes a second
+// core instead of time from the CPU.
+//
+// The CPU thread never waits for the worker to draw. catch_up() only moves
+// the point the worker may run up to, and register writes go into the same
+// lock free log together with the CPU cycle they were made on, which the
+// worker replays at that cycle. Whatever the CPU needs to know from the PPU, like
+// what a register read returns or whether there is an NMI, first waits for
+// the worker with sync(). After that, and until the next catch_up() or
+// write_register(), the worker is idle and the PPU can be used directly.
+//
+// The worker reads the mapper for CHR and mirroring, so whoever owns the
+// mapper has to sync() before it changes them (see ChrListener). Mappers
+// that count scanlines cannot be used at all, their IRQ counter would be run
+// by the worker and read by the CPU.
+class PPUWorker {
+   public:
+    explicit PPUWorker(PPU &ppu);
+    ~PPUWorker();
+
+    PPUWorker(const PPUWorker &) = delete;
+    PPUWorker &operator=(const PPUWorker &) = delete;
+
+    // Lets the worker run up to cpu_cycle, without waiting for it
+    void catch_up(uint64_t cpu_cycle);
+
+    // A register write made on cpu_cycle. Only waits if the log is full.
+    void write_register(uint64_t cpu_cycle, uint16_t address, uint8_t data);
+
+    // Waits until the worker has run up to cpu_cycle and made every write
+    // before it, then leaves the PPU idle for the CPU thread
+    void sync(uint64_t cpu_cycle);
+
+   private:
+    // address is 0 for entries that only let the worker run further
+    struct LoggedWrite {
+        uint64_t cpu_cycle;
+        uint16_t address;
+        uint8_t data;
+    };
+
+    void push(uint64_t cpu_cycle, uint16_t address, uint8_t data);
+    void run();
+
+    PPU &ppu;
+
+    // Single producer (the CPU thread), single consumer (the worker), with
+    // indexes like SpscRing's. Unlike there both sides wait: the worker
+    // sleeps on log_head when it is done, and the CPU thread on log_tail
+    // when it waits for the worker.
+    std::array<LoggedWrite, PPU_LOG_SIZE> log;
+    alignas(64) std::atomic<uint64_t> log_head;
+    alignas(64) std::atomic<uint64_t> log_tail;
+    std::atomic<bool> stopping;
+
+    // the latest cycle put in the log, only the CPU thread uses it
+    uint64_t logged_cycle;
+
+    std::thread thread;
+};
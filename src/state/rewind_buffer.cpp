@@ -0,0 +1,226 @@
+#include "rewind_buffer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+// A zero run is this byte followed by its length as a LEB128 varint, any
+// other byte n is followed by n bytes taken as they are
+const static uint8_t ZERO_RUN = 0x00;
+const static size_t MAX_LITERAL_RUN = 255;
+
+static uint64_t load_64(const uint8_t *in) {
+    uint64_t value;
+    std::memcpy(&value, in, sizeof(value));
+    return value;
+}
+
+size_t max_delta_length(size_t size) {
+    // nothing but literal runs, each with a byte in front
+    return size + size / MAX_LITERAL_RUN + 16;
+}
+
+size_t encode_delta(const uint8_t *current, const uint8_t *base, size_t size,
+                    uint8_t *out) {
+    uint8_t *start = out;
+    size_t i = 0;
+    while (i < size) {
+        // unchanged bytes, 8 at a time while we can
+        size_t run_start = i;
+        while (i + 8 <= size && load_64(current + i) == load_64(base + i)) {
+            i += 8;
+        }
+        while (i < size && current[i] == base[i]) {
+            i++;
+        }
+        if (i > run_start) {
+            *out++ = ZERO_RUN;
+            for (size_t run = i - run_start; ; run >>= 7) {
+                if (run < 0x80) {
+                    *out++ = run;
+                    break;
+                }
+                *out++ = (run & 0x7F) | 0x80;
+            }
+        }
+        if (i == size) {
+            break;
+        }
+
+        // changed bytes, up to where at least 3 unchanged ones in a row make
+        // a zero run worth it
+        uint8_t *length = out++;
+        size_t literal_start = i;
+        while (i < size && i - literal_start < MAX_LITERAL_RUN) {
+            if (i + 3 <= size && current[i] == base[i] &&
+                current[i + 1] == base[i + 1] &&
+                current[i + 2] == base[i + 2]) {
+                break;
+            }
+            *out++ = current[i] ^ base[i];
+            i++;
+        }
+        *length = i - literal_start;
+    }
+    return out - start;
+}
+
+void apply_delta(const uint8_t *delta, size_t length, uint8_t *out) {
+    const uint8_t *end = delta + length;
+    while (delta < end) {
+        uint8_t token = *delta++;
+        if (token == ZERO_RUN) {
+            size_t run = 0;
+            for (int shift = 0;; shift += 7) {
+                uint8_t byte = *delta++;
+                run |= static_cast<size_t>(byte & 0x7F) << shift;
+                if (!(byte & 0x80)) {
+                    break;
+                }
+            }
+            out += run;
+        } else {
+            for (uint8_t i = 0; i < token; i++) {
+                out[i] ^= delta[i];
+            }
+            out += token;
+            delta += token;
+        }
+    }
+}
+
+RewindBuffer::RewindBuffer(size_t budget, uint32_t max_frames,
+                           uint32_t keyframe_interval)
+    : keyframe_interval(std::max<uint32_t>(keyframe_interval, 1)),
+      storage(budget),
+      write_position(0),
+      used_bytes(0),
+      frames(std::max<uint32_t>(max_frames, 1)),
+      first(0),
+      count(0),
+      newest(SAVE_STATE_CAPACITY),
+      newest_size(0),
+      scratch(SAVE_STATE_CAPACITY),
+      zeros(SAVE_STATE_CAPACITY, 0) {
+    if (max_delta_length(SAVE_STATE_CAPACITY) > budget) {
+        throw std::runtime_error("rewind budget cannot hold a single frame");
+    }
+}
+
+void RewindBuffer::clear() {
+    write_position = 0;
+    used_bytes = 0;
+    first = 0;
+    count = 0;
+    newest_size = 0;
+}
+
+// A delta only works with the frame it was made from, so without its
+// keyframe a delta is useless and goes too
+void RewindBuffer::drop_oldest() {
+    do {
+        used_bytes -= frame(0).length;
+        first = (first + 1) % frames.size();
+        count--;
+    } while (count > 0 && frame(0).depth != 0);
+}
+
+// Finds length bytes in a row for the next frame, dropping the oldest ones
+// until there are. Returns where they start.
+size_t RewindBuffer::make_room(size_t length) {
+    if (count == frames.size()) {
+        drop_oldest();
+    }
+    while (true) {
+        if (count == 0) {
+            write_position = 0;
+            return 0;
+        }
+        size_t oldest = frame(0).offset;
+        if (oldest >= write_position) {
+            // the oldest frame is ahead in storage, everything up to it is
+            // free
+            if (write_position + length <= oldest) {
+                return write_position;
+            }
+            drop_oldest();
+        } else if (write_position + length <= storage.size()) {
+            // the oldest frame is behind, everything up to the end is free
+            return write_position;
+        } else {
+            // start over at the beginning, the end is wasted until then
+            write_position = 0;
+        }
+    }
+}
+
+void RewindBuffer::push(SaveState &state) {
+    size_t size = state.size();
+    size_t offset = make_room(max_delta_length(size));
+
+    bool keyframe = count == 0 || size != newest_size ||
+                    frame(count - 1).depth + 1 >= keyframe_interval;
+    const uint8_t *base = keyframe ? zeros.data() : newest.data();
+    size_t length =
+        encode_delta(state.data(), base, size, storage.data() + offset);
+
+    Frame &added = frames[(first + count) % frames.size()];
+    added.offset = offset;
+    added.length = length;
+    added.state_size = size;
+    added.depth = keyframe ? 0 : frame(count - 1).depth + 1;
+    count++;
+    write_position = offset + length;
+    used_bytes += length;
+
+    std::memcpy(newest.data(), state.data(), size);
+    newest_size = size;
+}
+
+// Starts from the keyframe age builds on and applies the deltas after it
+void RewindBuffer::rebuild(uint32_t age, uint8_t *out) {
+    uint32_t keyframe = age - frame(age).depth;
+    std::memset(out, 0, frame(keyframe).state_size);
+    for (uint32_t i = keyframe; i <= age; i++) {
+        apply_delta(storage.data() + frame(i).offset, frame(i).length, out);
+    }
+}
+
+bool RewindBuffer::rewind(SaveState &state) {
+    if (count < 2) {
+        return false;
+    }
+    Frame dropped = frame(count - 1);
+    if (dropped.depth != 0) {
+        // newest XOR (newest XOR previous)
+        apply_delta(storage.data() + dropped.offset, dropped.length,
+                    newest.data());
+    } else {
+        rebuild(count - 2, newest.data());
+    }
+    count--;
+    used_bytes -= dropped.length;
+    write_position = dropped.offset;
+    newest_size = frame(count - 1).state_size;
+    state.assign(newest.data(), newest_size);
+    return true;
+}
+
+bool RewindBuffer::peek(uint32_t frames_back, SaveState &state) {
+    if (frames_back >= count) {
+        return false;
+    }
+    uint32_t age = count - 1 - frames_back;
+    if (frame(count - 1).depth >= frames_back) {
+        // no keyframe in between, undo the deltas from the newest one back
+        std::memcpy(scratch.data(), newest.data(), newest_size);
+        for (uint32_t i = count - 1; i > age; i--) {
+            apply_delta(storage.data() + frame(i).offset, frame(i).length,
+                        scratch.data());
+        }
+    } else {
+        rebuild(age, scratch.data());
+    }
+    state.assign(scratch.data(), frame(age).state_size);
+    return true;
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "save_state.h"
+
+// Every this many frames the state is kept whole instead of as a delta, so
+// getting any frame back never takes more than this many deltas
+const static uint32_t REWIND_KEYFRAME_INTERVAL = 60;
+
+// The last so many frames of save states, in a fixed amount of memory.
+//
+// Each frame is kept as the XOR of its state with the one before, which is
+// zero wherever the frame changed nothing, so almost all of it, and the
+// zeros are run length encoded away. Every REWIND_KEYFRAME_INTERVAL frames
+// the state itself goes in instead, run length encoded the same way. When
+// the budget runs out the oldest keyframe goes, together with the deltas
+// that need it.
+//
+// The newest state is also kept as it is, so stepping back a frame is
+// undoing one delta, and a new frame only has to be XORed with it.
+class RewindBuffer {
+   public:
+    // budget is the bytes the encoded frames may take, max_frames how many
+    // there can be at most. Both are allocated up front.
+    RewindBuffer(size_t budget, uint32_t max_frames,
+                 uint32_t keyframe_interval = REWIND_KEYFRAME_INTERVAL);
+
+    RewindBuffer(const RewindBuffer &) = delete;
+    RewindBuffer &operator=(const RewindBuffer &) = delete;
+
+    // Adds state as the newest frame
+    void push(SaveState &state);
+
+    // Drops the newest frame and puts the one before it into state, which
+    // is the newest frame from then on. Returns false, and leaves state
+    // alone, if there is no frame before it.
+    bool rewind(SaveState &state);
+
+    // Puts the state from frames_back frames before the newest into state,
+    // without dropping anything. Returns false if it is not held anymore.
+    bool peek(uint32_t frames_back, SaveState &state);
+
+    void clear();
+
+    uint32_t get_frames() { return count; }
+    // bytes the encoded frames take up
+    size_t get_used_bytes() { return used_bytes; }
+
+   private:
+    struct Frame {
+        size_t offset;
+        uint32_t length;
+        uint32_t state_size;
+        // frames since the keyframe this one builds on, 0 for a keyframe
+        uint32_t depth;
+    };
+
+    Frame &frame(uint32_t age) {
+        return frames[(first + age) % frames.size()];
+    }
+    size_t make_room(size_t length);
+    void drop_oldest();
+    void rebuild(uint32_t age, uint8_t *out);
+
+    uint32_t keyframe_interval;
+    std::vector<uint8_t> storage;
+    // encoded frames are never split, one that does not fit before the end
+    // of storage starts over at the beginning
+    size_t write_position;
+    size_t used_bytes;
+
+    // oldest first
+    std::vector<Frame> frames;
+    uint32_t first;
+    uint32_t count;
+
+    // the newest state as it is, and room to rebuild others in
+    std::vector<uint8_t> newest;
+    size_t newest_size;
+    std::vector<uint8_t> scratch;
+    std::vector<uint8_t> zeros;
+};
+
+// The XOR of size bytes of current and base, encoded as runs of zeros and
+// runs of other bytes. Returns the length written to out, which needs
+// room for max_delta_length(size).
+size_t encode_delta(const uint8_t *current, const uint8_t *base, size_t size,
+                    uint8_t *out);
+// XORs what encode_delta() made into out
+void apply_delta(const uint8_t *delta, size_t length, uint8_t *out);
+size_t max_delta_length(size_t size);
@@ -0,0 +1,82 @@
+#include "save_state.h"
+
+#include <cstring>
+#include <stdexcept>
+
+const static uint32_t STATE_HEADER_SIZE = 12;
+const static uint32_t SECTION_HEADER_SIZE = 8;
+
+SaveState::SaveState()
+    : buffer(SAVE_STATE_CAPACITY, 0),
+      used(0),
+      sections(0),
+      owner(0),
+      serial(0) {}
+
+void SaveState::begin() {
+    used = STATE_HEADER_SIZE;
+    sections = 0;
+}
+
+uint8_t *SaveState::add_section(uint32_t tag, uint32_t size) {
+    if (buffer.size() - used < SECTION_HEADER_SIZE + size) {
+        throw std::runtime_error("save state is too big");
+    }
+    uint8_t *header = &buffer[used];
+    put_u32(header, tag);
+    put_u32(header + 4, size);
+    used += SECTION_HEADER_SIZE + size;
+    sections++;
+    return header + SECTION_HEADER_SIZE;
+}
+
+void SaveState::end() {
+    put_u32(&buffer[0], STATE_MAGIC);
+    put_u16(&buffer[4], SAVE_STATE_VERSION);
+    put_u16(&buffer[6], sections);
+    put_u32(&buffer[8], used);
+}
+
+void SaveState::check() {
+    if (used < STATE_HEADER_SIZE || get_u32(&buffer[0]) != STATE_MAGIC) {
+        throw std::runtime_error("not a save state");
+    }
+    if (get_u16(&buffer[4]) != SAVE_STATE_VERSION) {
+        throw std::runtime_error("save state is of another version");
+    }
+    if (get_u32(&buffer[8]) != used) {
+        throw std::runtime_error("save state is cut short");
+    }
+}
+
+const uint8_t *SaveState::find_section(uint32_t tag, uint32_t &size) {
+    size_t position = STATE_HEADER_SIZE;
+    uint16_t count = get_u16(&buffer[6]);
+    for (uint16_t i = 0; i < count; i++) {
+        if (used - position < SECTION_HEADER_SIZE) {
+            break;
+        }
+        const uint8_t *header = &buffer[position];
+        uint32_t section_size = get_u32(header + 4);
+        if (used - position - SECTION_HEADER_SIZE < section_size) {
+            throw std::runtime_error("save state is cut short");
+        }
+        if (get_u32(header) == tag) {
+            size = section_size;
+            return header + SECTION_HEADER_SIZE;
+        }
+        position += SECTION_HEADER_SIZE + section_size;
+    }
+    return nullptr;
+}
+
+void SaveState::assign(const uint8_t *data, size_t size) {
+    if (size > buffer.size()) {
+        throw std::runtime_error("save state is too big");
+    }
+    std::memcpy(buffer.data(), data, size);
+    used = size;
+    // the memory in here came from somewhere else
+    owner = 0;
+    serial = 0;
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Bumped whenever a section changes layout. States of another version are
+// refused rather than misread.
+const static uint16_t SAVE_STATE_VERSION = 1;
+
+// Room for the header, the CPU registers and all 256 pages of memory with
+// their page list, plus some for the sections still to come
+const static size_t SAVE_STATE_CAPACITY = 80 * 1024;
+
+constexpr uint32_t make_state_tag(char a, char b, char c, char d) {
+    return static_cast<uint8_t>(a) | (static_cast<uint8_t>(b) << 8) |
+           (static_cast<uint8_t>(c) << 16) |
+           (static_cast<uint32_t>(static_cast<uint8_t>(d)) << 24);
+}
+
+// Section tags. A section a reader does not know is skipped, so the PPU,
+// APU and mappers can add theirs next to the CPU's.
+const static uint32_t STATE_MAGIC = make_state_tag('N', 'E', 'S', 'S');
+const static uint32_t STATE_CPU = make_state_tag('C', 'P', 'U', ' ');
+const static uint32_t STATE_MEMORY = make_state_tag('M', 'E', 'M', ' ');
+
+// Little endian, whatever the host is
+inline void put_u16(uint8_t *out, uint16_t value) {
+    out[0] = value;
+    out[1] = value >> 8;
+}
+inline void put_u32(uint8_t *out, uint32_t value) {
+    put_u16(out, value);
+    put_u16(out + 2, value >> 16);
+}
+inline void put_u64(uint8_t *out, uint64_t value) {
+    put_u32(out, value);
+    put_u32(out + 4, value >> 32);
+}
+inline uint16_t get_u16(const uint8_t *in) { return in[0] | (in[1] << 8); }
+inline uint32_t get_u32(const uint8_t *in) {
+    return get_u16(in) | (static_cast<uint32_t>(get_u16(in + 2)) << 16);
+}
+inline uint64_t get_u64(const uint8_t *in) {
+    return get_u32(in) | (static_cast<uint64_t>(get_u32(in + 4)) << 32);
+}
+
+// A save state: a header followed by tagged sections.
+//
+//   header   "NESS", u16 version, u16 section count, u32 total size
+//   section  u32 tag, u32 payload size, payload
+//
+// The buffer is allocated once, up front, and every snapshot is written over
+// the last one, so taking one never allocates. That is also what lets the
+// CPU copy only the memory pages written since it last took a snapshot into
+// the same SaveState (see CPU::snapshot()), the other pages are already
+// there.
+class SaveState {
+   public:
+    SaveState();
+
+    // Writer side: begin(), one add_section() per section, then end().
+    // add_section() returns where the payload goes, which keeps whatever was
+    // there before. Throws std::runtime_error if the state would outgrow
+    // SAVE_STATE_CAPACITY.
+    void begin();
+    uint8_t *add_section(uint32_t tag, uint32_t size);
+    void end();
+
+    // Reader side. Throws std::runtime_error if this is not a save state of
+    // SAVE_STATE_VERSION. find_section() returns nullptr if there is no
+    // section with that tag, and sets size to its payload size otherwise.
+    void check();
+    const uint8_t *find_section(uint32_t tag, uint32_t &size);
+
+    // The bytes of the whole state, for writing it somewhere else
+    const uint8_t *data() { return buffer.data(); }
+    size_t size() { return used; }
+    // Takes a state written somewhere else. Throws std::runtime_error if it
+    // does not fit.
+    void assign(const uint8_t *data, size_t size);
+
+   private:
+    std::vector<uint8_t> buffer;
+    size_t used;
+    uint16_t sections;
+
+    // the CPU that last wrote the memory in here or was restored from it,
+    // and its snapshot serial at the time (see CPU::snapshot()). 0 if none.
+    uint64_t owner;
+    uint64_t serial;
+    friend class CPU;
+};
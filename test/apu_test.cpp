@@ -0,0 +1,343 @@
+#include "apu/apu.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "apu/wav_writer.h"
+#include "console/console.h"
+#include "rom_file.h"
+
+// CPU memory for the DMC, every byte is the same
+static uint8_t read_constant(void *context, uint16_t) {
+    return *static_cast<uint8_t *>(context);
+}
+
+// Catches apu up a frame at a time like a console would and returns
+// everything it put out
+static std::vector<int16_t> run_apu(APU &apu, AudioRing &ring,
+                                    uint64_t from, uint64_t to) {
+    std::vector<int16_t> samples;
+    std::vector<int16_t> chunk(ring.capacity());
+    for (uint64_t cycle = from; cycle < to;) {
+        cycle = std::min<uint64_t>(cycle + 29780, to);
+        apu.catch_up(cycle);
+        size_t count = ring.read(chunk.data(), chunk.size());
+        samples.insert(samples.end(), chunk.begin(), chunk.begin() + count);
+    }
+    return samples;
+}
+
+TEST(APUTest, TEST_BlipBuffer) {
+    BlipBuffer blip(CPU_CLOCK_RATE, 44100, 0);
+    // a step of 10000 a tenth of a second in
+    blip.add_delta(178977, 10000);
+    blip.end_frame(357955);
+    ASSERT_EQ(blip.samples_available(), 8820);
+
+    std::vector<int16_t> samples(9000);
+    ASSERT_EQ(blip.read_samples(samples.data(), samples.size()), 8820);
+    ASSERT_EQ(blip.samples_available(), 0);
+    // silent until just before the step, which is spread over a few samples
+    // around sample 4410, plus the half width the kernel delays it by
+    for (int i = 0; i < 4400; i++) {
+        ASSERT_EQ(samples[i], 0) << i;
+    }
+    int16_t peak = *std::max_element(samples.begin(), samples.end());
+    ASSERT_GE(peak, 9900);
+    // ringing stays within a few percent
+    ASSERT_LE(peak, 10600);
+    // then the high pass pulls it back towards 0
+    ASSERT_LT(samples[8819], 5000);
+    ASSERT_GT(samples[8819], 0);
+}
+
+TEST(APUTest, TEST_PulseFrequency) {
+    uint8_t zero = 0;
+    APU apu({&read_constant, &zero});
+    AudioRing ring(4096);
+    apu.set_output(&ring, 44100);
+
+    // pulse 1 at full constant volume, 50% duty, no length counter, timer 253
+    // which is 1789773 / 16 / 254 = 440.4 Hz
+    apu.write_register(0x4015, APU_STATUS_PULSE_1);
+    apu.write_register(0x4000, 0xBF);
+    apu.write_register(0x4001, 0x00);
+    apu.write_register(0x4002, 253);
+    apu.write_register(0x4003, 0x00);
+    std::vector<int16_t> samples = run_apu(apu, ring, 0, 1789773);
+    ASSERT_NEAR(samples.size(), 44100, 1);
+    ASSERT_EQ(ring.get_dropped(), 0);
+
+    // the high pass centers it on 0 after a while, from then on there is one
+    // rising edge per period
+    int rising = 0;
+    for (size_t i = 4410 + 1; i < samples.size(); i++) {
+        if (samples[i - 1] < 0 && samples[i] >= 0) {
+            rising++;
+        }
+    }
+    ASSERT_NEAR(rising, 440.4 * 0.9, 2);
+    int16_t loudest = *std::max_element(samples.begin(), samples.end());
+    ASSERT_GT(loudest, 15 * 260 / 2 - 200);
+}
+
+TEST(APUTest, TEST_LengthCounter) {
+    uint8_t zero = 0;
+    APU apu({&read_constant, &zero});
+
+    // nothing loads while the channel is disabled
+    apu.write_register(0x4003, 0x08);
+    ASSERT_EQ(apu.read_status() & APU_STATUS_PULSE_1, 0);
+
+    // index 1 is 254 half frames, index 0 is 10
+    apu.write_register(0x4015, APU_STATUS_PULSE_1 | APU_STATUS_NOISE);
+    apu.write_register(0x4003, 0x00);
+    apu.write_register(0x400F, 0x08);
+    ASSERT_EQ(apu.read_status(), APU_STATUS_PULSE_1 | APU_STATUS_NOISE);
+
+    // 2 half frames per 4 step sequence, the 10th takes it to 0
+    apu.write_register(0x4017, 0x40);
+    apu.catch_up(4 * 29830 + 29829 - 1);
+    ASSERT_EQ(apu.read_status() & APU_STATUS_PULSE_1, APU_STATUS_PULSE_1);
+    apu.catch_up(4 * 29830 + 29829);
+    ASSERT_EQ(apu.read_status(), APU_STATUS_NOISE);
+
+    // disabling clears it right away
+    apu.write_register(0x4015, 0);
+    ASSERT_EQ(apu.read_status(), 0);
+}
+
+TEST(APUTest, TEST_FrameIRQ) {
+    // JMP $E000 with interrupts disabled, which reset leaves them
+    std::vector<uint8_t> prg(2 * PRG_ROM_BANK_SIZE, 0xEA);
+    prg[0x6000] = 0x4C;
+    prg[0x6001] = 0x00;
+    prg[0x6002] = 0xE0;
+    prg[0x7FFC] = 0x00;
+    prg[0x7FFD] = 0xE0;
+    std::string path =
+        write_rom("apu_test_frame_irq", {'N', 'E', 'S', 0x1A, 2, 0}, prg, {});
+    Console console(path);
+    CPU &cpu = console.get_cpu();
+    APU &apu = console.get_apu();
+
+    // the slice ends on the IRQ, which is on the last step of the sequence
+    ASSERT_EQ(apu.next_event_cycle(), 29829);
+    ASSERT_TRUE(console.run_until_cycle(29000));
+    ASSERT_FALSE(apu.is_irq_asserted());
+    ASSERT_TRUE(console.run_until_cycle(29829));
+    ASSERT_TRUE(apu.is_irq_asserted());
+    ASSERT_LE(cpu.get_cycles(), 29829 + 3);
+
+    // reading $4015 tells and clears it, and the next one is a sequence later
+    ASSERT_EQ(cpu.mem_read(0x4015) & APU_STATUS_FRAME_IRQ,
+              APU_STATUS_FRAME_IRQ);
+    ASSERT_FALSE(apu.is_irq_asserted());
+    ASSERT_EQ(apu.next_event_cycle(), 29830 + 29829);
+
+    // none in 5 step mode or with the inhibit flag
+    cpu.mem_write(0x4017, 0x80);
+    ASSERT_EQ(apu.next_event_cycle(), UINT64_MAX);
+    ASSERT_TRUE(console.run_until_cycle(200000));
+    ASSERT_FALSE(apu.is_irq_asserted());
+    cpu.mem_write(0x4017, 0x40);
+    ASSERT_EQ(apu.next_event_cycle(), UINT64_MAX);
+}
+
+// Writes APU registers in a loop while the PPU draws, on its own thread if
+// threaded, and returns the cycle each of a few frames ended on
+static std::vector<uint64_t> run_apu_writes(bool threaded) {
+    std::vector<uint8_t> prg(2 * PRG_ROM_BANK_SIZE, 0xEA);
+    std::vector<uint8_t> program = {
+        0xA9, 0x1E,        // LDA #$1E
+        0x8D, 0x01, 0x20,  // STA $2001: background and sprites on
+        0x8D, 0x05, 0x20,  // STA $2005, which the worker takes
+        0x8D, 0x00, 0x40,  // STA $4000
+        0xAD, 0x15, 0x40,  // LDA $4015
+        0x4C, 0x05, 0xE0,  // JMP $E005
+    };
+    std::copy(program.begin(), program.end(), prg.begin() + 0x6000);
+    prg[0x7FFC] = 0x00;
+    prg[0x7FFD] = 0xE0;
+    std::string path =
+        write_rom(threaded ? "apu_test_writes_threaded" : "apu_test_writes",
+                  {'N', 'E', 'S', 0x1A, 2, 0}, prg, {});
+    Console console(path);
+    EXPECT_TRUE(console.set_ppu_thread(threaded));
+    std::vector<uint64_t> frame_ends;
+    for (int i = 0; i < 5; i++) {
+        EXPECT_TRUE(console.run_frame());
+        frame_ends.push_back(console.get_cpu().get_cycles());
+    }
+    std::filesystem::remove(path);
+    return frame_ends;
+}
+
+TEST(APUTest, TEST_ThreadedPPU) {
+    // APU register accesses must not look at the PPU while the worker runs
+    // it, and the frames end where they do without the thread
+    ASSERT_EQ(run_apu_writes(true), run_apu_writes(false));
+}
+
+TEST(APUTest, TEST_DMC) {
+    uint8_t ones = 0xFF;
+    APU apu({&read_constant, &ones});
+
+    // 17 bytes at the fastest rate with the IRQ on. The first byte is
+    // fetched right away, the next when the shift register runs out on the
+    // 8th DMC clock, and the last 16 bytes of 8 bits of 54 cycles after the
+    // first.
+    apu.write_register(0x4010, 0x8F);
+    apu.write_register(0x4011, 0);
+    apu.write_register(0x4012, 0);
+    apu.write_register(0x4013, 1);
+    apu.write_register(0x4015, APU_STATUS_DMC);
+    ASSERT_EQ(apu.read_status(), APU_STATUS_DMC);
+
+    // catching up to the guess and asking again always gets there
+    uint64_t cycle = 0;
+    int steps = 0;
+    while (!apu.is_irq_asserted()) {
+        uint64_t next = apu.next_event_cycle();
+        ASSERT_GT(next, cycle);
+        cycle = next;
+        apu.catch_up(cycle);
+        ASSERT_LT(++steps, 100);
+    }
+    ASSERT_EQ(cycle, (16 * 8 - 1) * 54 + 1);
+    ASSERT_EQ(steps, 1);
+    ASSERT_EQ(apu.read_status(), APU_STATUS_DMC_IRQ);
+
+    // writing $4015 acknowledges it
+    apu.write_register(0x4015, 0);
+    ASSERT_FALSE(apu.is_irq_asserted());
+}
+
+TEST(APUTest, TEST_AudioRing) {
+    AudioRing ring(1000);
+    ASSERT_EQ(ring.capacity(), 1024);
+
+    // goes around the end a few times
+    std::vector<int16_t> in(700);
+    std::vector<int16_t> out(700);
+    for (int round = 0; round < 5; round++) {
+        for (size_t i = 0; i < in.size(); i++) {
+            in[i] = round * 1000 + i;
+        }
+        ASSERT_EQ(ring.write(in.data(), in.size()), 700);
+        ASSERT_EQ(ring.size(), 700);
+        ASSERT_EQ(ring.read(out.data(), out.size()), 700);
+        ASSERT_EQ(in, out);
+    }
+
+    // what does not fit is dropped, what is missing is silence
+    ASSERT_EQ(ring.write(in.data(), 700), 700);
+    ASSERT_EQ(ring.write(in.data(), 700), 324);
+    ASSERT_EQ(ring.get_dropped(), 376);
+    std::vector<int16_t> stream(1100, 1);
+    AudioRing::audio_callback(&ring, reinterpret_cast<uint8_t *>(stream.data()),
+                              stream.size() * 2);
+    ASSERT_EQ(stream[1023], in[323]);
+    ASSERT_EQ(stream[1024], 0);
+    ASSERT_EQ(stream[1099], 0);
+    ASSERT_EQ(ring.size(), 0);
+}
+
+TEST(APUTest, TEST_AudioRing_Threads) {
+    AudioRing ring(256);
+    const int total = 200000;
+    std::thread producer([&ring]() {
+        int16_t next = 0;
+        int written = 0;
+        while (written < total) {
+            int16_t chunk[37];
+            int count = std::min(37, total - written);
+            for (int i = 0; i < count; i++) {
+                chunk[i] = next + i;
+            }
+            size_t fit = ring.write(chunk, count);
+            next += fit;
+            written += fit;
+            if (fit == 0) {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    // everything arrives in order, whatever the dropped samples did to the
+    // chunks the producer retries
+    int16_t expected = 0;
+    int read = 0;
+    int16_t chunk[53];
+    while (read < total) {
+        size_t count = ring.read(chunk, 53);
+        for (size_t i = 0; i < count; i++) {
+            ASSERT_EQ(chunk[i], expected);
+            expected++;
+        }
+        read += count;
+        if (count == 0) {
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+}
+
+TEST(APUTest, TEST_WavWriter) {
+    std::string path =
+        (std::filesystem::temp_directory_path() / "apu_test.wav").string();
+    std::vector<int16_t> samples = {0, 1000, -1000, 32767, -32768};
+    {
+        WavWriter wav(path, 48000);
+        wav.write(samples.data(), samples.size());
+        wav.write(samples.data(), samples.size());
+        ASSERT_EQ(wav.get_samples_written(), 10);
+    }
+
+    std::ifstream in(path, std::ios::binary);
+    std::vector<uint8_t> file((std::istreambuf_iterator<char>(in)),
+                              std::istreambuf_iterator<char>());
+    ASSERT_EQ(file.size(), 44 + 20);
+    ASSERT_EQ(std::string(file.begin(), file.begin() + 4), "RIFF");
+    ASSERT_EQ(std::string(file.begin() + 8, file.begin() + 16), "WAVEfmt ");
+    auto u32 = [&file](size_t at) {
+        return file[at] | (file[at + 1] << 8) | (file[at + 2] << 16) |
+               (file[at + 3] << 24);
+    };
+    ASSERT_EQ(u32(4), 36 + 20);
+    ASSERT_EQ(u32(24), 48000);
+    ASSERT_EQ(u32(40), 20);
+    // 1000, little endian
+    ASSERT_EQ(file[46], 0xE8);
+    ASSERT_EQ(file[47], 0x03);
+}
+
+TEST(APUTest, TEST_NoSink) {
+    uint8_t zero = 0;
+    APU apu({&read_constant, &zero});
+    apu.write_register(0x4015, APU_STATUS_PULSE_1 | APU_STATUS_TRIANGLE);
+    apu.write_register(0x4000, 0xBF);
+    apu.write_register(0x4003, 0x00);
+    apu.write_register(0x4008, 0xFF);
+    apu.write_register(0x400B, 0x00);
+
+    // with a ring nobody reads, it fills up and the rest is dropped
+    AudioRing ring(1024);
+    apu.set_output(&ring, 48000);
+    apu.catch_up(1789773);
+    ASSERT_EQ(ring.size(), 1024);
+    ASSERT_NEAR(ring.get_dropped(), 48000 - 1024, 2);
+
+    // and without one at all it still keeps time
+    apu.set_output(nullptr, 0);
+    apu.catch_up(2 * 1789773);
+    ASSERT_EQ(ring.size(), 1024);
+    ASSERT_EQ(apu.read_status() & 0x1F,
+              APU_STATUS_PULSE_1 | APU_STATUS_TRIANGLE);
+}
@@ -0,0 +1,347 @@
+#include "cartridge/cartridge.h"
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "cartridge/mapper.h"
+#include "cpu.h"
+#include "dynarec.h"
+#include "rom_file.h"
+
+TEST(CartridgeTest, TEST_NROM) {
+    // one 16 KiB bank: LDA #$42, STA $0200, BRK with the reset vector
+    // pointing at it
+    std::vector<uint8_t> prg(PRG_ROM_BANK_SIZE, 0xEA);
+    std::vector<uint8_t> code = {0xA9, 0x42, 0x8D, 0x00, 0x02, 0x00};
+    std::copy(code.begin(), code.end(), prg.begin());
+    prg[0x3FFC] = 0x00;
+    prg[0x3FFD] = 0x80;
+    std::vector<uint8_t> chr(CHR_ROM_BANK_SIZE, 0x55);
+    std::string path = write_rom("cartridge_test_nrom",
+                                 {'N', 'E', 'S', 0x1A, 1, 1, 0x01}, prg, chr);
+
+    Cartridge cartridge(path);
+    ASSERT_EQ(cartridge.get_mapper_number(), 0);
+    ASSERT_EQ(cartridge.get_mirroring(), VERTICAL);
+    ASSERT_FALSE(cartridge.is_nes2());
+    ASSERT_EQ(cartridge.get_prg_rom_size(), PRG_ROM_BANK_SIZE);
+    ASSERT_EQ(cartridge.get_chr_size(), CHR_ROM_BANK_SIZE);
+    ASSERT_FALSE(cartridge.has_chr_ram());
+    ASSERT_EQ(cartridge.get_chr()[0], 0x55);
+    // iNES 1 files always get 8 KiB of PRG RAM
+    ASSERT_EQ(cartridge.get_prg_ram_size(), 8 * 1024);
+
+    auto mapper = make_mapper(cartridge);
+    CPU cpu;
+    cpu.load(*mapper);
+    cpu.reset();
+    ASSERT_EQ(cpu.get_program_counter(), 0x8000);
+    cpu.run();
+    ASSERT_EQ(cpu.get_register_a(), 0x42);
+
+    // 2 KiB of RAM mirrored, 16 KiB of ROM mirrored, ROM ignores writes
+    ASSERT_EQ(cpu.mem_read(0x0A00), 0x42);
+    ASSERT_EQ(cpu.mem_read(0xC000), 0xA9);
+    cpu.mem_write(0x8000, 0x00);
+    ASSERT_EQ(cpu.mem_read(0x8000), 0xA9);
+    // PRG RAM
+    cpu.mem_write(0x6000, 0x12);
+    ASSERT_EQ(cpu.mem_read(0x6000), 0x12);
+
+    std::filesystem::remove(path);
+}
+
+TEST(CartridgeTest, TEST_NES2Header) {
+    // four 16 KiB banks, each filled with its own number
+    std::vector<uint8_t> prg;
+    for (uint8_t bank = 0; bank < 4; bank++) {
+        prg.insert(prg.end(), PRG_ROM_BANK_SIZE, bank);
+    }
+    // mapper 0x1A4 submapper 2, battery, vertical, 8 KiB of PRG NVRAM and
+    // 8 KiB of CHR RAM
+    std::string path =
+        write_rom("cartridge_test_nes2",
+                  {'N', 'E', 'S', 0x1A, 4, 0, 0x43, 0xA8, 0x21, 0x00, 0x70,
+                   0x07},
+                  prg, {});
+
+    Cartridge cartridge(path);
+    ASSERT_TRUE(cartridge.is_nes2());
+    ASSERT_EQ(cartridge.get_mapper_number(), 0x1A4);
+    ASSERT_EQ(cartridge.get_submapper(), 2);
+    ASSERT_TRUE(cartridge.has_battery());
+    ASSERT_EQ(cartridge.get_mirroring(), VERTICAL);
+    ASSERT_EQ(cartridge.get_prg_rom_size(), 4 * PRG_ROM_BANK_SIZE);
+    ASSERT_EQ(cartridge.get_prg_ram_size(), 8 * 1024);
+    ASSERT_TRUE(cartridge.has_chr_ram());
+    ASSERT_EQ(cartridge.get_chr_size(), 8 * 1024);
+    ASSERT_THROW(make_mapper(cartridge), std::runtime_error);
+
+    std::filesystem::remove(path);
+}
+
+TEST(CartridgeTest, TEST_Invalid) {
+    ASSERT_THROW(Cartridge("/nonexistent/rom.nes"), std::runtime_error);
+
+    std::vector<uint8_t> prg(PRG_ROM_BANK_SIZE);
+    std::string bad_magic =
+        write_rom("cartridge_test_magic", {'N', 'E', 'Z', 0x1A, 1}, prg, {});
+    ASSERT_THROW(Cartridge{bad_magic}, std::runtime_error);
+
+    // says 2 banks but only has 1
+    std::string truncated = write_rom("cartridge_test_truncated",
+                                      {'N', 'E', 'S', 0x1A, 2}, prg, {});
+    ASSERT_THROW(Cartridge{truncated}, std::runtime_error);
+
+    // NES 2.0 exponent sizes: 2^63 * 7 bytes of PRG, which overflows,
+    // 2^3 bytes of CHR, which is not a whole 1 KiB bank, and 2^0 bytes of
+    // PRG, which is not a whole 8 KiB bank
+    std::string huge = write_rom(
+        "cartridge_test_huge",
+        {'N', 'E', 'S', 0x1A, 0xFF, 0, 0, 0x08, 0, 0x0F}, prg, {});
+    ASSERT_THROW(Cartridge{huge}, std::runtime_error);
+    std::string tiny_chr = write_rom(
+        "cartridge_test_tiny_chr",
+        {'N', 'E', 'S', 0x1A, 1, 0x0C, 0, 0x08, 0, 0xF0}, prg,
+        std::vector<uint8_t>(8));
+    ASSERT_THROW(Cartridge{tiny_chr}, std::runtime_error);
+    std::string tiny_prg = write_rom(
+        "cartridge_test_tiny_prg",
+        {'N', 'E', 'S', 0x1A, 0, 0, 0, 0x08, 0, 0x0F}, {0xEA}, {});
+    ASSERT_THROW(Cartridge{tiny_prg}, std::runtime_error);
+
+    std::filesystem::remove(bad_magic);
+    std::filesystem::remove(truncated);
+    std::filesystem::remove(huge);
+    std::filesystem::remove(tiny_chr);
+    std::filesystem::remove(tiny_prg);
+}
+
+// Calls check with a function running the CPU until a BRK on every core that
+// caches code, those are the ones bank switches have to invalidate
+template <typename Check>
+static void for_each_cached_core(Check check) {
+    check([](CPU &cpu) { cpu.run_until_cycle(UINT64_MAX); });
+    check([](CPU &cpu) {
+        while (cpu.step_cached()) {
+        }
+    });
+    check([](CPU &cpu) { cpu.run_blocks_until_cycle(UINT64_MAX); });
+    check([](CPU &cpu) {
+        cpu.get_dynarec().set_threshold(0);
+        cpu.run_native_until_cycle(UINT64_MAX);
+    });
+}
+
+TEST(CartridgeTest, TEST_UxROM) {
+    // four 16 KiB banks, bank n starts with LDA #$1n, BRK
+    std::vector<uint8_t> prg;
+    for (uint8_t bank = 0; bank < 4; bank++) {
+        std::vector<uint8_t> code(PRG_ROM_BANK_SIZE, bank);
+        code[0] = 0xA9;
+        code[1] = 0x10 + bank;
+        code[2] = 0x00;
+        prg.insert(prg.end(), code.begin(), code.end());
+    }
+    // the last bank is fixed at 0xC000: LDA #$01, STA $C000, JMP $8000
+    std::vector<uint8_t> fixed = {0xA9, 0x01, 0x8D, 0x00, 0xC0,
+                                  0x4C, 0x00, 0x80};
+    std::copy(fixed.begin(), fixed.end(), prg.end() - PRG_ROM_BANK_SIZE);
+    prg[prg.size() - 4] = 0x00;
+    prg[prg.size() - 3] = 0xC0;
+    std::string path = write_rom("cartridge_test_uxrom",
+                                 {'N', 'E', 'S', 0x1A, 4, 0, 0x20}, prg, {});
+
+    Cartridge cartridge(path);
+    for_each_cached_core([&](auto run) {
+        auto mapper = make_mapper(cartridge);
+        CPU cpu;
+        cpu.load(*mapper);
+
+        // first bank at 0x8000, last bank at 0xC000
+        ASSERT_EQ(cpu.mem_read(0x8002), 0x00);
+        ASSERT_EQ(cpu.mem_read(0xBFFF), 0x00);
+        ASSERT_EQ(cpu.mem_read(0xFFFF), 0x03);
+
+        // runs bank 0 so whatever the core caches is for it
+        cpu.set_program_counter(0x8000);
+        run(cpu);
+        ASSERT_EQ(cpu.get_register_a(), 0x10);
+
+        // the program in the fixed bank switches to bank 1 and jumps to the
+        // same address, which must not run what was cached for bank 0
+        cpu.reset();
+        ASSERT_EQ(cpu.get_program_counter(), 0xC000);
+        run(cpu);
+        ASSERT_EQ(cpu.get_register_a(), 0x11);
+        ASSERT_EQ(cpu.mem_read(0xBFFF), 0x01);
+
+        // banks past the end wrap around
+        cpu.mem_write(0x8000, 6);
+        ASSERT_EQ(cpu.mem_read(0x8001), 0x12);
+    });
+
+    std::filesystem::remove(path);
+}
+
+TEST(CartridgeTest, TEST_CNROM) {
+    std::vector<uint8_t> prg(2 * PRG_ROM_BANK_SIZE);
+    // four 8 KiB CHR banks, each filled with its own number
+    std::vector<uint8_t> chr;
+    for (uint8_t bank = 0; bank < 4; bank++) {
+        chr.insert(chr.end(), CHR_ROM_BANK_SIZE, bank);
+    }
+    std::string path = write_rom("cartridge_test_cnrom",
+                                 {'N', 'E', 'S', 0x1A, 2, 4, 0x30}, prg, chr);
+
+    Cartridge cartridge(path);
+    auto mapper = make_mapper(cartridge);
+    CPU cpu;
+    cpu.load(*mapper);
+
+    ASSERT_EQ(mapper->read_chr(0x0000), 0);
+    ASSERT_EQ(mapper->read_chr(0x1FFF), 0);
+    cpu.mem_write(0xFFFF, 2);
+    ASSERT_EQ(mapper->read_chr(0x0000), 2);
+    ASSERT_EQ(mapper->read_chr(0x1FFF), 2);
+    // CHR ROM ignores writes
+    mapper->write_chr(0x0000, 0x42);
+    ASSERT_EQ(mapper->read_chr(0x0000), 2);
+    // PRG does not move
+    ASSERT_EQ(cpu.mem_read(0x8000), 0);
+
+    std::filesystem::remove(path);
+}
+
+// Writes value to an MMC1 register 1 bit at a time
+static void mmc1_write(CPU &cpu, uint16_t address, uint8_t value) {
+    for (int i = 0; i < 5; i++) {
+        cpu.mem_write(address, (value >> i) & 1);
+    }
+}
+
+TEST(CartridgeTest, TEST_MMC1) {
+    // eight 16 KiB banks and 8 KiB of CHR RAM
+    std::vector<uint8_t> prg;
+    for (uint8_t bank = 0; bank < 8; bank++) {
+        prg.insert(prg.end(), PRG_ROM_BANK_SIZE, bank);
+    }
+    std::string path = write_rom("cartridge_test_mmc1",
+                                 {'N', 'E', 'S', 0x1A, 8, 0, 0x10}, prg, {});
+
+    Cartridge cartridge(path);
+    auto mapper = make_mapper(cartridge);
+    CPU cpu;
+    cpu.load(*mapper);
+
+    // starts with the last bank fixed at 0xC000
+    ASSERT_EQ(cpu.mem_read(0xC000), 7);
+
+    mmc1_write(cpu, 0xE000, 3);
+    ASSERT_EQ(cpu.mem_read(0x8000), 3);
+    ASSERT_EQ(cpu.mem_read(0xC000), 7);
+
+    // 4 writes are not enough, and a reset throws them away
+    for (int i = 0; i < 4; i++) {
+        cpu.mem_write(0xE000, 1);
+    }
+    ASSERT_EQ(cpu.mem_read(0x8000), 3);
+    cpu.mem_write(0x8000, 0x80);
+    mmc1_write(cpu, 0xE000, 5);
+    ASSERT_EQ(cpu.mem_read(0x8000), 5);
+
+    // vertical mirroring, first bank fixed at 0x8000
+    mmc1_write(cpu, 0x8000, 0b01010);
+    ASSERT_EQ(mapper->get_mirroring(), VERTICAL);
+    ASSERT_EQ(cpu.mem_read(0x8000), 0);
+    ASSERT_EQ(cpu.mem_read(0xC000), 5);
+
+    // 32 KiB mode ignores the low bit of the bank
+    mmc1_write(cpu, 0x8000, 0b00000);
+    ASSERT_EQ(mapper->get_mirroring(), SINGLE_SCREEN_LOWER);
+    ASSERT_EQ(cpu.mem_read(0x8000), 4);
+    ASSERT_EQ(cpu.mem_read(0xC000), 5);
+
+    // CHR RAM in two 4 KiB banks
+    mmc1_write(cpu, 0x8000, 0b10000);
+    mapper->write_chr(0x0000, 0x42);
+    ASSERT_EQ(mapper->read_chr(0x0000), 0x42);
+    mmc1_write(cpu, 0xC000, 0);
+    ASSERT_EQ(mapper->read_chr(0x1000), 0x42);
+
+    std::filesystem::remove(path);
+}
+
+TEST(CartridgeTest, TEST_MMC3) {
+    // eight 8 KiB PRG banks and sixteen 1 KiB CHR banks, each filled with
+    // its own number
+    std::vector<uint8_t> prg;
+    for (uint8_t bank = 0; bank < 8; bank++) {
+        prg.insert(prg.end(), PRG_PAGE_SIZE, bank);
+    }
+    std::vector<uint8_t> chr;
+    for (uint8_t bank = 0; bank < 16; bank++) {
+        chr.insert(chr.end(), CHR_PAGE_SIZE, bank);
+    }
+    std::string path = write_rom("cartridge_test_mmc3",
+                                 {'N', 'E', 'S', 0x1A, 4, 2, 0x40}, prg, chr);
+
+    Cartridge cartridge(path);
+    auto mapper = make_mapper(cartridge);
+    CPU cpu;
+    cpu.load(*mapper);
+
+    // R6 at 0x8000, R7 at 0xA000, the last two banks fixed
+    cpu.mem_write(0x8000, 6);
+    cpu.mem_write(0x8001, 3);
+    cpu.mem_write(0x8000, 7);
+    cpu.mem_write(0x8001, 4);
+    ASSERT_EQ(cpu.mem_read(0x8000), 3);
+    ASSERT_EQ(cpu.mem_read(0xA000), 4);
+    ASSERT_EQ(cpu.mem_read(0xC000), 6);
+    ASSERT_EQ(cpu.mem_read(0xE000), 7);
+
+    // bit 6 swaps 0x8000 and 0xC000
+    cpu.mem_write(0x8000, 0x40);
+    ASSERT_EQ(cpu.mem_read(0x8000), 6);
+    ASSERT_EQ(cpu.mem_read(0xC000), 3);
+
+    // R0 is a 2 KiB bank, R2 a 1 KiB one, bit 7 swaps the halves
+    cpu.mem_write(0x8000, 0);
+    cpu.mem_write(0x8001, 9);
+    cpu.mem_write(0x8000, 2);
+    cpu.mem_write(0x8001, 13);
+    ASSERT_EQ(mapper->read_chr(0x0000), 8);
+    ASSERT_EQ(mapper->read_chr(0x0400), 9);
+    ASSERT_EQ(mapper->read_chr(0x1000), 13);
+    cpu.mem_write(0x8000, 0x80);
+    ASSERT_EQ(mapper->read_chr(0x1000), 8);
+    ASSERT_EQ(mapper->read_chr(0x0000), 13);
+
+    cpu.mem_write(0xA000, 1);
+    ASSERT_EQ(mapper->get_mirroring(), HORIZONTAL);
+
+    // IRQ after 3 scanlines: the first rise loads the latch
+    cpu.mem_write(0xC000, 2);
+    cpu.mem_write(0xC001, 0);
+    cpu.mem_write(0xE001, 0);
+    mapper->ppu_a12_rising();
+    mapper->ppu_a12_rising();
+    ASSERT_FALSE(mapper->is_irq_asserted());
+    mapper->ppu_a12_rising();
+    ASSERT_TRUE(mapper->is_irq_asserted());
+    // acknowledged by disabling
+    cpu.mem_write(0xE000, 0);
+    ASSERT_FALSE(mapper->is_irq_asserted());
+    // reloads from the latch once it is 0, no IRQ while disabled
+    for (int i = 0; i < 3; i++) {
+        mapper->ppu_a12_rising();
+    }
+    ASSERT_FALSE(mapper->is_irq_asserted());
+
+    std::filesystem::remove(path);
+}
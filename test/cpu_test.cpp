@@ -2,8 +2,13 @@
 
 #include <gtest/gtest.h>
 
+#include <functional>
+#include <utility>
 #include <vector>
 
+#include "dynarec.h"
+#include "snake.h"
+
 // Demonstrate some basic assertions.
 TEST(CPUTest, LDA) {
     CPU cpu;
@@ -223,4 +228,538 @@ TEST(CPUTest, TEST_SBC_withCarry) {
     cpu.load_and_run(program);
 
     ASSERT_EQ(cpu.get_register_a(), 0x55 - 0x05);
-}
\ No newline at end of file
+}
+TEST(CPUTest, TEST_Cycles) {
+    CPU cpu;
+
+    std::vector<uint8_t> program = {0xA9, 0x05, 0x00};
+    cpu.load_and_run(program);
+
+    // 7 for the reset, 2 for LDA immediate and 7 for BRK
+    ASSERT_EQ(cpu.get_cycles(), 7 + 2 + 7);
+}
+
+TEST(CPUTest, TEST_Cycles_PageCrossed) {
+    CPU cpu;
+
+    // LDX #$01, LDA $80FF,X crosses into page 0x81, STA $80FF,X never pays
+    // extra since its base cycle count already includes it
+    std::vector<uint8_t> program = {0xA2, 0x01, 0xBD, 0xFF, 0x80,
+                                    0x9D, 0xFF, 0x80, 0x00};
+    cpu.load_and_run(program);
+
+    ASSERT_EQ(cpu.get_cycles(), 7 + 2 + (4 + 1) + 5 + 7);
+}
+
+TEST(CPUTest, TEST_Cycles_Branch) {
+    CPU cpu;
+
+    // LDX #$03, then DEX and BNE back to the DEX until x is zero
+    std::vector<uint8_t> program = {0xA2, 0x03, 0xCA, 0xD0, 0xFD, 0x00};
+    cpu.load_and_run(program);
+
+    ASSERT_EQ(cpu.get_register_x(), 0);
+    // the branch is taken twice for 3 cycles each, and not taken the last
+    // time for 2 cycles
+    ASSERT_EQ(cpu.get_cycles(), 7 + 2 + (2 + 3) * 2 + (2 + 2) + 7);
+}
+
+TEST(CPUTest, TEST_RunForCycles) {
+    CPU cpu;
+
+    // JMP $0600 forever, 3 cycles every time
+    std::vector<uint8_t> program = {0x4C, 0x00, 0x06};
+    cpu.load(program);
+    cpu.reset();
+
+    ASSERT_TRUE(cpu.run_for_cycles(100));
+    // we can overshoot the budget by at most one instruction
+    ASSERT_GE(cpu.get_cycles(), 7 + 100);
+    ASSERT_LT(cpu.get_cycles(), 7 + 100 + 3);
+
+    ASSERT_TRUE(cpu.run_until_cycle(1000));
+    ASSERT_GE(cpu.get_cycles(), 1000);
+    ASSERT_LT(cpu.get_cycles(), 1000 + 3);
+}
+
+TEST(CPUTest, TEST_RunForCycles_StopsOnBRK) {
+    CPU cpu;
+
+    std::vector<uint8_t> program = {0xE8, 0x00};
+    cpu.load(program);
+    cpu.reset();
+
+    ASSERT_FALSE(cpu.run_for_cycles(1000));
+    ASSERT_EQ(cpu.get_register_x(), 1);
+}
+
+// Runs the snake game on the switch core and one of the other interpreter
+// cores side by side and makes sure they never disagree on registers, cycles
+// or memory
+template <bool (CPU::*Step)()>
+void expect_same_as_switch_core() {
+    std::vector<uint8_t> game_code = get_game_code();
+    CPU switch_cpu;
+    CPU table_cpu;
+    switch_cpu.load(game_code);
+    switch_cpu.reset();
+    table_cpu.load(game_code);
+    table_cpu.reset();
+
+    uint8_t keys[] = {0x77, 0x64, 0x73, 0x61};
+    for (int i = 0; i < 200000; i++) {
+        // feed both the same "random" byte and the occasional key press
+        uint8_t random = (i * 37) ^ (i >> 3);
+        switch_cpu.mem_write(0xFE, random);
+        table_cpu.mem_write(0xFE, random);
+        if (i % 5000 == 0) {
+            switch_cpu.mem_write(0xFF, keys[(i / 5000) % 4]);
+            table_cpu.mem_write(0xFF, keys[(i / 5000) % 4]);
+        }
+
+        bool switch_running = switch_cpu.step_switch();
+        bool table_running = (table_cpu.*Step)();
+
+        ASSERT_EQ(switch_running, table_running);
+        ASSERT_EQ(switch_cpu.get_program_counter(),
+                  table_cpu.get_program_counter());
+        ASSERT_EQ(switch_cpu.get_register_a(), table_cpu.get_register_a());
+        ASSERT_EQ(switch_cpu.get_register_x(), table_cpu.get_register_x());
+        ASSERT_EQ(switch_cpu.get_register_y(), table_cpu.get_register_y());
+        ASSERT_EQ(switch_cpu.get_status(), table_cpu.get_status());
+        ASSERT_EQ(switch_cpu.get_cycles(), table_cpu.get_cycles());
+
+        // the snake died, start a new game on both
+        if (!switch_running) {
+            switch_cpu.load(game_code);
+            switch_cpu.reset();
+            table_cpu.load(game_code);
+            table_cpu.reset();
+        }
+    }
+
+    for (int addr = 0; addr < 0xffff; addr++) {
+        ASSERT_EQ(switch_cpu.mem_read(addr), table_cpu.mem_read(addr));
+    }
+}
+
+TEST(CPUTest, TEST_DispatchCoresMatch) {
+    expect_same_as_switch_core<&CPU::step_table>();
+}
+
+TEST(CPUTest, TEST_DecodeCacheMatchesSwitchCore) {
+    expect_same_as_switch_core<&CPU::step_cached>();
+}
+
+TEST(CPUTest, TEST_IllegalOpcode) {
+    CPU cpu;
+
+    // INX, then 0xFF which is not an official opcode
+    std::vector<uint8_t> program = {0xE8, 0xFF, 0xE8, 0x00};
+    cpu.load_and_run(program);
+
+    // the CPU stopped on 0xFF without running the second INX, just past the
+    // illegal byte like it does for BRK
+    ASSERT_EQ(cpu.get_register_x(), 1);
+    ASSERT_EQ(cpu.get_program_counter(), 0x0602);
+    ASSERT_TRUE(!cpu.is_status_flag_set(BREAK_FLAG));
+
+    // both cores agree on it
+    cpu.set_program_counter(0x0601);
+    ASSERT_TRUE(!cpu.step_switch());
+    cpu.set_program_counter(0x0601);
+    ASSERT_TRUE(!cpu.step_table());
+}
+
+TEST(CPUTest, TEST_DecodeCache_SelfModifyingCode) {
+    CPU cpu;
+
+    // 0600: LDA #$01
+    // 0602: INX
+    // 0603: CPX #$02
+    // 0605: BEQ +6 (to the BRK)
+    // 0607: INC $0601 (the operand of the LDA)
+    // 060a: JMP $0600
+    // 060d: BRK
+    std::vector<uint8_t> program = {0xA9, 0x01, 0xE8, 0xE0, 0x02, 0xF0, 0x06,
+                                    0xEE, 0x01, 0x06, 0x4C, 0x00, 0x06, 0x00};
+    cpu.load(program);
+    cpu.reset();
+
+    while (cpu.step_cached()) {
+    }
+
+    // the second time around the LDA has to see the operand the INC wrote
+    ASSERT_EQ(cpu.get_register_x(), 2);
+    ASSERT_EQ(cpu.get_register_a(), 2);
+}
+
+// Plays a few games to the end on the switch core and with run(cpu), which
+// runs a whole game on the other CPU, and checks both end up the same
+template <typename Run>
+void expect_games_same_as_switch_core(Run run) {
+    std::vector<uint8_t> game_code = get_game_code();
+
+    // play a few games to the end on both, each with its own "random" byte
+    // and direction
+    uint8_t keys[] = {0x77, 0x64, 0x73, 0x61};
+    for (int game = 0; game < 20; game++) {
+        CPU switch_cpu;
+        CPU block_cpu;
+        switch_cpu.load(game_code);
+        switch_cpu.reset();
+        block_cpu.load(game_code);
+        block_cpu.reset();
+
+        switch_cpu.mem_write(0xFE, game * 13);
+        block_cpu.mem_write(0xFE, game * 13);
+        switch_cpu.mem_write(0xFF, keys[game % 4]);
+        block_cpu.mem_write(0xFF, keys[game % 4]);
+
+        // with a fixed direction some games loop forever, only compare the
+        // ones that end
+        bool running = true;
+        for (int i = 0; i < 1000000 && running; i++) {
+            running = switch_cpu.step_switch();
+        }
+        if (running) {
+            continue;
+        }
+        ASSERT_FALSE(run(block_cpu));
+
+        ASSERT_EQ(switch_cpu.get_program_counter(),
+                  block_cpu.get_program_counter());
+        ASSERT_EQ(switch_cpu.get_register_a(), block_cpu.get_register_a());
+        ASSERT_EQ(switch_cpu.get_register_x(), block_cpu.get_register_x());
+        ASSERT_EQ(switch_cpu.get_register_y(), block_cpu.get_register_y());
+        ASSERT_EQ(switch_cpu.get_status(), block_cpu.get_status());
+        ASSERT_EQ(switch_cpu.get_cycles(), block_cpu.get_cycles());
+        for (int addr = 0; addr < 0xffff; addr++) {
+            ASSERT_EQ(switch_cpu.mem_read(addr), block_cpu.mem_read(addr));
+        }
+    }
+}
+
+TEST(CPUTest, TEST_Blocks_MatchSwitchCore) {
+    expect_games_same_as_switch_core(
+        [](CPU &cpu) { return cpu.run_blocks_until_cycle(UINT64_MAX); });
+}
+
+TEST(CPUTest, TEST_Blocks_Superinstruction) {
+    CPU cpu;
+
+    // LDX #$03, then DEX; BNE back to the DEX, which runs as one fused op
+    std::vector<uint8_t> program = {0xA2, 0x03, 0xCA, 0xD0, 0xFD, 0x00};
+    cpu.load(program);
+    cpu.reset();
+
+    ASSERT_FALSE(cpu.run_blocks_until_cycle(UINT64_MAX));
+    ASSERT_EQ(cpu.get_register_x(), 0);
+    ASSERT_EQ(cpu.get_cycles(), 7 + 2 + (2 + 3) * 2 + (2 + 2) + 7);
+}
+
+TEST(CPUTest, TEST_Blocks_SelfModifyingCode) {
+    CPU cpu;
+
+    // 0600: INC $0604 (the operand of the LDA below, in the same block)
+    // 0603: LDA #$01
+    // 0605: BRK
+    std::vector<uint8_t> program = {0xEE, 0x04, 0x06, 0xA9, 0x01, 0x00};
+    cpu.load(program);
+    cpu.reset();
+
+    ASSERT_FALSE(cpu.run_blocks_until_cycle(UINT64_MAX));
+    ASSERT_EQ(cpu.get_register_a(), 2);
+}
+
+TEST(CPUTest, TEST_Dynarec_MatchesSwitchCore) {
+    expect_games_same_as_switch_core(
+        [](CPU &cpu) { return cpu.run_native_until_cycle(UINT64_MAX); });
+    // and again translating every block the first time it runs
+    expect_games_same_as_switch_core([](CPU &cpu) {
+        cpu.get_dynarec().set_threshold(0);
+        return cpu.run_native_until_cycle(UINT64_MAX);
+    });
+}
+
+TEST(CPUTest, TEST_Dynarec_Instructions) {
+    // every instruction the dynarec translates, in one block
+    std::vector<uint8_t> program = {
+        0xA9, 0x80,        // LDA #$80
+        0x85, 0x10,        // STA $10
+        0xA6, 0x10,        // LDX $10
+        0xA4, 0x10,        // LDY $10
+        0xE0, 0x7F,        // CPX #$7F
+        0x18,              // CLC
+        0x38,              // SEC
+        0xB8,              // CLV
+        0x8A,              // TXA
+        0xA8,              // TAY
+        0x98,              // TYA
+        0xAA,              // TAX
+        0xA2, 0x02,        // LDX #$02
+        0x95, 0x20,        // STA $20,X
+        0xF6, 0x20,        // INC $20,X
+        0xB5, 0x20,        // LDA $20,X
+        0xCE, 0x00, 0x03,  // DEC $0300
+        0xAD, 0x00, 0x03,  // LDA $0300
+        0x29, 0x0F,        // AND #$0F
+        0x09, 0x30,        // ORA #$30
+        0x45, 0x22,        // EOR $22
+        0xC5, 0x22,        // CMP $22
+        0xEC, 0x00, 0x03,  // CPX $0300
+        0xC0, 0x00,        // CPY #$00
+        0x00,              // BRK
+    };
+
+    CPU switch_cpu;
+    CPU native_cpu;
+    switch_cpu.load(program);
+    switch_cpu.reset();
+    native_cpu.load(program);
+    native_cpu.reset();
+    native_cpu.get_dynarec().set_threshold(0);
+
+    while (switch_cpu.step_switch()) {
+    }
+    ASSERT_FALSE(native_cpu.run_native_until_cycle(UINT64_MAX));
+
+    ASSERT_EQ(native_cpu.get_register_y(), 0x80);
+    ASSERT_EQ(switch_cpu.get_program_counter(),
+              native_cpu.get_program_counter());
+    ASSERT_EQ(switch_cpu.get_register_a(), native_cpu.get_register_a());
+    ASSERT_EQ(switch_cpu.get_register_x(), native_cpu.get_register_x());
+    ASSERT_EQ(switch_cpu.get_register_y(), native_cpu.get_register_y());
+    ASSERT_EQ(switch_cpu.get_status(), native_cpu.get_status());
+    ASSERT_EQ(switch_cpu.get_cycles(), native_cpu.get_cycles());
+    ASSERT_EQ(switch_cpu.mem_read(0x22), native_cpu.mem_read(0x22));
+    ASSERT_EQ(switch_cpu.mem_read(0x0300), native_cpu.mem_read(0x0300));
+}
+
+TEST(CPUTest, TEST_Dynarec_LoopStopsAtBudget) {
+    CPU cpu;
+
+    // LDX #$00, then INX; BNE back to the INX 256 times
+    std::vector<uint8_t> program = {0xA2, 0x00, 0xE8, 0xD0, 0xFD, 0x00};
+    cpu.load(program);
+    cpu.reset();
+    cpu.get_dynarec().set_threshold(0);
+
+    // the loop runs natively and has to give control back on time, at most
+    // one iteration late
+    uint64_t target = cpu.get_cycles() + 100;
+    ASSERT_TRUE(cpu.run_native_until_cycle(target));
+    ASSERT_GE(cpu.get_cycles(), target);
+    ASSERT_LT(cpu.get_cycles(), target + 5);
+
+    ASSERT_FALSE(cpu.run_native_until_cycle(UINT64_MAX));
+    ASSERT_EQ(cpu.get_register_x(), 0);
+    ASSERT_EQ(cpu.get_cycles(), 7 + 2 + (2 + 3) * 255 + (2 + 2) + 7);
+}
+
+TEST(CPUTest, TEST_Dynarec_SelfModifyingCode) {
+    CPU cpu;
+
+    // same program as TEST_DecodeCache_SelfModifyingCode, the INC writes into
+    // the block it runs in
+    std::vector<uint8_t> program = {0xA9, 0x01, 0xE8, 0xE0, 0x02, 0xF0, 0x06,
+                                    0xEE, 0x01, 0x06, 0x4C, 0x00, 0x06, 0x00};
+    cpu.load(program);
+    cpu.reset();
+    cpu.get_dynarec().set_threshold(0);
+
+    ASSERT_FALSE(cpu.run_native_until_cycle(UINT64_MAX));
+    ASSERT_EQ(cpu.get_register_x(), 2);
+    ASSERT_EQ(cpu.get_register_a(), 2);
+}
+
+TEST(CPUTest, TEST_WatchWrites) {
+    // STA $0200, STA $023F, STA $05FF, STA $0600 (outside), STA $01FF
+    // (outside), BRK
+    std::vector<uint8_t> program = {0x8D, 0x00, 0x02, 0x8D, 0x3F, 0x02,
+                                    0x8D, 0xFF, 0x05, 0x8D, 0x00, 0x06,
+                                    0x8D, 0xFF, 0x01, 0x00};
+    std::vector<std::function<bool(CPU &)>> cores = {
+        [](CPU &cpu) { return cpu.run_until_cycle(UINT64_MAX); },
+        [](CPU &cpu) { return cpu.run_blocks_until_cycle(UINT64_MAX); },
+        [](CPU &cpu) {
+            cpu.get_dynarec().set_threshold(0);
+            return cpu.run_native_until_cycle(UINT64_MAX);
+        },
+    };
+    for (auto &run : cores) {
+        CPU cpu;
+        cpu.load(program);
+        cpu.reset();
+        cpu.watch_writes(0x0200, 0x0400);
+        // everything starts out dirty
+        ASSERT_EQ(cpu.take_dirty_chunks(), 0xFFFFFFFF);
+        ASSERT_EQ(cpu.take_dirty_chunks(), 0);
+
+        ASSERT_FALSE(run(cpu));
+        // rows 0, 1 and 31, the BRK pushing onto the stack is not in range
+        ASSERT_EQ(cpu.take_dirty_chunks(),
+                  (uint64_t{1} << 0) | (uint64_t{1} << 1) |
+                      (uint64_t{1} << 31));
+        ASSERT_EQ(cpu.take_dirty_chunks(), 0);
+    }
+}
+
+// Counts everything run() can report
+struct CountingHooks {
+    uint32_t instructions = 0;
+    uint32_t reads = 0;
+    std::vector<std::pair<uint16_t, uint8_t>> writes;
+    std::vector<std::pair<uint16_t, uint16_t>> branches;
+
+    void instruction(CPU &) { instructions++; }
+    void read(uint16_t, uint8_t) { reads++; }
+    void write(uint16_t address, uint8_t value) {
+        writes.push_back({address, value});
+    }
+    void branch(CPU &, uint16_t from, uint16_t to) {
+        branches.push_back({from, to});
+    }
+};
+
+TEST(CPUTest, TEST_RunHooks) {
+    // LDX #3, loop: STA $0200,X, DEX, BNE loop, BRK
+    std::vector<uint8_t> program = {0xA2, 0x03, 0x9D, 0x00, 0x02,
+                                    0xCA, 0xD0, 0xFA, 0x00};
+    CPU cpu;
+    cpu.load(program);
+    cpu.reset();
+    cpu.set_register_a(0x42);
+
+    CountingHooks hooks;
+    ASSERT_FALSE(cpu.run(hooks));
+    // LDX, 3 times around the loop, BRK
+    ASSERT_EQ(hooks.instructions, 11);
+    // at least every opcode byte was fetched
+    ASSERT_GE(hooks.reads, 11);
+    std::vector<std::pair<uint16_t, uint8_t>> writes = {
+        {0x0203, 0x42}, {0x0202, 0x42}, {0x0201, 0x42}};
+    ASSERT_EQ(hooks.writes, writes);
+    // the BNE taken twice, falling through the third time is no branch
+    std::vector<std::pair<uint16_t, uint16_t>> branches = {
+        {0x0606, 0x0602}, {0x0606, 0x0602}};
+    ASSERT_EQ(hooks.branches, branches);
+
+    // the bus is back to direct access once the run is over
+    ASSERT_NE(cpu.get_bus().get_read_pages()[0x06], nullptr);
+    ASSERT_EQ(cpu.mem_read(0x0203), 0x42);
+
+    // and nobody observes it for hooks that do not look at memory
+    struct InstructionHooks {
+        bool observed = false;
+        void instruction(CPU &cpu) {
+            observed |= cpu.get_bus().get_read_pages()[0x06] == nullptr;
+        }
+    } instruction_hooks;
+    cpu.reset();
+    ASSERT_FALSE(cpu.run(instruction_hooks));
+    ASSERT_FALSE(instruction_hooks.observed);
+}
+
+TEST(CPUTest, TEST_Bus_LastByte) {
+    CPU cpu;
+
+    // the old flat array stopped one byte short of 0xFFFF
+    cpu.mem_write(0xFFFF, 0x42);
+    ASSERT_EQ(cpu.mem_read(0xFFFF), 0x42);
+    ASSERT_EQ(cpu.mem_read(0xFFFE), 0x00);
+}
+
+TEST(CPUTest, TEST_Bus_Mirroring) {
+    CPU cpu;
+
+    // 2 KiB of RAM repeated over 0x0000-0x1FFF like on the NES
+    uint8_t ram[0x800] = {};
+    cpu.get_bus().map_memory(0x00, 0x20, ram, sizeof(ram), true);
+
+    cpu.mem_write(0x0001, 0x11);
+    ASSERT_EQ(cpu.mem_read(0x0801), 0x11);
+    ASSERT_EQ(cpu.mem_read(0x1801), 0x11);
+    cpu.mem_write(0x17FF, 0x22);
+    ASSERT_EQ(cpu.mem_read(0x07FF), 0x22);
+    ASSERT_EQ(ram[0x7FF], 0x22);
+}
+
+TEST(CPUTest, TEST_Bus_ReadOnly) {
+    CPU cpu;
+
+    uint8_t rom[0x100];
+    std::fill(std::begin(rom), std::end(rom), 0xEA);
+    cpu.get_bus().map_memory(0x80, 0x80, rom, sizeof(rom), false);
+
+    cpu.mem_write(0x8000, 0x00);
+    ASSERT_EQ(cpu.mem_read(0x8000), 0xEA);
+    ASSERT_EQ(cpu.mem_read(0xC0FF), 0xEA);
+}
+
+// Stands in for a device register: reads count up, writes are remembered
+struct FakeRegister {
+    uint8_t reads = 0;
+    uint8_t written = 0;
+    uint16_t written_address = 0;
+
+    static uint8_t read(void *context, uint16_t) {
+        return ++static_cast<FakeRegister *>(context)->reads;
+    }
+
+    static void write(void *context, uint16_t address, uint8_t data) {
+        auto *fake = static_cast<FakeRegister *>(context);
+        fake->written = data;
+        fake->written_address = address;
+    }
+};
+
+TEST(CPUTest, TEST_Bus_MMIO) {
+    FakeRegister fake;
+
+    // LDA $2002, LDA $2002, STA $2001, BRK
+    std::vector<uint8_t> program = {0xAD, 0x02, 0x20, 0xAD, 0x02, 0x20,
+                                    0x8D, 0x01, 0x20, 0x00};
+
+    // the dynarec must leave the reads to the interpreter
+    for (bool native : {false, true}) {
+        CPU cpu;
+        cpu.get_bus().map_mmio(0x20, 0x20, {&FakeRegister::read,
+                                            &FakeRegister::write, &fake});
+        fake = FakeRegister{};
+        cpu.load(program);
+        cpu.reset();
+        if (native) {
+            cpu.get_dynarec().set_threshold(0);
+            ASSERT_FALSE(cpu.run_native_until_cycle(UINT64_MAX));
+        } else {
+            cpu.run();
+        }
+
+        ASSERT_EQ(fake.reads, 2);
+        ASSERT_EQ(cpu.get_register_a(), 2);
+        ASSERT_EQ(fake.written, 2);
+        ASSERT_EQ(fake.written_address, 0x2001);
+    }
+}
+
+TEST(CPUTest, TEST_Blocks_CodeIsPeeked) {
+    // NOPs up to 06FD: LDA #$01, 06FF: BRK, right before a device page
+    std::vector<uint8_t> program(0x100, 0xEA);
+    program[0xFD] = 0xA9;
+    program[0xFE] = 0x01;
+    program[0xFF] = 0x00;
+
+    FakeRegister fake;
+    CPU cpu;
+    cpu.get_bus().map_mmio(0x07, 1, {&FakeRegister::read,
+                                     &FakeRegister::write, &fake});
+    cpu.load(program);
+    cpu.reset();
+
+    // building the block does not read past its end, the device never sees
+    // a read the program did not make
+    ASSERT_FALSE(cpu.run_blocks_until_cycle(UINT64_MAX));
+    ASSERT_EQ(cpu.get_register_a(), 1);
+    ASSERT_EQ(fake.reads, 0);
+}
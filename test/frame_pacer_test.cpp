@@ -0,0 +1,49 @@
+#include "frontend/frame_pacer.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <thread>
+
+TEST(FramePacerTest, TEST_Pacing) {
+    // 10 frames at 200 per second, starting from when the pacer was made
+    FramePacer pacer(200);
+    auto start = FramePacer::Clock::now();
+    for (int i = 0; i < 10; i++) {
+        pacer.wait_for_next_frame();
+    }
+    std::chrono::duration<double> elapsed = FramePacer::Clock::now() - start;
+    ASSERT_GE(elapsed.count(), 0.05);
+    // loose, the machine running the tests may be busy
+    ASSERT_LT(elapsed.count(), 0.5);
+    ASSERT_EQ(pacer.get_dropped_frames(), 0);
+
+    // time spent in a frame does not push the next ones back
+    start = FramePacer::Clock::now();
+    for (int i = 0; i < 4; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(3));
+        pacer.wait_for_next_frame();
+    }
+    elapsed = FramePacer::Clock::now() - start;
+    ASSERT_LT(elapsed.count(), 0.04 + 0.1);
+
+    // a frame that runs long starts the schedule over
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    pacer.wait_for_next_frame();
+    ASSERT_EQ(pacer.get_dropped_frames(), 1);
+}
+
+TEST(FramePacerTest, TEST_Uncapped) {
+    FramePacer pacer(0);
+    ASSERT_TRUE(pacer.is_uncapped());
+    auto start = FramePacer::Clock::now();
+    for (int i = 0; i < 1000; i++) {
+        pacer.wait_for_next_frame();
+    }
+    std::chrono::duration<double> elapsed = FramePacer::Clock::now() - start;
+    ASSERT_LT(elapsed.count(), 0.01);
+
+    FramePacer capped(1000);
+    capped.set_uncapped(true);
+    ASSERT_TRUE(capped.is_uncapped());
+}
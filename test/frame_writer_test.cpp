@@ -0,0 +1,51 @@
+#include "frontend/frame_writer.h"
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "frontend/palette.h"
+
+static std::vector<uint8_t> read_file(const std::string &path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::vector<uint8_t>((std::istreambuf_iterator<char>(in)),
+                                std::istreambuf_iterator<char>());
+}
+
+TEST(FrameWriterTest, TEST_Formats) {
+    // 2x1, a PPU framebuffer that uses the high bits too
+    uint8_t indexes[2] = {0x16, 0x40 | 0x20};
+    uint32_t pixels[2];
+    expand_nes_pixels(indexes, pixels, 2);
+    ASSERT_EQ(pixels[0], 0xFFB53120);
+    ASSERT_EQ(pixels[1], 0xFFFFFEFF);
+
+    std::filesystem::path dir = std::filesystem::temp_directory_path();
+    std::string prefix = (dir / "frame_writer_test").string();
+    std::string raw = (dir / "frame_writer_test.rgb").string();
+    {
+        FrameWriter ppm_writer(FRAME_PPM, prefix);
+        FrameWriter raw_writer(FRAME_RAW, raw);
+        for (int i = 0; i < 2; i++) {
+            ppm_writer.write(pixels, 2, 1);
+            raw_writer.write(pixels, 2, 1);
+        }
+        ASSERT_EQ(ppm_writer.get_frames_written(), 2);
+    }
+
+    std::vector<uint8_t> rgb = {0xB5, 0x31, 0x20, 0xFF, 0xFE, 0xFF};
+    std::vector<uint8_t> ppm = read_file(prefix + "_000001.ppm");
+    std::string header = "P6\n2 1\n255\n";
+    ASSERT_EQ(std::string(ppm.begin(), ppm.begin() + header.size()), header);
+    ASSERT_EQ(std::vector<uint8_t>(ppm.begin() + header.size(), ppm.end()),
+              rgb);
+
+    // both frames back to back
+    std::vector<uint8_t> frames = rgb;
+    frames.insert(frames.end(), rgb.begin(), rgb.end());
+    ASSERT_EQ(read_file(raw), frames);
+}
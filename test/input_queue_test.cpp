@@ -0,0 +1,53 @@
+#include "frontend/input_queue.h"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+
+TEST(InputQueueTest, TEST_PushPop) {
+    InputQueue queue;
+    InputEvent event;
+    ASSERT_FALSE(queue.pop(event));
+
+    for (int i = 0; i < INPUT_QUEUE_SIZE; i++) {
+        ASSERT_TRUE(queue.push({0xFF, static_cast<uint8_t>(i)}));
+    }
+    // full, this one is dropped
+    ASSERT_FALSE(queue.push({0xFF, 0xAA}));
+
+    for (int i = 0; i < INPUT_QUEUE_SIZE; i++) {
+        ASSERT_TRUE(queue.pop(event));
+        ASSERT_EQ(event.address, 0xFF);
+        ASSERT_EQ(event.value, i);
+    }
+    ASSERT_FALSE(queue.pop(event));
+}
+
+TEST(InputQueueTest, TEST_Threads) {
+    InputQueue queue;
+    const int total = 100000;
+    std::thread producer([&queue]() {
+        for (int i = 0; i < total;) {
+            InputEvent event = {static_cast<uint16_t>(i),
+                                static_cast<uint8_t>(i)};
+            if (queue.push(event)) {
+                i++;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    // in order and nothing lost, since the producer retries
+    for (int i = 0; i < total;) {
+        InputEvent event;
+        if (!queue.pop(event)) {
+            std::this_thread::yield();
+            continue;
+        }
+        ASSERT_EQ(event.address, static_cast<uint16_t>(i));
+        ASSERT_EQ(event.value, static_cast<uint8_t>(i));
+        i++;
+    }
+    producer.join();
+}
@@ -0,0 +1,68 @@
+#include "netplay/loopback_transport.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <vector>
+
+TEST(LoopbackTransportTest, TEST_Latency) {
+    NetworkConditions conditions;
+    conditions.latency = 3;
+    LoopbackTransport a(conditions), b(conditions);
+    a.connect(b);
+
+    uint8_t sent[] = {1, 2, 3};
+    a.send(sent, sizeof(sent));
+    uint8_t received[NETPLAY_PACKET_SIZE];
+    for (int i = 0; i < 3; i++) {
+        ASSERT_EQ(b.receive(received), 0);
+        b.tick();
+    }
+    ASSERT_EQ(b.receive(received), sizeof(sent));
+    ASSERT_EQ(std::vector<uint8_t>(received, received + 3),
+              std::vector<uint8_t>(sent, sent + 3));
+    ASSERT_EQ(b.receive(received), 0);
+
+    // and the other way
+    b.send(sent, 1);
+    a.tick();
+    a.tick();
+    a.tick();
+    ASSERT_EQ(a.receive(received), 1);
+}
+
+TEST(LoopbackTransportTest, TEST_LossAndJitter) {
+    NetworkConditions conditions;
+    conditions.latency = 2;
+    conditions.jitter = 4;
+    conditions.loss_per_mille = 250;
+    conditions.seed = 99;
+    LoopbackTransport a(conditions), b(conditions);
+    a.connect(b);
+
+    const int packets = 1000;
+    std::vector<int> order;
+    uint8_t received[NETPLAY_PACKET_SIZE];
+    for (int i = 0; i < packets + 10; i++) {
+        if (i < packets) {
+            uint8_t data[] = {static_cast<uint8_t>(i),
+                              static_cast<uint8_t>(i >> 8)};
+            a.send(data, sizeof(data));
+        }
+        while (b.receive(received) == 2) {
+            order.push_back(received[0] | (received[1] << 8));
+        }
+        b.tick();
+    }
+    // about a quarter lost, and nothing else
+    ASSERT_EQ(a.get_sent(), packets);
+    ASSERT_EQ(order.size() + a.get_lost(), packets);
+    ASSERT_GT(a.get_lost(), packets / 5);
+    ASSERT_LT(a.get_lost(), packets / 3);
+    // some overtook others
+    bool reordered = false;
+    for (size_t i = 1; i < order.size(); i++) {
+        reordered |= order[i] < order[i - 1];
+    }
+    ASSERT_TRUE(reordered);
+}
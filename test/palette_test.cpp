@@ -0,0 +1,30 @@
+#include "frontend/palette.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+TEST(PaletteTest, TEST_ExpandPixels) {
+    // every byte value, at an odd length so the kernel has a tail left over
+    std::vector<uint8_t> indexes(256 + 7);
+    for (size_t i = 0; i < indexes.size(); i++) {
+        indexes[i] = i;
+    }
+    std::vector<uint32_t> scalar(indexes.size());
+    std::vector<uint32_t> ssse3(indexes.size());
+    expand_pixels_scalar(indexes.data(), scalar.data(), indexes.size(),
+                         SNAKE_PALETTE);
+    expand_pixels_ssse3(indexes.data(), ssse3.data(), indexes.size(),
+                        SNAKE_PALETTE);
+    ASSERT_EQ(scalar, ssse3);
+
+    ASSERT_EQ(scalar[0], 0xFF000000);
+    ASSERT_EQ(scalar[1], 0xFFFFFFFF);
+    ASSERT_EQ(scalar[3], 0xFFFF0000);
+    ASSERT_EQ(scalar[5], 0xFF0000FF);
+    ASSERT_EQ(scalar[10], scalar[3]);
+    // anything past the palette is its last color, like the random apple
+    // color 16
+    ASSERT_EQ(scalar[16], 0xFF00FFFF);
+    ASSERT_EQ(scalar[255], 0xFF00FFFF);
+}
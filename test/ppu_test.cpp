@@ -0,0 +1,559 @@
+#include "ppu/ppu.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "console/console.h"
+#include "rom_file.h"
+
+// 32 KiB of PRG with program at $E000 and handler at $F000, which both NMI
+// and IRQ jump to. CHR is 8 KiB of RAM.
+static std::string write_test_rom(const std::string &name, uint8_t mapper,
+                                  const std::vector<uint8_t> &program,
+                                  const std::vector<uint8_t> &handler) {
+    std::vector<uint8_t> prg(2 * PRG_ROM_BANK_SIZE, 0xEA);
+    std::copy(program.begin(), program.end(), prg.begin() + 0x6000);
+    std::copy(handler.begin(), handler.end(), prg.begin() + 0x7000);
+    // NMI, reset and IRQ vectors
+    std::vector<uint8_t> vectors = {0x00, 0xF0, 0x00, 0xE0, 0x00, 0xF0};
+    std::copy(vectors.begin(), vectors.end(), prg.end() - 6);
+    uint8_t flags_6 = (mapper << 4) | 0x01;
+    return write_rom(name, {'N', 'E', 'S', 0x1A, 2, 0, flags_6}, prg, {});
+}
+
+TEST(PPUTest, TEST_Vblank) {
+    // JMP $E000
+    std::string path = write_test_rom("ppu_test_vblank", 0, {0x4C, 0x00, 0xE0},
+                                      {0x40});
+    Console console(path);
+    CPU &cpu = console.get_cpu();
+    PPU &ppu = console.get_ppu();
+
+    // vblank starts on dot 1 of scanline 241
+    uint64_t vblank = ppu.next_event_cycle();
+    ASSERT_EQ(vblank, (VBLANK_SCANLINE * DOTS_PER_SCANLINE + 1) / 3 + 1);
+    ppu.catch_up(vblank - 1);
+    ASSERT_EQ(cpu.mem_read(0x2002) & STATUS_VBLANK, 0);
+    ASSERT_EQ(ppu.get_frame(), 0);
+
+    ASSERT_TRUE(console.run_frame());
+    ASSERT_EQ(ppu.get_frame(), 1);
+    ASSERT_EQ(ppu.get_scanline(), VBLANK_SCANLINE);
+    // the CPU overshoots by at most one instruction
+    ASSERT_GE(cpu.get_cycles(), vblank);
+    ASSERT_LE(cpu.get_cycles(), vblank + 3);
+
+    // reading the status clears the flag, and writes to it do nothing
+    cpu.mem_write(0x2002, 0x00);
+    ASSERT_NE(cpu.mem_read(0x2002) & STATUS_VBLANK, 0);
+    ASSERT_EQ(cpu.mem_read(0x2002) & STATUS_VBLANK, 0);
+
+    // a whole frame later, without NMIs nothing stops on the way
+    ASSERT_TRUE(console.run_frame());
+    ASSERT_EQ(ppu.get_frame(), 2);
+    ASSERT_NEAR(cpu.get_cycles() - vblank,
+                SCANLINES_PER_FRAME * DOTS_PER_SCANLINE / 3, 3);
+
+    std::filesystem::remove(path);
+}
+
+TEST(PPUTest, TEST_NMI) {
+    // LDA #$80, STA $2000, JMP $E005 with INC $10, RTI as the handler
+    std::string path = write_test_rom(
+        "ppu_test_nmi", 0, {0xA9, 0x80, 0x8D, 0x00, 0x20, 0x4C, 0x05, 0xE0},
+        {0xE6, 0x10, 0x40});
+    Console console(path);
+    CPU &cpu = console.get_cpu();
+
+    // every frame ends with the CPU entering the handler, which it runs
+    // during the next one
+    for (int i = 0; i < 10; i++) {
+        ASSERT_TRUE(console.run_frame());
+        ASSERT_EQ(cpu.get_program_counter(), 0xF000);
+    }
+    ASSERT_EQ(cpu.mem_read(0x0010), 9);
+
+    // turning NMIs on in the middle of vblank raises one right away
+    cpu.mem_write(0x2000, 0x00);
+    ASSERT_TRUE(console.run_frame());
+    uint64_t cycle = cpu.get_cycles();
+    ASSERT_TRUE(console.run_until_cycle(cycle + 100));
+    ASSERT_EQ(cpu.mem_read(0x0010), 10);
+    cpu.mem_write(0x2000, 0x80);
+    ASSERT_TRUE(console.run_until_cycle(cpu.get_cycles() + 100));
+    ASSERT_EQ(cpu.mem_read(0x0010), 11);
+
+    std::filesystem::remove(path);
+}
+
+TEST(PPUTest, TEST_PPUData) {
+    std::string path = write_test_rom("ppu_test_data", 0, {0x4C, 0x00, 0xE0},
+                                      {0x40});
+    Console console(path);
+    CPU &cpu = console.get_cpu();
+
+    cpu.mem_write(0x2006, 0x21);
+    cpu.mem_write(0x2006, 0x08);
+    cpu.mem_write(0x2007, 0x11);
+    cpu.mem_write(0x2007, 0x22);
+
+    // reads are a byte behind, except for the palette
+    cpu.mem_write(0x2006, 0x21);
+    cpu.mem_write(0x2006, 0x08);
+    cpu.mem_read(0x2007);
+    ASSERT_EQ(cpu.mem_read(0x2007), 0x11);
+    ASSERT_EQ(cpu.mem_read(0x2007), 0x22);
+
+    // vertical mirroring, $2800 is $2000 again
+    ASSERT_EQ(console.get_ppu().peek(0x2908), 0x11);
+    ASSERT_EQ(console.get_ppu().peek(0x2508), 0x00);
+
+    // increments of 32 go down a column
+    cpu.mem_write(0x2000, CTRL_INCREMENT_32);
+    cpu.mem_write(0x2006, 0x20);
+    cpu.mem_write(0x2006, 0x00);
+    cpu.mem_write(0x2007, 0x33);
+    cpu.mem_write(0x2007, 0x44);
+    ASSERT_EQ(console.get_ppu().peek(0x2020), 0x44);
+
+    // the sprite backdrop entries are the background ones
+    cpu.mem_write(0x2006, 0x3F);
+    cpu.mem_write(0x2006, 0x10);
+    cpu.mem_write(0x2007, 0x2A);
+    ASSERT_EQ(console.get_ppu().peek(0x3F00), 0x2A);
+    cpu.mem_write(0x2006, 0x3F);
+    cpu.mem_write(0x2006, 0x00);
+    ASSERT_EQ(cpu.mem_read(0x2007), 0x2A);
+
+    std::filesystem::remove(path);
+}
+
+// A background tile, sprite 0 over it and a sprite on its own, drawn with
+// mode
+static void check_render(RenderMode mode) {
+    std::string path = write_test_rom("ppu_test_render", 0,
+                                      {0x4C, 0x00, 0xE0}, {0x40});
+    Console console(path);
+    CPU &cpu = console.get_cpu();
+    PPU &ppu = console.get_ppu();
+    ppu.set_render_mode(mode);
+
+    // tile 1 is solid color 1
+    cpu.mem_write(0x2006, 0x00);
+    cpu.mem_write(0x2006, 0x10);
+    for (int i = 0; i < 16; i++) {
+        cpu.mem_write(0x2007, i < 8 ? 0xFF : 0x00);
+    }
+    // in the top left corner of the screen
+    cpu.mem_write(0x2006, 0x20);
+    cpu.mem_write(0x2006, 0x00);
+    cpu.mem_write(0x2007, 1);
+    // backdrop, background color 1, and color 1 of sprite palettes 0 and 1
+    std::vector<std::pair<uint8_t, uint8_t>> colors = {
+        {0x00, 0x0F}, {0x01, 0x30}, {0x11, 0x27}, {0x15, 0x16}};
+    for (auto [index, color] : colors) {
+        cpu.mem_write(0x2006, 0x3F);
+        cpu.mem_write(0x2006, index);
+        cpu.mem_write(0x2007, color);
+    }
+
+    // sprite 0 over the background tile, one line lower since sprites are
+    // drawn a line below their Y, and sprite 1 with palette 1 on its own.
+    // Copied in with OAM DMA from page 2.
+    std::vector<uint8_t> sprites = {0, 1, 0x00, 0, 50, 1, 0x01, 100};
+    sprites.resize(0x100, 0xFF);
+    for (int i = 0; i < 0x100; i++) {
+        cpu.mem_write(0x0200 + i, sprites[i]);
+    }
+    uint64_t before = cpu.get_cycles();
+    cpu.mem_write(0x4014, 0x02);
+    ASSERT_GE(cpu.get_cycles() - before, OAM_DMA_CYCLES);
+
+    cpu.mem_write(0x2000, 0x00);
+    cpu.mem_write(0x2005, 0x00);
+    cpu.mem_write(0x2005, 0x00);
+    cpu.mem_write(0x2001, MASK_BACKGROUND | MASK_SPRITES |
+                              MASK_BACKGROUND_LEFT | MASK_SPRITES_LEFT);
+
+    // the first frame started with rendering off, the second one is whole
+    ASSERT_TRUE(console.run_frame());
+    ASSERT_TRUE(console.run_frame());
+    const uint8_t *screen = ppu.get_framebuffer();
+    auto pixel = [&](int x, int y) { return screen[y * SCREEN_WIDTH + x]; };
+
+    ASSERT_EQ(pixel(0, 0), 0x30);
+    ASSERT_EQ(pixel(7, 0), 0x30);
+    ASSERT_EQ(pixel(8, 0), 0x0F);
+    ASSERT_EQ(pixel(0, 1), 0x27);
+    ASSERT_EQ(pixel(7, 8), 0x27);
+    ASSERT_EQ(pixel(0, 9), 0x0F);
+    ASSERT_EQ(pixel(100, 50), 0x0F);
+    ASSERT_EQ(pixel(100, 51), 0x16);
+    ASSERT_EQ(pixel(107, 58), 0x16);
+    ASSERT_EQ(pixel(108, 51), 0x0F);
+
+    // sprite 0 was drawn over the background
+    ASSERT_NE(cpu.mem_read(0x2002) & STATUS_SPRITE_ZERO_HIT, 0);
+
+    std::filesystem::remove(path);
+}
+
+TEST(PPUTest, TEST_Render) {
+    for (RenderMode mode : {RENDER_DOTS, RENDER_SCANLINES}) {
+        SCOPED_TRACE(mode);
+        check_render(mode);
+    }
+}
+
+// Runs a program that keeps changing the scroll and PPUMASK while the screen
+// is drawn with mode, and returns the third frame
+static std::vector<uint8_t> render_mid_line_writes(RenderMode mode,
+                                                   bool threaded = false) {
+    std::vector<uint8_t> program = {
+        0xA2, 0x00,              // LDX #$00
+        0x8E, 0x05, 0x20,        // STX $2005
+        0x8E, 0x05, 0x20,        // STX $2005
+        0x8A,                    // TXA
+        0x29, 0x07,              // AND #$07: greyscale and left edges
+        0x09, 0x18,              // ORA #$18: background and sprites on
+        0x8D, 0x01, 0x20,        // STA $2001
+        0xE8,                    // INX
+        0x8A,                    // TXA
+        0x29, 0x0F,              // AND #$0F
+        0xD0, 0x03,              // BNE +3
+        0xAD, 0x02, 0x20,        // LDA $2002 every 16 times round
+        0xA0, 0x1C,              // LDY #$1C
+        0x88,                    // DEY
+        0xD0, 0xFD,              // BNE -3
+        0x4C, 0x02, 0xE0,        // JMP $E002
+    };
+    std::string path = write_test_rom(
+        threaded ? "ppu_test_mid_line_threaded" : "ppu_test_mid_line", 0,
+        program, {0x40});
+    Console console(path);
+    CPU &cpu = console.get_cpu();
+    PPU &ppu = console.get_ppu();
+    ppu.set_render_mode(mode);
+    EXPECT_TRUE(console.set_ppu_thread(threaded));
+
+    // 4 tiles of noise, all over the nametable and attributes
+    uint32_t seed = 7;
+    auto random = [&]() {
+        seed = seed * 1103515245 + 12345;
+        return static_cast<uint8_t>(seed >> 16);
+    };
+    cpu.mem_write(0x2006, 0x00);
+    cpu.mem_write(0x2006, 0x00);
+    for (int i = 0; i < 4 * 16; i++) {
+        cpu.mem_write(0x2007, random());
+    }
+    cpu.mem_write(0x2006, 0x20);
+    cpu.mem_write(0x2006, 0x00);
+    for (int i = 0; i < 0x800; i++) {
+        cpu.mem_write(0x2007, (i & 0x3FF) >= 0x3C0 ? random() : random() & 3);
+    }
+    cpu.mem_write(0x2006, 0x3F);
+    cpu.mem_write(0x2006, 0x00);
+    for (int i = 0; i < 0x20; i++) {
+        cpu.mem_write(0x2007, random());
+    }
+    // sprites all over, some of them behind the background and flipped
+    for (int i = 0; i < 0x100; i++) {
+        cpu.mem_write(0x2004, (i & 3) == 1 ? random() & 3 : random());
+    }
+
+    for (int i = 0; i < 3; i++) {
+        if (!console.run_frame()) {
+            ADD_FAILURE() << "the program stopped";
+            break;
+        }
+    }
+    std::filesystem::remove(path);
+    return std::vector<uint8_t>(ppu.get_framebuffer(),
+                                ppu.get_framebuffer() +
+                                    SCREEN_WIDTH * SCREEN_HEIGHT);
+}
+
+TEST(PPUTest, TEST_RenderMidLineWrites) {
+    std::vector<uint8_t> dots = render_mid_line_writes(RENDER_DOTS);
+    std::vector<uint8_t> scanlines = render_mid_line_writes(RENDER_SCANLINES);
+
+    // greyscale comes and goes, so some lines are all grey and some are not
+    int grey_lines = 0;
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        auto line = dots.begin() + y * SCREEN_WIDTH;
+        grey_lines += std::all_of(line, line + SCREEN_WIDTH,
+                                  [](uint8_t color) { return !(color & 0x0F); });
+    }
+    ASSERT_GT(grey_lines, 0);
+    ASSERT_LT(grey_lines, SCREEN_HEIGHT);
+
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        for (int x = 0; x < SCREEN_WIDTH; x++) {
+            ASSERT_EQ(scanlines[y * SCREEN_WIDTH + x],
+                      dots[y * SCREEN_WIDTH + x])
+                << "at " << x << ", " << y;
+        }
+    }
+}
+
+// CNROM with each of its 4 CHR banks a different solid color, and a program
+// that keeps switching them while the screen is drawn
+static std::vector<uint8_t> render_bank_switches(bool threaded) {
+    std::vector<uint8_t> prg(2 * PRG_ROM_BANK_SIZE, 0xEA);
+    std::vector<uint8_t> program = {
+        0xA9, 0x0A, 0x8D, 0x01, 0x20,  // LDA #$0A, STA $2001: background on
+        0xE8,                          // INX
+        0x8E, 0x00, 0x80,              // STX $8000: CHR bank
+        0xA0, 0x30,                    // LDY #$30
+        0x88,                          // DEY
+        0xD0, 0xFD,                    // BNE -3
+        0x4C, 0x05, 0xE0,              // JMP $E005
+    };
+    std::copy(program.begin(), program.end(), prg.begin() + 0x6000);
+    std::vector<uint8_t> vectors = {0x00, 0xE0, 0x00, 0xE0, 0x00, 0xE0};
+    std::copy(vectors.begin(), vectors.end(), prg.end() - 6);
+    std::vector<uint8_t> chr;
+    for (uint8_t bank = 0; bank < 4; bank++) {
+        for (size_t tile = 0; tile < CHR_ROM_BANK_SIZE / CHR_TILE_SIZE;
+             tile++) {
+            chr.insert(chr.end(), 8, (bank & 1) ? 0xFF : 0x00);
+            chr.insert(chr.end(), 8, (bank & 2) ? 0xFF : 0x00);
+        }
+    }
+    std::string path = write_rom(
+        threaded ? "ppu_test_banks_threaded" : "ppu_test_banks",
+        {'N', 'E', 'S', 0x1A, 2, 4, 0x30}, prg, chr);
+    Console console(path);
+    CPU &cpu = console.get_cpu();
+    PPU &ppu = console.get_ppu();
+    EXPECT_TRUE(console.set_ppu_thread(threaded));
+
+    cpu.mem_write(0x2006, 0x3F);
+    cpu.mem_write(0x2006, 0x00);
+    for (uint8_t color : {0x0F, 0x16, 0x2A, 0x12}) {
+        cpu.mem_write(0x2007, color);
+    }
+    for (int i = 0; i < 3; i++) {
+        if (!console.run_frame()) {
+            ADD_FAILURE() << "the program stopped";
+            break;
+        }
+    }
+    std::filesystem::remove(path);
+    return std::vector<uint8_t>(ppu.get_framebuffer(),
+                                ppu.get_framebuffer() +
+                                    SCREEN_WIDTH * SCREEN_HEIGHT);
+}
+
+TEST(PPUTest, TEST_PPUWorker) {
+    std::vector<uint8_t> alone = render_mid_line_writes(RENDER_DOTS);
+    ASSERT_EQ(render_mid_line_writes(RENDER_DOTS, true), alone);
+    ASSERT_EQ(render_mid_line_writes(RENDER_SCANLINES, true), alone);
+
+    // bank switches wait for the worker, so they land on the same dots
+    std::vector<uint8_t> banks = render_bank_switches(false);
+    ASSERT_EQ(render_bank_switches(true), banks);
+    std::sort(banks.begin(), banks.end());
+    ASSERT_EQ(std::unique(banks.begin(), banks.end()) - banks.begin(), 4);
+
+    // MMC3 counts scanlines with the PPU, so it stays on this thread
+    std::string path =
+        write_test_rom("ppu_test_worker_mmc3", 4, {0x4C, 0x00, 0xE0}, {0x40});
+    Console console(path);
+    ASSERT_FALSE(console.set_ppu_thread(true));
+    ASSERT_FALSE(console.is_ppu_threaded());
+    std::filesystem::remove(path);
+}
+
+TEST(PPUTest, TEST_SpriteEvaluation) {
+    // JMP $E000
+    std::string path = write_test_rom("ppu_test_sprite_evaluation", 0,
+                                      {0x4C, 0x00, 0xE0}, {0x40});
+    Console console(path);
+    CPU &cpu = console.get_cpu();
+    PPU &ppu = console.get_ppu();
+
+    // tile 1 is solid color 1, which is white in sprite palette 0
+    cpu.mem_write(0x2006, 0x00);
+    cpu.mem_write(0x2006, 0x10);
+    for (int i = 0; i < 16; i++) {
+        cpu.mem_write(0x2007, i < 8 ? 0xFF : 0x00);
+    }
+    cpu.mem_write(0x2006, 0x3F);
+    cpu.mem_write(0x2006, 0x11);
+    cpu.mem_write(0x2007, 0x30);
+
+    // 9 sprites on lines 100-107 side by side, and one with a Y below the
+    // screen that must not wrap around to the top
+    std::vector<uint8_t> sprites;
+    for (int i = 0; i < 9; i++) {
+        sprites.insert(sprites.end(), {99, 1, 0x00, uint8_t(i * 16)});
+    }
+    sprites.insert(sprites.end(), {0xFC, 1, 0x00, 200});
+    sprites.resize(0x100, 0xFF);
+    for (uint8_t byte : sprites) {
+        cpu.mem_write(0x2004, byte);
+    }
+    ASSERT_EQ(ppu.peek_oam(8 * 4 + 3), 128);
+    ASSERT_EQ(ppu.peek_oam(9 * 4 + 0), 0xFC);
+    cpu.mem_write(0x2001, MASK_SPRITES | MASK_SPRITES_LEFT);
+
+    ASSERT_TRUE(console.run_frame());
+    ASSERT_TRUE(console.run_frame());
+    const uint8_t *screen = ppu.get_framebuffer();
+    auto pixel = [&](int x, int y) { return screen[y * SCREEN_WIDTH + x]; };
+
+    // only the first 8 make it, and the 9th sets the overflow flag
+    ASSERT_EQ(pixel(0, 100), 0x30);
+    ASSERT_EQ(pixel(112, 107), 0x30);
+    ASSERT_EQ(pixel(128, 100), 0x00);
+    ASSERT_EQ(pixel(0, 99), 0x00);
+    ASSERT_EQ(pixel(0, 108), 0x00);
+    ASSERT_NE(cpu.mem_read(0x2002) & STATUS_SPRITE_OVERFLOW, 0);
+    for (int y = 0; y < 8; y++) {
+        ASSERT_EQ(pixel(200, y), 0x00);
+    }
+
+    std::filesystem::remove(path);
+}
+
+TEST(PPUTest, TEST_MMC3_IRQ) {
+    std::vector<uint8_t> program = {
+        0xA9, 0x09, 0x8D, 0x00, 0xC0,  // LDA #$09, STA $C000: latch
+        0x8D, 0x01, 0xC0,              // STA $C001: reload
+        0x8D, 0x01, 0xE0,              // STA $E001: enable
+        0xA9, 0x08, 0x8D, 0x00, 0x20,  // sprites from $1000
+        0xA9, 0x18, 0x8D, 0x01, 0x20,  // background and sprites on
+        0x58,                          // CLI
+        0x4C, 0x16, 0xE0,              // JMP $E016
+    };
+    // INC $10, STA $E000 to acknowledge, RTI
+    std::vector<uint8_t> handler = {0xE6, 0x10, 0x8D, 0x00, 0xE0, 0x40};
+    std::string path = write_test_rom("ppu_test_mmc3", 4, program, handler);
+    Console console(path);
+    CPU &cpu = console.get_cpu();
+    PPU &ppu = console.get_ppu();
+
+    // A12 first rises on line 0, which loads the counter with 9, and it gets
+    // to 0 on line 9
+    while (cpu.mem_read(0x0010) == 0 && ppu.get_frame() == 0) {
+        ASSERT_TRUE(console.run_until_cycle(cpu.get_cycles() + 4));
+    }
+    ASSERT_EQ(cpu.mem_read(0x0010), 1);
+    ASSERT_EQ(ppu.get_scanline(), 9);
+
+    // disabled by the handler, so no more of them
+    ASSERT_TRUE(console.run_frame());
+    ASSERT_EQ(cpu.mem_read(0x0010), 1);
+
+    std::filesystem::remove(path);
+}
+
+// Decodes one tile a pixel at a time, straight from how the PPU does it
+static std::vector<uint8_t> decode_tile_slowly(const uint8_t *chr) {
+    std::vector<uint8_t> pixels;
+    for (int row = 0; row < 8; row++) {
+        for (int column = 0; column < 8; column++) {
+            uint8_t low = (chr[row] >> (7 - column)) & 1;
+            uint8_t high = (chr[row + 8] >> (7 - column)) & 1;
+            pixels.push_back(low | (high << 1));
+        }
+    }
+    return pixels;
+}
+
+TEST(PPUTest, TEST_DecodeTiles) {
+    const size_t tiles = 64;
+    std::vector<uint8_t> chr(tiles * CHR_TILE_SIZE);
+    uint32_t seed = 1;
+    for (uint8_t &byte : chr) {
+        seed = seed * 1103515245 + 12345;
+        byte = seed >> 16;
+    }
+    // a tile with both planes told apart: color 1 down the left edge, color
+    // 2 along the top, color 3 where they meet
+    std::fill(chr.begin(), chr.begin() + 8, 0x80);
+    std::fill(chr.begin() + 8, chr.begin() + 16, 0x00);
+    chr[8] = 0xFF;
+
+    std::vector<uint8_t> expected;
+    for (size_t tile = 0; tile < tiles; tile++) {
+        std::vector<uint8_t> pixels =
+            decode_tile_slowly(&chr[tile * CHR_TILE_SIZE]);
+        expected.insert(expected.end(), pixels.begin(), pixels.end());
+    }
+    ASSERT_EQ(expected[0], 3);
+    ASSERT_EQ(expected[1], 2);
+    ASSERT_EQ(expected[8], 1);
+    ASSERT_EQ(expected[9], 0);
+
+    for (auto decode : {&decode_tiles, &decode_tiles_scalar, &decode_tiles_sse2,
+                        &decode_tiles_avx2}) {
+        std::vector<uint8_t> out(tiles * DECODED_TILE_SIZE, 0xFF);
+        decode(chr.data(), out.data(), tiles);
+        ASSERT_EQ(out, expected);
+    }
+}
+
+TEST(PPUTest, TEST_PatternCache) {
+    // JMP $E000
+    std::string path = write_test_rom("ppu_test_pattern_cache", 0,
+                                      {0x4C, 0x00, 0xE0}, {0x40});
+    Console console(path);
+    CPU &cpu = console.get_cpu();
+    PatternCache &patterns = console.get_ppu().get_pattern_cache();
+
+    // CHR RAM starts out blank
+    const uint8_t *tile = patterns.get_tile(0x1010);
+    ASSERT_TRUE(std::all_of(tile, tile + DECODED_TILE_SIZE,
+                            [](uint8_t pixel) { return pixel == 0; }));
+
+    // writing the low plane of row 2 of tile $101 through PPUDATA shows up
+    // the next time the tile is asked for
+    cpu.mem_write(0x2006, 0x10);
+    cpu.mem_write(0x2006, 0x12);
+    cpu.mem_write(0x2007, 0x81);
+    tile = patterns.get_tile(0x1010);
+    ASSERT_EQ(tile[2 * 8 + 0], 1);
+    ASSERT_EQ(tile[2 * 8 + 1], 0);
+    ASSERT_EQ(tile[2 * 8 + 7], 1);
+    ASSERT_EQ(std::count(tile, tile + DECODED_TILE_SIZE, 0), 62);
+    // the tile next to it is left alone
+    tile = patterns.get_tile(0x1000);
+    ASSERT_EQ(std::count(tile, tile + DECODED_TILE_SIZE, 0), 64);
+
+    std::filesystem::remove(path);
+}
+
+TEST(PPUTest, TEST_PatternCache_Banks) {
+    // CNROM with four 8 KiB CHR ROM banks, the first tile of each one filled
+    // with its number in both planes
+    std::vector<uint8_t> prg(2 * PRG_ROM_BANK_SIZE);
+    std::vector<uint8_t> chr(4 * CHR_ROM_BANK_SIZE);
+    for (uint8_t bank = 0; bank < 4; bank++) {
+        std::fill_n(chr.begin() + bank * CHR_ROM_BANK_SIZE, CHR_TILE_SIZE,
+                    bank & 1 ? 0xFF : 0x00);
+        std::fill_n(chr.begin() + bank * CHR_ROM_BANK_SIZE + 8, 8,
+                    bank & 2 ? 0xFF : 0x00);
+    }
+    std::string path = write_rom("ppu_test_pattern_cache_banks",
+                                 {'N', 'E', 'S', 0x1A, 2, 4, 0x30}, prg, chr);
+    Cartridge cartridge(path);
+    auto mapper = make_mapper(cartridge);
+    CPU cpu;
+    cpu.load(*mapper);
+    PatternCache patterns(*mapper);
+
+    for (uint8_t bank = 0; bank < 4; bank++) {
+        cpu.mem_write(0xFFFF, bank);
+        const uint8_t *tile = patterns.get_tile(0x0000);
+        ASSERT_EQ(std::count(tile, tile + DECODED_TILE_SIZE, bank), 64);
+    }
+
+    std::filesystem::remove(path);
+}
@@ -0,0 +1,137 @@
+#include "state/rewind_buffer.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "cpu.h"
+#include "snake.h"
+
+// Plays frames of the snake game into rewind and returns the states of the
+// last keep of them, as bytes to compare against
+static std::vector<std::vector<uint8_t>> play_snake(RewindBuffer &rewind,
+                                                    int frames,
+                                                    int keep = 1000) {
+    std::vector<uint8_t> game = get_game_code();
+    CPU cpu;
+    cpu.load(game);
+    cpu.reset();
+    SaveState state;
+    std::vector<std::vector<uint8_t>> states;
+    for (int i = 0; i < frames; i++) {
+        cpu.mem_write(0xFE, i * 37 + 1);
+        cpu.run_until_cycle(cpu.get_cycles() + 400);
+        cpu.snapshot(state);
+        rewind.push(state);
+        if (i >= frames - keep) {
+            states.emplace_back(state.data(), state.data() + state.size());
+        }
+    }
+    return states;
+}
+
+static std::vector<uint8_t> bytes(SaveState &state) {
+    return std::vector<uint8_t>(state.data(), state.data() + state.size());
+}
+
+TEST(RewindBufferTest, TEST_Delta) {
+    std::vector<uint8_t> base(1000, 0x11);
+    std::vector<uint8_t> current = base;
+    current[0] = 0x22;
+    current[500] = 0x33;
+    current[501] = 0x44;
+    current[999] = 0x55;
+    std::vector<uint8_t> delta(max_delta_length(base.size()));
+    size_t length =
+        encode_delta(current.data(), base.data(), base.size(), delta.data());
+    // 4 changed bytes in 3 literal runs, and 2 zero runs
+    ASSERT_LT(length, 20);
+    std::vector<uint8_t> out = base;
+    apply_delta(delta.data(), length, out.data());
+    ASSERT_EQ(out, current);
+    // and the same delta takes it back
+    apply_delta(delta.data(), length, out.data());
+    ASSERT_EQ(out, base);
+}
+
+TEST(RewindBufferTest, TEST_Rewind) {
+    RewindBuffer rewind(1 << 20, 1000, 10);
+    std::vector<std::vector<uint8_t>> states = play_snake(rewind, 95);
+    ASSERT_EQ(rewind.get_frames(), 95);
+    // 10 keyframes and the deltas are tiny next to 95 whole states
+    ASSERT_LT(rewind.get_used_bytes(), 95 * states[0].size() / 4);
+
+    SaveState state;
+    ASSERT_TRUE(rewind.peek(0, state));
+    ASSERT_EQ(bytes(state), states[94]);
+    ASSERT_TRUE(rewind.peek(37, state));
+    ASSERT_EQ(bytes(state), states[94 - 37]);
+    ASSERT_FALSE(rewind.peek(95, state));
+
+    // all the way back, across keyframes
+    for (int i = 93; i >= 0; i--) {
+        ASSERT_TRUE(rewind.rewind(state));
+        ASSERT_EQ(bytes(state), states[i]);
+    }
+    ASSERT_FALSE(rewind.rewind(state));
+    ASSERT_EQ(rewind.get_frames(), 1);
+}
+
+TEST(RewindBufferTest, TEST_Budget) {
+    // the smallest budget there can be, the oldest frames have to go
+    size_t budget = max_delta_length(SAVE_STATE_CAPACITY);
+    RewindBuffer rewind(budget, 10000, 10);
+    std::vector<std::vector<uint8_t>> states = play_snake(rewind, 10000);
+    ASSERT_LT(rewind.get_frames(), 10000);
+    ASSERT_GT(rewind.get_frames(), 0);
+    ASSERT_LE(rewind.get_used_bytes(), budget);
+
+    // what is left is still right
+    SaveState state;
+    uint32_t frames = rewind.get_frames();
+    ASSERT_LE(frames, states.size());
+    ASSERT_TRUE(rewind.peek(frames - 1, state));
+    ASSERT_EQ(bytes(state), states[states.size() - frames]);
+    for (uint32_t i = 1; i < frames; i++) {
+        ASSERT_TRUE(rewind.rewind(state));
+        ASSERT_EQ(bytes(state), states[states.size() - 1 - i]);
+    }
+
+    // so is a limit on frames
+    RewindBuffer few(1 << 20, 25, 10);
+    states = play_snake(few, 100);
+    ASSERT_LE(few.get_frames(), 25);
+    ASSERT_TRUE(few.peek(few.get_frames() - 1, state));
+    ASSERT_EQ(bytes(state), states[states.size() - few.get_frames()]);
+}
+
+TEST(RewindBufferTest, TEST_RestoreAndContinue) {
+    // rewind a few frames, restore, play on and rewind into the new frames
+    RewindBuffer rewind(1 << 20, 1000, 10);
+    std::vector<std::vector<uint8_t>> states = play_snake(rewind, 30);
+    SaveState state;
+    for (int i = 0; i < 5; i++) {
+        ASSERT_TRUE(rewind.rewind(state));
+    }
+    ASSERT_EQ(bytes(state), states[24]);
+
+    std::vector<uint8_t> game = get_game_code();
+    CPU cpu;
+    cpu.load(game);
+    cpu.restore(state);
+    std::vector<std::vector<uint8_t>> replayed;
+    for (int i = 0; i < 12; i++) {
+        cpu.mem_write(0xFE, 0x80 + i);
+        cpu.run_until_cycle(cpu.get_cycles() + 400);
+        cpu.snapshot(state);
+        rewind.push(state);
+        replayed.emplace_back(bytes(state));
+    }
+    for (int i = 10; i >= 0; i--) {
+        ASSERT_TRUE(rewind.rewind(state));
+        ASSERT_EQ(bytes(state), replayed[i]);
+    }
+    ASSERT_TRUE(rewind.rewind(state));
+    ASSERT_EQ(bytes(state), states[24]);
+}
@@ -0,0 +1,156 @@
+#include "netplay/rollback_session.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "cpu.h"
+#include "netplay/loopback_transport.h"
+#include "snake_fixture.h"
+
+// The snake game for two: player 0 steers, player 1 is where the food
+// goes, through the random byte the game reads.
+static void run_snake_frame(void *, CPU &cpu, const uint8_t *inputs) {
+    if (inputs[0] != 0) {
+        cpu.mem_write(0xFF, inputs[0]);
+    }
+    cpu.mem_write(0xFE, inputs[1]);
+    cpu.run_until_cycle(cpu.get_cycles() + 400);
+}
+
+// What each player presses in their own frames, changing often enough that
+// predictions keep going wrong
+static uint8_t script(uint8_t player, uint32_t frame) {
+    const uint8_t keys[] = {0x77, 0x64, 0x73, 0x61};
+    if (player == 0) {
+        return keys[(frame / 7) % 4];
+    }
+    return (frame / 3) * 53 + 11;
+}
+
+// The input of player at frame, once their input delay is taken into account
+static uint8_t delayed_script(uint8_t player, uint32_t frame,
+                              uint32_t delay) {
+    return frame < delay ? 0 : script(player, frame - delay);
+}
+
+// Plays frames on two sessions over a loopback network and checks both
+// end up where a single machine with all the inputs does
+static void play(NetworkConditions conditions, uint32_t delay_0,
+                 uint32_t delay_1, uint32_t frames, RollbackStats &stats) {
+    std::vector<uint8_t> game = get_game_code();
+    FrameRunner runner = {run_snake_frame, nullptr};
+    CPU cpu_0, cpu_1, reference;
+    start_snake(cpu_0, game);
+    start_snake(cpu_1, game);
+    start_snake(reference, game);
+
+    LoopbackTransport transport_0(conditions);
+    conditions.seed++;
+    LoopbackTransport transport_1(conditions);
+    transport_0.connect(transport_1);
+    RollbackSession session_0(cpu_0, runner, transport_0, 0, delay_0);
+    RollbackSession session_1(cpu_1, runner, transport_1, 1, delay_1);
+
+    // frames each side has taken local input for
+    uint32_t played_0 = 0, played_1 = 0;
+    for (int tick = 0; tick < 10000; tick++) {
+        if (played_0 < frames) {
+            played_0 += session_0.advance(script(0, played_0));
+        } else {
+            session_0.poll();
+        }
+        if (played_1 < frames) {
+            played_1 += session_1.advance(script(1, played_1));
+        } else {
+            session_1.poll();
+        }
+        transport_0.tick();
+        transport_1.tick();
+        if (session_0.get_confirmed_frame() == frames &&
+            session_1.get_confirmed_frame() == frames) {
+            break;
+        }
+    }
+    ASSERT_EQ(session_0.get_confirmed_frame(), frames);
+    ASSERT_EQ(session_1.get_confirmed_frame(), frames);
+
+    for (uint32_t frame = 0; frame < frames; frame++) {
+        uint8_t inputs[] = {delayed_script(0, frame, delay_0),
+                            delayed_script(1, frame, delay_1)};
+        run_snake_frame(nullptr, reference, inputs);
+    }
+    CPUView expected(reference);
+    ASSERT_EQ(CPUView(cpu_0), expected);
+    ASSERT_EQ(CPUView(cpu_1), expected);
+
+    stats = session_0.get_stats();
+    stats.rollbacks += session_1.get_stats().rollbacks;
+    stats.frames_rerun += session_1.get_stats().frames_rerun;
+    stats.stalls += session_1.get_stats().stalls;
+    stats.max_rollback =
+        std::max(stats.max_rollback, session_1.get_stats().max_rollback);
+}
+
+TEST(RollbackSessionTest, TEST_PerfectNetwork) {
+    // the other side's input is always there in time, nothing to roll back
+    RollbackStats stats;
+    play(NetworkConditions(), 1, 1, 80, stats);
+    ASSERT_EQ(stats.rollbacks, 0);
+    ASSERT_EQ(stats.stalls, 0);
+}
+
+TEST(RollbackSessionTest, TEST_Latency) {
+    NetworkConditions conditions;
+    conditions.latency = 3;
+    RollbackStats stats;
+    play(conditions, 0, 0, 80, stats);
+    ASSERT_GT(stats.rollbacks, 0);
+    ASSERT_LE(stats.max_rollback, NETPLAY_MAX_PREDICTION);
+    ASSERT_EQ(stats.stalls, 0);
+
+    // an input delay as long as the latency hides it
+    play(conditions, 4, 4, 80, stats);
+    ASSERT_EQ(stats.rollbacks, 0);
+}
+
+TEST(RollbackSessionTest, TEST_LossAndJitter) {
+    NetworkConditions conditions;
+    conditions.latency = 2;
+    conditions.jitter = 5;
+    conditions.loss_per_mille = 300;
+    RollbackStats stats;
+    play(conditions, 2, 0, 80, stats);
+    ASSERT_GT(stats.rollbacks, 0);
+    ASSERT_LE(stats.max_rollback, NETPLAY_MAX_PREDICTION);
+}
+
+TEST(RollbackSessionTest, TEST_Stall) {
+    // nothing ever gets through, the session runs as far as it can guess and
+    // then waits
+    NetworkConditions conditions;
+    conditions.loss_per_mille = 1000;
+    LoopbackTransport transport(conditions), other(conditions);
+    transport.connect(other);
+    std::vector<uint8_t> game = get_game_code();
+    CPU cpu;
+    start_snake(cpu, game);
+    RollbackSession session(cpu, {run_snake_frame, nullptr}, transport, 0);
+    for (uint32_t i = 0; i < NETPLAY_MAX_PREDICTION; i++) {
+        ASSERT_TRUE(session.advance(0x77));
+    }
+    ASSERT_FALSE(session.advance(0x77));
+    ASSERT_EQ(session.get_frame(), NETPLAY_MAX_PREDICTION);
+    ASSERT_EQ(session.get_confirmed_frame(), 0);
+    ASSERT_EQ(session.get_stats().stalls, 1);
+
+    ASSERT_THROW(RollbackSession(cpu, {run_snake_frame, nullptr}, transport,
+                                 2),
+                 std::runtime_error);
+    ASSERT_THROW(RollbackSession(cpu, {run_snake_frame, nullptr}, transport,
+                                 0, NETPLAY_MAX_INPUT_DELAY + 1),
+                 std::runtime_error);
+}
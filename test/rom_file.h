@@ -0,0 +1,24 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "cartridge/cartridge.h"
+
+// Writes header, prg and chr to a .nes file in the temp directory and returns
+// its path
+inline std::string write_rom(const std::string &name,
+                             std::vector<uint8_t> header,
+                             const std::vector<uint8_t> &prg,
+                             const std::vector<uint8_t> &chr) {
+    header.resize(INES_HEADER_SIZE, 0);
+    std::string path =
+        (std::filesystem::temp_directory_path() / (name + ".nes")).string();
+    std::ofstream out(path, std::ios::binary);
+    out.write(reinterpret_cast<const char *>(header.data()), header.size());
+    out.write(reinterpret_cast<const char *>(prg.data()), prg.size());
+    out.write(reinterpret_cast<const char *>(chr.data()), chr.size());
+    return path;
+}
@@ -0,0 +1,97 @@
+#include "frontend/run_ahead.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "cpu.h"
+#include "snake_fixture.h"
+
+// A frame of the snake game with the random byte it reads
+static bool snake_frame(CPU &cpu, uint8_t random) {
+    cpu.mem_write(0xFE, random);
+    return cpu.run_until_cycle(cpu.get_cycles() + 400);
+}
+
+// A frame of the snake game, always with the same random byte so the
+// frames ahead see what the real ones will
+static bool snake_frame(CPU &cpu) { return snake_frame(cpu, 0x5A); }
+
+TEST(RunAheadTest, TEST_RunAhead) {
+    std::vector<uint8_t> game = get_game_code();
+    CPU plain;
+    start_snake(plain, game);
+    std::vector<CPUView> plain_frames;
+    for (int i = 0; i < 20; i++) {
+        snake_frame(plain);
+        plain_frames.push_back(CPUView(plain));
+    }
+
+    CPU cpu;
+    start_snake(cpu, game);
+    RunAhead run_ahead(2);
+    std::optional<CPUView> shown;
+    int frames_run = 0;
+    auto run_frame = [&](bool is_shown) {
+        frames_run++;
+        bool running = snake_frame(cpu);
+        if (is_shown) {
+            shown.emplace(cpu);
+        }
+        return running;
+    };
+    for (int i = 0; i < 15; i++) {
+        ASSERT_TRUE(run_ahead.run(cpu, run_frame));
+        // what is shown is 2 frames in the future, and the CPU is still
+        // where it would be without running ahead
+        ASSERT_EQ(shown, plain_frames[i + 2]);
+        ASSERT_EQ(CPUView(cpu), plain_frames[i]);
+    }
+    ASSERT_EQ(frames_run, 15 * 3);
+
+    // without frames ahead every frame is shown
+    run_ahead.set_frames(0);
+    frames_run = 0;
+    ASSERT_TRUE(run_ahead.run(cpu, run_frame));
+    ASSERT_EQ(frames_run, 1);
+    ASSERT_EQ(shown, plain_frames[15]);
+    ASSERT_EQ(CPUView(cpu), plain_frames[15]);
+}
+
+TEST(RunAheadTest, TEST_RandomInput) {
+    // the way the front ends run it: the random byte changes every real
+    // frame, is drawn before run() and the frames ahead get the same one
+    std::vector<uint8_t> game = get_game_code();
+    CPU cpu, plain;
+    start_snake(cpu, game);
+    start_snake(plain, game);
+    RunAhead run_ahead(2);
+    uint32_t seed = 3;
+    uint8_t random = 0;
+    std::optional<CPUView> shown;
+    auto run_frame = [&](bool is_shown) {
+        bool running = snake_frame(cpu, random);
+        if (is_shown) {
+            shown.emplace(cpu);
+        }
+        return running;
+    };
+    SaveState state;
+    for (int i = 0; i < 15; i++) {
+        seed = seed * 1103515245 + 12345;
+        random = seed >> 16;
+        ASSERT_TRUE(run_ahead.run(cpu, run_frame));
+
+        // the real frames play out as they do without running ahead
+        snake_frame(plain, random);
+        ASSERT_EQ(CPUView(cpu), CPUView(plain));
+        // and what is shown is those 2 frames further with the same byte
+        plain.snapshot(state);
+        snake_frame(plain, random);
+        snake_frame(plain, random);
+        ASSERT_EQ(shown, CPUView(plain));
+        plain.restore(state);
+    }
+}
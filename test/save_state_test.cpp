@@ -0,0 +1,123 @@
+#include "state/save_state.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "cpu.h"
+#include "snake_fixture.h"
+
+TEST(SaveStateTest, TEST_SnapshotRestore) {
+    std::vector<uint8_t> game = get_game_code();
+    CPU cpu;
+    start_snake(cpu, game);
+    uint32_t seed = 1;
+    run_snake(cpu, seed, 10);
+
+    SaveState state;
+    cpu.snapshot(state);
+    CPUView saved(cpu);
+    uint32_t saved_seed = seed;
+
+    run_snake(cpu, seed, 20);
+    CPUView ahead(cpu);
+    ASSERT_NE(ahead, saved);
+
+    // back to the snapshot, and from there the same frames play out the
+    // same way again
+    cpu.restore(state);
+    ASSERT_EQ(CPUView(cpu), saved);
+    seed = saved_seed;
+    run_snake(cpu, seed, 20);
+    ASSERT_EQ(CPUView(cpu), ahead);
+
+    // the state can be restored any number of times
+    cpu.restore(state);
+    ASSERT_EQ(CPUView(cpu), saved);
+}
+
+TEST(SaveStateTest, TEST_DirtyPages) {
+    std::vector<uint8_t> game = get_game_code();
+    CPU cpu;
+    start_snake(cpu, game);
+    uint32_t seed = 7;
+
+    // the second and third snapshots only copy what the game wrote, which
+    // a fresh CPU has to get all of anyway
+    SaveState state;
+    cpu.snapshot(state);
+    run_snake(cpu, seed, 5);
+    cpu.snapshot(state);
+    cpu.mem_write(0x1234, 0x56);
+    run_snake(cpu, seed, 5);
+    cpu.snapshot(state);
+    CPUView saved(cpu);
+
+    CPU other;
+    other.restore(state);
+    ASSERT_EQ(CPUView(other), saved);
+
+    // a state from somewhere else has everything in it too
+    SaveState copy;
+    copy.assign(state.data(), state.size());
+    run_snake(cpu, seed, 5);
+    cpu.restore(copy);
+    ASSERT_EQ(CPUView(cpu), saved);
+}
+
+TEST(SaveStateTest, TEST_Mirrors) {
+    // 2 KiB of RAM repeated over 0x0000-0x1FFF like on the NES, it goes in
+    // once and a write through any mirror is in it
+    uint8_t ram[0x800] = {};
+    CPU cpu;
+    cpu.get_bus().map_memory(0x00, 0x20, ram, sizeof(ram), true);
+    SaveState state;
+    cpu.snapshot(state);
+    cpu.mem_write(0x1801, 0x11);
+    cpu.snapshot(state);
+    uint32_t size;
+    const uint8_t *memory = state.find_section(STATE_MEMORY, size);
+    ASSERT_NE(memory, nullptr);
+    // 8 pages of RAM and the 0xE0 pages above it
+    ASSERT_EQ(get_u16(memory), 8 + 0xE0);
+
+    uint8_t other_ram[0x800] = {};
+    CPU other;
+    other.get_bus().map_memory(0x00, 0x20, other_ram, sizeof(other_ram),
+                               true);
+    other.restore(state);
+    ASSERT_EQ(other_ram[0x0001], 0x11);
+    ASSERT_EQ(other.mem_read(0x0801), 0x11);
+
+    // and a write through a mirror is undone through the RAM's own page
+    cpu.mem_write(0x0801, 0x22);
+    cpu.restore(state);
+    ASSERT_EQ(ram[0x0001], 0x11);
+}
+
+TEST(SaveStateTest, TEST_Broken) {
+    CPU cpu;
+    SaveState state;
+    ASSERT_THROW(cpu.restore(state), std::runtime_error);
+
+    cpu.snapshot(state);
+    std::vector<uint8_t> bytes(state.data(), state.data() + state.size());
+    // another version
+    bytes[4]++;
+    state.assign(bytes.data(), bytes.size());
+    ASSERT_THROW(cpu.restore(state), std::runtime_error);
+
+    // cut short
+    bytes[4]--;
+    state.assign(bytes.data(), bytes.size() - 1);
+    ASSERT_THROW(cpu.restore(state), std::runtime_error);
+
+    // memory this CPU cannot write to
+    CPU rom_cpu;
+    uint8_t rom[0x100] = {};
+    rom_cpu.get_bus().map_memory(0x80, 0x80, rom, sizeof(rom), false);
+    state.assign(bytes.data(), bytes.size());
+    ASSERT_THROW(rom_cpu.restore(state), std::runtime_error);
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "cpu.h"
+#include "snake.h"
+
+// Everything a CPU shows from the outside
+struct CPUView {
+    uint16_t program_counter;
+    uint8_t a, x, y, status;
+    uint64_t cycles;
+    std::vector<uint8_t> memory;
+
+    explicit CPUView(CPU &cpu)
+        : program_counter(cpu.get_program_counter()),
+          a(cpu.get_register_a()),
+          x(cpu.get_register_x()),
+          y(cpu.get_register_y()),
+          status(cpu.get_status()),
+          cycles(cpu.get_cycles()),
+          memory(0x10000) {
+        for (uint32_t address = 0; address < 0x10000; address++) {
+            memory[address] = cpu.mem_read(address);
+        }
+    }
+
+    bool operator==(const CPUView &other) const = default;
+};
+
+// Loads the snake game and resets to its start
+inline void start_snake(CPU &cpu, std::vector<uint8_t> &game) {
+    cpu.load(game);
+    cpu.reset();
+}
+
+// Runs the snake game for a few of its frames, with the random bytes it
+// reads coming from seed
+inline void run_snake(CPU &cpu, uint32_t &seed, int frames) {
+    for (int i = 0; i < frames; i++) {
+        seed = seed * 1103515245 + 12345;
+        cpu.mem_write(0xFE, seed >> 16);
+        cpu.run_until_cycle(cpu.get_cycles() + 400);
+    }
+}
@@ -0,0 +1,58 @@
+#include "frontend/triple_buffer.h"
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <cstdint>
+#include <thread>
+
+using TestFrame = std::array<uint32_t, 256>;
+
+TEST(TripleBufferTest, TEST_Publish) {
+    TripleBuffer<TestFrame> buffer;
+    ASSERT_FALSE(buffer.update());
+
+    buffer.back().fill(1);
+    buffer.publish();
+    buffer.back().fill(2);
+    buffer.publish();
+    // only the latest frame is shown, the one before it was dropped
+    ASSERT_TRUE(buffer.update());
+    ASSERT_EQ(buffer.front()[0], 2);
+    ASSERT_FALSE(buffer.update());
+    ASSERT_EQ(buffer.front()[0], 2);
+
+    // drawing the next frame does not touch the one shown
+    buffer.back().fill(3);
+    ASSERT_EQ(buffer.front()[0], 2);
+    buffer.publish();
+    ASSERT_TRUE(buffer.update());
+    ASSERT_EQ(buffer.front()[0], 3);
+}
+
+TEST(TripleBufferTest, TEST_Threads) {
+    TripleBuffer<TestFrame> buffer;
+    const uint32_t frames = 100000;
+    std::thread producer([&buffer]() {
+        for (uint32_t frame = 1; frame <= frames; frame++) {
+            buffer.back().fill(frame);
+            buffer.publish();
+        }
+    });
+
+    // every frame seen is whole and newer than the one before
+    uint32_t last = 0;
+    while (last < frames) {
+        if (!buffer.update()) {
+            std::this_thread::yield();
+            continue;
+        }
+        const TestFrame &frame = buffer.front();
+        for (uint32_t value : frame) {
+            ASSERT_EQ(value, frame[0]);
+        }
+        ASSERT_GT(frame[0], last);
+        last = frame[0];
+    }
+    producer.join();
+}